@@ -84,6 +84,13 @@ static const char rcsid[] _U_ =
 
 #if !defined(KERNEL) && !defined(_KERNEL)
 #include <stdlib.h>
+#include <string.h>
+#include <pcap/pcap.h>		/* for struct bpf_profile */
+#endif
+
+#if defined(linux) && !defined(KERNEL) && !defined(_KERNEL)
+#include <linux/types.h>
+#include <linux/filter.h>	/* for the SKF_AD_ offsets */
 #endif
 
 #define int32 bpf_int32
@@ -200,23 +207,154 @@ m_xhalf(m, k, err)
 }
 #endif
 
+#if defined(KERNEL) || defined(_KERNEL)
+struct bpf_profile;
+struct bpf_resume;
+struct bpf_aux_data;
+
+#define PROF_STEP()
+#define PROF_RETURN(v)	return (v)
+#else
+/*
+ * Read a cheap, monotonically increasing cycle counter, if we have one;
+ * if we don't, the profile has execution counts but no cycle counts.
+ */
+static inline u_int64_t
+bpf_profile_clock(void)
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	u_int32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return (((u_int64_t)hi << 32) | lo);
+#elif defined(__GNUC__) && defined(__aarch64__)
+	u_int64_t t;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (t));
+	return (t);
+#else
+	return (0);
+#endif
+}
+
+/*
+ * The time between two instructions is charged to the first of them,
+ * and a conditional jump whose next instruction is its "true" target
+ * has its taken count bumped;
+ * the time from the last instruction to the return is charged to it
+ * when we leave.
+ */
+static inline u_int
+bpf_profile_done(prof, insns, last, then, ret)
+	struct bpf_profile *prof;
+	const struct bpf_insn *insns, *last;
+	u_int64_t then;
+	u_int ret;
+{
+	if (prof != NULL) {
+		if (last != NULL)
+			prof->bp_cycles[last - insns] +=
+			    bpf_profile_clock() - then;
+		prof->bp_runs++;
+		if (ret != 0)
+			prof->bp_accepted++;
+	}
+	return (ret);
+}
+
+#define PROF_STEP() \
+	if (prof != NULL && (u_int)(pc - insns) < prof->bp_len) { \
+		now = bpf_profile_clock(); \
+		if (last != NULL) { \
+			prof->bp_cycles[last - insns] += now - then; \
+			if (BPF_CLASS(last->code) == BPF_JMP && \
+			    BPF_OP(last->code) != BPF_JA && \
+			    pc == last + 1 + last->jt) \
+				prof->bp_taken[last - insns]++; \
+		} \
+		prof->bp_hits[pc - insns]++; \
+		last = pc; \
+		then = now; \
+	}
+#define PROF_RETURN(v) \
+	return (bpf_profile_done(prof, insns, last, then, (u_int)(v)))
+
+/*
+ * Look up the metadata that an absolute load from the special offset
+ * k asks for; returns -1 if k isn't one of those offsets, or we don't
+ * have the metadata.  We only get here for loads that are outside the
+ * packet data, so ordinary loads don't pay for this.
+ */
+static inline int
+bpf_aux_load(const struct bpf_aux_data *aux, int k)
+{
+	if (aux == NULL)
+		return (-1);
+	switch (k) {
+
+#ifdef SKF_AD_VLAN_TAG_PRESENT
+	case SKF_AD_OFF + SKF_AD_VLAN_TAG:
+		return (aux->vlan_tag);
+
+	case SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT:
+		return (aux->vlan_tag_present);
+#endif
+	}
+	return (-1);
+}
+
+/*
+ * Machine state from which to carry on running a program that was
+ * started elsewhere; see bpf_lanes_run().
+ */
+struct bpf_resume {
+	u_int		pc;
+	u_int32		A, X;
+	const int32	*mem;		/* null if nothing was stored */
+};
+#endif
+
 /*
  * Execute the filter program starting at pc on the packet p
  * wirelen is the length of the original packet
  * buflen is the amount of data present
  * For the kernel, p is assumed to be a pointer to an mbuf if buflen is 0,
  * in all other cases, p is a pointer to a buffer and buflen is its size.
+ * If prof is non-null, per-instruction execution counts and cycles are
+ * accumulated into it; if aux is non-null, loads from the special
+ * metadata offsets are answered from it; if rs is non-null, execution
+ * starts from the state it describes rather than at the first
+ * instruction.  bpf_filter() passes null pointers for all of them,
+ * and, as this is forcibly inlined, the code for them is compiled out
+ * of that path.
  */
-u_int
-bpf_filter(pc, p, wirelen, buflen)
+#if defined(__GNUC__) && !defined(KERNEL) && !defined(_KERNEL)
+static inline u_int bpf_filter_common(const struct bpf_insn *,
+    const u_char *, u_int, u_int, struct bpf_profile *,
+    const struct bpf_aux_data *, const struct bpf_resume *)
+    __attribute__((always_inline));
+#endif
+
+static inline u_int
+bpf_filter_common(pc, p, wirelen, buflen, prof, aux, rs)
 	register const struct bpf_insn *pc;
 	register const u_char *p;
 	u_int wirelen;
 	register u_int buflen;
+	struct bpf_profile *prof;
+	const struct bpf_aux_data *aux;
+	const struct bpf_resume *rs;
 {
 	register u_int32 A, X;
 	register int k;
+#if !defined(KERNEL) && !defined(_KERNEL)
+	int v;
+#endif
 	int32 mem[BPF_MEMWORDS];
+#if !defined(KERNEL) && !defined(_KERNEL)
+	const struct bpf_insn *insns = pc, *last = NULL;
+	u_int64_t then = 0, now;
+#endif
 #if defined(KERNEL) || defined(_KERNEL)
 	struct mbuf *m, *n;
 	int merr, len;
@@ -236,35 +374,48 @@ bpf_filter(pc, p, wirelen, buflen)
 		return (u_int)-1;
 	A = 0;
 	X = 0;
+#if !defined(KERNEL) && !defined(_KERNEL)
+	if (rs != NULL) {
+		A = rs->A;
+		X = rs->X;
+		if (rs->mem != NULL)
+			memcpy(mem, rs->mem, sizeof(mem));
+		pc += rs->pc;
+	}
+#endif
 	--pc;
 	while (1) {
 		++pc;
+		PROF_STEP();
 		switch (pc->code) {
 
 		default:
 #if defined(KERNEL) || defined(_KERNEL)
-			return 0;
+			PROF_RETURN(0);
 #else
 			abort();
 #endif
 		case BPF_RET|BPF_K:
-			return (u_int)pc->k;
+			PROF_RETURN((u_int)pc->k);
 
 		case BPF_RET|BPF_A:
-			return (u_int)A;
+			PROF_RETURN((u_int)A);
 
 		case BPF_LD|BPF_W|BPF_ABS:
 			k = pc->k;
 			if (k + sizeof(int32) > buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				A = m_xword(m, k, &merr);
 				if (merr != 0)
-					return 0;
+					PROF_RETURN(0);
 				continue;
 #else
-				return 0;
+				if ((v = bpf_aux_load(aux, k)) == -1)
+					PROF_RETURN(0);
+				A = v;
+				continue;
 #endif
 			}
 			A = EXTRACT_LONG(&p[k]);
@@ -275,13 +426,16 @@ bpf_filter(pc, p, wirelen, buflen)
 			if (k + sizeof(short) > buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				A = m_xhalf(m, k, &merr);
 				if (merr != 0)
-					return 0;
+					PROF_RETURN(0);
 				continue;
 #else
-				return 0;
+				if ((v = bpf_aux_load(aux, k)) == -1)
+					PROF_RETURN(0);
+				A = v;
+				continue;
 #endif
 			}
 			A = EXTRACT_SHORT(&p[k]);
@@ -292,13 +446,16 @@ bpf_filter(pc, p, wirelen, buflen)
 			if (k >= buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				n = m;
 				MINDEX(len, n, k);
 				A = mtod(n, u_char *)[k];
 				continue;
 #else
-				return 0;
+				if ((v = bpf_aux_load(aux, k)) == -1)
+					PROF_RETURN(0);
+				A = v;
+				continue;
 #endif
 			}
 			A = p[k];
@@ -317,13 +474,13 @@ bpf_filter(pc, p, wirelen, buflen)
 			if (k + sizeof(int32) > buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				A = m_xword(m, k, &merr);
 				if (merr != 0)
-					return 0;
+					PROF_RETURN(0);
 				continue;
 #else
-				return 0;
+				PROF_RETURN(0);
 #endif
 			}
 			A = EXTRACT_LONG(&p[k]);
@@ -334,13 +491,13 @@ bpf_filter(pc, p, wirelen, buflen)
 			if (k + sizeof(short) > buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				A = m_xhalf(m, k, &merr);
 				if (merr != 0)
-					return 0;
+					PROF_RETURN(0);
 				continue;
 #else
-				return 0;
+				PROF_RETURN(0);
 #endif
 			}
 			A = EXTRACT_SHORT(&p[k]);
@@ -351,13 +508,13 @@ bpf_filter(pc, p, wirelen, buflen)
 			if (k >= buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				n = m;
 				MINDEX(len, n, k);
 				A = mtod(n, u_char *)[k];
 				continue;
 #else
-				return 0;
+				PROF_RETURN(0);
 #endif
 			}
 			A = p[k];
@@ -368,13 +525,13 @@ bpf_filter(pc, p, wirelen, buflen)
 			if (k >= buflen) {
 #if defined(KERNEL) || defined(_KERNEL)
 				if (m == NULL)
-					return 0;
+					PROF_RETURN(0);
 				n = m;
 				MINDEX(len, n, k);
 				X = (mtod(n, char *)[k] & 0xf) << 2;
 				continue;
 #else
-				return 0;
+				PROF_RETURN(0);
 #endif
 			}
 			X = (p[pc->k] & 0xf) << 2;
@@ -465,7 +622,7 @@ bpf_filter(pc, p, wirelen, buflen)
 
 		case BPF_ALU|BPF_DIV|BPF_X:
 			if (X == 0)
-				return 0;
+				PROF_RETURN(0);
 			A /= X;
 			continue;
 
@@ -532,6 +689,604 @@ bpf_filter(pc, p, wirelen, buflen)
 	}
 }
 
+u_int
+bpf_filter(pc, p, wirelen, buflen)
+	register const struct bpf_insn *pc;
+	register const u_char *p;
+	u_int wirelen;
+	register u_int buflen;
+{
+	return (bpf_filter_common(pc, p, wirelen, buflen, NULL, NULL, NULL));
+}
+
+#if !defined(KERNEL) && !defined(_KERNEL)
+/*
+ * Execute the filter program like bpf_filter(), recording into prof,
+ * which must have been set up with bpf_profile_init() for this program.
+ */
+u_int
+bpf_filter_profile(pc, p, wirelen, buflen, prof)
+	const struct bpf_insn *pc;
+	const u_char *p;
+	u_int wirelen;
+	u_int buflen;
+	struct bpf_profile *prof;
+{
+	return (bpf_filter_common(pc, p, wirelen, buflen, prof, NULL, NULL));
+}
+
+/*
+ * Execute the filter program like bpf_filter(), taking the values of
+ * loads from the special metadata offsets from aux.
+ */
+u_int
+bpf_filter_with_aux_data(pc, p, wirelen, buflen, aux)
+	const struct bpf_insn *pc;
+	const u_char *p;
+	u_int wirelen;
+	u_int buflen;
+	const struct bpf_aux_data *aux;
+{
+	return (bpf_filter_common(pc, p, wirelen, buflen, NULL, aux, NULL));
+}
+
+/*
+ * Batched evaluation.  bpf_filter_batch() runs one program over the
+ * packets of a batch at once, a packet per lane of a set of vector
+ * registers: the accumulator, the index register and each scratch
+ * memory word become vectors holding a word for each packet.
+ *
+ * While the packets all take the same path through the program, each
+ * instruction is decoded once for the whole batch and applied to every
+ * lane together.  A lane that goes off the end of its packet, or
+ * divides by zero, drops out with a return value of 0.  Once a
+ * conditional jump sends lanes different ways, or there's a single lane
+ * left, each lane is finished by the ordinary interpreter, starting
+ * from the state it had reached; following each path for just the
+ * lanes on it, with the others masked out, turned out to cost more than
+ * that on traffic with a mix of protocols.
+ *
+ * Packet loads are gathered with AVX2's masked gathers; everything else
+ * is written with GCC's vector extensions, compiled for AVX2.  Without
+ * a gather instruction, loading each lane by itself costs more than
+ * decoding each instruction once saves - that's so with SSE2 on x86,
+ * and NEON has no gathers either - so, on CPUs without AVX2, the
+ * packets are run through the ordinary interpreter one at a time.
+ */
+#define BPF_BATCH_LANES	8
+
+#if defined(__x86_64__) && !defined(LBL_ALIGN) && \
+    defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)
+#define BPF_LANES
+#endif
+
+#ifdef BPF_LANES
+#include <immintrin.h>
+
+typedef u_int32 bpf_lanes_t
+    __attribute__((vector_size(BPF_BATCH_LANES * sizeof(u_int32))));
+typedef int32 bpf_lanes_mask_t
+    __attribute__((vector_size(BPF_BATCH_LANES * sizeof(int32))));
+
+union bpf_lanes_words {
+	bpf_lanes_t	v;
+	u_int32		w[BPF_BATCH_LANES];
+};
+
+/*
+ * Put the "size"-byte big-endian value at offset off[l] of packet l
+ * into val[l], for each lane l in "lanes"; returns the lanes for which
+ * that's off the end of the packet.  Each lane gathers the 4 bytes that
+ * end where the value does, or, if the value's within the first 4 bytes
+ * of the packet, the first 4 bytes, so that a gather never reads outside
+ * the packet; lanes whose packets are shorter than that load by
+ * themselves.
+ */
+static u_int bpf_lanes_load_avx2(const u_char *const *, const u_int32 *,
+    const u_int *, u_int, u_int, u_int32 *)
+    __attribute__((target("avx2"), always_inline));
+
+static inline u_int
+bpf_lanes_load_avx2(const u_char *const *pkts, const u_int32 *offp,
+    const u_int *buflenp, u_int size, u_int lanes, u_int32 *val)
+{
+	static const int32 bit[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	static const char bswap[32] = {
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+	};
+	__m256i off, len, sz, four, bits, active, ok, end, big, start;
+	__m256i shift, gmask, lo_addr, hi_addr, v;
+	__m128i lo, hi;
+	u_int okbits, slow, l;
+
+	off = _mm256_loadu_si256((const __m256i *)offp);
+	len = _mm256_loadu_si256((const __m256i *)buflenp);
+	sz = _mm256_set1_epi32(size);
+	four = _mm256_set1_epi32(4);
+	bits = _mm256_loadu_si256((const __m256i *)bit);
+	active = _mm256_cmpeq_epi32(
+	    _mm256_and_si256(_mm256_set1_epi32(lanes), bits), bits);
+
+	/*
+	 * In the packet if size <= len and off <= len - size.
+	 */
+	ok = _mm256_and_si256(active, _mm256_and_si256(
+	    _mm256_cmpeq_epi32(_mm256_max_epu32(len, sz), len),
+	    _mm256_cmpeq_epi32(
+	    _mm256_min_epu32(off, _mm256_sub_epi32(len, sz)), off)));
+	end = _mm256_add_epi32(off, sz);
+	big = _mm256_cmpeq_epi32(_mm256_max_epu32(end, four), end);
+	start = _mm256_and_si256(big, _mm256_sub_epi32(end, four));
+	shift = _mm256_andnot_si256(big,
+	    _mm256_slli_epi32(_mm256_sub_epi32(four, end), 3));
+	gmask = _mm256_and_si256(ok, _mm256_or_si256(big,
+	    _mm256_cmpeq_epi32(_mm256_max_epu32(len, four), len)));
+
+	lo_addr = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)pkts),
+	    _mm256_cvtepu32_epi64(_mm256_castsi256_si128(start)));
+	hi_addr = _mm256_add_epi64(
+	    _mm256_loadu_si256((const __m256i *)(pkts + 4)),
+	    _mm256_cvtepu32_epi64(_mm256_extracti128_si256(start, 1)));
+	lo = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), (const int *)0,
+	    lo_addr, _mm256_castsi256_si128(gmask), 1);
+	hi = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), (const int *)0,
+	    hi_addr, _mm256_extracti128_si256(gmask, 1), 1);
+	v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	v = _mm256_shuffle_epi8(v, _mm256_loadu_si256((const __m256i *)bswap));
+	v = _mm256_srlv_epi32(v, shift);
+	if (size < 4)
+		v = _mm256_and_si256(v, _mm256_set1_epi32((1 << (size * 8)) - 1));
+	_mm256_storeu_si256((__m256i *)val, v);
+
+	okbits = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+	slow = okbits & ~_mm256_movemask_ps(_mm256_castsi256_ps(gmask));
+	for (l = 0; slow != 0; l++, slow >>= 1) {
+		if (!(slow & 1))
+			continue;
+		if (size == 2)
+			val[l] = EXTRACT_SHORT(&pkts[l][offp[l]]);
+		else
+			val[l] = pkts[l][offp[l]];
+	}
+	return (lanes & ~okbits);
+}
+
+/*
+ * The lanes for which "m" is true.
+ */
+static inline u_int bpf_lanes_bits(bpf_lanes_mask_t)
+    __attribute__((target("avx2"), always_inline));
+
+static inline u_int
+bpf_lanes_bits(bpf_lanes_mask_t m)
+{
+	return (_mm256_movemask_ps((__m256)m));
+}
+
+/*
+ * Run the program over the packets in the lanes in "live", storing
+ * bpf_filter()'s return value for lane l in ret[l].
+ */
+static void bpf_lanes_run(const struct bpf_insn *, const u_char *const *,
+    const u_int *, const u_int *, u_int *, u_int)
+    __attribute__((target("avx2")));
+
+static void
+bpf_lanes_run(const struct bpf_insn *insns, const u_char *const *pkts,
+    const u_int *wirelens, const u_int *buflens, u_int *ret, u_int live)
+{
+	bpf_lanes_t A, X, d, mem[BPF_MEMWORDS];
+	bpf_lanes_mask_t cond;
+	union bpf_lanes_words off, val, next;
+	const struct bpf_insn *pc;
+	struct bpf_resume rs;
+	int32 lmem[BPF_MEMWORDS];
+	u_int cur, taken, bad, size, l, m;
+	int stored = 0;
+
+	A = X = (bpf_lanes_t){ 0 };
+	cur = 0;
+	for (;;) {
+		if ((live & (live - 1)) == 0) {
+			/*
+			 * There's at most one lane left; finish it by
+			 * itself.
+			 */
+			next.v = (bpf_lanes_t){ 0 } + cur;
+			break;
+		}
+		pc = &insns[cur];
+		switch (pc->code) {
+
+		default:
+			abort();
+
+		case BPF_RET|BPF_K:
+			for (l = 0; l < BPF_BATCH_LANES; l++)
+				if (live & (1U << l))
+					ret[l] = (u_int)pc->k;
+			return;
+
+		case BPF_RET|BPF_A:
+			for (l = 0; l < BPF_BATCH_LANES; l++)
+				if (live & (1U << l))
+					ret[l] = (u_int)A[l];
+			return;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+		case BPF_LD|BPF_W|BPF_IND:
+		case BPF_LD|BPF_H|BPF_IND:
+		case BPF_LD|BPF_B|BPF_IND:
+		case BPF_LDX|BPF_MSH|BPF_B:
+			off.v = (bpf_lanes_t){ 0 } + pc->k;
+			if (BPF_MODE(pc->code) == BPF_IND)
+				off.v += X;
+			switch (BPF_SIZE(pc->code)) {
+
+			case BPF_W:
+				size = 4;
+				break;
+
+			case BPF_H:
+				size = 2;
+				break;
+
+			default:
+				size = 1;
+				break;
+			}
+			bad = bpf_lanes_load_avx2(pkts, off.w, buflens, size,
+			    live, val.w);
+			if (bad != 0) {
+				/*
+				 * Those lanes are off the end of their
+				 * packets, so they're rejected.
+				 */
+				for (l = 0; l < BPF_BATCH_LANES; l++)
+					if (bad & (1U << l))
+						ret[l] = 0;
+				live &= ~bad;
+			}
+			if (BPF_CLASS(pc->code) == BPF_LDX)
+				X = (val.v & 0xf) << 2;
+			else
+				A = val.v;
+			cur++;
+			continue;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			memcpy(&val.w, wirelens, sizeof(val.w));
+			A = val.v;
+			cur++;
+			continue;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			memcpy(&val.w, wirelens, sizeof(val.w));
+			X = val.v;
+			cur++;
+			continue;
+
+		case BPF_LD|BPF_IMM:
+			A = (bpf_lanes_t){ 0 } + pc->k;
+			cur++;
+			continue;
+
+		case BPF_LDX|BPF_IMM:
+			X = (bpf_lanes_t){ 0 } + pc->k;
+			cur++;
+			continue;
+
+		case BPF_LD|BPF_MEM:
+			A = mem[pc->k];
+			cur++;
+			continue;
+
+		case BPF_LDX|BPF_MEM:
+			X = mem[pc->k];
+			cur++;
+			continue;
+
+		case BPF_ST:
+			mem[pc->k] = A;
+			stored = 1;
+			cur++;
+			continue;
+
+		case BPF_STX:
+			mem[pc->k] = X;
+			stored = 1;
+			cur++;
+			continue;
+
+		case BPF_JMP|BPF_JA:
+			cur += 1 + pc->k;
+			continue;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_K:
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+		case BPF_JMP|BPF_JSET|BPF_X:
+			d = BPF_SRC(pc->code) == BPF_X ? X :
+			    (bpf_lanes_t){ 0 } + pc->k;
+			switch (BPF_OP(pc->code)) {
+
+			case BPF_JGT:
+				cond = A > d;
+				break;
+
+			case BPF_JGE:
+				cond = A >= d;
+				break;
+
+			case BPF_JEQ:
+				cond = A == d;
+				break;
+
+			default:
+				cond = (A & d) != 0;
+				break;
+			}
+			taken = bpf_lanes_bits(cond) & live;
+			if (taken == live) {
+				cur += 1 + pc->jt;
+				continue;
+			}
+			if (taken == 0) {
+				cur += 1 + pc->jf;
+				continue;
+			}
+			next.v = ((bpf_lanes_t)cond & (u_int32)(pc->jt - pc->jf)) +
+			    (u_int32)(cur + 1 + pc->jf);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			A += X;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			A -= X;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			A *= X;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+			cond = X == 0;
+			bad = bpf_lanes_bits(cond) & live;
+			if (bad != 0) {
+				for (l = 0; l < BPF_BATCH_LANES; l++)
+					if (bad & (1U << l))
+						ret[l] = 0;
+				live &= ~bad;
+			}
+			A /= X | (bpf_lanes_t)(X == 0);
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			A &= X;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			A |= X;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+			A <<= X & 31;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_RSH|BPF_X:
+			A >>= X & 31;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			A += pc->k;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			A -= pc->k;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			A *= pc->k;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+			A /= pc->k;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			A &= pc->k;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			A |= pc->k;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+			A <<= pc->k & 31;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			A >>= pc->k & 31;
+			cur++;
+			continue;
+
+		case BPF_ALU|BPF_NEG:
+			A = -A;
+			cur++;
+			continue;
+
+		case BPF_MISC|BPF_TAX:
+			X = A;
+			cur++;
+			continue;
+
+		case BPF_MISC|BPF_TXA:
+			A = X;
+			cur++;
+			continue;
+		}
+		break;
+	}
+
+	/*
+	 * The lanes have parted company, or there's only one left; each
+	 * is finished by the ordinary interpreter, from where it's got to.
+	 */
+	for (l = 0; l < BPF_BATCH_LANES; l++) {
+		if (!(live & (1U << l)))
+			continue;
+		rs.pc = next.w[l];
+		rs.A = A[l];
+		rs.X = X[l];
+		rs.mem = NULL;
+		if (stored) {
+			for (m = 0; m < BPF_MEMWORDS; m++)
+				lmem[m] = mem[m][l];
+			rs.mem = lmem;
+		}
+		ret[l] = bpf_filter_common(insns, pkts[l], wirelens[l],
+		    buflens[l], NULL, NULL, &rs);
+	}
+}
+
+#endif /* BPF_LANES */
+
+/*
+ * Run the filter program over n packets, storing bpf_filter()'s return
+ * value for packet i in ret[i]; returns the number of packets accepted.
+ * This is meant for running one program over many independent packets,
+ * such as the records of a savefile.
+ */
+u_int
+bpf_filter_batch(pc, pkts, wirelens, buflens, ret, n)
+	const struct bpf_insn *pc;
+	const u_char **pkts;
+	const u_int *wirelens, *buflens;
+	u_int *ret;
+	u_int n;
+{
+#ifdef BPF_LANES
+	static int have_avx2 = -1;
+	static const u_char nothing[1];
+	const u_char *lp[BPF_BATCH_LANES];
+	u_int lw[BPF_BATCH_LANES], lb[BPF_BATCH_LANES], lr[BPF_BATCH_LANES];
+#endif
+	u_int i, j, chunk, accepted;
+
+	if (pc == NULL) {
+		/*
+		 * No filter means accept all.
+		 */
+		for (i = 0; i < n; i++)
+			ret[i] = (u_int)-1;
+		return (n);
+	}
+#ifdef BPF_LANES
+	if (have_avx2 == -1) {
+		__builtin_cpu_init();
+		have_avx2 = __builtin_cpu_supports("avx2") != 0;
+	}
+#endif
+	accepted = 0;
+	for (i = 0; i < n; i += chunk) {
+		chunk = n - i;
+		if (chunk > BPF_BATCH_LANES)
+			chunk = BPF_BATCH_LANES;
+#ifdef BPF_LANES
+		if (have_avx2 && chunk == BPF_BATCH_LANES)
+			bpf_lanes_run(pc, &pkts[i], &wirelens[i], &buflens[i],
+			    &ret[i], (1U << BPF_BATCH_LANES) - 1);
+		else if (have_avx2 && chunk > 1) {
+			/*
+			 * Fill the lanes we're not using with an empty
+			 * packet.
+			 */
+			for (j = 0; j < BPF_BATCH_LANES; j++) {
+				lp[j] = j < chunk ? pkts[i + j] : nothing;
+				lw[j] = j < chunk ? wirelens[i + j] : 0;
+				lb[j] = j < chunk ? buflens[i + j] : 0;
+			}
+			bpf_lanes_run(pc, lp, lw, lb, lr, (1U << chunk) - 1);
+			memcpy(&ret[i], lr, chunk * sizeof(*ret));
+		} else
+#endif
+		for (j = 0; j < chunk; j++)
+			ret[i + j] = bpf_filter(pc, pkts[i + j],
+			    wirelens[i + j], buflens[i + j]);
+		for (j = 0; j < chunk; j++)
+			if (ret[i + j] != 0)
+				accepted++;
+	}
+	return (accepted);
+}
+
+
+int
+bpf_profile_init(prof, fp)
+	struct bpf_profile *prof;
+	const struct bpf_program *fp;
+{
+	memset(prof, 0, sizeof(*prof));
+	prof->bp_hits = calloc(fp->bf_len ? fp->bf_len : 1, sizeof(u_int64_t));
+	prof->bp_cycles = calloc(fp->bf_len ? fp->bf_len : 1, sizeof(u_int64_t));
+	prof->bp_taken = calloc(fp->bf_len ? fp->bf_len : 1, sizeof(u_int64_t));
+	if (prof->bp_hits == NULL || prof->bp_cycles == NULL ||
+	    prof->bp_taken == NULL) {
+		bpf_profile_free(prof);
+		return (-1);
+	}
+	prof->bp_len = fp->bf_len;
+	return (0);
+}
+
+void
+bpf_profile_reset(prof)
+	struct bpf_profile *prof;
+{
+	if (prof->bp_len != 0) {
+		memset(prof->bp_hits, 0, prof->bp_len * sizeof(u_int64_t));
+		memset(prof->bp_cycles, 0, prof->bp_len * sizeof(u_int64_t));
+		memset(prof->bp_taken, 0, prof->bp_len * sizeof(u_int64_t));
+	}
+	prof->bp_runs = 0;
+	prof->bp_accepted = 0;
+}
+
+void
+bpf_profile_free(prof)
+	struct bpf_profile *prof;
+{
+	free(prof->bp_hits);
+	free(prof->bp_cycles);
+	free(prof->bp_taken);
+	memset(prof, 0, sizeof(*prof));
+}
+#endif
+
 /*
  * Return true if the 'fcode' is a valid filter program.
  * The constraints are that each jump be forward and to a valid
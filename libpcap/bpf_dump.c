@@ -60,3 +60,19 @@ bpf_dump(const struct bpf_program *p, int option)
 		puts(bpf_image(insn, i));
 	}
 }
+
+void
+bpf_dump_profile(const struct bpf_program *p, const struct bpf_profile *prof)
+{
+	const struct bpf_insn *insn;
+	int i;
+	int n = p->bf_len;
+
+	printf("%llu runs, %llu accepted\n",
+	    (unsigned long long)prof->bp_runs,
+	    (unsigned long long)prof->bp_accepted);
+	printf("%12s %7s %8s  %s\n", "hits", "reached", "ticks", "instruction");
+	insn = p->bf_insns;
+	for (i = 0; i < n; ++insn, ++i)
+		puts(bpf_image_profile(insn, i, prof));
+}
@@ -303,3 +303,31 @@ bpf_image(p, n)
 	}
 	return image;
 }
+
+/*
+ * Like bpf_image(), but prefixed with the instruction's execution count,
+ * the percentage of runs that reached it, and the average number of
+ * clock ticks spent in it, as recorded by bpf_filter_profile().
+ */
+char *
+bpf_image_profile(p, n, prof)
+	const struct bpf_insn *p;
+	int n;
+	const struct bpf_profile *prof;
+{
+	static char image[256];
+	u_int64_t hits, cycles;
+	double pct;
+
+	if (n < 0 || (u_int)n >= prof->bp_len) {
+		hits = cycles = 0;
+	} else {
+		hits = prof->bp_hits[n];
+		cycles = prof->bp_cycles[n];
+	}
+	pct = prof->bp_runs ? 100.0 * hits / prof->bp_runs : 0.0;
+	(void)snprintf(image, sizeof image, "%12llu %6.2f%% %8.1f  %s",
+	    (unsigned long long)hits, pct,
+	    hits ? (double)cycles / hits : 0.0, bpf_image(p, n));
+	return image;
+}
@@ -0,0 +1,614 @@
+/*
+ * dispatcher.c - spread the packets captured on a pcap_t over a set
+ * of worker threads, by flow.
+ *
+ * The capture thread runs the pcap_t's read loop; packets that get
+ * past the filter are hashed on their addresses, and, for TCP, UDP
+ * and SCTP, ports, in a way that gives the same hash for both
+ * directions of a flow, and queued for the worker the hash picks.
+ *
+ * Each worker has a single-producer, single-consumer queue of packet
+ * descriptors, which needs no locks: the capture thread only moves
+ * the head, the worker only moves the tail.  If the pcap_t can retain
+ * packets in its capture buffer (see pcap_retain()), the descriptors
+ * point into that buffer; otherwise, the packet data is copied into
+ * a per-worker arena, which is used as a ring in the same way as the
+ * queue.  A worker with nothing to do spins for a while and then
+ * sleeps on a condition variable, which the capture thread signals
+ * only if the worker has said it's asleep.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_SYS_BITYPES_H
+#include <sys/bitypes.h>
+#endif
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "pcap-int.h"
+#include "ethertype.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#define DISPATCH_QLEN		1024	/* default queue length, in packets */
+#define DISPATCH_MAX_WORKERS	1024
+#define DISPATCH_AVG_PACKET	1024	/* arena bytes per queue slot */
+#define DISPATCH_SPINS		2000	/* empty polls before sleeping */
+#define DISPATCH_MAX_TAGS	4	/* VLAN tags we'll look past */
+
+#ifndef ETHERTYPE_8021AD
+#define ETHERTYPE_8021AD	0x88a8
+#endif
+
+#define FLOW_GET16(p)	((u_int)(p)[0] << 8 | (u_int)(p)[1])
+#define FLOW_GET32(p)	((bpf_u_int32)(p)[0] << 24 | (bpf_u_int32)(p)[1] << 16 | \
+			 (bpf_u_int32)(p)[2] << 8 | (bpf_u_int32)(p)[3])
+
+struct dispatch_desc {
+	struct pcap_pkthdr_if hdr;	/* as much of it as the pcap_t fills in */
+	const u_char	*data;
+	u_int		arena_end;	/* arena position after this packet */
+	int		retained;	/* data is retained in the capture buffer */
+};
+
+struct dispatch_worker {
+	struct pcap_dispatcher *d;
+	int		index;
+	struct dispatch_desc *ring;
+	u_char		*arena;
+	u_int		arena_size;	/* a power of 2 */
+
+	/*
+	 * Written by the capture thread.
+	 */
+	volatile u_int	head;
+	u_int		arena_head;
+	u_int		queued;
+	u_int		dropped;
+	u_int		max_depth;
+	char		pad1[64];
+
+	/*
+	 * Written by the worker.
+	 */
+	volatile u_int	tail;
+	volatile u_int	arena_tail;
+	volatile u_int	handled;
+	volatile int	waiting;	/* asleep, or about to be */
+	char		pad2[64];
+
+#ifdef HAVE_PTHREADS
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+#endif
+	int		started;
+};
+
+struct pcap_dispatcher {
+	pcap_t		*p;
+	pcap_worker_handler callback;
+	u_char		*user;
+	int		nworkers;
+	u_int		qmask;		/* queue length - 1 */
+	int		off_nl;		/* network-layer header, or -1 */
+	int		off_ethertype;	/* Ethernet type field, or -1 */
+	int		zerocopy;	/* retain rather than copy */
+	volatile int	stopping;
+	struct dispatch_worker *workers;
+};
+
+/*
+ * Bob Jenkins' lookup3 final mix.
+ */
+#define ROT32(x, k)	(((x) << (k)) | ((x) >> (32 - (k))))
+
+static bpf_u_int32
+flow_mix(bpf_u_int32 a, bpf_u_int32 b, bpf_u_int32 c)
+{
+	c ^= b; c -= ROT32(b, 14);
+	a ^= c; a -= ROT32(c, 11);
+	b ^= a; b -= ROT32(a, 25);
+	c ^= b; c -= ROT32(b, 16);
+	a ^= c; a -= ROT32(c, 4);
+	b ^= a; b -= ROT32(a, 14);
+	c ^= b; c -= ROT32(b, 24);
+	return (c);
+}
+
+/*
+ * Find a packet's network-layer and transport-layer headers, and pick
+ * out the fields that identify its flow, given the offsets of the
+ * network-layer header and of the Ethernet type field, if any, from
+ * pcap_nl_offset().  Returns 0 if it isn't IPv4 or IPv6, or is too
+ * short to tell; otherwise, the addresses are pointed to in the packet,
+ * and the ports are filled in only if the transport-layer header has
+ * them and we have them - fragments other than the first have no ports,
+ * and we don't trust the first one to have them either.
+ */
+int
+pcap_flow_parse(const u_char *bp, u_int caplen, int off_nl, int off_ethertype,
+    struct pcap_flow_key *k)
+{
+	int off = off_nl;
+	int et = off_ethertype;
+	int i;
+	u_int type;
+
+	memset(k, 0, sizeof(*k));
+	k->off_l3 = k->off_l4 = -1;
+	if (off < 0)
+		return (0);
+
+	if (et >= 0) {
+		if ((u_int)et + 2 > caplen)
+			return (0);
+		type = FLOW_GET16(bp + et);
+		for (i = 0; i < DISPATCH_MAX_TAGS &&
+		    (type == ETHERTYPE_8021Q || type == ETHERTYPE_8021AD ||
+		     type == ETHERTYPE_8021QINQ); i++) {
+			et += 4;
+			off += 4;
+			if ((u_int)et + 2 > caplen)
+				return (0);
+			type = FLOW_GET16(bp + et);
+		}
+		k->ethertype = type;
+		if (type == ETHERTYPE_IP)
+			k->version = 4;
+		else if (type == ETHERTYPE_IPV6)
+			k->version = 6;
+		else
+			return (0);
+	} else {
+		if ((u_int)off >= caplen)
+			return (0);
+		k->version = bp[off] >> 4;
+		if (k->version == 4)
+			k->ethertype = ETHERTYPE_IP;
+		else if (k->version == 6)
+			k->ethertype = ETHERTYPE_IPV6;
+	}
+
+	switch (k->version) {
+
+	case 4:
+		if ((u_int)off + 20 > caplen)
+			return (k->version = 0);
+		k->off_l3 = off;
+		k->proto = bp[off + 9];
+		k->src = bp + off + 12;
+		k->dst = bp + off + 16;
+		/* fragment offset or more-fragments set */
+		if ((FLOW_GET16(bp + off + 6) & 0x3fff) != 0)
+			k->fragment = 1;
+		off += (bp[off] & 0x0f) * 4;
+		break;
+
+	case 6:
+		if ((u_int)off + 40 > caplen)
+			return (k->version = 0);
+		k->off_l3 = off;
+		k->proto = bp[off + 6];
+		k->src = bp + off + 8;
+		k->dst = bp + off + 24;
+		off += 40;
+		/*
+		 * Skip hop-by-hop, routing and destination options
+		 * headers to get to the transport header.
+		 */
+		while ((k->proto == 0 || k->proto == 43 || k->proto == 60) &&
+		    (u_int)off + 8 <= caplen) {
+			k->proto = bp[off];
+			off += (bp[off + 1] + 1) * 8;
+		}
+		if (k->proto == 44)	/* fragment header */
+			k->fragment = 1;
+		break;
+
+	default:
+		return (k->version = 0);
+	}
+
+	if ((u_int)off <= caplen && !k->fragment)
+		k->off_l4 = off;
+	if (!k->fragment && (k->proto == 6 /* TCP */ ||
+	    k->proto == 17 /* UDP */ || k->proto == 132 /* SCTP */ ||
+	    k->proto == 136 /* UDP-Lite */) && (u_int)off + 4 <= caplen) {
+		k->sport = FLOW_GET16(bp + off);
+		k->dport = FLOW_GET16(bp + off + 2);
+		k->ports = 1;
+	}
+	return (k->version);
+}
+
+/*
+ * Hash a packet's flow so that both directions get the same value:
+ * the addresses, and ports if any, are put in order before they're
+ * mixed.  Fragments are hashed without ports, as only the first one
+ * has them.  Packets that aren't IPv4 or IPv6, or for whose link-layer
+ * type we can't find the network-layer header, all hash to 0.
+ */
+u_int
+pcap_flow_hash(pcap_dispatcher_t *d, const struct pcap_pkthdr *h,
+    const u_char *bp)
+{
+	struct pcap_flow_key k;
+	int i;
+	bpf_u_int32 a, b, t, sport, dport;
+
+	switch (pcap_flow_parse(bp, h->caplen, d->off_nl, d->off_ethertype,
+	    &k)) {
+
+	case 4:
+		a = FLOW_GET32(k.src);
+		b = FLOW_GET32(k.dst);
+		break;
+
+	case 6:
+		a = b = 0;
+		for (i = 0; i < 16; i += 4) {
+			a ^= FLOW_GET32(k.src + i);
+			b ^= FLOW_GET32(k.dst + i);
+		}
+		break;
+
+	default:
+		return (0);
+	}
+	sport = k.sport;
+	dport = k.dport;
+
+	if (a > b || (a == b && sport > dport)) {
+		t = a; a = b; b = t;
+		t = sport; sport = dport; dport = t;
+	}
+	return (flow_mix(a, b, (sport << 16 | dport) ^ (k.proto << 8)));
+}
+
+#ifdef HAVE_PTHREADS
+
+static void
+dispatch_wakeup(struct dispatch_worker *w)
+{
+	pthread_mutex_lock(&w->lock);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * The capture thread's callback: pick a worker and queue the packet.
+ */
+static void
+dispatch_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *bp)
+{
+	struct pcap_dispatcher *d = (struct pcap_dispatcher *)user;
+	struct dispatch_worker *w;
+	struct dispatch_desc *desc;
+	u_int head, depth, pos, skip, used;
+
+	w = &d->workers[((u_int64_t)pcap_flow_hash(d, h, bp) *
+	    d->nworkers) >> 32];
+	head = w->head;
+	depth = head - w->tail;
+	if (depth > d->qmask) {
+		w->dropped++;
+		return;
+	}
+	desc = &w->ring[head & d->qmask];
+	if (d->p->per_interface)
+		desc->hdr = *(const struct pcap_pkthdr_if *)h;
+	else if (d->p->vlan_metadata)
+		desc->hdr.vhdr = *(const struct pcap_pkthdr_vlan *)h;
+	else
+		desc->hdr.vhdr.hdr = *h;
+
+	if (d->zerocopy && (*d->p->retain_op)(d->p, bp) == 0) {
+		desc->data = bp;
+		desc->retained = 1;
+	} else {
+		/*
+		 * Copy it into the arena; if it won't fit before the
+		 * end, skip to the beginning.
+		 */
+		pos = w->arena_head & (w->arena_size - 1);
+		skip = 0;
+		if (pos + h->caplen > w->arena_size) {
+			skip = w->arena_size - pos;
+			pos = 0;
+		}
+		used = w->arena_head - w->arena_tail;
+		if (h->caplen > w->arena_size ||
+		    used + skip + h->caplen > w->arena_size) {
+			w->dropped++;
+			return;
+		}
+		memcpy(w->arena + pos, bp, h->caplen);
+		w->arena_head += skip + h->caplen;
+		desc->data = w->arena + pos;
+		desc->retained = 0;
+	}
+	desc->arena_end = w->arena_head;
+
+	/*
+	 * Make the descriptor visible before the new head, and the
+	 * new head visible before we look to see whether the worker
+	 * has gone to sleep; it sets "waiting" before it looks at the
+	 * head for the last time, so one of us sees the other.
+	 */
+	__sync_synchronize();
+	w->head = head + 1;
+	w->queued++;
+	if (depth + 1 > w->max_depth)
+		w->max_depth = depth + 1;
+	__sync_synchronize();
+	if (w->waiting)
+		dispatch_wakeup(w);
+}
+
+static void *
+dispatch_worker_thread(void *arg)
+{
+	struct dispatch_worker *w = arg;
+	struct pcap_dispatcher *d = w->d;
+	struct dispatch_desc *desc;
+	u_int tail = w->tail;
+	int spins = 0;
+
+	for (;;) {
+		if (tail == w->head) {
+			/*
+			 * Nothing queued.  We only quit once our queue
+			 * is drained, so that retained packets are all
+			 * released.
+			 */
+			if (d->stopping) {
+				__sync_synchronize();
+				if (tail == w->head)
+					break;
+				continue;
+			}
+			if (spins++ < DISPATCH_SPINS)
+				continue;
+			pthread_mutex_lock(&w->lock);
+			w->waiting = 1;
+			__sync_synchronize();
+			while (tail == w->head && !d->stopping)
+				pthread_cond_wait(&w->cond, &w->lock);
+			w->waiting = 0;
+			pthread_mutex_unlock(&w->lock);
+			spins = 0;
+			continue;
+		}
+		__sync_synchronize();
+		desc = &w->ring[tail & d->qmask];
+		(*d->callback)(d->user, w->index, &desc->hdr.vhdr.hdr,
+		    desc->data);
+		if (desc->retained)
+			(*d->p->release_op)(d->p, desc->data);
+		w->arena_tail = desc->arena_end;
+		w->handled++;
+		__sync_synchronize();
+		w->tail = ++tail;
+		spins = 0;
+	}
+	return (NULL);
+}
+
+/*
+ * Stop the workers that were started, once they've drained their
+ * queues, and free everything.
+ */
+static void
+dispatch_free(struct pcap_dispatcher *d)
+{
+	struct dispatch_worker *w;
+	int i;
+
+	d->stopping = 1;
+	__sync_synchronize();
+	for (i = 0; i < d->nworkers; i++) {
+		w = &d->workers[i];
+		if (!w->started)
+			continue;
+		dispatch_wakeup(w);
+		pthread_join(w->thread, NULL);
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+	}
+	for (i = 0; i < d->nworkers; i++) {
+		free(d->workers[i].ring);
+		free(d->workers[i].arena);
+	}
+	free(d->workers);
+	free(d);
+}
+
+pcap_dispatcher_t *
+pcap_dispatcher_create(pcap_t *p, int nworkers, int qlen,
+    pcap_worker_handler callback, u_char *user, char *errbuf)
+{
+	struct pcap_dispatcher *d;
+	struct dispatch_worker *w;
+	u_int qsize, asize;
+	int i, err;
+
+	if (!p->activated) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_dispatcher_create");
+		return (NULL);
+	}
+	if (nworkers < 1 || nworkers > DISPATCH_MAX_WORKERS) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "number of workers must be between 1 and %d",
+		    DISPATCH_MAX_WORKERS);
+		return (NULL);
+	}
+	if (qlen <= 0)
+		qlen = DISPATCH_QLEN;
+	if (qlen > 1024*1024) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "queue length %d is too large", qlen);
+		return (NULL);
+	}
+	for (qsize = 1; qsize < (u_int)qlen; qsize <<= 1)
+		;
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	d->p = p;
+	d->callback = callback;
+	d->user = user;
+	d->qmask = qsize - 1;
+	d->off_nl = pcap_nl_offset(p, &d->off_ethertype);
+	d->zerocopy = (p->retain_op != NULL);
+	d->workers = calloc(nworkers, sizeof(*d->workers));
+	if (d->workers == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(d);
+		return (NULL);
+	}
+	d->nworkers = nworkers;
+
+	/*
+	 * The arena's needed even with zero-copy, for any packets we
+	 * fail to retain; it needs to hold at least a couple of
+	 * packets of the maximum size.
+	 */
+	for (asize = 1; asize < qsize * DISPATCH_AVG_PACKET ||
+	    asize < 2 * (u_int)p->snapshot; asize <<= 1)
+		;
+	for (i = 0; i < nworkers; i++) {
+		w = &d->workers[i];
+		w->d = d;
+		w->index = i;
+		w->ring = malloc(qsize * sizeof(*w->ring));
+		w->arena = malloc(asize);
+		w->arena_size = asize;
+		if (w->ring == NULL || w->arena == NULL) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			dispatch_free(d);
+			return (NULL);
+		}
+	}
+	for (i = 0; i < nworkers; i++) {
+		w = &d->workers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		err = pthread_create(&w->thread, NULL, dispatch_worker_thread,
+		    w);
+		if (err != 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "pthread_create: %s", pcap_strerror(err));
+			pthread_cond_destroy(&w->cond);
+			pthread_mutex_destroy(&w->lock);
+			dispatch_free(d);
+			return (NULL);
+		}
+		w->started = 1;
+	}
+	return (d);
+}
+
+int
+pcap_dispatcher_loop(pcap_dispatcher_t *d, int cnt)
+{
+	return (pcap_loop(d->p, cnt, dispatch_packet, (u_char *)d));
+}
+
+int
+pcap_dispatcher_dispatch(pcap_dispatcher_t *d, int cnt)
+{
+	return (pcap_dispatch(d->p, cnt, dispatch_packet, (u_char *)d));
+}
+
+int
+pcap_dispatcher_stats(pcap_dispatcher_t *d, int worker,
+    struct pcap_worker_stat *ws)
+{
+	struct dispatch_worker *w;
+
+	if (worker < 0 || worker >= d->nworkers) {
+		snprintf(d->p->errbuf, PCAP_ERRBUF_SIZE,
+		    "worker %d doesn't exist", worker);
+		return (PCAP_ERROR);
+	}
+	w = &d->workers[worker];
+	ws->ws_queued = w->queued;
+	ws->ws_dropped = w->dropped;
+	ws->ws_handled = w->handled;
+	ws->ws_depth = w->head - w->tail;
+	ws->ws_max_depth = w->max_depth;
+	return (0);
+}
+
+/*
+ * Waits for the workers to handle everything that's been queued for
+ * them; it must be called before the pcap_t is closed.
+ */
+void
+pcap_dispatcher_destroy(pcap_dispatcher_t *d)
+{
+	dispatch_free(d);
+}
+
+#else /* HAVE_PTHREADS */
+
+pcap_dispatcher_t *
+pcap_dispatcher_create(pcap_t *p _U_, int nworkers _U_, int qlen _U_,
+    pcap_worker_handler callback _U_, u_char *user _U_, char *errbuf)
+{
+	snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "Worker threads aren't supported on this platform");
+	return (NULL);
+}
+
+int
+pcap_dispatcher_loop(pcap_dispatcher_t *d _U_, int cnt _U_)
+{
+	return (PCAP_ERROR);
+}
+
+int
+pcap_dispatcher_dispatch(pcap_dispatcher_t *d _U_, int cnt _U_)
+{
+	return (PCAP_ERROR);
+}
+
+int
+pcap_dispatcher_stats(pcap_dispatcher_t *d _U_, int worker _U_,
+    struct pcap_worker_stat *ws _U_)
+{
+	return (PCAP_ERROR);
+}
+
+void
+pcap_dispatcher_destroy(pcap_dispatcher_t *d _U_)
+{
+}
+
+#endif /* HAVE_PTHREADS */
@@ -42,11 +42,18 @@ static const char rcsid[] _U_ =
 #include <sys/types.h>
 #endif /* WIN32 */
 
+#include <sys/stat.h>
+
 #include <ctype.h>
 #include <memory.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #include "pcap-int.h"
 
 #include <pcap/namedb.h>
@@ -141,6 +148,10 @@ pcap_next_etherent(FILE *fp)
 			c = skip_line(fp);
 			continue;
 		}
+
+		/* an address with no name; don't go on to the next line */
+		if (c == '\n')
+			continue;
 		c = skip_space(fp);
 
 		/* hit end of line... */
@@ -172,3 +183,262 @@ pcap_next_etherent(FILE *fp)
 
 	return (NULL);
 }
+
+/*
+ * Looking names up in the ethers file.
+ *
+ * Rather than going through the file for each name, it's read whole,
+ * parsed in place, and put in a hash table, which is used until the
+ * file changes - we stat() it on each lookup, and read it again if
+ * its modification time, size or inode number has changed; the time
+ * is compared to the nanosecond where stat() gives us that, so that
+ * rewriting the file in place, within a second of the last time, is
+ * noticed.  Names are
+ * chained in the order they're in the file, so, as before, the first
+ * entry for a name is the one found.  The table's protected by a lock,
+ * so lookups can be done from any thread.
+ */
+#define ETHERS_HASH_MIN		64
+
+#if defined(__APPLE__)
+#define ETHERS_MTIME_NSEC(st)	((st)->st_mtimespec.tv_nsec)
+#elif defined(__linux__) || defined(__FreeBSD__)
+#define ETHERS_MTIME_NSEC(st)	((st)->st_mtim.tv_nsec)
+#else
+#define ETHERS_MTIME_NSEC(st)	0L
+#endif
+#define ETHERS_NAME_MAX		(sizeof(((struct pcap_etherent *)0)->name) - 1)
+
+struct ethers_entry {
+	const char	*name;		/* in ethers_buf */
+	u_char		addr[6];
+	int		next;		/* next in the chain, or -1 */
+};
+
+static char *ethers_buf;		/* the file, names NUL-terminated */
+static struct ethers_entry *ethers_entries;
+static int *ethers_hash;		/* index of first entry, or -1 */
+static u_int ethers_hash_size;		/* a power of 2 */
+static int ethers_loaded;		/* have we looked at the file? */
+static time_t ethers_mtime;
+static long ethers_mtime_nsec;
+static off_t ethers_size;
+static ino_t ethers_ino;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t ethers_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static u_int
+ethers_hash_name(const char *name)
+{
+	const u_char *cp = (const u_char *)name;
+	u_int hash = 2166136261U;
+
+	while (*cp != 0)
+		hash = (hash ^ *cp++) * 16777619;
+	return (hash);
+}
+
+/*
+ * Parse the file, in "buf", into "entries", the way
+ * pcap_next_etherent() does, but a line at a time rather than a
+ * character at a time; returns the number of entries.  Names are
+ * NUL-terminated in place, which can always be done, as there's a
+ * spare byte after the end of the file.
+ */
+static int
+ethers_parse(char *buf, size_t len, struct ethers_entry *entries)
+{
+	u_char *cp = (u_char *)buf, *ep = cp + len, *name;
+	struct ethers_entry *e;
+	size_t namelen;
+	int n = 0, i, d, eol;
+
+	for (; cp < ep; cp++) {
+		e = &entries[n];
+		while (cp < ep && isspace(*cp) && *cp != '\n')
+			cp++;
+		if (cp >= ep || *cp == '\n')
+			continue;
+
+		/*
+		 * If this is a comment, or the first thing on the line
+		 * can't be an Ethernet address, skip the line.
+		 */
+		if (!isxdigit(*cp))
+			goto skip;
+
+		/* must be the start of an address */
+		memset(e->addr, 0, sizeof(e->addr));
+		for (i = 0; i < 6; i++) {
+			d = xdtoi(*cp++);
+			if (cp < ep && isxdigit(*cp)) {
+				d <<= 4;
+				d |= xdtoi(*cp++);
+			}
+			e->addr[i] = d;
+			if (cp >= ep || *cp != ':')
+				break;
+			cp++;
+		}
+
+		/* Must be whitespace */
+		if (cp >= ep || !isspace(*cp))
+			goto skip;
+		while (cp < ep && isspace(*cp) && *cp != '\n')
+			cp++;
+		if (cp >= ep || *cp == '\n')
+			continue;
+		if (*cp == '#')
+			goto skip;
+
+		/* pick up name, cut down to what pcap_etherent holds */
+		name = cp;
+		while (cp < ep && !isspace(*cp))
+			cp++;
+		eol = (cp >= ep || *cp == '\n');
+		namelen = cp - name;
+		if (namelen > ETHERS_NAME_MAX)
+			namelen = ETHERS_NAME_MAX;
+		name[namelen] = '\0';
+		e->name = (const char *)name;
+		n++;
+		if (eol)
+			continue;
+
+	skip:
+		while (cp < ep && *cp != '\n')
+			cp++;
+	}
+	return (n);
+}
+
+/*
+ * Throw away what we have, and read the file, if it's there; called
+ * with the lock held.  If we can't read it, we carry on without it.
+ */
+static void
+ethers_load(void)
+{
+	FILE *fp;
+	struct stat st;
+	char *buf;
+	struct ethers_entry *entries;
+	int *hash;
+	u_int size, bucket, lines;
+	size_t i;
+	int n;
+
+	free(ethers_buf);
+	free(ethers_entries);
+	free(ethers_hash);
+	ethers_buf = NULL;
+	ethers_entries = NULL;
+	ethers_hash = NULL;
+	ethers_hash_size = 0;
+
+	fp = fopen(PCAP_ETHERS_FILE, "r");
+	if (fp == NULL)
+		return;
+	if (fstat(fileno(fp), &st) == -1) {
+		fclose(fp);
+		return;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (buf == NULL ||
+	    fread(buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+		free(buf);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+	buf[st.st_size] = '\0';
+
+	/*
+	 * There's no more than one entry per line.
+	 */
+	for (i = 0, lines = 1; i < (size_t)st.st_size; i++)
+		if (buf[i] == '\n')
+			lines++;
+	entries = calloc(lines, sizeof(*entries));
+	if (entries == NULL) {
+		free(buf);
+		return;
+	}
+	n = ethers_parse(buf, st.st_size, entries);
+
+	for (size = ETHERS_HASH_MIN; size < (u_int)n * 2; size *= 2)
+		;
+	hash = malloc(size * sizeof(*hash));
+	if (hash == NULL) {
+		free(entries);
+		free(buf);
+		return;
+	}
+	memset(hash, 0xff, size * sizeof(*hash));
+
+	/*
+	 * Chain them from the last to the first, so that the first
+	 * entry for a name is the first one in its chain.
+	 */
+	while (--n >= 0) {
+		bucket = ethers_hash_name(entries[n].name) & (size - 1);
+		entries[n].next = hash[bucket];
+		hash[bucket] = n;
+	}
+	ethers_buf = buf;
+	ethers_entries = entries;
+	ethers_hash = hash;
+	ethers_hash_size = size;
+}
+
+/*
+ * Look "name" up in the ethers file, putting its address in "addr";
+ * returns 1 if it's there, and 0 if it isn't.  It can be called from
+ * more than one thread at a time.
+ */
+int
+pcap_ether_lookup(const char *name, u_char *addr)
+{
+	struct stat st;
+	int i, found = 0;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&ethers_lock);
+#endif
+	if (stat(PCAP_ETHERS_FILE, &st) == -1) {
+		/*
+		 * It's gone, or was never there.
+		 */
+		if (!ethers_loaded || ethers_hash_size != 0)
+			ethers_load();
+		ethers_size = -1;
+	} else if (!ethers_loaded || st.st_mtime != ethers_mtime ||
+	    ETHERS_MTIME_NSEC(&st) != ethers_mtime_nsec ||
+	    st.st_size != ethers_size || st.st_ino != ethers_ino) {
+		ethers_mtime = st.st_mtime;
+		ethers_mtime_nsec = ETHERS_MTIME_NSEC(&st);
+		ethers_size = st.st_size;
+		ethers_ino = st.st_ino;
+		ethers_load();
+	}
+	ethers_loaded = 1;
+
+	if (ethers_hash_size != 0) {
+		i = ethers_hash[ethers_hash_name(name) &
+		    (ethers_hash_size - 1)];
+		for (; i != -1; i = ethers_entries[i].next) {
+			if (strcmp(name, ethers_entries[i].name) == 0) {
+				memcpy(addr, ethers_entries[i].addr, 6);
+				found = 1;
+				break;
+			}
+		}
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&ethers_lock);
+#endif
+	return (found);
+}
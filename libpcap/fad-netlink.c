@@ -0,0 +1,935 @@
+/* -*- Mode: c; tab-width: 8; indent-tabs-mode: 1; c-basic-offset: 8; -*- */
+/*
+ * fad-netlink.c - get the list of interfaces, and their addresses, on
+ * Linux with two rtnetlink dumps, one of links and one of addresses,
+ * rather than with getifaddrs() plus a scan of /sys/class/net and an
+ * open of each interface to see whether it can be captured on.
+ *
+ * The dumps are cached; a netlink socket subscribed to link and
+ * address changes tells us when they're out of date.  The same
+ * notifications are delivered, as interface add/remove/change events,
+ * by pcap_if_watch_next().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <net/if.h>
+#include <netpacket/packet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "pcap-int.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#define NL_MAXADDR	32	/* longest link-layer address we keep */
+
+#define NL_GROUPS	(RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR)
+
+struct nl_link {
+	int		ifindex;
+	u_int		flags;		/* IFF_ flags */
+	u_short		type;		/* ARPHRD_ type */
+	char		name[IFNAMSIZ];
+	u_char		addr[NL_MAXADDR];
+	u_char		brd[NL_MAXADDR];
+	int		addrlen;
+	int		brdlen;
+};
+
+struct nl_addr {
+	int		ifindex;
+	u_char		family;
+	u_char		prefixlen;
+	u_char		local[16];	/* IFA_LOCAL */
+	u_char		address[16];	/* IFA_ADDRESS */
+	u_char		broadcast[16];	/* IFA_BROADCAST */
+	u_char		has_local, has_address, has_broadcast;
+};
+
+struct nl_links {
+	struct nl_link	*links;
+	int		nlinks, maxlinks;
+};
+
+/*
+ * The results of the last pair of dumps.  pcap_findalldevs() may be
+ * called from several threads at once, so it's only used with
+ * nl_cache_lock held; interface watches have tables of their own.
+ */
+static struct {
+	struct nl_links	lt;
+	struct nl_addr	*addrs;
+	int		naddrs, maxaddrs;
+	int		valid;		/* no change seen since the dumps */
+	int		mon_fd;		/* change notifications, or -1 */
+	int		can_open;	/* could we open a packet socket? */
+} nl_cache = { { NULL, 0, 0 }, NULL, 0, 0, 0, -1, 0 };
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t nl_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Open a netlink socket, subscribed to the given multicast groups.
+ */
+int
+pcap_rtnl_open(u_int groups, char *errbuf)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "netlink socket: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "netlink bind: %s",
+		    pcap_strerror(errno));
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * Parse an RTM_NEWLINK or RTM_DELLINK message.
+ */
+static void
+nl_parse_link(struct nlmsghdr *nh, struct nl_link *link)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct rtattr *rta;
+	int len = IFLA_PAYLOAD(nh);
+
+	memset(link, 0, sizeof(*link));
+	link->ifindex = ifi->ifi_index;
+	link->flags = ifi->ifi_flags;
+	link->type = ifi->ifi_type;
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+
+		case IFLA_IFNAME:
+			strncpy(link->name, RTA_DATA(rta),
+			    sizeof(link->name) - 1);
+			break;
+
+		case IFLA_ADDRESS:
+			link->addrlen = RTA_PAYLOAD(rta) < NL_MAXADDR ?
+			    RTA_PAYLOAD(rta) : NL_MAXADDR;
+			memcpy(link->addr, RTA_DATA(rta), link->addrlen);
+			break;
+
+		case IFLA_BROADCAST:
+			link->brdlen = RTA_PAYLOAD(rta) < NL_MAXADDR ?
+			    RTA_PAYLOAD(rta) : NL_MAXADDR;
+			memcpy(link->brd, RTA_DATA(rta), link->brdlen);
+			break;
+		}
+	}
+}
+
+/*
+ * Add a link from an RTM_GETLINK dump to a table.
+ */
+static int
+nl_add_link(struct nlmsghdr *nh, void *arg)
+{
+	struct nl_links *lt = arg;
+	struct nl_link *newlinks;
+
+	if (lt->nlinks == lt->maxlinks) {
+		newlinks = realloc(lt->links,
+		    (lt->maxlinks * 2 + 64) * sizeof(*newlinks));
+		if (newlinks == NULL)
+			return (-1);
+		lt->links = newlinks;
+		lt->maxlinks = lt->maxlinks * 2 + 64;
+	}
+	nl_parse_link(nh, &lt->links[lt->nlinks++]);
+	return (0);
+}
+
+/*
+ * Add an address from an RTM_GETADDR dump to the cache.
+ */
+static int
+nl_add_addr(struct nlmsghdr *nh, void *arg _U_)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	struct rtattr *rta;
+	int len = IFA_PAYLOAD(nh);
+	struct nl_addr *a, *newaddrs;
+	size_t alen;
+
+	if (ifa->ifa_family == AF_INET)
+		alen = 4;
+	else if (ifa->ifa_family == AF_INET6)
+		alen = 16;
+	else
+		return (0);
+
+	if (nl_cache.naddrs == nl_cache.maxaddrs) {
+		newaddrs = realloc(nl_cache.addrs,
+		    (nl_cache.maxaddrs * 2 + 64) * sizeof(*newaddrs));
+		if (newaddrs == NULL)
+			return (-1);
+		nl_cache.addrs = newaddrs;
+		nl_cache.maxaddrs = nl_cache.maxaddrs * 2 + 64;
+	}
+	a = &nl_cache.addrs[nl_cache.naddrs++];
+	memset(a, 0, sizeof(*a));
+	a->ifindex = ifa->ifa_index;
+	a->family = ifa->ifa_family;
+	a->prefixlen = ifa->ifa_prefixlen;
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (RTA_PAYLOAD(rta) < alen)
+			continue;
+		switch (rta->rta_type) {
+
+		case IFA_LOCAL:
+			memcpy(a->local, RTA_DATA(rta), alen);
+			a->has_local = 1;
+			break;
+
+		case IFA_ADDRESS:
+			memcpy(a->address, RTA_DATA(rta), alen);
+			a->has_address = 1;
+			break;
+
+		case IFA_BROADCAST:
+			memcpy(a->broadcast, RTA_DATA(rta), alen);
+			a->has_broadcast = 1;
+			break;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Ask for a dump of the given type, and hand each message in it, and
+ * "arg", to "handler", which returns -1, with errno set, if it fails.
+ * "buf" must be PCAP_RTNL_BUFSIZE bytes long.
+ */
+int
+pcap_rtnl_dump(int fd, int type, int (*handler)(struct nlmsghdr *, void *),
+    void *arg, char *buf, char *errbuf)
+{
+	struct {
+		struct nlmsghdr	nh;
+		struct rtgenmsg	g;
+	} req;
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nh;
+	struct nlmsgerr *err;
+	ssize_t len;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+	req.nh.nlmsg_type = type;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = type;
+	req.g.rtgen_family = AF_UNSPEC;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa,
+	    sizeof(sa)) == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "netlink send: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+
+	for (;;) {
+		len = recv(fd, buf, PCAP_RTNL_BUFSIZE, 0);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "netlink recv: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		if (len == 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "netlink dump: connection closed");
+			return (-1);
+		}
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len);
+		    nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != (u_int)type)
+				continue;
+			if (nh->nlmsg_type == NLMSG_DONE)
+				return (0);
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				err = NLMSG_DATA(nh);
+				snprintf(errbuf, PCAP_ERRBUF_SIZE,
+				    "netlink dump: %s",
+				    pcap_strerror(-err->error));
+				return (-1);
+			}
+			if (handler(nh, arg) == -1) {
+				snprintf(errbuf, PCAP_ERRBUF_SIZE,
+				    "netlink dump: %s", pcap_strerror(errno));
+				return (-1);
+			}
+		}
+	}
+}
+
+/*
+ * Has anything changed since the cache was filled?  Reads, and
+ * discards, any pending notifications.
+ */
+static int
+nl_cache_changed(void)
+{
+	char buf[8192];
+	ssize_t len;
+	int changed = 0;
+
+	for (;;) {
+		len = recv(nl_cache.mon_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len > 0) {
+			changed = 1;
+			continue;
+		}
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len == -1 && errno == EAGAIN)
+			return (changed);
+		/*
+		 * ENOBUFS means we missed some; anything else, and
+		 * we can't rely on being told.
+		 */
+		if (len == -1 && errno != ENOBUFS) {
+			close(nl_cache.mon_fd);
+			nl_cache.mon_fd = -1;
+		}
+		return (1);
+	}
+}
+
+static int
+nl_cache_fill(char *errbuf)
+{
+	char *buf;
+	int fd, ret;
+
+	if (nl_cache.valid && nl_cache.mon_fd != -1 && !nl_cache_changed())
+		return (0);
+
+	/*
+	 * Listen for changes before dumping, so none are missed;
+	 * if we can't, just don't keep the cache.
+	 */
+	nl_cache.valid = 0;
+	if (nl_cache.mon_fd == -1)
+		nl_cache.mon_fd = pcap_rtnl_open(NL_GROUPS, errbuf);
+	else
+		(void)nl_cache_changed();
+
+	/*
+	 * Any interface that's up can be opened if a packet socket
+	 * can be, and none can be otherwise; rather than opening each
+	 * of them, as add_or_find_if() does, find out once.  Closing
+	 * a packet socket waits for the network stack to quiesce, so
+	 * that's not cheap either; remember the answer along with the
+	 * rest.
+	 */
+	fd = socket(PF_PACKET, SOCK_RAW, 0);
+	nl_cache.can_open = (fd != -1);
+	if (fd != -1)
+		close(fd);
+
+	fd = pcap_rtnl_open(0, errbuf);
+	if (fd == -1)
+		return (-1);
+	buf = malloc(PCAP_RTNL_BUFSIZE);
+	if (buf == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		close(fd);
+		return (-1);
+	}
+	nl_cache.lt.nlinks = nl_cache.naddrs = 0;
+	ret = pcap_rtnl_dump(fd, RTM_GETLINK, nl_add_link, &nl_cache.lt, buf,
+	    errbuf);
+	if (ret == 0)
+		ret = pcap_rtnl_dump(fd, RTM_GETADDR, nl_add_addr, NULL, buf,
+		    errbuf);
+	free(buf);
+	close(fd);
+	if (ret == 0 && nl_cache.mon_fd != -1)
+		nl_cache.valid = 1;
+	return (ret);
+}
+
+/*
+ * The same as get_instance() in inet.c, for putting the list in the
+ * order add_or_find_if() would.
+ */
+static int
+nl_instance(const char *name)
+{
+	const char *cp;
+
+	for (cp = name; *cp != '\0' && !isdigit((unsigned char)*cp); cp++)
+		continue;
+	return (isdigit((unsigned char)*cp) ? atoi(cp) : 0);
+}
+
+struct nl_dev {
+	pcap_if_t	*dev;
+	pcap_addr_t	**tail;	/* where the next address goes */
+	int		ifindex;
+	int		instance;
+	int		order;	/* position in the dump */
+};
+
+static int
+nl_dev_compare(const void *a, const void *b)
+{
+	const struct nl_dev *da = a, *db = b;
+	int la = (da->dev->flags & PCAP_IF_LOOPBACK) != 0;
+	int lb = (db->dev->flags & PCAP_IF_LOOPBACK) != 0;
+
+	if (la != lb)
+		return (la - lb);
+	if (da->instance != db->instance)
+		return (da->instance < db->instance ? -1 : 1);
+	return (da->order - db->order);
+}
+
+static int
+nl_dev_ifindex_compare(const void *a, const void *b)
+{
+	const struct nl_dev *da = a, *db = b;
+
+	return (da->ifindex < db->ifindex ? -1 : da->ifindex > db->ifindex);
+}
+
+/*
+ * Add an address to an interface's list.
+ */
+static int
+nl_append_addr(struct nl_dev *nd, struct sockaddr *addr,
+    struct sockaddr *netmask, struct sockaddr *broadaddr,
+    struct sockaddr *dstaddr, size_t size, char *errbuf)
+{
+	pcap_addr_t *a;
+
+	a = calloc(1, sizeof(*a));
+	if (a == NULL)
+		goto nomem;
+	*nd->tail = a;
+	nd->tail = &a->next;
+	if ((a->addr = dup_sockaddr(addr, size)) == NULL ||
+	    (netmask != NULL &&
+	     (a->netmask = dup_sockaddr(netmask, size)) == NULL) ||
+	    (broadaddr != NULL &&
+	     (a->broadaddr = dup_sockaddr(broadaddr, size)) == NULL) ||
+	    (dstaddr != NULL &&
+	     (a->dstaddr = dup_sockaddr(dstaddr, size)) == NULL))
+		goto nomem;
+	return (0);
+
+nomem:
+	snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s", pcap_strerror(errno));
+	return (-1);
+}
+
+/*
+ * Fill in a sockaddr for an IPv4 or IPv6 address.
+ */
+static void
+nl_sockaddr(struct sockaddr_storage *ss, int family, const u_char *bytes,
+    int ifindex)
+{
+	struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+
+	memset(ss, 0, sizeof(*ss));
+	if (family == AF_INET) {
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, bytes, 4);
+	} else {
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, bytes, 16);
+		if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr) ||
+		    IN6_IS_ADDR_MC_LINKLOCAL(&sin6->sin6_addr))
+			sin6->sin6_scope_id = ifindex;
+	}
+}
+
+static void
+nl_netmask(struct sockaddr_storage *ss, int family, int prefixlen)
+{
+	u_char bytes[16];
+	int i;
+
+	memset(bytes, 0, sizeof(bytes));
+	for (i = 0; i < prefixlen && i < 128; i++)
+		bytes[i / 8] |= 0x80 >> (i % 8);
+	nl_sockaddr(ss, family, bytes, 0);
+}
+
+/*
+ * Add the link-layer address, as getifaddrs() would, as a sockaddr_ll.
+ */
+static int
+nl_add_link_addr(struct nl_dev *nd, struct nl_link *link, char *errbuf)
+{
+	struct {
+		struct sockaddr_ll sll;
+		u_char		more[NL_MAXADDR];
+	} addr, brd;
+	size_t size = offsetof(struct sockaddr_ll, sll_addr) + NL_MAXADDR;
+
+	if (size < sizeof(struct sockaddr_ll))
+		size = sizeof(struct sockaddr_ll);
+	memset(&addr, 0, sizeof(addr));
+	addr.sll.sll_family = AF_PACKET;
+	addr.sll.sll_ifindex = link->ifindex;
+	addr.sll.sll_hatype = link->type;
+	addr.sll.sll_halen = link->addrlen;
+	memcpy(addr.sll.sll_addr, link->addr, link->addrlen);
+	brd = addr;
+	brd.sll.sll_halen = link->brdlen;
+	memset(brd.sll.sll_addr, 0, NL_MAXADDR);
+	memcpy(brd.sll.sll_addr, link->brd, link->brdlen);
+	return (nl_append_addr(nd, (struct sockaddr *)&addr, NULL,
+	    (link->flags & IFF_BROADCAST) && link->brdlen != 0 ?
+	    (struct sockaddr *)&brd : NULL,
+	    (link->flags & IFF_POINTOPOINT) && link->brdlen != 0 ?
+	    (struct sockaddr *)&brd : NULL, size, errbuf));
+}
+
+/*
+ * The work of pcap_findalldevs_interfaces(), with nl_cache_lock held.
+ */
+static int
+nl_findalldevs(pcap_if_t **alldevsp, char *errbuf)
+{
+	struct nl_dev *devs, key, *nd;
+	struct nl_link *link;
+	struct nl_addr *a;
+	struct sockaddr_storage addr, netmask, other;
+	pcap_if_t *devlist = NULL, **next;
+	size_t size;
+	int i, n, ret = 0;
+
+	*alldevsp = NULL;
+
+	if (nl_cache_fill(errbuf) == -1)
+		return (-1);
+	if (!nl_cache.can_open)
+		return (0);
+
+	devs = calloc(nl_cache.lt.nlinks + 1, sizeof(*devs));
+	if (devs == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	for (i = n = 0; i < nl_cache.lt.nlinks; i++) {
+		link = &nl_cache.lt.links[i];
+		if (!(link->flags & IFF_UP) || link->name[0] == '\0')
+			continue;
+		nd = &devs[n];
+		nd->dev = calloc(1, sizeof(pcap_if_t));
+		if (nd->dev == NULL ||
+		    (nd->dev->name = strdup(link->name)) == NULL) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			free(nd->dev);
+			ret = -1;
+			break;
+		}
+		if (link->flags & IFF_LOOPBACK)
+			nd->dev->flags |= PCAP_IF_LOOPBACK;
+		nd->tail = &nd->dev->addresses;
+		nd->ifindex = link->ifindex;
+		nd->instance = nl_instance(link->name);
+		nd->order = n++;
+		if (nl_add_link_addr(nd, link, errbuf) == -1) {
+			ret = -1;
+			break;
+		}
+	}
+
+	/*
+	 * Now the IP addresses, looked up by interface index.
+	 */
+	if (ret == 0) {
+		qsort(devs, n, sizeof(*devs), nl_dev_ifindex_compare);
+		for (i = 0; i < nl_cache.naddrs; i++) {
+			a = &nl_cache.addrs[i];
+			key.ifindex = a->ifindex;
+			nd = bsearch(&key, devs, n, sizeof(*devs),
+			    nl_dev_ifindex_compare);
+			if (nd == NULL || (!a->has_local && !a->has_address))
+				continue;
+			size = a->family == AF_INET ?
+			    sizeof(struct sockaddr_in) :
+			    sizeof(struct sockaddr_in6);
+			nl_sockaddr(&addr, a->family,
+			    a->has_local ? a->local : a->address, a->ifindex);
+			nl_netmask(&netmask, a->family, a->prefixlen);
+			if (a->has_local && a->has_address &&
+			    memcmp(a->local, a->address, 16) != 0) {
+				/* point-to-point; IFA_ADDRESS is the peer */
+				nl_sockaddr(&other, a->family, a->address,
+				    a->ifindex);
+				ret = nl_append_addr(nd, (struct sockaddr *)&addr,
+				    (struct sockaddr *)&netmask, NULL,
+				    (struct sockaddr *)&other, size, errbuf);
+			} else if (a->has_broadcast) {
+				nl_sockaddr(&other, a->family, a->broadcast,
+				    a->ifindex);
+				ret = nl_append_addr(nd, (struct sockaddr *)&addr,
+				    (struct sockaddr *)&netmask,
+				    (struct sockaddr *)&other, NULL, size,
+				    errbuf);
+			} else
+				ret = nl_append_addr(nd, (struct sockaddr *)&addr,
+				    (struct sockaddr *)&netmask, NULL, NULL,
+				    size, errbuf);
+			if (ret == -1)
+				break;
+		}
+	}
+
+	/*
+	 * Put them in the order add_or_find_if() would have: by
+	 * instance number, with loopback interfaces last.
+	 */
+	qsort(devs, n, sizeof(*devs), nl_dev_compare);
+	next = &devlist;
+	for (i = 0; i < n; i++) {
+		*next = devs[i].dev;
+		next = &devs[i].dev->next;
+	}
+	free(devs);
+
+	if (ret == -1) {
+		if (devlist != NULL)
+			pcap_freealldevs(devlist);
+		return (-1);
+	}
+	*alldevsp = devlist;
+	return (0);
+}
+
+/*
+ * Get a list of all interfaces that are up and that we can open.
+ * Returns -1 on error, 0 otherwise.
+ * The list, as returned through "alldevsp", may be null if no interfaces
+ * were up and could be opened.
+ */
+int
+pcap_findalldevs_interfaces(pcap_if_t **alldevsp, char *errbuf)
+{
+	int ret;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&nl_cache_lock);
+#endif
+	ret = nl_findalldevs(alldevsp, errbuf);
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&nl_cache_lock);
+#endif
+	return (ret);
+}
+
+/*
+ * Interface change notifications.
+ */
+struct watch_event {
+	int		type;
+	bpf_u_int32	flags;
+	char		name[IFNAMSIZ];
+};
+
+struct pcap_if_watch {
+	int		fd;
+	char		*buf;
+	ssize_t		len;		/* bytes of messages left in buf */
+	struct nlmsghdr	*next;		/* next message to look at */
+	struct nl_link	*links;		/* the links we know of */
+	int		nlinks, maxlinks;
+	struct nl_links	now;		/* the links there are, when resyncing */
+	struct watch_event *events;	/* events not yet handed out */
+	int		nevents, maxevents, nextevent;
+	char		name[IFNAMSIZ];	/* of the last event handed out */
+};
+
+static int
+watch_queue(pcap_if_watch_t *w, int type, const struct nl_link *link)
+{
+	struct watch_event *newevents, *ev;
+
+	if (w->nevents == w->maxevents) {
+		newevents = realloc(w->events,
+		    (w->maxevents * 2 + 8) * sizeof(*newevents));
+		if (newevents == NULL)
+			return (-1);
+		w->events = newevents;
+		w->maxevents = w->maxevents * 2 + 8;
+	}
+	ev = &w->events[w->nevents++];
+	ev->type = type;
+	ev->flags = (link->flags & IFF_LOOPBACK) ? PCAP_IF_LOOPBACK : 0;
+	memcpy(ev->name, link->name, sizeof(ev->name));
+	return (0);
+}
+
+static struct nl_link *
+watch_find(struct nl_link *links, int nlinks, int ifindex)
+{
+	int i;
+
+	for (i = 0; i < nlinks; i++) {
+		if (links[i].ifindex == ifindex)
+			return (&links[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * A link appeared, changed, or went away ("link" is NULL); queue
+ * whatever events that means for the interfaces pcap_findalldevs()
+ * would report, i.e. the ones that are up.  A rename is reported as
+ * the old name going away and the new one appearing.
+ */
+static int
+watch_link(pcap_if_watch_t *w, int ifindex, const struct nl_link *link)
+{
+	struct nl_link *old, *newlinks;
+	int was_up, is_up;
+
+	old = watch_find(w->links, w->nlinks, ifindex);
+	was_up = old != NULL && (old->flags & IFF_UP);
+	is_up = link != NULL && (link->flags & IFF_UP);
+
+	if (was_up && (!is_up || strcmp(old->name, link->name) != 0)) {
+		if (watch_queue(w, PCAP_IF_EVENT_REMOVED, old) == -1)
+			return (-1);
+		was_up = 0;
+	}
+	if (link == NULL) {
+		if (old != NULL)
+			*old = w->links[--w->nlinks];
+		return (0);
+	}
+	if (old == NULL) {
+		if (w->nlinks == w->maxlinks) {
+			newlinks = realloc(w->links,
+			    (w->maxlinks * 2 + 64) * sizeof(*newlinks));
+			if (newlinks == NULL)
+				return (-1);
+			w->links = newlinks;
+			w->maxlinks = w->maxlinks * 2 + 64;
+		}
+		old = &w->links[w->nlinks++];
+	}
+	*old = *link;
+	if (is_up && !was_up)
+		return (watch_queue(w, PCAP_IF_EVENT_ADDED, link));
+	return (0);
+}
+
+/*
+ * Find out what links there are now, when starting up or after we've
+ * missed notifications.  Links we knew of that aren't there any more
+ * are gone and, if "report_changes" is set, the addresses of any that
+ * are up may have changed.  The dump goes into the watch's own table,
+ * so that watches don't disturb the interface list cache, or each
+ * other.
+ */
+static int
+watch_resync(pcap_if_watch_t *w, int report_changes, char *errbuf)
+{
+	struct nl_link *link;
+	int i, fd, ret;
+
+	fd = pcap_rtnl_open(0, errbuf);
+	if (fd == -1)
+		return (-1);
+	w->now.nlinks = 0;
+	ret = pcap_rtnl_dump(fd, RTM_GETLINK, nl_add_link, &w->now, w->buf,
+	    errbuf);
+	close(fd);
+	if (ret == -1)
+		return (-1);
+
+	for (i = 0; i < w->nlinks; ) {
+		if (watch_find(w->now.links, w->now.nlinks,
+		    w->links[i].ifindex) == NULL) {
+			if (watch_link(w, w->links[i].ifindex, NULL) == -1)
+				goto nomem;
+		} else
+			i++;
+	}
+	for (i = 0; i < w->now.nlinks; i++) {
+		link = &w->now.links[i];
+		if (report_changes && (link->flags & IFF_UP) &&
+		    watch_find(w->links, w->nlinks, link->ifindex) != NULL &&
+		    watch_queue(w, PCAP_IF_EVENT_CHANGED, link) == -1)
+			goto nomem;
+		if (watch_link(w, link->ifindex, link) == -1)
+			goto nomem;
+	}
+	return (0);
+
+nomem:
+	snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s", pcap_strerror(errno));
+	return (-1);
+}
+
+pcap_if_watch_t *
+pcap_if_watch_open(char *errbuf)
+{
+	pcap_if_watch_t *w;
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL || (w->buf = malloc(PCAP_RTNL_BUFSIZE)) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(w);
+		return (NULL);
+	}
+	w->fd = pcap_rtnl_open(NL_GROUPS, errbuf);
+	if (w->fd == -1 || watch_resync(w, 0, errbuf) == -1) {
+		pcap_if_watch_close(w);
+		return (NULL);
+	}
+	/* the interfaces that are already there aren't news */
+	w->nevents = 0;
+	return (w);
+}
+
+int
+pcap_if_watch_get_selectable_fd(pcap_if_watch_t *w)
+{
+	return (w->fd);
+}
+
+/*
+ * Get the next event.  Returns 1 if there was one, 0 if there are
+ * none pending, and -1 on an error.
+ */
+int
+pcap_if_watch_next(pcap_if_watch_t *w, struct pcap_if_event *ev,
+    char *errbuf)
+{
+	struct watch_event *wev;
+	struct nlmsghdr *nh;
+	struct ifaddrmsg *ifa;
+	struct nl_link link, *l;
+	int ret;
+
+	for (;;) {
+		if (w->nextevent < w->nevents) {
+			wev = &w->events[w->nextevent++];
+			if (w->nextevent == w->nevents)
+				w->nextevent = w->nevents = 0;
+			memcpy(w->name, wev->name, sizeof(w->name));
+			ev->ev_type = wev->type;
+			ev->ev_name = w->name;
+			ev->ev_flags = wev->flags;
+			return (1);
+		}
+
+		if (w->next == NULL || !NLMSG_OK(w->next, w->len)) {
+			w->next = NULL;
+			w->len = recv(w->fd, w->buf, PCAP_RTNL_BUFSIZE, MSG_DONTWAIT);
+			if (w->len == -1) {
+				if (errno == EAGAIN)
+					return (0);
+				if (errno == EINTR)
+					continue;
+				if (errno == ENOBUFS) {
+					/*
+					 * We fell behind, and the kernel
+					 * dropped some; see where things
+					 * stand now.
+					 */
+					if (watch_resync(w, 1, errbuf) == -1)
+						return (-1);
+					continue;
+				}
+				snprintf(errbuf, PCAP_ERRBUF_SIZE,
+				    "netlink recv: %s", pcap_strerror(errno));
+				return (-1);
+			}
+			w->next = (struct nlmsghdr *)w->buf;
+			continue;
+		}
+
+		nh = w->next;
+		w->next = NLMSG_NEXT(w->next, w->len);
+		ret = 0;
+		switch (nh->nlmsg_type) {
+
+		case RTM_NEWLINK:
+			nl_parse_link(nh, &link);
+			ret = watch_link(w, link.ifindex, &link);
+			break;
+
+		case RTM_DELLINK:
+			nl_parse_link(nh, &link);
+			ret = watch_link(w, link.ifindex, NULL);
+			break;
+
+		case RTM_NEWADDR:
+		case RTM_DELADDR:
+			ifa = NLMSG_DATA(nh);
+			l = watch_find(w->links, w->nlinks, ifa->ifa_index);
+			if (l != NULL && (l->flags & IFF_UP))
+				ret = watch_queue(w, PCAP_IF_EVENT_CHANGED, l);
+			break;
+		}
+		if (ret == -1) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+	}
+}
+
+void
+pcap_if_watch_close(pcap_if_watch_t *w)
+{
+	if (w->fd != -1)
+		close(w->fd);
+	free(w->buf);
+	free(w->links);
+	free(w->now.links);
+	free(w->events);
+	free(w);
+}
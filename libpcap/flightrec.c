@@ -0,0 +1,573 @@
+/*
+ * flightrec.c - keep the last stretch of a capture in memory, and
+ * write it to a file only when asked to.
+ *
+ * Packets are copied into one buffer, allocated up front, as records
+ * laid end to end; when a record won't fit before the end of the
+ * buffer, the rest is marked unused and it goes at the beginning.
+ * Before a record is written, the oldest records are thrown away until
+ * there's room for it, and, after it's written, until none are older
+ * than the time limit.  So the buffer always holds a run of the most
+ * recent packets, oldest at "tail", and nothing's allocated per packet.
+ *
+ * A dump walks the records from "tail" to "head" and hands them to the
+ * savefile writers.  pcap_flightrec_dump() does it all at once.  After
+ * pcap_flightrec_trigger(), which can be called from a signal handler,
+ * the next packet recorded just notes which records are in the window,
+ * by their sequence numbers, and the writing is left to
+ * pcap_flightrec_poll(), a few packets at a time, so capture doesn't
+ * wait on the file.  Capture carries on meanwhile, and, if it throws
+ * away records the dump hasn't got to yet, they're counted as lost.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_SYS_BITYPES_H
+#include <sys/bitypes.h>
+#endif
+#include <sys/types.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pcap-int.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#define FR_WRAP		0xFFFFFFFFU	/* rest of the buffer is unused */
+#define FR_ALIGN(x)	(((x) + 7) & ~7U)
+
+struct fr_record {
+	u_int32_t	rec_len;	/* whole record, padded; or FR_WRAP */
+	u_int32_t	caplen;
+	u_int32_t	len;
+	int32_t		if_index;	/* per-interface mode only */
+	int64_t		ts_sec;
+	int32_t		ts_frac;	/* microseconds or nanoseconds */
+	int32_t		if_dlt;
+	int32_t		if_direction;
+	u_int32_t	seq;		/* sequence number */
+};
+
+/* states of a dump */
+#define FR_DUMP_NONE	0
+#define FR_DUMP_PENDING	1	/* window noted, file not yet opened */
+#define FR_DUMP_RUNNING	2
+
+struct pcap_flightrec {
+	pcap_t		*p;
+	u_char		*buf;
+	u_int		size;
+	u_int		head;		/* where the next record goes */
+	u_int		tail;		/* oldest record */
+	u_int		count;		/* records held */
+	u_int		seconds;	/* time limit, or 0 for none */
+	int		nanos;		/* time stamps are in nanoseconds */
+	u_int		too_big;	/* packets too big to keep */
+	u_int32_t	next_seq;	/* sequence number of the next record */
+	volatile sig_atomic_t triggered;
+	char		*trigger_name;	/* strftime() pattern for the file */
+	int		trigger_flags;
+
+	/*
+	 * The dump in progress, if any: the records from "dump_next"
+	 * up to, but not including, "dump_end", the next of which is
+	 * at "dump_pos", unless it's been thrown away.
+	 */
+	int		dump_state;	/* FR_DUMP_ */
+	int		dump_flags;
+	time_t		dump_time;	/* when it was triggered */
+	pcap_t		*dump_dead;	/* handle for a pcapng file */
+	pcap_dumper_t	*dump;
+	u_int		dump_pos;
+	u_int32_t	dump_next, dump_end;
+	int		dump_written;
+	u_int		lost;		/* thrown away before being dumped */
+	char		errbuf[PCAP_ERRBUF_SIZE];
+};
+
+pcap_flightrec_t *
+pcap_flightrec_create(pcap_t *p, u_int bytes, u_int seconds, char *errbuf)
+{
+	struct pcap_flightrec *fr;
+
+	if (!p->activated) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_flightrec_create");
+		return (NULL);
+	}
+	if (bytes < 2 * FR_ALIGN(sizeof(struct fr_record) + p->snapshot)) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "flight recorder of %u bytes can't hold two packets of the snapshot length",
+		    bytes);
+		return (NULL);
+	}
+	fr = calloc(1, sizeof(*fr));
+	if (fr == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	fr->size = bytes & ~7U;
+	fr->buf = malloc(fr->size);
+	if (fr->buf == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(fr);
+		return (NULL);
+	}
+	/*
+	 * Touch it all now, rather than taking page faults while
+	 * capturing.
+	 */
+	memset(fr->buf, 0, fr->size);
+	fr->p = p;
+	fr->seconds = seconds;
+	fr->nanos = (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO);
+	return (fr);
+}
+
+/*
+ * Find the oldest record.
+ */
+static struct fr_record *
+fr_oldest(struct pcap_flightrec *fr)
+{
+	struct fr_record *rec;
+
+	rec = (struct fr_record *)(fr->buf + fr->tail);
+	if (rec->rec_len == FR_WRAP)
+		rec = (struct fr_record *)fr->buf;
+	return (rec);
+}
+
+/*
+ * Throw away the oldest record.
+ */
+static void
+fr_drop_oldest(struct pcap_flightrec *fr)
+{
+	struct fr_record *rec;
+
+	rec = fr_oldest(fr);
+	fr->tail = ((u_char *)rec - fr->buf) + rec->rec_len;
+	if (fr->tail == fr->size)
+		fr->tail = 0;
+	fr->count--;
+	if (fr->count == 0)
+		fr->head = fr->tail = 0;
+}
+
+/*
+ * Is the packet "rec" more than the time limit older than the time
+ * stamp "sec"/"frac"?
+ */
+static int
+fr_too_old(struct pcap_flightrec *fr, const struct fr_record *rec,
+    int64_t sec, int32_t frac)
+{
+	if (sec - rec->ts_sec != (int64_t)fr->seconds)
+		return (sec - rec->ts_sec > (int64_t)fr->seconds);
+	return (frac > rec->ts_frac);
+}
+
+/*
+ * Note which records a dump is to write: the ones held now.
+ */
+static void
+fr_note_window(struct pcap_flightrec *fr, int state)
+{
+	struct fr_record *rec;
+
+	fr->triggered = 0;
+	if (fr->count != 0) {
+		rec = fr_oldest(fr);
+		fr->dump_pos = (u_char *)rec - fr->buf;
+		fr->dump_next = rec->seq;
+	} else {
+		fr->dump_pos = fr->head;
+		fr->dump_next = fr->next_seq;
+	}
+	fr->dump_end = fr->next_seq;
+	fr->dump_written = 0;
+	fr->dump_state = state;
+	if (state == FR_DUMP_PENDING) {
+		fr->dump_flags = fr->trigger_flags;
+		fr->dump_time = time(NULL);
+	}
+}
+
+void
+pcap_flightrec_record(u_char *user, const struct pcap_pkthdr *h,
+    const u_char *sp)
+{
+	struct pcap_flightrec *fr = (struct pcap_flightrec *)user;
+	struct fr_record *rec;
+	u_int32_t caplen, rec_len;
+	u_int off;
+
+	if (fr->triggered && fr->dump_state == FR_DUMP_NONE)
+		fr_note_window(fr, FR_DUMP_PENDING);
+
+	caplen = h->caplen;
+	rec_len = FR_ALIGN(sizeof(*rec) + caplen);
+	if (rec_len > fr->size / 2) {
+		fr->too_big++;
+		return;
+	}
+
+	/*
+	 * Find room for it, making some if we have to.  With records
+	 * held, head == tail means the buffer's full up.
+	 */
+	for (;;) {
+		off = fr->head;
+		if (off + rec_len > fr->size)
+			off = 0;	/* it'll have to go at the beginning */
+		if (fr->count == 0)
+			break;
+		if (fr->head > fr->tail) {
+			/*
+			 * Free space is after head, and before tail.
+			 */
+			if (off == fr->head || rec_len <= fr->tail)
+				break;
+		} else {
+			/*
+			 * Free space is between head and tail.
+			 */
+			if (fr->head != fr->tail && off == fr->head &&
+			    fr->head + rec_len <= fr->tail)
+				break;
+		}
+		fr_drop_oldest(fr);
+	}
+	if (off != fr->head) {
+		/*
+		 * Offsets and sizes are all multiples of 8, so there's
+		 * always room for the marker.
+		 */
+		rec = (struct fr_record *)(fr->buf + fr->head);
+		rec->rec_len = FR_WRAP;
+	}
+
+	rec = (struct fr_record *)(fr->buf + off);
+	rec->rec_len = rec_len;
+	rec->caplen = caplen;
+	rec->len = h->len;
+	rec->ts_sec = h->ts.tv_sec;
+	rec->ts_frac = h->ts.tv_usec;
+	if (fr->p->per_interface) {
+		const struct pcap_pkthdr_if *ih =
+		    (const struct pcap_pkthdr_if *)h;
+
+		rec->if_index = ih->if_index;
+		rec->if_dlt = ih->if_dlt;
+		rec->if_direction = ih->if_direction;
+	} else {
+		rec->if_index = 0;
+		rec->if_dlt = fr->p->linktype;
+		rec->if_direction = PCAP_D_INOUT;
+	}
+	rec->seq = fr->next_seq++;
+	memcpy(rec + 1, sp, caplen);
+	fr->head = off + rec_len;
+	if (fr->head == fr->size)
+		fr->head = 0;
+	fr->count++;
+
+	if (fr->seconds != 0) {
+		while (fr->count > 1 &&
+		    fr_too_old(fr, fr_oldest(fr), rec->ts_sec, rec->ts_frac))
+			fr_drop_oldest(fr);
+	}
+}
+
+/*
+ * Open the file for a dump.
+ */
+static int
+fr_dump_open(struct pcap_flightrec *fr, const char *fname, int flags)
+{
+	pcap_t *p = fr->p;
+
+	if (flags & PCAP_FLIGHTREC_PCAPNG) {
+		/*
+		 * Use a handle of our own, so as not to disturb the
+		 * interface IDs of any pcapng file being written from
+		 * the capture handle.
+		 */
+		fr->dump_dead = pcap_open_dead_with_tstamp_precision(
+		    p->linktype, p->snapshot, p->opt.tstamp_precision);
+		if (fr->dump_dead == NULL) {
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		fr->dump_dead->per_interface = p->per_interface;
+		fr->dump = pcap_ng_dump_if_open(fr->dump_dead, fname);
+		if (fr->dump == NULL) {
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE, "%s",
+			    pcap_geterr(fr->dump_dead));
+			pcap_close(fr->dump_dead);
+			fr->dump_dead = NULL;
+			return (-1);
+		}
+	} else {
+		if (p->linktype == DLT_PCAPNG) {
+			/*
+			 * The packets have link-layer types of their
+			 * own, which a pcap file can't say.
+			 */
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: packets with link-layer types of their own can only be dumped to a pcapng file",
+			    fname);
+			return (-1);
+		}
+		fr->dump = pcap_dump_open(p, fname);
+		if (fr->dump == NULL) {
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE, "%s",
+			    pcap_geterr(p));
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Finish a dump, returning the number of packets written, or -1 if
+ * "status" is -1 or the file couldn't be flushed.
+ */
+static int
+fr_dump_close(struct pcap_flightrec *fr, int status)
+{
+	if (fr->dump != NULL) {
+		if (status != -1 && pcap_dump_flush(fr->dump) == -1) {
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE, "flush: %s",
+			    pcap_strerror(errno));
+			status = -1;
+		}
+		pcap_dump_close(fr->dump);
+		fr->dump = NULL;
+	}
+	if (fr->dump_dead != NULL) {
+		pcap_close(fr->dump_dead);
+		fr->dump_dead = NULL;
+	}
+	fr->dump_state = FR_DUMP_NONE;
+	return (status == -1 ? -1 : fr->dump_written);
+}
+
+/*
+ * Write up to "max" more packets of the dump, or the rest if "max" is
+ * 0 or less.  Records that capture has thrown away since the dump was
+ * started are skipped, and counted as lost.
+ */
+static int
+fr_dump_some(struct pcap_flightrec *fr, int max)
+{
+	struct fr_record *rec;
+	struct pcap_pkthdr_if ih;
+	int n;
+
+	memset(&ih, 0, sizeof(ih));
+	for (n = 0; fr->dump_next != fr->dump_end && (max <= 0 || n < max);
+	    n++) {
+		if (fr->count == 0 ||
+		    (int32_t)(fr->dump_next - fr_oldest(fr)->seq) < 0) {
+			/*
+			 * Capture got there first; carry on from the
+			 * oldest record left, if it's in the window.
+			 */
+			if (fr->count == 0 ||
+			    (int32_t)(fr_oldest(fr)->seq - fr->dump_end) >= 0) {
+				fr->lost += fr->dump_end - fr->dump_next;
+				fr->dump_next = fr->dump_end;
+				break;
+			}
+			rec = fr_oldest(fr);
+			fr->lost += rec->seq - fr->dump_next;
+			fr->dump_next = rec->seq;
+			fr->dump_pos = (u_char *)rec - fr->buf;
+		}
+		if (fr->dump_pos == fr->size)
+			fr->dump_pos = 0;
+		rec = (struct fr_record *)(fr->buf + fr->dump_pos);
+		if (rec->rec_len == FR_WRAP) {
+			fr->dump_pos = 0;
+			rec = (struct fr_record *)fr->buf;
+		}
+		ih.vhdr.hdr.ts.tv_sec = rec->ts_sec;
+		ih.vhdr.hdr.ts.tv_usec = rec->ts_frac;
+		ih.vhdr.hdr.caplen = rec->caplen;
+		ih.vhdr.hdr.len = rec->len;
+		ih.if_index = rec->if_index;
+		ih.if_dlt = rec->if_dlt;
+		ih.if_direction = rec->if_direction;
+		if (fr->dump_dead != NULL) {
+			if (pcap_ng_dump_if(fr->dump_dead, fr->dump,
+			    &ih.vhdr.hdr, (u_char *)(rec + 1)) == -1) {
+				snprintf(fr->errbuf, PCAP_ERRBUF_SIZE, "%s",
+				    pcap_geterr(fr->dump_dead));
+				return (-1);
+			}
+		} else
+			pcap_dump((u_char *)fr->dump, &ih.vhdr.hdr,
+			    (u_char *)(rec + 1));
+		fr->dump_written++;
+		fr->dump_pos += rec->rec_len;
+		fr->dump_next++;
+	}
+	return (0);
+}
+
+int
+pcap_flightrec_dump(pcap_flightrec_t *fr, const char *fname, int flags)
+{
+	int status;
+
+	/*
+	 * Finish any dumps that have been triggered first.
+	 */
+	while ((status = pcap_flightrec_poll(fr, 0)) == 1)
+		;
+	if (status == -1)
+		return (-1);
+
+	if (fr_dump_open(fr, fname, flags) == -1)
+		return (-1);
+	fr_note_window(fr, FR_DUMP_RUNNING);
+	return (fr_dump_close(fr, fr_dump_some(fr, 0)));
+}
+
+int
+pcap_flightrec_set_trigger(pcap_flightrec_t *fr, const char *pattern,
+    int flags)
+{
+	char *name;
+
+	name = strdup(pattern);
+	if (name == NULL) {
+		snprintf(fr->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	free(fr->trigger_name);
+	fr->trigger_name = name;
+	fr->trigger_flags = flags;
+	return (0);
+}
+
+/*
+ * Safe to call from a signal handler.
+ */
+void
+pcap_flightrec_trigger(pcap_flightrec_t *fr)
+{
+	fr->triggered = 1;
+}
+
+int
+pcap_flightrec_poll(pcap_flightrec_t *fr, int max_packets)
+{
+	char fname[1024];
+	struct tm *tm;
+
+	if (fr->triggered && fr->dump_state == FR_DUMP_NONE)
+		fr_note_window(fr, FR_DUMP_PENDING);
+	if (fr->dump_state == FR_DUMP_NONE)
+		return (0);
+
+	if (fr->dump_state == FR_DUMP_PENDING) {
+		if (fr->trigger_name == NULL) {
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE,
+			    "flight recorder triggered with no file to dump to");
+			return (fr_dump_close(fr, -1));
+		}
+		tm = localtime(&fr->dump_time);
+		if (tm == NULL ||
+		    strftime(fname, sizeof(fname), fr->trigger_name, tm) == 0) {
+			snprintf(fr->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't make a file name from \"%s\"",
+			    fr->trigger_name);
+			return (fr_dump_close(fr, -1));
+		}
+		if (fr_dump_open(fr, fname, fr->dump_flags) == -1)
+			return (fr_dump_close(fr, -1));
+		fr->dump_state = FR_DUMP_RUNNING;
+	}
+
+	if (fr_dump_some(fr, max_packets) == -1)
+		return (fr_dump_close(fr, -1));
+	if (fr->dump_next != fr->dump_end)
+		return (1);
+	if (fr_dump_close(fr, 0) == -1)
+		return (-1);
+
+	/*
+	 * If it was triggered again meanwhile, there's another to do.
+	 */
+	return (fr->triggered ? 1 : 0);
+}
+
+int
+pcap_flightrec_service(pcap_flightrec_t *fr)
+{
+	int status;
+
+	if (!fr->triggered && fr->dump_state == FR_DUMP_NONE)
+		return (0);
+	while ((status = pcap_flightrec_poll(fr, 0)) == 1)
+		;
+	if (status == -1)
+		return (-1);
+	return (fr->dump_written);
+}
+
+void
+pcap_flightrec_stats(pcap_flightrec_t *fr, struct pcap_flightrec_stat *fs)
+{
+	struct fr_record *rec;
+
+	fs->fs_packets = fr->count;
+	fs->fs_bytes = 0;
+	fs->fs_too_big = fr->too_big;
+	fs->fs_lost = fr->lost;
+	if (fr->count == 0)
+		return;
+	if (fr->head > fr->tail)
+		fs->fs_bytes = fr->head - fr->tail;
+	else
+		fs->fs_bytes = fr->size - fr->tail + fr->head;
+	rec = fr_oldest(fr);
+	fs->fs_first.tv_sec = rec->ts_sec;
+	fs->fs_first.tv_usec = rec->ts_frac;
+}
+
+char *
+pcap_flightrec_geterr(pcap_flightrec_t *fr)
+{
+	return (fr->errbuf);
+}
+
+void
+pcap_flightrec_destroy(pcap_flightrec_t *fr)
+{
+	(void)fr_dump_close(fr, -1);
+	free(fr->trigger_name);
+	free(fr->buf);
+	free(fr);
+}
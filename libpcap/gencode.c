@@ -139,6 +139,7 @@ static u_int	orig_linktype = (u_int)-1, orig_nl = (u_int)-1, label_stack_depth =
 #else
 static u_int	orig_linktype = -1U, orig_nl = -1U, label_stack_depth = -1U;
 #endif
+static u_int	vlan_stack_depth;
 
 /* XXX */
 static int	pcap_fddipad;
@@ -211,7 +212,6 @@ static int cur_chunk;
 
 static void *newchunk(u_int);
 static void freechunks(void);
-static inline struct block *new_block(int);
 static inline struct slist *new_stmt(int);
 static struct block *gen_retblk(int);
 static inline void syntax(void);
@@ -354,7 +354,11 @@ sdup(s)
 	return (cp);
 }
 
-static inline struct block *
+/*
+ * Allocate a block; also used by the optimizer when it restructures
+ * the flow graph.
+ */
+struct block *
 new_block(code)
 	int code;
 {
@@ -962,6 +966,7 @@ init_linktype(p)
 	orig_linktype = -1;
 	orig_nl = -1;
         label_stack_depth = 0;
+	vlan_stack_depth = 0;
 
 	reg_off_ll = -1;
 	reg_off_macpl = -1;
@@ -1460,6 +1465,20 @@ init_linktype(p)
 		off_nl_nosnap = 3;	/* 802.3+802.2 */
 		return;
 
+	case DLT_PCAPNG:
+		/*
+		 * Each packet has a link-layer type of its own, so
+		 * there's no header we know the layout of; as with
+		 * the DLT_USERn types, only raw "link[N:M]" filtering
+		 * works, and anything that looks at a protocol fails
+		 * in gen_linktype().
+		 */
+		off_linktype = -1;
+		off_macpl = -1;
+		off_nl = -1;
+		off_nl_nosnap = -1;
+		return;
+
 	default:
 		/*
 		 * For values in the range in which we've assigned new
@@ -1479,6 +1498,44 @@ init_linktype(p)
 	/* NOTREACHED */
 }
 
+/*
+ * Get the offset, from the beginning of the packet data, of the
+ * network-layer header in packets of the pcap_t's link-layer type,
+ * for code outside the compiler that wants to look at that header.
+ * If the link-layer header has an Ethernet type field, its offset
+ * is put in "*off_ethertypep"; otherwise -1 is, and the caller will
+ * have to tell the network-layer protocol from the header itself.
+ *
+ * Returns -1 if the network-layer header isn't at a fixed offset.
+ *
+ * Like pcap_compile(), this uses the compiler's global state, so it
+ * mustn't be called while another thread is compiling a filter.
+ */
+int
+pcap_nl_offset(pcap_t *p, int *off_ethertypep)
+{
+	*off_ethertypep = -1;
+	bpf_pcap = p;
+	if (setjmp(top_ctx))
+		return (-1);	/* unknown link-layer type */
+	init_linktype(p);
+
+	if (off_macpl == (u_int)-1 || off_nl == (u_int)-1 ||
+	    off_macpl_is_variable)
+		return (-1);
+
+	switch (linktype) {
+
+	case DLT_EN10MB:
+	case DLT_NETANALYZER:
+	case DLT_NETANALYZER_TRANSPARENT:
+	case DLT_LINUX_SLL:
+		*off_ethertypep = off_ll + off_linktype;
+		break;
+	}
+	return (off_ll + off_macpl + off_nl);
+}
+
 /*
  * Load a value relative to the beginning of the link-layer header.
  * The link-layer header doesn't necessarily begin at the beginning
@@ -3410,6 +3467,9 @@ gen_linktype(proto)
 
 	case DLT_AX25_KISS:
 		bpf_error("AX.25 link-layer type filtering not implemented");
+
+	case DLT_PCAPNG:
+		bpf_error("each packet has a link-layer type of its own; use a per-interface filter");
 	}
 
 	/*
@@ -7905,6 +7965,30 @@ gen_vlan(vlan_num)
 	case DLT_EN10MB:
 	case DLT_NETANALYZER:
 	case DLT_NETANALYZER_TRANSPARENT:
+#if defined(linux) && defined(PF_PACKET) && defined(SO_ATTACH_FILTER) && \
+    defined(SKF_AD_VLAN_TAG_PRESENT)
+		/*
+		 * If the outermost tag has been taken off the packet and
+		 * is supplied as metadata, check that, rather than the
+		 * packet data, for the first "vlan"; the offsets stay as
+		 * they are, as the tag isn't in the packet.  Any tags
+		 * after that are still in the packet.
+		 */
+		if (vlan_stack_depth == 0 &&
+		    (bpf_pcap->bpf_codegen_flags & BPF_SPECIAL_VLAN_HANDLING)) {
+			b0 = gen_cmp(OR_PACKET,
+			    SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT, BPF_B, 1);
+			if (vlan_num >= 0) {
+				b1 = gen_mcmp(OR_PACKET,
+				    SKF_AD_OFF + SKF_AD_VLAN_TAG, BPF_H,
+				    (bpf_int32)vlan_num, 0x0fff);
+				gen_and(b0, b1);
+				b0 = b1;
+			}
+			vlan_stack_depth++;
+			break;
+		}
+#endif
 		/* check for VLAN, including QinQ */
 		b0 = gen_cmp(OR_LINK, off_linktype, BPF_H,
 		    (bpf_int32)ETHERTYPE_8021Q);
@@ -7927,6 +8011,7 @@ gen_vlan(vlan_num)
 		off_nl_nosnap += 4;
 		off_nl += 4;
 #endif
+		vlan_stack_depth++;
 		break;
 
 	default:
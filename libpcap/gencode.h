@@ -344,6 +344,7 @@ void bpf_error(const char *, ...)
 
 void finish_parse(struct block *);
 char *sdup(const char *);
+struct block *new_block(int);
 
 struct bpf_insn *icode_to_fcode(struct block *, u_int *);
 int pcap_parse(void);
@@ -0,0 +1,483 @@
+/*
+ * group.c - wait on a group of pcap_t's at once, and hand the packets
+ * from the ones that are ready to their callbacks.
+ *
+ * Live handles are put in non-blocking mode and waited on with one
+ * epoll instance where we have it, and poll() where we don't; savefiles
+ * are always ready, until they run out.  Each round dispatches at most
+ * a budget of packets from each ready handle, starting with a different
+ * handle each time; a handle that used its whole budget is taken to
+ * have more to read, so the next wait doesn't block.  A savefile read
+ * from buffers handed to us with pcap_offline_buffer_append(), or one
+ * being followed as it's written, that's read all there is so far
+ * isn't done, just waiting; it's tried again each round, but doesn't
+ * stop the wait from blocking.  Followed savefiles are put in
+ * non-blocking mode, so that they don't wait for more themselves.
+ *
+ * The wait is level-triggered.  For a TPACKET_V3 ring, that means a
+ * handle is reported ready as long as there's a block we haven't
+ * handed back to the kernel, and the kernel's block timeout, set with
+ * pcap_set_timeout(), bounds how long packets in a partly-filled block
+ * wait to be seen.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "pcap-int.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+struct group_member {
+	pcap_t		*p;
+	pcap_handler	callback;
+	u_char		*user;
+	int		fd;		/* -1 for a savefile */
+	int		was_nonblock;	/* to restore when it leaves */
+	int		set_nonblock;	/* we put it in non-blocking mode */
+	int		ready;		/* has, or may have, packets to read */
+	int		done;		/* savefile that's run out */
+	int		waiting;	/* buffer savefile that's run dry, for now */
+	int		removed;	/* removed during a round */
+};
+
+struct pcap_group {
+	struct group_member **members;
+	int		count;
+	int		max;
+	int		budget;
+	int		next;		/* member to start the next round with */
+	int		in_round;
+	volatile int	break_loop;
+#ifdef HAVE_SYS_EPOLL_H
+	int		epfd;
+	struct epoll_event *events;
+#else
+	struct pollfd	*pfds;
+#endif
+	char		errbuf[PCAP_ERRBUF_SIZE];
+};
+
+pcap_group_t *
+pcap_group_create(char *errbuf)
+{
+	struct pcap_group *g;
+
+	g = calloc(1, sizeof(*g));
+	if (g == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	g->budget = PCAP_GROUP_BUDGET;
+#ifdef HAVE_SYS_EPOLL_H
+	g->epfd = epoll_create(64);
+	if (g->epfd == -1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "epoll_create: %s",
+		    pcap_strerror(errno));
+		free(g);
+		return (NULL);
+	}
+#endif
+	return (g);
+}
+
+static struct group_member *
+group_find(struct pcap_group *g, pcap_t *p)
+{
+	int i;
+
+	for (i = 0; i < g->count; i++) {
+		if (g->members[i]->p == p && !g->members[i]->removed)
+			return (g->members[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * Take a member out of the wait set and put its pcap_t back the way
+ * we found it.
+ */
+static void
+group_release(struct pcap_group *g, struct group_member *m)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (m->fd != -1)
+		epoll_ctl(g->epfd, EPOLL_CTL_DEL, m->fd, NULL);
+#endif
+	if (m->set_nonblock && !m->was_nonblock)
+		pcap_setnonblock(m->p, 0, errbuf);
+	m->removed = 1;
+}
+
+int
+pcap_group_add(pcap_group_t *g, pcap_t *p, pcap_handler callback,
+    u_char *user)
+{
+	struct group_member *m, **newmembers;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event *newevents, ev;
+#else
+	struct pollfd *newpfds;
+#endif
+	int newmax;
+
+	if (!p->activated) {
+		snprintf(g->errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_group_add");
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	}
+	if (group_find(g, p) != NULL) {
+		snprintf(g->errbuf, PCAP_ERRBUF_SIZE,
+		    "pcap_t is already in the group");
+		return (PCAP_ERROR);
+	}
+
+	if (g->count == g->max) {
+		newmax = g->max == 0 ? 16 : g->max * 2;
+		newmembers = realloc(g->members,
+		    newmax * sizeof(*newmembers));
+		if (newmembers == NULL)
+			goto nomem;
+		g->members = newmembers;
+#ifdef HAVE_SYS_EPOLL_H
+		newevents = realloc(g->events, newmax * sizeof(*newevents));
+		if (newevents == NULL)
+			goto nomem;
+		g->events = newevents;
+#else
+		newpfds = realloc(g->pfds, newmax * sizeof(*newpfds));
+		if (newpfds == NULL)
+			goto nomem;
+		g->pfds = newpfds;
+#endif
+		g->max = newmax;
+	}
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		goto nomem;
+	m->p = p;
+	m->callback = callback;
+	m->user = user;
+	m->fd = -1;
+
+	if (p->rfile != NULL) {
+		/*
+		 * A savefile; there's always something to read until
+		 * we get to the end.  If we're following it, we mustn't
+		 * wait for it to grow.
+		 */
+		if (sf_following(p)) {
+			m->was_nonblock = pcap_getnonblock(p, g->errbuf);
+			if (m->was_nonblock == -1 ||
+			    pcap_setnonblock(p, 1, g->errbuf) == -1) {
+				free(m);
+				return (PCAP_ERROR);
+			}
+			m->set_nonblock = 1;
+		}
+		m->ready = 1;
+	} else {
+		m->fd = pcap_get_selectable_fd(p);
+		if (m->fd == -1) {
+			snprintf(g->errbuf, PCAP_ERRBUF_SIZE,
+			    "pcap_t can't be waited on with select() or poll()");
+			free(m);
+			return (PCAP_ERROR);
+		}
+		m->was_nonblock = pcap_getnonblock(p, g->errbuf);
+		if (m->was_nonblock == -1 ||
+		    pcap_setnonblock(p, 1, g->errbuf) == -1) {
+			free(m);
+			return (PCAP_ERROR);
+		}
+		m->set_nonblock = 1;
+#ifdef HAVE_SYS_EPOLL_H
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = m;
+		if (epoll_ctl(g->epfd, EPOLL_CTL_ADD, m->fd, &ev) == -1) {
+			snprintf(g->errbuf, PCAP_ERRBUF_SIZE,
+			    "epoll_ctl: %s", pcap_strerror(errno));
+			group_release(g, m);
+			free(m);
+			return (PCAP_ERROR);
+		}
+#endif
+		/*
+		 * There may be packets buffered already, which wouldn't
+		 * make the descriptor readable.
+		 */
+		m->ready = 1;
+	}
+	g->members[g->count++] = m;
+	return (0);
+
+nomem:
+	snprintf(g->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+	    pcap_strerror(errno));
+	return (PCAP_ERROR);
+}
+
+/*
+ * Free the members that have been removed, and close up the gaps.
+ */
+static void
+group_compact(struct pcap_group *g)
+{
+	int i, j;
+
+	for (i = j = 0; i < g->count; i++) {
+		if (g->members[i]->removed)
+			free(g->members[i]);
+		else
+			g->members[j++] = g->members[i];
+	}
+	g->count = j;
+	if (g->next >= g->count)
+		g->next = 0;
+}
+
+int
+pcap_group_remove(pcap_group_t *g, pcap_t *p)
+{
+	struct group_member *m;
+
+	m = group_find(g, p);
+	if (m == NULL) {
+		snprintf(g->errbuf, PCAP_ERRBUF_SIZE,
+		    "pcap_t isn't in the group");
+		return (PCAP_ERROR);
+	}
+	group_release(g, m);
+	/*
+	 * If we're in the middle of a round - i.e., this was called
+	 * from a callback - the round will clean up after itself.
+	 */
+	if (!g->in_round)
+		group_compact(g);
+	return (0);
+}
+
+int
+pcap_group_set_budget(pcap_group_t *g, int budget)
+{
+	if (budget <= 0)
+		budget = PCAP_GROUP_BUDGET;
+	g->budget = budget;
+	return (0);
+}
+
+/*
+ * Wait, for at most "timeout" milliseconds, or indefinitely if it's
+ * negative, and mark the members that are ready.
+ */
+static int
+group_wait(struct pcap_group *g, int timeout)
+{
+	struct group_member *m;
+	int i, n, live;
+
+	/*
+	 * If there's anything we already know there's more to read
+	 * from, just look for anything else that's ready; and, if
+	 * there's nothing live to wait on, don't wait.
+	 */
+	live = 0;
+	for (i = 0; i < g->count; i++) {
+		m = g->members[i];
+		if (m->ready && !m->done && !m->waiting)
+			timeout = 0;
+		if (m->fd != -1 && !m->removed)
+			live++;
+	}
+	if (live == 0)
+		timeout = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	n = epoll_wait(g->epfd, g->events, g->max, timeout);
+	if (n == -1) {
+		if (errno == EINTR)
+			return (0);
+		snprintf(g->errbuf, PCAP_ERRBUF_SIZE, "epoll_wait: %s",
+		    pcap_strerror(errno));
+		return (PCAP_ERROR);
+	}
+	for (i = 0; i < n; i++) {
+		m = g->events[i].data.ptr;
+		m->ready = 1;
+	}
+#else
+	for (i = 0; i < g->count; i++) {
+		g->pfds[i].fd = g->members[i]->fd;
+		g->pfds[i].events = POLLIN;
+		g->pfds[i].revents = 0;
+	}
+	n = poll(g->pfds, g->count, timeout);
+	if (n == -1) {
+		if (errno == EINTR)
+			return (0);
+		snprintf(g->errbuf, PCAP_ERRBUF_SIZE, "poll: %s",
+		    pcap_strerror(errno));
+		return (PCAP_ERROR);
+	}
+	for (i = 0; i < g->count; i++) {
+		if (g->pfds[i].revents != 0)
+			g->members[i]->ready = 1;
+	}
+#endif
+	return (0);
+}
+
+int
+pcap_group_dispatch(pcap_group_t *g, int timeout)
+{
+	struct group_member *m;
+	int i, start, count, n, total = 0, ret = 0;
+
+	if (g->break_loop) {
+		g->break_loop = 0;
+		return (PCAP_ERROR_BREAK);
+	}
+	if (g->count == 0)
+		return (0);
+	if (group_wait(g, timeout) == -1)
+		return (PCAP_ERROR);
+
+	g->in_round = 1;
+	start = g->next;
+	count = g->count;
+	for (i = 0; i < count; i++) {
+		m = g->members[(start + i) % count];
+		if (!m->ready || m->done || m->removed)
+			continue;
+		n = pcap_dispatch(m->p, g->budget, m->callback, m->user);
+		if (n == PCAP_ERROR_BREAK) {
+			ret = PCAP_ERROR_BREAK;
+			break;
+		}
+		if (n < 0) {
+			snprintf(g->errbuf, PCAP_ERRBUF_SIZE, "%s",
+			    pcap_geterr(m->p));
+			ret = PCAP_ERROR;
+			break;
+		}
+		total += n;
+		if (m->fd == -1) {
+			/*
+			 * A savefile returns 0 only at the end, or, if
+			 * it's being read from buffers and the last one
+			 * hasn't been appended, or it's being followed,
+			 * when it's read all there is so far.
+			 */
+			m->waiting = 0;
+			if (n == 0) {
+				if ((m->p->sf_mem != NULL &&
+				    !m->p->sf_mem->done) ||
+				    sf_following(m->p))
+					m->waiting = 1;
+				else
+					m->done = 1;
+			}
+		} else
+			m->ready = (n >= g->budget);
+		if (g->break_loop) {
+			g->break_loop = 0;
+			ret = PCAP_ERROR_BREAK;
+			break;
+		}
+	}
+	g->in_round = 0;
+	g->next = (start + 1) % count;
+	group_compact(g);
+	return (ret != 0 ? ret : total);
+}
+
+/*
+ * Dispatch rounds until "cnt" packets have been handled, if it's
+ * positive, or there's nothing left to read from, for now.
+ */
+int
+pcap_group_loop(pcap_group_t *g, int cnt)
+{
+	int i, n, live;
+
+	/*
+	 * More may have been appended to the buffer savefiles since
+	 * we last looked.
+	 */
+	for (i = 0; i < g->count; i++)
+		g->members[i]->waiting = 0;
+	for (;;) {
+		live = 0;
+		for (i = 0; i < g->count; i++) {
+			if (!g->members[i]->done && !g->members[i]->waiting)
+				live++;
+		}
+		if (live == 0)
+			return (0);
+		n = pcap_group_dispatch(g, -1);
+		if (n < 0)
+			return (n);
+		if (cnt > 0) {
+			cnt -= n;
+			if (cnt <= 0)
+				return (0);
+		}
+	}
+}
+
+void
+pcap_group_breakloop(pcap_group_t *g)
+{
+	g->break_loop = 1;
+}
+
+char *
+pcap_group_geterr(pcap_group_t *g)
+{
+	return (g->errbuf);
+}
+
+/*
+ * Put the members back in the modes they were in; this must be called
+ * before they're closed.
+ */
+void
+pcap_group_destroy(pcap_group_t *g)
+{
+	int i;
+
+	for (i = 0; i < g->count; i++) {
+		group_release(g, g->members[i]);
+		free(g->members[i]);
+	}
+	free(g->members);
+#ifdef HAVE_SYS_EPOLL_H
+	close(g->epfd);
+	free(g->events);
+#else
+	free(g->pfds);
+#endif
+	free(g);
+}
@@ -660,6 +660,40 @@ pcap_freealldevs(pcap_if_t *alldevs)
 	}
 }
 
+#ifndef HAVE_NETLINK_FINDALLDEVS
+/*
+ * Interface change notifications are supported only where the
+ * interface list comes from rtnetlink; see fad-netlink.c.
+ */
+pcap_if_watch_t *
+pcap_if_watch_open(char *errbuf)
+{
+	(void)snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "Interface change notifications aren't supported on this platform");
+	return (NULL);
+}
+
+int
+pcap_if_watch_get_selectable_fd(pcap_if_watch_t *w _U_)
+{
+	return (-1);
+}
+
+int
+pcap_if_watch_next(pcap_if_watch_t *w _U_, struct pcap_if_event *ev _U_,
+    char *errbuf)
+{
+	(void)snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "Interface change notifications aren't supported on this platform");
+	return (-1);
+}
+
+void
+pcap_if_watch_close(pcap_if_watch_t *w _U_)
+{
+}
+#endif /* HAVE_NETLINK_FINDALLDEVS */
+
 #if !defined(WIN32) && !defined(MSDOS)
 
 /*
@@ -437,32 +437,16 @@ pcap_ether_aton(const char *s)
 u_char *
 pcap_ether_hostton(const char *name)
 {
-	register struct pcap_etherent *ep;
 	register u_char *ap;
-	static FILE *fp = NULL;
-	static int init = 0;
-
-	if (!init) {
-		fp = fopen(PCAP_ETHERS_FILE, "r");
-		++init;
-		if (fp == NULL)
-			return (NULL);
-	} else if (fp == NULL)
-		return (NULL);
-	else
-		rewind(fp);
-
-	while ((ep = pcap_next_etherent(fp)) != NULL) {
-		if (strcmp(ep->name, name) == 0) {
-			ap = (u_char *)malloc(6);
-			if (ap != NULL) {
-				memcpy(ap, ep->addr, 6);
-				return (ap);
-			}
-			break;
-		}
+	u_char a[6];
+
+	ap = NULL;
+	if (pcap_ether_lookup(name, a)) {
+		ap = (u_char *)malloc(6);
+		if (ap != NULL)
+			memcpy((char *)ap, (char *)a, 6);
 	}
-	return (NULL);
+	return (ap);
 }
 #else
 
@@ -475,7 +459,12 @@ struct ether_addr {
 extern int ether_hostton(const char *, struct ether_addr *);
 #endif
 
-/* Use the os supplied routines */
+/*
+ * Use the os supplied routines, for names that aren't in our own
+ * index of the ethers file; those typically go through the file a
+ * line at a time for every name, and we want to be able to compile
+ * filters that use a lot of names quickly.
+ */
 u_char *
 pcap_ether_hostton(const char *name)
 {
@@ -483,7 +472,8 @@ pcap_ether_hostton(const char *name)
 	u_char a[6];
 
 	ap = NULL;
-	if (ether_hostton(name, (struct ether_addr *)a) == 0) {
+	if (pcap_ether_lookup(name, a) ||
+	    ether_hostton(name, (struct ether_addr *)a) == 0) {
 		ap = (u_char *)malloc(6);
 		if (ap != NULL)
 			memcpy((char *)ap, (char *)a, 6);
@@ -1370,13 +1370,28 @@ opt_j(struct edge *ep)
 }
 
 
+/*
+ * True iff 'b' is reached by exactly one edge.  The pull-ups below
+ * only rearrange chains that can't be entered part-way down.  The
+ * dominator sets can't be trusted for that once opt_j() or an earlier
+ * pull-up has moved edges in this pass, but the in-edges, which are
+ * recomputed after opt_j() and kept up to date by the pull-ups, can.
+ * (Blocks that opt_j() has made unreachable still contribute in-edges,
+ * which only makes this more conservative.)
+ */
+static int
+single_entry(struct block *b)
+{
+	return b->in_edges != 0 && b->in_edges->next == 0;
+}
+
 static void
 or_pullup(struct block *b)
 {
 	int val, at_top;
-	struct block *pull;
+	struct block *pull, *next, *rest;
 	struct block **diffp, **samep;
-	struct edge *ep;
+	struct edge *ep, *diffe = 0, *samee, **epp;
 
 	ep = b->in_edges;
 	if (ep == 0)
@@ -1404,15 +1419,17 @@ or_pullup(struct block *b)
 		if (JT(*diffp) != JT(b))
 			return;
 
-		if (!SET_MEMBER((*diffp)->dom, b->id))
+		if (*diffp != b && !single_entry(*diffp))
 			return;
 
 		if ((*diffp)->val[A_ATOM] != val)
 			break;
 
+		diffe = &(*diffp)->ef;
 		diffp = &JF(*diffp);
 		at_top = 0;
 	}
+	samee = &(*diffp)->ef;
 	samep = &JF(*diffp);
 	while (1) {
 		if (*samep == 0)
@@ -1421,7 +1438,7 @@ or_pullup(struct block *b)
 		if (JT(*samep) != JT(b))
 			return;
 
-		if (!SET_MEMBER((*samep)->dom, b->id))
+		if (!single_entry(*samep))
 			return;
 
 		if ((*samep)->val[A_ATOM] == val)
@@ -1430,6 +1447,7 @@ or_pullup(struct block *b)
 		/* XXX Need to check that there are no data dependencies
 		   between dp0 and dp1.  Currently, the code generator
 		   will not produce such dependencies. */
+		samee = &(*samep)->ef;
 		samep = &JF(*samep);
 	}
 #ifdef notdef
@@ -1440,8 +1458,10 @@ or_pullup(struct block *b)
 #endif
 	/* Pull up the node. */
 	pull = *samep;
-	*samep = JF(pull);
-	JF(pull) = *diffp;
+	rest = JF(pull);
+	next = *diffp;
+	*samep = rest;
+	JF(pull) = next;
 
 	/*
 	 * At the top of the chain, each predecessor needs to point at the
@@ -1459,6 +1479,23 @@ or_pullup(struct block *b)
 	else
 		*diffp = pull;
 
+	/*
+	 * Bring the in-edges of the blocks we've moved up to date, for
+	 * the pull-ups still to come in this pass.
+	 */
+	for (epp = &rest->in_edges; *epp != &pull->ef; epp = &(*epp)->next)
+		;
+	samee->next = (*epp)->next;
+	*epp = samee;
+	if (at_top)
+		pull->in_edges = b->in_edges;
+	else {
+		pull->in_edges = diffe;
+		diffe->next = 0;
+	}
+	next->in_edges = &pull->ef;
+	pull->ef.next = 0;
+
 	done = 0;
 }
 
@@ -1466,9 +1503,9 @@ static void
 and_pullup(struct block *b)
 {
 	int val, at_top;
-	struct block *pull;
+	struct block *pull, *next, *rest;
 	struct block **diffp, **samep;
-	struct edge *ep;
+	struct edge *ep, *diffe = 0, *samee, **epp;
 
 	ep = b->in_edges;
 	if (ep == 0)
@@ -1495,15 +1532,17 @@ and_pullup(struct block *b)
 		if (JF(*diffp) != JF(b))
 			return;
 
-		if (!SET_MEMBER((*diffp)->dom, b->id))
+		if (*diffp != b && !single_entry(*diffp))
 			return;
 
 		if ((*diffp)->val[A_ATOM] != val)
 			break;
 
+		diffe = &(*diffp)->et;
 		diffp = &JT(*diffp);
 		at_top = 0;
 	}
+	samee = &(*diffp)->et;
 	samep = &JT(*diffp);
 	while (1) {
 		if (*samep == 0)
@@ -1512,7 +1551,7 @@ and_pullup(struct block *b)
 		if (JF(*samep) != JF(b))
 			return;
 
-		if (!SET_MEMBER((*samep)->dom, b->id))
+		if (!single_entry(*samep))
 			return;
 
 		if ((*samep)->val[A_ATOM] == val)
@@ -1521,6 +1560,7 @@ and_pullup(struct block *b)
 		/* XXX Need to check that there are no data dependencies
 		   between diffp and samep.  Currently, the code generator
 		   will not produce such dependencies. */
+		samee = &(*samep)->et;
 		samep = &JT(*samep);
 	}
 #ifdef notdef
@@ -1531,8 +1571,10 @@ and_pullup(struct block *b)
 #endif
 	/* Pull up the node. */
 	pull = *samep;
-	*samep = JT(pull);
-	JT(pull) = *diffp;
+	rest = JT(pull);
+	next = *diffp;
+	*samep = rest;
+	JT(pull) = next;
 
 	/*
 	 * At the top of the chain, each predecessor needs to point at the
@@ -1550,6 +1592,23 @@ and_pullup(struct block *b)
 	else
 		*diffp = pull;
 
+	/*
+	 * Bring the in-edges of the blocks we've moved up to date, for
+	 * the pull-ups still to come in this pass.
+	 */
+	for (epp = &rest->in_edges; *epp != &pull->et; epp = &(*epp)->next)
+		;
+	samee->next = (*epp)->next;
+	*epp = samee;
+	if (at_top)
+		pull->in_edges = b->in_edges;
+	else {
+		pull->in_edges = diffe;
+		diffe->next = 0;
+	}
+	next->in_edges = &pull->et;
+	pull->et.next = 0;
+
 	done = 0;
 }
 
@@ -1669,6 +1728,429 @@ opt_loop(struct block *root, int do_stmts)
 	} while (!done);
 }
 
+/*
+ * Turn long "or" chains of equality tests into binary searches.
+ *
+ * Expressions such as "host a or host b or ..." or "port x or port y
+ * or ..." end up, after the passes above, as a chain of blocks that
+ * each compare some quantity against a constant, all branching to
+ * the same block on success and falling through to the next block
+ * on failure.  Evaluating such a chain costs one comparison per
+ * value; for lists with thousands of entries that dominates the
+ * cost of running the filter.
+ *
+ * We group the tests in a chain by the quantity they compare (two
+ * blocks compare the same quantity if they load it with the same
+ * statements, ignoring a trailing "and" with a netmask, as generated
+ * for "net" expressions), convert the constants of each group into
+ * sorted, disjoint ranges, and emit a balanced tree of "jgt" tests
+ * with short runs of "jeq"/"jge" tests at the leaves.  Like
+ * or_pullup(), this may reorder the tests in the chain; that's safe
+ * because we only consider blocks whose statements define nothing
+ * but the accumulator.
+ */
+
+/*
+ * Minimum number of constants a quantity has to be compared against
+ * before we bother building a search tree for it.
+ */
+#define BSEARCH_MIN	8
+
+/*
+ * Maximum number of ranges tested linearly at a leaf of the tree.
+ */
+#define BSEARCH_LEAF	3
+
+struct bsearch_range {
+	bpf_u_int32 lo;
+	bpf_u_int32 hi;
+};
+
+struct bsearch_member {
+	struct block *b;
+	int group;
+	bpf_u_int32 mask;	/* netmask stripped from the load, or 0 */
+	struct slist *and;	/* the "and" statement we'd strip */
+};
+
+struct bsearch_group {
+	struct slist *load;	/* first statement of the load, or NULL */
+	struct slist *end;	/* statement following the load */
+	int first;		/* first member in this group */
+	int count;		/* number of members in this group */
+};
+
+/*
+ * True iff the statements from 'x' up to 'xend' are the same as the
+ * statements from 'y' up to 'yend'.
+ */
+static int
+eq_load(struct slist *x, struct slist *xend, struct slist *y,
+    struct slist *yend)
+{
+	while (1) {
+		while (x != xend && x->s.code == NOP)
+			x = x->next;
+		while (y != yend && y->s.code == NOP)
+			y = y->next;
+		if (x == xend || y == yend)
+			return x == xend && y == yend;
+		if (x->s.code != y->s.code || x->s.k != y->s.k)
+			return 0;
+		x = x->next;
+		y = y->next;
+	}
+}
+
+/*
+ * True iff 'm' is a netmask, i.e. some number of one bits followed
+ * by zero bits.
+ */
+static int
+is_netmask(bpf_u_int32 m)
+{
+	return m != 0 && ((~m + 1) & ~m) == 0;
+}
+
+/*
+ * Find the statements of 'b' that compute the value the branch
+ * tests.  If the block belongs in an "or" chain, return 1 and set
+ * '*loadp' to the first statement of the load (or NULL if the block
+ * tests the value left in the accumulator by its predecessor, possibly
+ * after masking it), and '*andp' to a trailing "and" with a netmask,
+ * if any.  Return 0 if the block can't be part of a chain.
+ *
+ * The head of a chain is allowed to define other registers before
+ * loading the accumulator, as it stays at the head of the chain.
+ */
+static int
+chain_load(struct block *b, int is_head, struct slist **loadp,
+    struct slist **andp)
+{
+	struct slist *s, *load, *last;
+	int atom;
+
+	load = 0;
+	last = 0;
+	for (s = b->stmts; s != 0; s = s->next) {
+		atom = atomdef(&s->s);
+		if (atom < 0)
+			continue;
+		if (atom != A_ATOM) {
+			if (!is_head)
+				return 0;
+			load = 0;
+			continue;
+		}
+		if (load == 0)
+			load = s;
+		last = s;
+	}
+	*loadp = load;
+	*andp = 0;
+	if (load == 0)
+		return 1;
+	if (BPF_CLASS(load->s.code) != BPF_LD) {
+		if (is_head)
+			return 1;
+		if (last != load || load->s.code != (BPF_ALU|BPF_AND|BPF_K) ||
+		    !is_netmask((bpf_u_int32)load->s.k))
+			return 0;
+		/* Masks what our predecessor loaded. */
+		*loadp = 0;
+		*andp = load;
+		return 1;
+	}
+	if (last != load && last->s.code == (BPF_ALU|BPF_AND|BPF_K) &&
+	    is_netmask((bpf_u_int32)last->s.k))
+		*andp = last;
+	return 1;
+}
+
+/*
+ * True iff 'b' uses the value in the accumulator when it's entered.
+ */
+static int
+uses_acc(struct block *b)
+{
+	if (JT(b) == 0)
+		return BPF_RVAL(b->s.code) == BPF_A;
+	return ATOMELEM(b->in_use, A_ATOM);
+}
+
+static int
+bsearch_range_cmp(const void *a, const void *b)
+{
+	const struct bsearch_range *ra = a, *rb = b;
+
+	if (ra->lo != rb->lo)
+		return ra->lo < rb->lo ? -1 : 1;
+	return ra->hi < rb->hi ? -1 : (ra->hi > rb->hi);
+}
+
+/*
+ * Make 'b' the root of a tree that branches to 'hit' if the
+ * accumulator falls into one of the 'n' sorted, disjoint ranges in
+ * 'r', and to 'miss' otherwise.
+ */
+static void
+emit_bsearch(struct block *b, struct bsearch_range *r, int n,
+    struct block *hit, struct block *miss)
+{
+	struct block *rest, *upper;
+	int mid;
+
+	if (n > BSEARCH_LEAF) {
+		mid = (n - 1) / 2;
+		b->s.code = BPF_JMP|BPF_JGT|BPF_K;
+		b->s.k = r[mid].hi;
+		JT(b) = new_block(BPF_JMP|BPF_JEQ|BPF_K);
+		JF(b) = new_block(BPF_JMP|BPF_JEQ|BPF_K);
+		emit_bsearch(JT(b), r + mid + 1, n - mid - 1, hit, miss);
+		emit_bsearch(JF(b), r, mid + 1, hit, miss);
+		return;
+	}
+	rest = n > 1 ? new_block(BPF_JMP|BPF_JEQ|BPF_K) : miss;
+	if (r->lo == r->hi) {
+		b->s.code = BPF_JMP|BPF_JEQ|BPF_K;
+		b->s.k = r->lo;
+		JT(b) = hit;
+		JF(b) = rest;
+	} else {
+		/*
+		 * The ranges are sorted, so if we're below this one
+		 * we're below all the remaining ones as well.
+		 */
+		upper = new_block(BPF_JMP|BPF_JGT|BPF_K);
+		upper->s.k = r->hi;
+		JT(upper) = rest;
+		JF(upper) = hit;
+		b->s.code = BPF_JMP|BPF_JGE|BPF_K;
+		b->s.k = r->lo;
+		JT(b) = upper;
+		JF(b) = miss;
+	}
+	if (n > 1)
+		emit_bsearch(rest, r + 1, n - 1, hit, miss);
+}
+
+/*
+ * Convert the members of group 'g' into ranges and emit the search
+ * tree for them, rooted at the group's first member.
+ */
+static void
+bsearch_group(struct bsearch_member *mem, int n_mem, struct bsearch_group *grp,
+    int g, struct block *hit, struct block *miss)
+{
+	struct bsearch_range *r;
+	struct bsearch_member *m;
+	bpf_u_int32 k;
+	int i, n;
+
+	r = (struct bsearch_range *)malloc(grp[g].count * sizeof(*r));
+	if (r == NULL)
+		bpf_error("malloc");
+	n = 0;
+	for (i = grp[g].first; i < n_mem; ++i) {
+		m = &mem[i];
+		if (m->group != g)
+			continue;
+		k = (bpf_u_int32)m->b->s.k;
+		if (m->mask != 0) {
+			/*
+			 * "(A & mask) == k" is "A in [k, k | ~mask]",
+			 * unless k has bits outside the mask, in which
+			 * case the test never succeeds.
+			 */
+			if ((k & ~m->mask) != 0)
+				continue;
+			r[n].lo = k;
+			r[n].hi = k | ~m->mask;
+		} else
+			r[n].lo = r[n].hi = k;
+		++n;
+	}
+	qsort(r, n, sizeof(*r), bsearch_range_cmp);
+
+	/*
+	 * Merge overlapping and adjacent ranges.
+	 */
+	if (n > 0) {
+		int j = 0;
+
+		for (i = 1; i < n; ++i) {
+			if (r[j].hi == 0xffffffff || r[i].lo <= r[j].hi + 1) {
+				if (r[i].hi > r[j].hi)
+					r[j].hi = r[i].hi;
+			} else
+				r[++j] = r[i];
+		}
+		n = j + 1;
+	}
+
+	m = &mem[grp[g].first];
+	if (m->and != 0)
+		m->and->s.code = NOP;
+	if (n == 0) {
+		/*
+		 * None of the constants can match.
+		 */
+		JT(m->b) = JF(m->b) = miss;
+	} else
+		emit_bsearch(m->b, r, n, hit, miss);
+	free((void *)r);
+}
+
+/*
+ * Try to convert the "or" chain starting at 'b'.  Returns true if
+ * the flow graph was changed.
+ */
+static int
+bsearch_chain(struct block *b)
+{
+	struct block *hit, *miss, *p;
+	struct bsearch_member *mem;
+	struct bsearch_group *grp;
+	struct slist *load, *and, *end;
+	int i, g, n_mem, n_grp, worth_it;
+
+	if (b->s.code != (BPF_JMP|BPF_JEQ|BPF_K))
+		return 0;
+	hit = JT(b);
+
+	/*
+	 * Count the members of the chain.
+	 */
+	n_mem = 0;
+	for (p = b; ; p = JF(p)) {
+		if (p->s.code != (BPF_JMP|BPF_JEQ|BPF_K) || JT(p) != hit)
+			break;
+		if (p != b &&
+		    (p->in_edges == 0 || p->in_edges->next != 0))
+			break;
+		if (!chain_load(p, p == b, &load, &and))
+			break;
+		Mark(p);
+		++n_mem;
+	}
+	if (n_mem < BSEARCH_MIN)
+		return 0;
+
+	/*
+	 * Whatever we branch to mustn't care what's in the
+	 * accumulator, as that will no longer depend on which tests
+	 * were made.
+	 */
+	if (uses_acc(hit) || uses_acc(p))
+		return 0;
+
+	mem = (struct bsearch_member *)calloc(n_mem, sizeof(*mem));
+	grp = (struct bsearch_group *)calloc(n_mem, sizeof(*grp));
+	if (mem == NULL || grp == NULL)
+		bpf_error("malloc");
+
+	/*
+	 * Sort the members into groups comparing the same quantity.
+	 */
+	n_grp = 0;
+	worth_it = 0;
+	for (i = 0, p = b; i < n_mem; ++i, p = JF(p)) {
+		mem[i].b = p;
+		(void)chain_load(p, i == 0, &load, &and);
+		if (load == 0 && i > 0) {
+			/* Tests what our predecessor loaded. */
+			mem[i].group = mem[i - 1].group;
+			mem[i].mask = mem[i - 1].mask;
+			if (and != 0) {
+				if (mem[i].mask != 0)
+					mem[i].mask &= (bpf_u_int32)and->s.k;
+				else
+					mem[i].mask = (bpf_u_int32)and->s.k;
+				mem[i].and = and;
+			}
+		} else if (load == 0 || BPF_CLASS(load->s.code) != BPF_LD) {
+			/* Tests something only the head knows about. */
+			mem[i].group = n_grp++;
+			grp[mem[i].group].first = i;
+		} else {
+			end = and;
+			for (g = 0; g < n_grp; ++g) {
+				if (grp[g].load != 0 &&
+				    eq_load(grp[g].load, grp[g].end, load, end))
+					break;
+			}
+			if (g == n_grp) {
+				grp[g].load = load;
+				grp[g].end = end;
+				grp[g].first = i;
+				++n_grp;
+			}
+			mem[i].group = g;
+			if (and != 0) {
+				mem[i].mask = (bpf_u_int32)and->s.k;
+				mem[i].and = and;
+			}
+		}
+		if (++grp[mem[i].group].count >= BSEARCH_MIN)
+			worth_it = 1;
+	}
+	if (!worth_it) {
+		free((void *)grp);
+		free((void *)mem);
+		return 0;
+	}
+
+	/*
+	 * Rebuild the chain one group at a time, starting with the
+	 * last one; each group falls through to the next.  Small
+	 * groups keep their original blocks, in their original order,
+	 * so that blocks testing what their predecessor loaded still
+	 * follow that predecessor.
+	 */
+	miss = JF(mem[n_mem - 1].b);
+	for (g = n_grp - 1; g >= 0; --g) {
+		if (grp[g].count >= BSEARCH_MIN)
+			bsearch_group(mem, n_mem, grp, g, hit, miss);
+		else {
+			p = 0;
+			for (i = n_mem - 1; i >= grp[g].first; --i) {
+				if (mem[i].group != g)
+					continue;
+				JF(mem[i].b) = p != 0 ? p : miss;
+				p = mem[i].b;
+			}
+		}
+		miss = mem[grp[g].first].b;
+	}
+	free((void *)grp);
+	free((void *)mem);
+	return 1;
+}
+
+/*
+ * Look for "or" chains worth converting into binary searches.
+ * Returns true if the flow graph was changed, in which case the
+ * optimizer's data structures have to be rebuilt.
+ */
+static int
+opt_bsearch(struct block *root)
+{
+	struct block *p;
+	int i, changed;
+
+	find_levels(root);
+	find_inedges(root);
+	unMarkAll();
+	changed = 0;
+	for (i = root->level; i > 0; --i) {
+		for (p = levels[i]; p; p = p->link) {
+			if (!isMarked(p) && bsearch_chain(p))
+				changed = 1;
+		}
+	}
+	return changed;
+}
+
 /*
  * Optimize the filter code in its dag representation.
  */
@@ -1682,6 +2164,20 @@ bpf_optimize(struct block **rootp)
 	opt_init(root);
 	opt_loop(root, 0);
 	opt_loop(root, 1);
+	if (opt_bsearch(root)) {
+		/*
+		 * The search trees are made of new blocks, so the
+		 * block array has to be rebuilt.
+		 */
+		opt_cleanup();
+		opt_init(root);
+#ifdef BDEBUG
+		if (dflag > 1) {
+			printf("after opt_bsearch()\n");
+			opt_dump(root);
+		}
+#endif
+	}
 	intern_blocks(root);
 #ifdef BDEBUG
 	if (dflag > 1) {
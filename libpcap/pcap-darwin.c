@@ -509,13 +509,20 @@ pcap_ng_dump_proc_info(pcap_t *pcap, pcap_dumper_t *dumper, pcapng_block_t block
 	
 	/*
 	 * Need to add the all the process info blocks until the one we're adding
-	 * to avoid reference to missing processes caused by filtering
+	 * to avoid reference to missing processes caused by filtering;
+	 * the ones below proc_info_dumped have all been added already
 	 */
-	for (i = 0; i <= proc_info->proc_index; i++) {
+	for (i = pcap->proc_info_dumped; i <= proc_info->proc_index; i++) {
 		struct pcap_proc_info *tmp_pi;
 		struct pcapng_process_information_fields *pib;
 		
 		tmp_pi = pcap_find_proc_info_by_index(pcap, i);
+		if (tmp_pi == NULL) {
+			snprintf(pcap->errbuf, PCAP_ERRBUF_SIZE,
+				 "%s: pcap_find_proc_info_by_index(%i) failed",
+				 __func__, i);
+			return (NULL);
+		}
 		if (tmp_pi->proc_block_added)
 			continue;
 		
@@ -537,8 +544,9 @@ pcap_ng_dump_proc_info(pcap_t *pcap, pcap_dumper_t *dumper, pcapng_block_t block
 		
 		pcap_ng_dump_block(dumper, block);
 		
-		proc_info->proc_block_added = 1;
+		tmp_pi->proc_block_added = 1;
 	}
+	pcap->proc_info_dumped = proc_info->proc_index + 1;
 	
 	return (proc_info);
 }
@@ -575,9 +583,10 @@ pcap_ng_dump_if_info(pcap_t *pcap, pcap_dumper_t *dumper, pcapng_block_t block,
 	
 	/*
 	 * Need to add the all the interface info blocks until the one we're adding
-	 * to avoid reference to missing interfaces caused by filtering
+	 * to avoid reference to missing interfaces caused by filtering;
+	 * the ones below if_info_dumped have all been added already
 	 */
-	for (i = 0; i <= if_info->if_id; i++) {
+	for (i = pcap->if_info_dumped; i <= if_info->if_id; i++) {
 		struct pcapng_interface_description_fields *idb = NULL;
 		struct pcap_if_info *tmp_ifi;
 		
@@ -613,6 +622,8 @@ pcap_ng_dump_if_info(pcap_t *pcap, pcap_dumper_t *dumper, pcapng_block_t block,
 		
 		tmp_ifi->if_block_added = 1;
 	}
+	if (if_info->if_id >= pcap->if_info_dumped)
+		pcap->if_info_dumped = if_info->if_id + 1;
 	return (if_info);
 }
 
@@ -94,18 +94,37 @@ struct pcap_opt {
 	int	immediate;	/* immediate mode - deliver packets as soon as they arrive */
 	int	tstamp_type;
 	int	tstamp_precision;
+	int	tx_ring;	/* map a transmit ring, if supported */
+	int	qdisc_bypass;	/* send bypassing the qdisc layer, if supported */
+	int	busy_poll;	/* microseconds to spin waiting for packets */
+	int	busy_poll_flags; /* PCAP_BUSY_POLL_ flags */
+	int	latency_hist;	/* keep a histogram of delivery latency */
+	int	numa_node;	/* node to put the buffer on, or PCAP_NUMA_NODE_ */
+	int	cpu;		/* CPU to run on, or PCAP_CPU_ */
+	int	fanout_group;	/* fanout group to join, or -1 */
+	int	fanout_mode;	/* PCAP_FANOUT_ mode for that group */
+	int	stats_refresh;	/* max age, in ms, of interface counters */
+	int	recv_batch;	/* packets per read without a ring; 0 = use one */
+	int	vlan_metadata;	/* hand stripped VLAN tags over as metadata */
+	int	per_interface;	/* say which interface each packet came from */
 };
 
 typedef int	(*activate_op_t)(pcap_t *);
 typedef int	(*can_set_rfmon_op_t)(pcap_t *);
 typedef int	(*read_op_t)(pcap_t *, int cnt, pcap_handler, u_char *);
 typedef int	(*inject_op_t)(pcap_t *, const void *, size_t);
+typedef int	(*transmit_op_t)(pcap_t *, struct pcap_send_queue *);
 typedef int	(*setfilter_op_t)(pcap_t *, struct bpf_program *);
 typedef int	(*setdirection_op_t)(pcap_t *, pcap_direction_t);
 typedef int	(*set_datalink_op_t)(pcap_t *, int);
 typedef int	(*getnonblock_op_t)(pcap_t *, char *);
 typedef int	(*setnonblock_op_t)(pcap_t *, int, char *);
 typedef int	(*stats_op_t)(pcap_t *, struct pcap_stat *);
+typedef int	(*stats64_op_t)(pcap_t *, struct pcap_stat64 *);
+typedef int	(*retain_op_t)(pcap_t *, const u_char *);
+struct pcap_block_file_header;
+typedef int	(*block_header_op_t)(pcap_t *, struct pcap_block_file_header *);
+typedef int	(*write_blocks_op_t)(pcap_t *, int, int);
 #ifdef WIN32
 typedef int	(*setbuff_op_t)(pcap_t *, int);
 typedef int	(*setmode_op_t)(pcap_t *, int);
@@ -118,6 +137,36 @@ typedef void	(*cleanup_interface_op_t)(const char *);
 struct pcap_if_info;
 struct pcap_proc_info;
 
+/*
+ * A filter for the packets from one interface; see pcap_setfilter_if().
+ */
+struct pcap_if_filter {
+	int	ifindex;
+	struct bpf_program prog;
+};
+
+/*
+ * pcapng interface IDs given to interfaces, sorted by interface index,
+ * in a pcapng file being written, and the DLT_ type each was described
+ * as; see sf-pcap-ng.c.
+ */
+struct pcap_ng_if_table {
+	struct pcap_ng_if_id *ids;
+	int	size;		/* entries in ids[] */
+	int	max;		/* room in ids[] */
+	int	last;		/* entry last looked up */
+	bpf_u_int32 count;	/* interface IDs given out */
+};
+
+/*
+ * A file being written by pcap_ng_dump_if(), and its interfaces.
+ */
+struct pcap_ng_if_dumper {
+	struct pcap_ng_if_dumper *next;
+	FILE	*f;
+	struct pcap_ng_if_table t;
+};
+
 /*
  * We put all the stuff used in the read code path at the beginning,
  * to try to keep it together in the same cache line or lines.
@@ -199,7 +248,91 @@ struct pcap {
 	int tstamp_precision_count;
 	u_int *tstamp_precision_list;
 
-	struct pcap_pkthdr pcap_header;	/* This is needed for the pcap_next_ex() to work */
+	struct pcap_pkthdr_if pcap_header;	/* This is needed for the pcap_next_ex() to work */
+
+	/*
+	 * The caller's buffers, if the savefile is being read from
+	 * memory; see pcap_open_offline_buffer().
+	 */
+	struct sf_mem *sf_mem;
+
+	/*
+	 * State for following a savefile as it's written; see
+	 * pcap_offline_follow().
+	 */
+	struct sf_follow *sf_follow;
+
+	/*
+	 * Savefile records read ahead to be run through the filter
+	 * together; see pcap_offline_read().
+	 */
+	struct sf_batch *sf_batch;
+
+	/*
+	 * Histogram of how long packets took to get from the time
+	 * they were time stamped to the callback, if requested and
+	 * supported.
+	 */
+	struct pcap_latency_hist *lat_hist;
+
+	/*
+	 * NUMA node the device is attached to, or -1 if not known.
+	 */
+	int numa_node;
+
+	/*
+	 * CPU the handle was activated on, if it was pinned to one,
+	 * otherwise -1.
+	 */
+	int cpu;
+
+	/*
+	 * Non-zero if headers handed to the callback are really
+	 * struct pcap_pkthdr_vlan.
+	 */
+	int vlan_metadata;
+
+	/*
+	 * Non-zero if pcap_set_vlan_metadata() can be used; set by the
+	 * create routine of modules that support it.
+	 */
+	int vlan_metadata_ok;
+
+	/*
+	 * Non-zero if headers handed to the callback are really
+	 * struct pcap_pkthdr_if.
+	 */
+	int per_interface;
+
+	/*
+	 * Files being written by pcap_ng_dump_if(), each with the
+	 * interfaces described in it.
+	 */
+	struct pcap_ng_if_dumper *ng_dumpers;
+
+	/*
+	 * Filters for packets from particular interfaces, in
+	 * per-interface mode, sorted by interface index, so that the
+	 * default, for index 0, comes first if there is one; see
+	 * pcap_setfilter_if().
+	 */
+	struct pcap_if_filter *if_filters;
+	int if_filter_count;	/* entries in if_filters[] */
+	int if_filters_max;	/* room in if_filters[] */
+	int if_filter_last;	/* entry last looked up */
+
+	/*
+	 * BPF_ flags telling the filter compiler what the capture
+	 * mechanism can do.
+	 */
+	int bpf_codegen_flags;
+
+	/*
+	 * Number of buffer blocks the capture mechanism is done with
+	 * that are being kept only by packets retained with
+	 * pcap_retain(); updated from whatever thread releases them.
+	 */
+	volatile int pinned_blocks;
 
 	/*
 	 * More methods.
@@ -207,12 +340,18 @@ struct pcap {
 	activate_op_t activate_op;
 	can_set_rfmon_op_t can_set_rfmon_op;
 	inject_op_t inject_op;
+	transmit_op_t transmit_op;	/* NULL: pcap_sendqueue_transmit() injects one at a time */
 	setfilter_op_t setfilter_op;
 	setdirection_op_t setdirection_op;
 	set_datalink_op_t set_datalink_op;
 	getnonblock_op_t getnonblock_op;
 	setnonblock_op_t setnonblock_op;
 	stats_op_t stats_op;
+	stats64_op_t stats64_op;	/* NULL: pcap_stats64() widens pcap_stats() */
+	retain_op_t retain_op;		/* NULL: packets can't be retained */
+	retain_op_t release_op;
+	block_header_op_t block_header_op; /* NULL: blocks can't be recorded */
+	write_blocks_op_t write_blocks_op;
 
 	/*
 	 * Routine to use as callback for pcap_next()/pcap_next_ex().
@@ -245,9 +384,16 @@ struct pcap {
     
 	int if_info_count;
 	struct pcap_if_info **if_infos;
+	u_int if_info_hash_size;
+	struct pcap_if_info **if_info_by_name;	/* hash chains */
+	struct pcap_if_info **if_info_by_id;	/* hash chains */
+	int if_info_dumped;	/* ids below this have had IDBs written */
 	
 	int proc_info_count;
-	struct pcap_proc_info **proc_infos;
+	struct pcap_proc_info **proc_infos;	/* indexed by proc_index */
+	u_int proc_info_hash_size;
+	struct pcap_proc_info **proc_info_by_pid;	/* hash chains */
+	int proc_info_dumped;	/* indexes below this have had PIBs written */
 
 	cleanup_op_t cleanup_extra_op;	
 };
@@ -328,10 +474,16 @@ struct pcap_sf_patched_pkthdr {
  */
 struct oneshot_userdata {
 	struct pcap_pkthdr *hdr;
+	struct pcap_pkthdr_if *xhdr;	/* if non-null, where hdr is in one */
 	const u_char **pkt;
 	pcap_t *pd;
 };
 
+/*
+ * Flags for bpf_codegen_flags.
+ */
+#define BPF_SPECIAL_VLAN_HANDLING	0x00000001	/* VLAN tags are metadata */
+
 int	yylex(void);
 
 #ifndef min
@@ -432,6 +584,71 @@ int	add_or_find_if(pcap_if_t **, pcap_if_t **, const char *, u_int,
 pcap_t	*pcap_open_offline_common(char *ebuf, size_t size);
 void	sf_cleanup(pcap_t *p);
 
+/*
+ * A savefile being read from the caller's buffers, in the order they
+ * were handed to us, rather than from "rfile".
+ *
+ * "sf_mem_have()" returns 1 if the next "len" bytes are there, 0 at
+ * the end of the file or if they haven't all arrived yet, and -1, with
+ * an error in p->errbuf, if they never will.
+ *
+ * "sf_mem_peek()" copies the next "len" bytes, which must be there,
+ * without consuming them.
+ *
+ * "sf_mem_get()" consumes the next "len" bytes, which must be there,
+ * and returns a pointer to them; that's where they are, if they're all
+ * in one buffer and at a multiple of "align", and otherwise they're
+ * copied to "copybuf", or, if "copybuf" is null, just skipped.  An
+ * "align" of 0 means always copy.
+ */
+struct sf_mem_buf {
+	const u_char *data;
+	size_t	len;
+};
+
+struct sf_mem {
+	struct sf_mem_buf *bufs;
+	u_int	count;		/* buffers in bufs[] */
+	u_int	size;		/* room in bufs[] */
+	u_int	cur;		/* buffer being read */
+	size_t	off;		/* offset in it */
+	size_t	avail;		/* bytes not yet read, in all buffers */
+	int	done;		/* no more buffers are coming */
+	u_char	*block;		/* start of the last pcap-ng block read */
+	u_int	base;		/* number of buffers before bufs[0] */
+	u_int	released;	/* number of buffers handed back */
+	pcap_release_handler release;	/* how to hand them back */
+	u_char	*release_user;
+};
+
+int	sf_mem_have(pcap_t *p, size_t len);
+void	sf_mem_release(pcap_t *p, int all);
+void	sf_mem_peek(pcap_t *p, void *buf, size_t len);
+u_char	*sf_mem_get(pcap_t *p, size_t len, u_char *copybuf, u_int align);
+
+/*
+ * Following a savefile as it's written.
+ *
+ * "sf_follow_rewind()" is called by the record readers when a read
+ * comes up short; it goes back to the start of the record, at "offset",
+ * so that it's read again once it's all there, and returns 1, as for
+ * the end of the file.
+ *
+ * "sf_following()" says whether the end of the file just means that
+ * no more has been written yet.
+ */
+int	sf_follow_rewind(pcap_t *p, off_t offset);
+int	sf_following(pcap_t *p);
+
+/*
+ * Routines for putting records straight into a sink's buffer; see
+ * sf-sink.c.  "pcap_sink_reserve()" returns a pointer to room for "len"
+ * bytes, or null if the sink has failed, and "pcap_sink_commit()" adds
+ * the "len" bytes put there to what's in the buffer.
+ */
+u_char	*pcap_sink_reserve(pcap_sink_t *s, size_t len);
+void	pcap_sink_commit(pcap_sink_t *s, size_t len);
+
 /*
  * Internal interfaces for both "pcap_create()" and routines that
  * open savefiles.
@@ -447,8 +664,54 @@ char	*pcap_win32strerror(void);
 
 int	install_bpf_program(pcap_t *, struct bpf_program *);
 
+/*
+ * Check a packet against the per-interface filters, if
+ * "p->if_filter_count" is non-zero.
+ */
+int	pcap_filter_if(pcap_t *, const struct pcap_pkthdr_if *, const u_char *);
+
+/*
+ * Offset of the network-layer header for the pcap_t's link-layer type,
+ * from the filter compiler's tables.
+ */
+int	pcap_nl_offset(pcap_t *, int *);
+
+/*
+ * What identifies a packet's flow, found by "pcap_flow_parse()" (see
+ * dispatcher.c) given the offsets from "pcap_nl_offset()".  Offsets are
+ * from the start of the packet data, or -1 if not found.
+ */
+struct pcap_flow_key {
+	int		version;	/* IP version, or 0 if not IP */
+	u_int		ethertype;	/* after any VLAN tags, or 0 */
+	int		off_l3;		/* IP header */
+	int		off_l4;		/* transport header */
+	u_int		proto;		/* transport protocol */
+	int		fragment;	/* it's a fragment */
+	int		ports;		/* sport and dport are set */
+	bpf_u_int32	sport, dport;
+	const u_char	*src, *dst;	/* addresses, in the packet */
+};
+
+int	pcap_flow_parse(const u_char *, u_int, int, int, struct pcap_flow_key *);
+
 int	pcap_strcasecmp(const char *, const char *);
 
+#ifdef HAVE_NETLINK_FINDALLDEVS
+/*
+ * Talking to rtnetlink; see fad-netlink.c.  "pcap_rtnl_dump()" asks
+ * for a dump of the given type and hands each message in it to the
+ * handler, with "arg"; "buf" must be PCAP_RTNL_BUFSIZE bytes long.
+ */
+#define PCAP_RTNL_BUFSIZE	65536
+
+struct nlmsghdr;
+
+int	pcap_rtnl_open(u_int, char *);
+int	pcap_rtnl_dump(int, int, int (*)(struct nlmsghdr *, void *), void *,
+	    char *, char *);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -134,18 +134,28 @@ static const char rcsid[] _U_ =
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <linux/if.h>
 #include <linux/if_packet.h>
 #include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <netinet/in.h>
 #include <linux/if_ether.h>
 #include <net/if_arp.h>
 #include <poll.h>
 #include <dirent.h>
+#include <sched.h>
+#include <time.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #include "pcap-int.h"
 #include "pcap/sll.h"
 #include "pcap/vlan.h"
+#include "sf-blocks.h"
 
 /*
  * If PF_PACKET is defined, we can use {SOCK_RAW,SOCK_DGRAM}/PF_PACKET
@@ -206,6 +216,9 @@ static const char rcsid[] _U_ =
 #  else  /* TPACKET2_HDRLEN */
 #   define TPACKET_V1	0    /* Old kernel with only V1, so no TPACKET_Vn defined */
 #  endif /* TPACKET2_HDRLEN */
+#  ifdef PACKET_TX_RING
+#   define HAVE_PACKET_TX_RING
+#  endif /* PACKET_TX_RING */
 # endif /* TPACKET_HDRLEN */
 #endif /* PF_PACKET */
 
@@ -214,6 +227,18 @@ static const char rcsid[] _U_ =
 #include <linux/filter.h>
 #endif
 
+/*
+ * Without the memory-mapped ring, we can pull several packets off the
+ * socket per system call with recvmmsg(); we only do so if we can
+ * get the auxiliary data and per-packet time stamps along with them.
+ */
+#if defined(HAVE_RECVMMSG) && defined(HAVE_PACKET_AUXDATA) && \
+    defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) && defined(SO_TIMESTAMP)
+#define HAVE_RECV_BATCH
+#define RECV_BATCH_DEFAULT	32	/* packets per recvmmsg() */
+#define RECV_BATCH_MAX		1024
+#endif
+
 #ifdef HAVE_LINUX_NET_TSTAMP_H
 #include <linux/net_tstamp.h>
 #endif
@@ -284,9 +309,9 @@ typedef int		socklen_t;
  * Private data for capturing on Linux SOCK_PACKET or PF_PACKET sockets.
  */
 struct pcap_linux {
-	u_int	packets_read;	/* count of packets read with recvfrom() */
-	long	proc_dropped;	/* packets reported dropped by /proc/net/dev */
-	struct pcap_stat stat;
+	u_int64_t packets_read;	/* count of packets read with recvfrom() */
+	u_int64_t if_drops;	/* interface's drop count when we last looked */
+	struct pcap_stat64 stat;
 
 	char	*device;	/* device name */
 	int	filter_in_userland; /* must filter in userland */
@@ -302,12 +327,38 @@ struct pcap_linux {
 	u_char	*mmapbuf;	/* memory-mapped region pointer */
 	size_t	mmapbuflen;	/* size of region */
 	int	vlan_offset;	/* offset at which to insert vlan tags; if -1, don't insert */
+	int	any_native;	/* per-interface mode on "any": SOCK_RAW, no cooking */
+	int	last_hatype;	/* ARPHRD_ type last looked up for any_native, */
+	int	last_dlt;	/* and its DLT_ type, or -1 if it has none */
 	u_int	tp_version;	/* version of tpacket_hdr for mmaped ring */
 	u_int	tp_hdrlen;	/* hdrlen of tpacket_hdr for mmaped ring */
 	u_char	*oneshot_buffer; /* buffer for copy of packet */
+	u_char	*txring;	/* transmit ring, mapped after the rx ring */
+	u_int	tx_frame_size;	/* size of a transmit ring frame */
+	u_int	tx_frame_nr;	/* number of transmit ring frames */
+	u_int	tx_frames_per_block;
+	u_int	tx_block_size;
+	u_int	tx_head;	/* next transmit ring frame to fill */
+#ifdef HAVE_RECV_BATCH
+	int	rx_batch;	/* packets per recvmmsg(); 0 if not batching */
+	int	rx_count;	/* packets got by the last recvmmsg() */
+	int	rx_next;	/* next of those to process */
+	size_t	rx_slotlen;	/* size of each packet's part of handle->buffer */
+	struct mmsghdr *rx_msgs; /* also holds the iovecs, addresses and cmsgs */
+#endif
 #ifdef HAVE_TPACKET3
 	unsigned char *current_packet; /* Current packet within the TPACKET_V3 block. Move to next block if NULL. */
 	int packets_left; /* Unhandled packets left within the block from previous call to pcap_read_linux_mmap_v3 in case of TPACKET_V3. */
+	volatile int *block_refs; /* references to each TPACKET_V3 block; see pcap_retain_linux_mmap() */
+	int	held_block;	/* block the reader holds a reference to, or -1 */
+#endif
+	int	fanout_counted;	/* counted as a member in fanout_groups[] */
+	int	pin_reader;	/* pin the thread reading to reader_cpus */
+	cpu_set_t reader_cpus;	/* CPUs the handle was placed on */
+	read_op_t pinned_read_op; /* read routine once the reader's pinned */
+	int	reader_pinned;	/* a reader has been pinned */
+#ifdef HAVE_PTHREADS
+	pthread_t reader;	/* and this is it */
 #endif
 };
 
@@ -332,8 +383,16 @@ static int activate_mmap(pcap_t *, int *);
 static int pcap_can_set_rfmon_linux(pcap_t *);
 static int pcap_read_linux(pcap_t *, int, pcap_handler, u_char *);
 static int pcap_read_packet(pcap_t *, pcap_handler, u_char *);
+static int linux_handle_packet(pcap_t *, u_char *, int, size_t,
+    struct msghdr *, void *, const struct timeval *, pcap_handler, u_char *);
+#ifdef HAVE_RECV_BATCH
+static int linux_init_recv_batch(pcap_t *);
+static int pcap_read_packets_batch(pcap_t *, int, pcap_handler, u_char *);
+#endif
 static int pcap_inject_linux(pcap_t *, const void *, size_t);
+static int pcap_transmit_linux(pcap_t *, struct pcap_send_queue *);
 static int pcap_stats_linux(pcap_t *, struct pcap_stat *);
+static int pcap_stats64_linux(pcap_t *, struct pcap_stat64 *);
 static int pcap_setfilter_linux(pcap_t *, struct bpf_program *);
 static int pcap_setdirection_linux(pcap_t *, pcap_direction_t);
 static int pcap_set_datalink_linux(pcap_t *, int);
@@ -350,8 +409,20 @@ union thdr {
 	void				*raw;
 };
 
+/*
+ * The TPID of a stripped VLAN tag, from a header with a tp_status
+ * field and a header with a tp_vlan_tpid field; kernels that don't
+ * supply it only strip 802.1Q tags.
+ */
+#ifdef TP_STATUS_VLAN_TPID_VALID
+# define VLAN_TPID(hdr, hv)	(((hv)->tp_vlan_tpid || ((hdr)->tp_status & TP_STATUS_VLAN_TPID_VALID)) ? (hv)->tp_vlan_tpid : ETH_P_8021Q)
+#else
+# define VLAN_TPID(hdr, hv)	ETH_P_8021Q
+#endif
+
 #ifdef HAVE_PACKET_RING
 #define RING_GET_FRAME(h) (((union thdr **)h->buffer)[h->offset])
+#define RING_GET_FRAME_AT(h, offset) (((union thdr **)h->buffer)[offset])
 
 static void destroy_ring(pcap_t *handle);
 static int create_ring(pcap_t *handle, int *status);
@@ -363,6 +434,11 @@ static int pcap_read_linux_mmap_v2(pcap_t *, int, pcap_handler , u_char *);
 #endif
 #ifdef HAVE_TPACKET3
 static int pcap_read_linux_mmap_v3(pcap_t *, int, pcap_handler , u_char *);
+static int pcap_retain_linux_mmap(pcap_t *, const u_char *);
+static int pcap_release_linux_mmap(pcap_t *, const u_char *);
+static int pcap_block_header_linux_mmap(pcap_t *,
+    struct pcap_block_file_header *);
+static int pcap_write_blocks_linux_mmap(pcap_t *, int, int);
 #endif
 static int pcap_setfilter_linux_mmap(pcap_t *, struct bpf_program *);
 static int pcap_setnonblock_mmap(pcap_t *p, int nonblock, char *errbuf);
@@ -414,6 +490,13 @@ pcap_create_interface(const char *device, char *ebuf)
 
 	handle->activate_op = pcap_activate_linux;
 	handle->can_set_rfmon_op = pcap_can_set_rfmon_linux;
+#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
+	/*
+	 * Stripped VLAN tags come to us in the auxiliary data, so we
+	 * can hand them over as metadata.
+	 */
+	handle->vlan_metadata_ok = 1;
+#endif
 #if defined(HAVE_LINUX_NET_TSTAMP_H) && defined(PACKET_TIMESTAMP)
 	/*
 	 * We claim that we support:
@@ -997,14 +1080,10 @@ pcap_can_set_rfmon_linux(pcap_t *handle)
 
 /*
  * Grabs the number of dropped packets by the interface from /proc/net/dev.
- *
- * XXX - what about /sys/class/net/{interface name}/rx_*?  There are
- * individual devices giving, in ASCII, various rx_ and tx_ statistics.
- *
- * Or can we get them in binary form from netlink?
+ * Used only if we can't get it from rtnetlink; see linux_if_drops().
  */
 static long int
-linux_if_drops(const char * if_name)
+linux_proc_if_drops(const char * if_name)
 {
 	char buffer[512];
 	char * bufptr;
@@ -1055,6 +1134,545 @@ linux_if_drops(const char * if_name)
 	return dropped_pkts;
 } 
 
+static u_int64_t
+linux_clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * The interfaces' drop counts, as of the last time we fetched them,
+ * sorted by name.  We get them for all interfaces at once, with a
+ * single rtnetlink RTM_GETLINK dump, so that a process polling the
+ * statistics of many handles doesn't go to the kernel for each of
+ * them; a handle uses them if they're no older than its
+ * pcap_set_stats_refresh() interval, which is a second by default,
+ * and fetches them again on every call if that's 0.  Handles used by
+ * different threads share the cache, so it's only touched with
+ * if_drops_lock held.
+ */
+struct if_drops {
+	char		name[IFNAMSIZ];
+	u_int64_t	drops;
+};
+
+static struct {
+	struct if_drops	*ifs;
+	int		count;
+	int		max;
+	u_int64_t	fetched;	/* CLOCK_MONOTONIC ns, 0 if never */
+	int		unavailable;	/* no rtnetlink; use /proc/net/dev */
+} if_drops_cache;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t if_drops_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int
+if_drops_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct if_drops *)a)->name,
+	    ((const struct if_drops *)b)->name);
+}
+
+/*
+ * Add one interface's counts from an RTM_NEWLINK message to the cache.
+ * The drop count is what /proc/net/dev reports: the packets the stack
+ * dropped plus the ones the adapter missed.
+ */
+static int
+if_drops_add(struct nlmsghdr *nh, void *arg _U_)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct rtattr *rta;
+	int len = IFLA_PAYLOAD(nh);
+	struct if_drops *ifd, *newifs;
+	const char *name = NULL;
+	int have64 = 0;
+#ifdef IFLA_STATS64
+	struct rtnl_link_stats64 st64;
+#endif
+	struct rtnl_link_stats st;
+	u_int64_t drops = 0;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+
+		case IFLA_IFNAME:
+			name = RTA_DATA(rta);
+			break;
+
+#ifdef IFLA_STATS64
+		case IFLA_STATS64:
+			if (RTA_PAYLOAD(rta) < sizeof(st64))
+				break;
+			/* only 4-byte aligned */
+			memcpy(&st64, RTA_DATA(rta), sizeof(st64));
+			drops = st64.rx_dropped + st64.rx_missed_errors;
+			have64 = 1;
+			break;
+#endif
+
+		case IFLA_STATS:
+			if (have64 || RTA_PAYLOAD(rta) < sizeof(st))
+				break;
+			memcpy(&st, RTA_DATA(rta), sizeof(st));
+			drops = (u_int64_t)st.rx_dropped + st.rx_missed_errors;
+			break;
+		}
+	}
+	if (name == NULL)
+		return 0;
+
+	if (if_drops_cache.count == if_drops_cache.max) {
+		newifs = realloc(if_drops_cache.ifs,
+		    (if_drops_cache.max + 64) * sizeof(*newifs));
+		if (newifs == NULL)
+			return -1;
+		if_drops_cache.ifs = newifs;
+		if_drops_cache.max += 64;
+	}
+	ifd = &if_drops_cache.ifs[if_drops_cache.count++];
+	strncpy(ifd->name, name, sizeof(ifd->name) - 1);
+	ifd->name[sizeof(ifd->name) - 1] = '\0';
+	ifd->drops = drops;
+	return 0;
+}
+
+/*
+ * Refill the cache.  Returns -1 if rtnetlink didn't work, 0 otherwise.
+ */
+static int
+if_drops_fetch(void)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	char *buf;
+	int fd, ret;
+
+	fd = pcap_rtnl_open(0, errbuf);
+	if (fd == -1)
+		return -1;
+	buf = malloc(PCAP_RTNL_BUFSIZE);
+	if (buf == NULL) {
+		close(fd);
+		return -1;
+	}
+	if_drops_cache.count = 0;
+	ret = pcap_rtnl_dump(fd, RTM_GETLINK, if_drops_add, NULL, buf, errbuf);
+	if (ret == 0)
+		qsort(if_drops_cache.ifs, if_drops_cache.count,
+		    sizeof(*if_drops_cache.ifs), if_drops_compare);
+	else
+		if_drops_cache.count = 0;
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Get the number of packets the handle's interface has dropped, from
+ * the cache if it's fresh enough for the handle, refilling it if not.
+ */
+static u_int64_t
+linux_if_drops(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct if_drops key, *ifd;
+	u_int64_t now, drops = 0;
+	int stale, refetched = 0, use_proc = 0;
+
+	memset(&key, 0, sizeof(key));
+	strncpy(key.name, handlep->device, sizeof(key.name) - 1);
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&if_drops_lock);
+#endif
+	now = linux_clock_ns(CLOCK_MONOTONIC);
+	stale = (if_drops_cache.fetched == 0 ||
+	    now - if_drops_cache.fetched >=
+	    (u_int64_t)handle->opt.stats_refresh * 1000000);
+	for (;;) {
+		if (if_drops_cache.unavailable) {
+			use_proc = 1;
+			break;
+		}
+		if (stale) {
+			if (if_drops_fetch() == -1) {
+				if_drops_cache.unavailable = 1;
+				continue;
+			}
+			if_drops_cache.fetched = now;
+			refetched = 1;
+		}
+		ifd = bsearch(&key, if_drops_cache.ifs, if_drops_cache.count,
+		    sizeof(*if_drops_cache.ifs), if_drops_compare);
+		if (ifd != NULL) {
+			drops = ifd->drops;
+			break;
+		}
+
+		/*
+		 * Not there; perhaps the interface appeared since we
+		 * last looked.  If it's really not there (the "any"
+		 * device, for example), report no change.
+		 */
+		if (refetched || strcmp(handlep->device, "any") == 0) {
+			drops = handlep->if_drops;
+			break;
+		}
+		stale = 1;
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&if_drops_lock);
+#endif
+
+	/*
+	 * Without rtnetlink, read /proc/net/dev, which doesn't need
+	 * the lock.
+	 */
+	if (use_proc)
+		drops = linux_proc_if_drops(handlep->device);
+	return drops;
+}
+
+/*
+ * Get the NUMA node a network device is attached to from
+ * /sys/class/net/{device}/device/numa_node; returns -1 if it isn't
+ * attached to a particular node, or we can't tell.
+ */
+static int
+linux_if_numa_node(const char *device)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	int node;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+	    device);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+	if (fscanf(file, "%d", &node) != 1 || node < 0)
+		node = -1;
+	fclose(file);
+	return node;
+}
+
+/*
+ * Add the CPUs of a NUMA node, as listed in
+ * /sys/devices/system/node/node{N}/cpulist ("0-3,8-11" or the like),
+ * to a set.  Returns the number of CPUs, or -1 if the node doesn't
+ * exist.
+ */
+static int
+linux_numa_node_cpus(int node, cpu_set_t *set)
+{
+	char path[PATH_MAX], buf[1024], *cp, *end;
+	FILE *file;
+	long first, last;
+	int count = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+	    node);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+	cp = fgets(buf, sizeof(buf), file);
+	fclose(file);
+	if (cp == NULL)
+		return -1;
+
+	while (*cp != '\0' && *cp != '\n') {
+		first = last = strtol(cp, &end, 10);
+		if (end == cp)
+			break;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (; first <= last && first < CPU_SETSIZE; first++) {
+			CPU_SET(first, set);
+			count++;
+		}
+		cp = (*end == ',') ? end + 1 : end;
+	}
+	return count;
+}
+
+/*
+ * To put the buffer on a NUMA node, we have the kernel prefer that
+ * node for our allocations while it allocates the ring, and then put
+ * things back the way they were.  We make the system calls directly,
+ * so as not to require libnuma.
+ */
+#if defined(SYS_get_mempolicy) && defined(SYS_set_mempolicy)
+#define HAVE_MEMPOLICY
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#endif
+#define MAX_NUMA_NODES	1024
+#define NODEMASK_LONGS	(MAX_NUMA_NODES / (8 * sizeof(unsigned long)))
+#endif
+
+struct linux_placement {
+	int	node;		/* node the buffer's going on, or -1 */
+	int	cpus_saved;	/* the old affinity was saved */
+	cpu_set_t cpus;		/* the old affinity */
+#ifdef HAVE_MEMPOLICY
+	int	saved;		/* the old policy was saved */
+	int	mode;		/* the old policy */
+	unsigned long nodemask[NODEMASK_LONGS];
+#endif
+};
+
+/*
+ * Members of each fanout group we've put in this process, so that,
+ * with PCAP_CPU_NODE, successive ones are put on different CPUs.
+ * Handles may be opened and closed on several threads at once, so
+ * the table is only used with fanout_groups_lock held; a group is
+ * dropped from it when its last member is closed.
+ */
+#define FANOUT_GROUPS_TRACKED	32
+static struct {
+	int	group;
+	u_int	members;	/* members open now */
+	u_int	next;		/* number to give the next member */
+} fanout_groups[FANOUT_GROUPS_TRACKED];
+static int fanout_groups_count;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t fanout_groups_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Count the handle as a member of its fanout group, and return its
+ * number in the group; linux_fanout_leave() must be called when it's
+ * closed if handlep->fanout_counted gets set.
+ */
+static u_int
+linux_fanout_join(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int group = handle->opt.fanout_group;
+	u_int member = 0;
+	int i;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&fanout_groups_lock);
+#endif
+	for (i = 0; i < fanout_groups_count; i++) {
+		if (fanout_groups[i].group == group)
+			break;
+	}
+	if (i == fanout_groups_count && i < FANOUT_GROUPS_TRACKED) {
+		fanout_groups[i].group = group;
+		fanout_groups[i].members = 0;
+		fanout_groups[i].next = 0;
+		fanout_groups_count++;
+	}
+	if (i < fanout_groups_count) {
+		fanout_groups[i].members++;
+		member = fanout_groups[i].next++;
+		handlep->fanout_counted = 1;
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&fanout_groups_lock);
+#endif
+	return member;
+}
+
+static void
+linux_fanout_leave(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int group = handle->opt.fanout_group;
+	int i;
+
+	if (!handlep->fanout_counted)
+		return;
+	handlep->fanout_counted = 0;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&fanout_groups_lock);
+#endif
+	for (i = 0; i < fanout_groups_count; i++) {
+		if (fanout_groups[i].group == group) {
+			if (--fanout_groups[i].members == 0)
+				fanout_groups[i] =
+				    fanout_groups[--fanout_groups_count];
+			break;
+		}
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&fanout_groups_lock);
+#endif
+}
+
+/*
+ * Put back the affinity and memory policy linux_place_capture()
+ * changed.
+ */
+static void
+linux_unplace_capture(struct linux_placement *pl)
+{
+#ifdef HAVE_MEMPOLICY
+	if (pl->saved) {
+		(void)syscall(SYS_set_mempolicy, pl->mode, pl->nodemask,
+		    MAX_NUMA_NODES);
+		pl->saved = 0;
+	}
+#endif
+	if (pl->cpus_saved) {
+		(void)sched_setaffinity(0, sizeof(pl->cpus), &pl->cpus);
+		pl->cpus_saved = 0;
+	}
+}
+
+/*
+ * Pin the thread activating the handle to the requested CPU or CPUs,
+ * and arrange that the buffer be allocated on the requested NUMA node.
+ * Returns -1, with an error in handle->errbuf and everything put back
+ * the way it was, on failure, 0 otherwise; linux_unplace_capture()
+ * must be called once the buffer is allocated, whether or not that
+ * worked.  The CPUs are kept in handlep->reader_cpus, for
+ * pcap_read_linux_pinned().
+ */
+static int
+linux_place_capture(pcap_t *handle, struct linux_placement *pl)
+{
+	struct pcap_linux *handlep = handle->priv;
+	cpu_set_t cpus, node_cpus;
+	int i, count, pick;
+#ifdef HAVE_MEMPOLICY
+	unsigned long nodemask[NODEMASK_LONGS];
+#endif
+
+	memset(pl, 0, sizeof(*pl));
+	handle->cpu = -1;
+	if (handle->opt.numa_node == PCAP_NUMA_NODE_DEVICE)
+		pl->node = handle->numa_node;
+	else if (handle->opt.numa_node >= 0)
+		pl->node = handle->opt.numa_node;
+	else
+		pl->node = -1;
+
+	CPU_ZERO(&cpus);
+	if (handle->opt.cpu >= 0) {
+		if (handle->opt.cpu >= CPU_SETSIZE) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "CPU %d is out of range", handle->opt.cpu);
+			return -1;
+		}
+		CPU_SET(handle->opt.cpu, &cpus);
+	} else if (handle->opt.cpu == PCAP_CPU_NODE && pl->node >= 0) {
+		CPU_ZERO(&node_cpus);
+		count = linux_numa_node_cpus(pl->node, &node_cpus);
+		if (count <= 0) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "NUMA node %d has no CPUs", pl->node);
+			return -1;
+		}
+		if (handle->opt.fanout_group >= 0) {
+			pick = linux_fanout_join(handle) % count;
+			for (i = 0; i < CPU_SETSIZE; i++) {
+				if (CPU_ISSET(i, &node_cpus) && pick-- == 0) {
+					CPU_SET(i, &cpus);
+					break;
+				}
+			}
+		} else
+			cpus = node_cpus;
+	}
+	if (CPU_COUNT(&cpus) != 0) {
+		if (sched_getaffinity(0, sizeof(pl->cpus), &pl->cpus) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "sched_getaffinity: %s", pcap_strerror(errno));
+			return -1;
+		}
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "sched_setaffinity: %s", pcap_strerror(errno));
+			return -1;
+		}
+		pl->cpus_saved = 1;
+		handlep->reader_cpus = cpus;
+		handlep->pin_reader = 1;
+		if (CPU_COUNT(&cpus) == 1) {
+			for (i = 0; !CPU_ISSET(i, &cpus); i++)
+				;
+			handle->cpu = i;
+		}
+	}
+
+	if (pl->node < 0)
+		return 0;
+#ifdef HAVE_MEMPOLICY
+	if (pl->node >= MAX_NUMA_NODES - 1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "NUMA node %d is out of range", pl->node);
+		goto fail;
+	}
+	if (syscall(SYS_get_mempolicy, &pl->mode, pl->nodemask,
+	    MAX_NUMA_NODES, NULL, 0) == -1) {
+		/*
+		 * No NUMA support in the kernel, so there's
+		 * only one place the buffer can go.
+		 */
+		if (errno == ENOSYS)
+			return 0;
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "get_mempolicy: %s", pcap_strerror(errno));
+		goto fail;
+	}
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[pl->node / (8 * sizeof(unsigned long))] |=
+	    1UL << (pl->node % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask,
+	    MAX_NUMA_NODES) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't put the buffer on NUMA node %d: %s", pl->node,
+		    pcap_strerror(errno));
+		goto fail;
+	}
+	pl->saved = 1;
+	return 0;
+
+fail:
+	linux_unplace_capture(pl);
+	return -1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * The read routine for a ring placed on particular CPUs: pin whichever
+ * thread reads from it to them, the first time that thread reads, and
+ * then read with the ring's own routine.
+ */
+static int
+pcap_read_linux_pinned(pcap_t *handle, int max_packets,
+    pcap_handler callback, u_char *user)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+#ifdef HAVE_PTHREADS
+	if (!handlep->reader_pinned ||
+	    !pthread_equal(handlep->reader, pthread_self())) {
+#else
+	if (!handlep->reader_pinned) {
+#endif
+		if (sched_setaffinity(0, sizeof(handlep->reader_cpus),
+		    &handlep->reader_cpus) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "sched_setaffinity: %s", pcap_strerror(errno));
+			return PCAP_ERROR;
+		}
+#ifdef HAVE_PTHREADS
+		handlep->reader = pthread_self();
+#endif
+		handlep->reader_pinned = 1;
+	}
+	return handlep->pinned_read_op(handle, max_packets, callback, user);
+}
 
 /*
  * With older kernels promiscuous mode is kind of interesting because we
@@ -1221,6 +1839,14 @@ static void	pcap_cleanup_linux( pcap_t *handle )
 		free(handlep->device);
 		handlep->device = NULL;
 	}
+#ifdef HAVE_RECV_BATCH
+	if (handlep->rx_msgs != NULL) {
+		free(handlep->rx_msgs);
+		handlep->rx_msgs = NULL;
+	}
+	handlep->rx_batch = 0;
+#endif
+	linux_fanout_leave(handle);
 	pcap_cleanup_live_common(handle);
 }
 
@@ -1237,11 +1863,13 @@ pcap_activate_linux(pcap_t *handle)
 {
 	struct pcap_linux *handlep = handle->priv;
 	const char	*device;
-	int		status = 0;
+	int		ret, status = 0;
+	struct linux_placement placement;
 
 	device = handle->opt.source;
 
 	handle->inject_op = pcap_inject_linux;
+	handle->transmit_op = pcap_transmit_linux;
 	handle->setfilter_op = pcap_setfilter_linux;
 	handle->setdirection_op = pcap_setdirection_linux;
 	handle->set_datalink_op = pcap_set_datalink_linux;
@@ -1250,6 +1878,7 @@ pcap_activate_linux(pcap_t *handle)
 	handle->cleanup_op = pcap_cleanup_linux;
 	handle->read_op = pcap_read_linux;
 	handle->stats_op = pcap_stats_linux;
+	handle->stats64_op = pcap_stats64_linux;
 
 	/*
 	 * The "any" device is a special device which causes us not
@@ -1276,13 +1905,16 @@ pcap_activate_linux(pcap_t *handle)
 	/* copy timeout value */
 	handlep->timeout = handle->opt.timeout;
 
+	if (strcmp(device, "any") != 0)
+		handle->numa_node = linux_if_numa_node(device);
+
 	/*
 	 * If we're in promiscuous mode, then we probably want 
 	 * to see when the interface drops packets too, so get an
-	 * initial count from /proc/net/dev
+	 * initial count.
 	 */
 	if (handle->opt.promisc)
-		handlep->proc_dropped = linux_if_drops(handlep->device);
+		handlep->if_drops = linux_if_drops(handle);
 
 	/*
 	 * Current Linux kernels use the protocol family PF_PACKET to
@@ -1302,12 +1934,21 @@ pcap_activate_linux(pcap_t *handle)
 		 */
 		goto fail;
 	}
-	if (status == 1) {
+	if (status == 1 && handle->opt.recv_batch == 0) {
 		/*
-		 * Success.
-		 * Try to use memory-mapped access.
+		 * Success, and we weren't asked to read from the
+		 * socket directly.
+		 * Move to where we were asked to run, and try to use
+		 * memory-mapped access, with the ring put where we
+		 * were asked to put it.
 		 */
-		switch (activate_mmap(handle, &status)) {
+		if (linux_place_capture(handle, &placement) == -1) {
+			status = PCAP_ERROR;
+			goto fail;
+		}
+		ret = activate_mmap(handle, &status);
+		linux_unplace_capture(&placement);
+		switch (ret) {
 
 		case 1:
 			/*
@@ -1315,7 +1956,13 @@ pcap_activate_linux(pcap_t *handle)
 			 * set to the status to return,
 			 * which might be 0, or might be
 			 * a PCAP_WARNING_ value.
+			 * If the ring was put on particular
+			 * CPUs, its reader runs on them.
 			 */
+			if (handlep->pin_reader) {
+				handlep->pinned_read_op = handle->read_op;
+				handle->read_op = pcap_read_linux_pinned;
+			}
 			return status;
 
 		case 0:
@@ -1368,6 +2015,17 @@ pcap_activate_linux(pcap_t *handle)
 
 	/* Allocate the buffer */
 
+#ifdef HAVE_RECV_BATCH
+	/*
+	 * If we're going to receive packets in batches, that allocates
+	 * room for a batch of them.
+	 */
+	if (!handlep->sock_packet && linux_init_recv_batch(handle) == -1) {
+		status = PCAP_ERROR;
+		goto fail;
+	}
+	if (handlep->rx_batch == 0)
+#endif
 	handle->buffer	 = malloc(handle->bufsize + handle->offset);
 	if (!handle->buffer) {
 		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
@@ -1397,9 +2055,16 @@ fail:
 static int
 pcap_read_linux(pcap_t *handle, int max_packets, pcap_handler callback, u_char *user)
 {
+#ifdef HAVE_RECV_BATCH
+	struct pcap_linux *handlep = handle->priv;
+
+	if (handlep->rx_batch != 0)
+		return pcap_read_packets_batch(handle, max_packets, callback,
+		    user);
+#endif
 	/*
-	 * Currently, on Linux only one packet is delivered per read,
-	 * so we don't loop.
+	 * Otherwise, only one packet is delivered per read, so we
+	 * don't loop.
 	 */
 	return pcap_read_packet(handle, callback, user);
 }
@@ -1447,6 +2112,74 @@ linux_check_direction(const pcap_t *handle, const struct sockaddr_ll *sll)
 	return 1;
 }
 
+/*
+ * Get the DLT_ type of the link-layer header of packets from
+ * interfaces of the given ARPHRD_ type, as received on a SOCK_RAW
+ * socket, or -1 if we can only capture on those in cooked mode.
+ */
+static int
+linux_arphrd_to_dlt(pcap_t *handle, int arptype)
+{
+	int linktype = handle->linktype;
+	int offset = handle->offset;
+	u_int *dlt_list = handle->dlt_list;
+	int dlt_count = handle->dlt_count;
+	int dlt;
+
+	handle->dlt_list = NULL;
+	handle->dlt_count = 0;
+	map_arphrd_to_dlt(handle, arptype, 0);
+	dlt = handle->linktype;
+	if (handle->dlt_list != NULL)
+		free(handle->dlt_list);
+	handle->linktype = linktype;
+	handle->offset = offset;
+	handle->dlt_list = dlt_list;
+	handle->dlt_count = dlt_count;
+
+	if (dlt == DLT_LINUX_SLL || dlt == DLT_LINUX_IRDA ||
+	    dlt == DLT_LINUX_LAPD)
+		dlt = -1;
+	return dlt;
+}
+
+/*
+ * In per-interface mode, fill in, in the header, the interface a
+ * packet was seen on, the type of its link-layer header and its
+ * direction, and set "*vlan_offsetp" to where to re-insert a VLAN tag
+ * in it.  Returns 0 if it should be discarded, because it's from an
+ * interface whose link-layer header we have no DLT_ type for.
+ */
+static inline int
+linux_packet_interface(pcap_t *handle, const struct sockaddr_ll *sll,
+    struct pcap_pkthdr_if *hdr, int *vlan_offsetp)
+{
+	struct pcap_linux	*handlep = handle->priv;
+
+	hdr->if_index = sll->sll_ifindex;
+	hdr->if_direction = (sll->sll_pkttype == PACKET_OUTGOING) ?
+	    PCAP_D_OUT : PCAP_D_IN;
+	if (!handlep->any_native) {
+		hdr->if_dlt = handle->linktype;
+		return 1;
+	}
+
+	/*
+	 * Most packets come from interfaces of the same type as
+	 * the last one, so remember its DLT_ type.
+	 */
+	if (sll->sll_hatype != handlep->last_hatype) {
+		handlep->last_dlt = linux_arphrd_to_dlt(handle,
+		    sll->sll_hatype);
+		handlep->last_hatype = sll->sll_hatype;
+	}
+	if (handlep->last_dlt == -1)
+		return 0;
+	hdr->if_dlt = handlep->last_dlt;
+	*vlan_offsetp = (hdr->if_dlt == DLT_EN10MB) ? 2 * ETH_ALEN : -1;
+	return 1;
+}
+
 /*
  *  Read a packet from the socket calling the handler provided by
  *  the user. Returns the number of packets received or -1 if an
@@ -1460,14 +2193,12 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	int			offset;
 #ifdef HAVE_PF_PACKET_SOCKETS
 	struct sockaddr_ll	from;
-	struct sll_header	*hdrp;
 #else
 	struct sockaddr		from;
 #endif
 #if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
 	struct iovec		iov;
 	struct msghdr		msg;
-	struct cmsghdr		*cmsg;
 	union {
 		struct cmsghdr	cmsg;
 		char		buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
@@ -1475,8 +2206,7 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 #else /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
 	socklen_t		fromlen;
 #endif /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI) */
-	int			packet_len, caplen;
-	struct pcap_pkthdr	pcap_header;
+	int			packet_len;
 
 #ifdef HAVE_PF_PACKET_SOCKETS
 	/*
@@ -1577,6 +2307,42 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		}
 	}
 
+#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
+	return linux_handle_packet(handle, bp, packet_len, iov.iov_len, &msg,
+	    &from, NULL, callback, userdata);
+#else
+	return linux_handle_packet(handle, bp, packet_len,
+	    handle->bufsize - offset, NULL, &from, NULL, callback, userdata);
+#endif
+}
+
+/*
+ * Process a packet that's been received into "bp", which has "buflen"
+ * bytes of room for it after any cooked-mode header; "msg", if not
+ * null, is the message it was received with, for the auxiliary data,
+ * and "tsp", if not null, is its time stamp, otherwise we ask the
+ * socket for the time stamp of the last packet received.  Returns 1
+ * if the packet was handed to the callback, 0 if it was discarded,
+ * and PCAP_ERROR on an error.
+ */
+static int
+linux_handle_packet(pcap_t *handle, u_char *bp, int packet_len, size_t buflen,
+    struct msghdr *msg, void *fromp, const struct timeval *tsp,
+    pcap_handler callback, u_char *userdata)
+{
+	struct pcap_linux	*handlep = handle->priv;
+#ifdef HAVE_PF_PACKET_SOCKETS
+	struct sockaddr_ll	*from = fromp;
+	struct sll_header	*hdrp;
+#endif
+#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
+	struct cmsghdr		*cmsg;
+#endif
+	int			caplen;
+	struct pcap_pkthdr_if	pcap_header;
+	int			vlan_offset = handlep->vlan_offset;
+	struct bpf_aux_data	aux_data;
+
 #ifdef HAVE_PF_PACKET_SOCKETS
 	if (!handlep->sock_packet) {
 		/*
@@ -1592,7 +2358,7 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		 * It would save some instructions per packet, however.)
 		 */
 		if (handlep->ifindex != -1 &&
-		    from.sll_ifindex != handlep->ifindex)
+		    from->sll_ifindex != handlep->ifindex)
 			return 0;
 
 		/*
@@ -1601,7 +2367,12 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		 * address returned for SOCK_PACKET is a "sockaddr_pkt"
 		 * which lacks the relevant packet type information.
 		 */
-		if (!linux_check_direction(handle, &from))
+		if (!linux_check_direction(handle, from))
+			return 0;
+
+		if (handle->per_interface &&
+		    !linux_packet_interface(handle, from, &pcap_header,
+		    &vlan_offset))
 			return 0;
 	}
 #endif
@@ -1618,19 +2389,23 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 		packet_len += SLL_HDR_LEN;
 
 		hdrp = (struct sll_header *)bp;
-		hdrp->sll_pkttype = map_packet_type_to_sll_type(from.sll_pkttype);
-		hdrp->sll_hatype = htons(from.sll_hatype);
-		hdrp->sll_halen = htons(from.sll_halen);
-		memcpy(hdrp->sll_addr, from.sll_addr,
-		    (from.sll_halen > SLL_ADDRLEN) ?
+		hdrp->sll_pkttype = map_packet_type_to_sll_type(from->sll_pkttype);
+		hdrp->sll_hatype = htons(from->sll_hatype);
+		hdrp->sll_halen = htons(from->sll_halen);
+		memcpy(hdrp->sll_addr, from->sll_addr,
+		    (from->sll_halen > SLL_ADDRLEN) ?
 		      SLL_ADDRLEN :
-		      from.sll_halen);
-		hdrp->sll_protocol = from.sll_protocol;
+		      from->sll_halen);
+		hdrp->sll_protocol = from->sll_protocol;
 	}
 
+	pcap_header.vhdr.vlan_flags = 0;
+	aux_data.vlan_tag_present = 0;
+	aux_data.vlan_tag = 0;
 #if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_LINUX_TPACKET_AUXDATA_TP_VLAN_TCI)
-	if (handlep->vlan_offset != -1) {
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	if ((vlan_offset != -1 || handle->vlan_metadata) &&
+	    msg != NULL) {
+		for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 			struct tpacket_auxdata *aux;
 			unsigned int len;
 			struct vlan_tag *tag;
@@ -1650,15 +2425,28 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 #endif
 				continue;
 
-			len = packet_len > iov.iov_len ? iov.iov_len : packet_len;
-			if (len < (unsigned int) handlep->vlan_offset)
+			aux_data.vlan_tag_present = 1;
+			aux_data.vlan_tag = aux->tp_vlan_tci;
+			if (handle->vlan_metadata) {
+				/*
+				 * Leave the packet alone, and hand the
+				 * tag over in the header.
+				 */
+				pcap_header.vhdr.vlan_flags = PCAP_VLAN_VALID;
+				pcap_header.vhdr.vlan_tci = aux->tp_vlan_tci;
+				pcap_header.vhdr.vlan_tpid = VLAN_TPID(aux, aux);
+				break;
+			}
+
+			len = packet_len > buflen ? buflen : packet_len;
+			if (len < (unsigned int) vlan_offset)
 				break;
 
 			bp -= VLAN_TAG_LEN;
-			memmove(bp, bp + VLAN_TAG_LEN, handlep->vlan_offset);
+			memmove(bp, bp + VLAN_TAG_LEN, vlan_offset);
 
-			tag = (struct vlan_tag *)(bp + handlep->vlan_offset);
-			tag->vlan_tpid = htons(ETH_P_8021Q);
+			tag = (struct vlan_tag *)(bp + vlan_offset);
+			tag->vlan_tpid = htons(VLAN_TPID(aux, aux));
 			tag->vlan_tci = htons(aux->tp_vlan_tci);
 
 			packet_len += VLAN_TAG_LEN;
@@ -1705,8 +2493,8 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 
 	/* Run the packet filter if not using kernel filter */
 	if (handlep->filter_in_userland && handle->fcode.bf_insns) {
-		if (bpf_filter(handle->fcode.bf_insns, bp,
-		                packet_len, caplen) == 0)
+		if (bpf_filter_with_aux_data(handle->fcode.bf_insns, bp,
+		                packet_len, caplen, &aux_data) == 0)
 		{
 			/* rejected by filter */
 			return 0;
@@ -1716,9 +2504,12 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	/* Fill in our own header data */
 
 	/* get timestamp for this packet */
+	if (tsp != NULL)
+		pcap_header.vhdr.hdr.ts = *tsp;
+	else
 #if defined(SIOCGSTAMPNS) && defined(SO_TIMESTAMPNS)
 	if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
-		if (ioctl(handle->fd, SIOCGSTAMPNS, &pcap_header.ts) == -1) {
+		if (ioctl(handle->fd, SIOCGSTAMPNS, &pcap_header.vhdr.hdr.ts) == -1) {
 			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
 					"SIOCGSTAMPNS: %s", pcap_strerror(errno));
 			return PCAP_ERROR;
@@ -1726,15 +2517,20 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
         } else
 #endif
 	{
-		if (ioctl(handle->fd, SIOCGSTAMP, &pcap_header.ts) == -1) {
+		if (ioctl(handle->fd, SIOCGSTAMP, &pcap_header.vhdr.hdr.ts) == -1) {
 			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
 					"SIOCGSTAMP: %s", pcap_strerror(errno));
 			return PCAP_ERROR;
 		}
         }
 
-	pcap_header.caplen	= caplen;
-	pcap_header.len		= packet_len;
+	pcap_header.vhdr.hdr.caplen	= caplen;
+	pcap_header.vhdr.hdr.len	= packet_len;
+
+	/* Run the filter for the packet's interface, if there is one */
+	if (handle->if_filter_count != 0 &&
+	    !pcap_filter_if(handle, &pcap_header, bp))
+		return 0;
 
 	/*
 	 * Count the packet.
@@ -1783,18 +2579,204 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	handlep->packets_read++;
 
 	/* Call the user supplied callback function */
-	callback(userdata, &pcap_header, bp);
+	callback(userdata, &pcap_header.vhdr.hdr, bp);
+
+	return 1;
+}
+
+#ifdef HAVE_RECV_BATCH
+/*
+ * Set up to receive packets in batches with recvmmsg(); the batch size
+ * can be set with pcap_set_recv_batch(), with 1 meaning "don't batch".
+ * Allocates handle->buffer with room for a batch of packets if
+ * batching; returns -1 on an error.
+ */
+static int
+linux_init_recv_batch(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct iovec *iov;
+	struct sockaddr_ll *from;
+	char *cmsgs;
+	size_t cmsglen;
+	int n, i, offset, one = 1;
+
+	handlep->rx_batch = 0;
+	n = handle->opt.recv_batch != 0 ? handle->opt.recv_batch :
+	    RECV_BATCH_DEFAULT;
+	if (n <= 1)
+		return 0;
+	if (n > RECV_BATCH_MAX)
+		n = RECV_BATCH_MAX;
+
+	/*
+	 * SIOCGSTAMP only gives the time stamp of the last packet
+	 * received, so we need the time stamps delivered along with
+	 * the packets; for nanosecond time stamps, activate_new()
+	 * has already asked for that.  If we can't get them, don't
+	 * batch.
+	 */
+	if (handle->opt.tstamp_precision != PCAP_TSTAMP_PRECISION_NANO &&
+	    setsockopt(handle->fd, SOL_SOCKET, SO_TIMESTAMP, &one,
+	    sizeof(one)) == -1)
+		return 0;
+
+	cmsglen = CMSG_SPACE(sizeof(struct tpacket_auxdata)) +
+	    CMSG_SPACE(sizeof(struct timespec));
+	handlep->rx_msgs = calloc(n, sizeof(struct mmsghdr) +
+	    sizeof(struct iovec) + cmsglen + sizeof(struct sockaddr_ll));
+	if (handlep->rx_msgs == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			 "malloc: %s", pcap_strerror(errno));
+		return -1;
+	}
+	iov = (struct iovec *)&handlep->rx_msgs[n];
+	cmsgs = (char *)&iov[n];
+	from = (struct sockaddr_ll *)(cmsgs + n * cmsglen);
+
+	handlep->rx_slotlen = (handle->bufsize + handle->offset + 7) & ~7;
+	handle->buffer = malloc(n * handlep->rx_slotlen);
+	if (handle->buffer == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			 "malloc: %s", pcap_strerror(errno));
+		free(handlep->rx_msgs);
+		handlep->rx_msgs = NULL;
+		return -1;
+	}
+
+	/*
+	 * If this is a cooked device, leave extra room for a
+	 * fake packet header.
+	 */
+	offset = handlep->cooked ? SLL_HDR_LEN : 0;
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = handle->buffer + i * handlep->rx_slotlen +
+		    handle->offset + offset;
+		iov[i].iov_len = handle->bufsize - offset;
+		handlep->rx_msgs[i].msg_hdr.msg_iov = &iov[i];
+		handlep->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		handlep->rx_msgs[i].msg_hdr.msg_name = &from[i];
+		handlep->rx_msgs[i].msg_hdr.msg_control = cmsgs + i * cmsglen;
+	}
+	handlep->rx_batch = n;
+	handlep->rx_count = handlep->rx_next = 0;
+	return 0;
+}
+
+/*
+ * Read a batch of packets from the socket with recvmmsg(), unless
+ * some from the last batch haven't been processed yet, and hand at
+ * most max_packets of them to the callback.
+ */
+static int
+pcap_read_packets_batch(pcap_t *handle, int max_packets,
+    pcap_handler callback, u_char *userdata)
+{
+	struct pcap_linux	*handlep = handle->priv;
+	struct msghdr		*msg;
+	struct cmsghdr		*cmsg;
+	struct timeval		ts, *tsp;
+#ifdef SO_TIMESTAMPNS
+	struct timespec		tsn;
+#endif
+	u_char			*bp;
+	size_t			cmsglen;
+	int			n, i, ret, count = 0;
+
+	if (handlep->rx_next == handlep->rx_count) {
+		cmsglen = CMSG_SPACE(sizeof(struct tpacket_auxdata)) +
+		    CMSG_SPACE(sizeof(struct timespec));
+		for (i = 0; i < handlep->rx_batch; i++) {
+			msg = &handlep->rx_msgs[i].msg_hdr;
+			msg->msg_namelen = sizeof(struct sockaddr_ll);
+			msg->msg_controllen = cmsglen;
+			msg->msg_flags = 0;
+		}
+
+		/*
+		 * As in pcap_read_packet(), we ignore EINTR; we
+		 * block only until the first packet arrives.
+		 */
+		do {
+			if (handle->break_loop) {
+				handle->break_loop = 0;
+				return PCAP_ERROR_BREAK;
+			}
+			n = recvmmsg(handle->fd, handlep->rx_msgs,
+			    handlep->rx_batch, MSG_TRUNC|MSG_WAITFORONE, NULL);
+		} while (n == -1 && errno == EINTR);
+
+		if (n == -1) {
+			switch (errno) {
+
+			case EAGAIN:
+				return 0;	/* no packet there */
+
+			case ENETDOWN:
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+					"The interface went down");
+				return PCAP_ERROR;
+
+			default:
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+					 "recvmmsg: %s", pcap_strerror(errno));
+				return PCAP_ERROR;
+			}
+		}
+		handlep->rx_count = n;
+		handlep->rx_next = 0;
+	}
+
+	while (handlep->rx_next < handlep->rx_count &&
+	    (max_packets <= 0 || count < max_packets)) {
+		i = handlep->rx_next++;
+		msg = &handlep->rx_msgs[i].msg_hdr;
+		bp = handle->buffer + i * handlep->rx_slotlen + handle->offset;
+
+		tsp = NULL;
+		for (cmsg = CMSG_FIRSTHDR(msg); cmsg;
+		    cmsg = CMSG_NXTHDR(msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET)
+				continue;
+#ifdef SO_TIMESTAMPNS
+			if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				memcpy(&tsn, CMSG_DATA(cmsg), sizeof(tsn));
+				ts.tv_sec = tsn.tv_sec;
+				ts.tv_usec = tsn.tv_nsec;
+				tsp = &ts;
+			}
+#endif
+			if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				tsp = &ts;
+			}
+		}
+
+		ret = linux_handle_packet(handle, bp,
+		    handlep->rx_msgs[i].msg_len, msg->msg_iov->iov_len, msg,
+		    msg->msg_name, tsp, callback, userdata);
+		if (ret < 0)
+			return ret;
+		count += ret;
 
-	return 1;
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+	}
+	return count;
 }
+#endif /* HAVE_RECV_BATCH */
 
+/*
+ * Check whether we can send on this handle.
+ */
 static int
-pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
+linux_can_inject(pcap_t *handle)
 {
+#ifdef HAVE_PF_PACKET_SOCKETS
 	struct pcap_linux *handlep = handle->priv;
-	int ret;
 
-#ifdef HAVE_PF_PACKET_SOCKETS
 	if (!handlep->sock_packet) {
 		/* PF_PACKET socket */
 		if (handlep->ifindex == -1) {
@@ -1822,6 +2804,281 @@ pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
 		}
 	}
 #endif
+	return (0);
+}
+
+#ifdef HAVE_PACKET_TX_RING
+/*
+ * Transmit ring frames start with a tpacket_hdr or tpacket2_hdr, as
+ * receive ring frames do; the packet data follows the aligned header.
+ */
+static union thdr
+tx_ring_frame(struct pcap_linux *handlep, u_int i)
+{
+	union thdr h;
+
+	h.raw = handlep->txring +
+	    (i / handlep->tx_frames_per_block) * handlep->tx_block_size +
+	    (i % handlep->tx_frames_per_block) * handlep->tx_frame_size;
+	return h;
+}
+
+static u_int
+tx_ring_status(struct pcap_linux *handlep, union thdr h)
+{
+	switch (handlep->tp_version) {
+	case TPACKET_V1:
+		return (h.h1->tp_status);
+#ifdef HAVE_TPACKET2
+	case TPACKET_V2:
+		return (h.h2->tp_status);
+#endif
+	}
+	return (TP_STATUS_AVAILABLE);
+}
+
+static void
+tx_ring_set(struct pcap_linux *handlep, union thdr h, u_int status,
+    u_int len)
+{
+	switch (handlep->tp_version) {
+	case TPACKET_V1:
+		if (status == TP_STATUS_SEND_REQUEST)
+			h.h1->tp_len = len;
+		h.h1->tp_status = status;
+		break;
+#ifdef HAVE_TPACKET2
+	case TPACKET_V2:
+		if (status == TP_STATUS_SEND_REQUEST)
+			h.h2->tp_len = len;
+		h.h2->tp_status = status;
+		break;
+#endif
+	}
+}
+
+static u_int
+tx_ring_len(struct pcap_linux *handlep, union thdr h)
+{
+	switch (handlep->tp_version) {
+	case TPACKET_V1:
+		return (h.h1->tp_len);
+#ifdef HAVE_TPACKET2
+	case TPACKET_V2:
+		return (h.h2->tp_len);
+#endif
+	}
+	return (0);
+}
+
+/*
+ * The kernel refused the frame at "first", the first of the "n"
+ * frames still waiting to go; it marks such a frame
+ * TP_STATUS_WRONG_FORMAT and doesn't advance its ring position past
+ * it, so nothing after it would ever be sent.  Move the frames
+ * after it down one slot, so the kernel finds the next one where
+ * it's looking, and free the slot left at the end.
+ */
+static void
+tx_ring_drop(struct pcap_linux *handlep, u_int first, u_int n)
+{
+	union thdr to, from;
+	u_int i, len, off;
+
+	off = TPACKET_ALIGN(handlep->tp_hdrlen);
+	to = tx_ring_frame(handlep, first);
+	for (i = 1; i < n; i++) {
+		from = tx_ring_frame(handlep,
+		    (first + i) % handlep->tx_frame_nr);
+		len = tx_ring_len(handlep, from);
+		memcpy((u_char *)to.raw + off, (u_char *)from.raw + off, len);
+		tx_ring_set(handlep, to, TP_STATUS_SEND_REQUEST, len);
+		to = from;
+	}
+	tx_ring_set(handlep, to, TP_STATUS_AVAILABLE, 0);
+	handlep->tx_head = (first + n - 1) % handlep->tx_frame_nr;
+}
+
+/*
+ * Have the kernel send the "n" frames we've filled starting at
+ * "first"; they're the frames up to handlep->tx_head.
+ *
+ * The send blocks until the kernel is done with the frames, each of
+ * which it either hands to the device, leaving it TP_STATUS_SENDING
+ * or, once the device is done with it, TP_STATUS_AVAILABLE, or
+ * refuses, marking it TP_STATUS_WRONG_FORMAT and stopping there.  We
+ * don't ask for PACKET_LOSS, with which the kernel would instead
+ * quietly set a refused frame back to TP_STATUS_AVAILABLE, making it
+ * look just like one that was sent.  A refused frame is counted as
+ * failed and squeezed out of the ring, and the send is redone for
+ * the frames after it.
+ */
+static int
+tx_ring_flush(pcap_t *handle, u_int first, u_int n, u_int *sent,
+    u_int *failed)
+{
+	struct pcap_linux *handlep = handle->priv;
+	union thdr h;
+	int ret, err;
+	u_int i, status, left;
+
+	while (n != 0) {
+		ret = send(handle->fd, NULL, 0, 0);
+		err = errno;
+		left = n;
+		for (; n != 0; first = (first + 1) % handlep->tx_frame_nr, n--) {
+			h = tx_ring_frame(handlep, first);
+			status = tx_ring_status(handlep, h);
+			if (status & (TP_STATUS_SEND_REQUEST|TP_STATUS_WRONG_FORMAT))
+				break;
+			(*sent)++;
+		}
+		if (n == 0)
+			break;
+		if (status & TP_STATUS_WRONG_FORMAT) {
+			(*failed)++;
+			tx_ring_drop(handlep, first, n);
+			n--;
+			continue;
+		}
+
+		/*
+		 * The kernel stopped short of this frame; if it got
+		 * something sent, go around again.  Otherwise give
+		 * back this frame and the ones after it, which the
+		 * kernel hasn't looked at; it'll start with this slot
+		 * next time.
+		 */
+		if (ret != -1 && n < left)
+			continue;
+		for (i = 0; i < n; i++) {
+			h = tx_ring_frame(handlep,
+			    (first + i) % handlep->tx_frame_nr);
+			tx_ring_set(handlep, h, TP_STATUS_AVAILABLE, 0);
+		}
+		*failed += n;
+		handlep->tx_head = first;
+		if (ret == -1)
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "send: %s",
+			    pcap_strerror(err));
+		else
+			strlcpy(handle->errbuf,
+			    "transmit ring frames weren't sent",
+			    PCAP_ERRBUF_SIZE);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Copy a packet into the next free transmit ring frame; returns -1,
+ * with the error buffer filled in, if it can't be queued.
+ */
+static int
+tx_ring_put(pcap_t *handle, const void *buf, size_t size)
+{
+	struct pcap_linux *handlep = handle->priv;
+	union thdr h;
+
+	if (size > handlep->tx_frame_size -
+	    TPACKET_ALIGN(handlep->tp_hdrlen)) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "packet of %lu bytes is too large for the transmit ring",
+		    (unsigned long)size);
+		return (-1);
+	}
+	h = tx_ring_frame(handlep, handlep->tx_head);
+	if (tx_ring_status(handlep, h) != TP_STATUS_AVAILABLE) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "transmit ring is full");
+		return (-1);
+	}
+	memcpy((u_char *)h.raw + TPACKET_ALIGN(handlep->tp_hdrlen), buf,
+	    size);
+	tx_ring_set(handlep, h, TP_STATUS_SEND_REQUEST, size);
+	handlep->tx_head = (handlep->tx_head + 1) % handlep->tx_frame_nr;
+	return (0);
+}
+
+/*
+ * Fill the transmit ring from a send queue, a ringful at a time.
+ */
+static int
+tx_ring_transmit(pcap_t *handle, struct pcap_send_queue *q)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_pkthdr hdr;
+	u_int off, first, n;
+	int ret = 0;
+
+	first = handlep->tx_head;
+	n = 0;
+	for (off = 0; q->len - off >= sizeof(hdr);
+	    off += sizeof(hdr) + hdr.caplen) {
+		memcpy(&hdr, q->buffer + off, sizeof(hdr));
+		if (q->len - off - sizeof(hdr) < hdr.caplen)
+			break;
+		if (n == handlep->tx_frame_nr) {
+			if (tx_ring_flush(handle, first, n, &q->sent,
+			    &q->failed) == -1)
+				ret = -1;
+			first = handlep->tx_head;
+			n = 0;
+		}
+		if (tx_ring_put(handle, q->buffer + off + sizeof(hdr),
+		    hdr.caplen) == -1) {
+			q->failed++;
+			continue;
+		}
+		n++;
+	}
+	if (n != 0 &&
+	    tx_ring_flush(handle, first, n, &q->sent, &q->failed) == -1)
+		ret = -1;
+	if (q->sent == 0 && q->failed != 0) {
+		if (ret != -1)
+			strlcpy(handle->errbuf,
+			    "packets rejected by the transmit ring",
+			    PCAP_ERRBUF_SIZE);
+		return (-1);
+	}
+	return (q->sent);
+}
+#endif /* HAVE_PACKET_TX_RING */
+
+static int
+pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
+{
+	int ret;
+#ifdef HAVE_PACKET_TX_RING
+	struct pcap_linux *handlep = handle->priv;
+	u_int sent = 0, failed = 0;
+	u_int first;
+#endif
+
+	if (linux_can_inject(handle) == -1)
+		return (-1);
+
+#ifdef HAVE_PACKET_TX_RING
+	/*
+	 * Once a socket has a transmit ring, everything sent on it
+	 * goes through the ring.
+	 */
+	if (handlep->txring != NULL) {
+		first = handlep->tx_head;
+		if (tx_ring_put(handle, buf, size) == -1)
+			return (-1);
+		if (tx_ring_flush(handle, first, 1, &sent, &failed) == -1)
+			return (-1);
+		if (sent == 0) {
+			strlcpy(handle->errbuf,
+			    "packet rejected by the transmit ring",
+			    PCAP_ERRBUF_SIZE);
+			return (-1);
+		}
+		return (size);
+	}
+#endif
 
 	ret = send(handle->fd, buf, size, 0);
 	if (ret == -1) {
@@ -1832,6 +3089,92 @@ pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
 	return (ret);
 }                           
 
+/*
+ * Send the contents of a send queue: through the transmit ring if
+ * there is one, otherwise with sendmmsg(), which gets a batch of
+ * packets to the kernel per system call.
+ */
+#define TX_BATCH	64
+
+static int
+pcap_transmit_linux(pcap_t *handle, struct pcap_send_queue *q)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[TX_BATCH];
+	struct iovec iov[TX_BATCH];
+	u_int i, n;
+	int ret;
+#endif
+	struct pcap_pkthdr hdr;
+	u_int off;
+
+	if (linux_can_inject(handle) == -1)
+		return (-1);
+
+#ifdef HAVE_PACKET_TX_RING
+	if (((struct pcap_linux *)handle->priv)->txring != NULL)
+		return (tx_ring_transmit(handle, q));
+#endif
+
+#ifdef HAVE_SENDMMSG
+	memset(msgs, 0, sizeof(msgs));
+	off = 0;
+	for (;;) {
+		for (n = 0; n < TX_BATCH && q->len - off >= sizeof(hdr);
+		    n++, off += sizeof(hdr) + hdr.caplen) {
+			memcpy(&hdr, q->buffer + off, sizeof(hdr));
+			if (q->len - off - sizeof(hdr) < hdr.caplen) {
+				off = q->len;
+				break;
+			}
+			iov[n].iov_base = q->buffer + off + sizeof(hdr);
+			iov[n].iov_len = hdr.caplen;
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+		}
+		if (n == 0)
+			break;
+
+		/*
+		 * sendmmsg() stops at the first packet it can't send,
+		 * reporting that error only if it's the first one in
+		 * the batch; skip it and carry on with the rest.
+		 */
+		for (i = 0; i < n; ) {
+			ret = sendmmsg(handle->fd, &msgs[i], n - i, 0);
+			if (ret == -1) {
+				if (errno == EINTR)
+					continue;
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				    "sendmmsg: %s", pcap_strerror(errno));
+				q->failed++;
+				i++;
+			} else {
+				q->sent += ret;
+				i += ret;
+			}
+		}
+	}
+#else /* HAVE_SENDMMSG */
+	for (off = 0; q->len - off >= sizeof(hdr);
+	    off += sizeof(hdr) + hdr.caplen) {
+		memcpy(&hdr, q->buffer + off, sizeof(hdr));
+		if (q->len - off - sizeof(hdr) < hdr.caplen)
+			break;
+		if (send(handle->fd, q->buffer + off + sizeof(hdr),
+		    hdr.caplen, 0) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "send: %s",
+			    pcap_strerror(errno));
+			q->failed++;
+		} else
+			q->sent++;
+	}
+#endif /* HAVE_SENDMMSG */
+	if (q->sent == 0 && q->failed != 0)
+		return (-1);
+	return (q->sent);
+}
+
 /*
  *  Get the statistics for the given packet capture handle.
  *  Reports the number of dropped packets iff the kernel supports
@@ -1841,7 +3184,7 @@ pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
  *  and report 0 as the count of dropped packets.
  */
 static int
-pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
+linux_update_stats(pcap_t *handle)
 {
 	struct pcap_linux *handlep = handle->priv;
 #ifdef HAVE_TPACKET_STATS
@@ -1867,16 +3210,19 @@ pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
 	socklen_t len = sizeof (struct tpacket_stats);
 #endif /* HAVE_TPACKET_STATS */
 
-	long if_dropped = 0;
+	u_int64_t if_drops;
 	
 	/* 
-	 *	To fill in ps_ifdrop, we parse /proc/net/dev for the number
+	 *	To fill in ps_ifdrop, we get the interface's drop count;
+	 *	if it went backwards, the interface was probably
+	 *	removed and re-created, so start counting again.
 	 */
 	if (handle->opt.promisc)
 	{
-		if_dropped = handlep->proc_dropped;
-		handlep->proc_dropped = linux_if_drops(handlep->device);
-		handlep->stat.ps_ifdrop += (handlep->proc_dropped - if_dropped);
+		if_drops = linux_if_drops(handle);
+		if (if_drops > handlep->if_drops)
+			handlep->stat.ps_ifdrop += if_drops - handlep->if_drops;
+		handlep->if_drops = if_drops;
 	}
 
 #ifdef HAVE_TPACKET_STATS
@@ -1934,7 +3280,6 @@ pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
 		 */
 		handlep->stat.ps_recv += kstats.tp_packets;
 		handlep->stat.ps_drop += kstats.tp_drops;
-		*stats = handlep->stat;
 		return 0;
 	}
 	else
@@ -1978,12 +3323,40 @@ pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
 	 * how many the interface dropped, so we can return that.
 	 */
 	 
-	stats->ps_recv = handlep->packets_read;
-	stats->ps_drop = 0;
-	stats->ps_ifdrop = handlep->stat.ps_ifdrop;
+	handlep->stat.ps_recv = handlep->packets_read;
+	handlep->stat.ps_drop = 0;
+	return 0;
+}
+
+/*
+ *  Get the statistics; we accumulate them in 64 bits, and the 32-bit
+ *  ones just wrap.
+ */
+static int
+pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (linux_update_stats(handle) == -1)
+		return -1;
+	stats->ps_recv = (u_int)handlep->stat.ps_recv;
+	stats->ps_drop = (u_int)handlep->stat.ps_drop;
+	stats->ps_ifdrop = (u_int)handlep->stat.ps_ifdrop;
+	return 0;
+}
+
+static int
+pcap_stats64_linux(pcap_t *handle, struct pcap_stat64 *stats)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (linux_update_stats(handle) == -1)
+		return -1;
+	*stats = handlep->stat;
 	return 0;
 }
 
+#ifndef HAVE_NETLINK_FINDALLDEVS
 /*
  * Get from "/sys/class/net" all interfaces listed there; if they're
  * already in the list of interfaces we have, that won't add another
@@ -2315,6 +3688,7 @@ scan_proc_net_dev(pcap_if_t **devlistp, char *errbuf)
 	(void)fclose(proc_net_f);
 	return (ret);
 }
+#endif /* HAVE_NETLINK_FINDALLDEVS */
 
 /*
  * Description string for the "any" device.
@@ -2324,6 +3698,7 @@ static const char any_descr[] = "Pseudo-device that captures on all interfaces";
 int
 pcap_platform_finddevs(pcap_if_t **alldevsp, char *errbuf)
 {
+#ifndef HAVE_NETLINK_FINDALLDEVS
 	int ret;
 
 	/*
@@ -2344,6 +3719,12 @@ pcap_platform_finddevs(pcap_if_t **alldevsp, char *errbuf)
 		if (scan_proc_net_dev(alldevsp, errbuf) == -1)
 			return (-1);
 	}
+#else
+	/*
+	 * The rtnetlink link dump gave us the interfaces with no
+	 * addresses along with the rest of them.
+	 */
+#endif /* HAVE_NETLINK_FINDALLDEVS */
 
 	/*
 	 * Add the "any" device.
@@ -2378,6 +3759,22 @@ pcap_setfilter_linux_common(pcap_t *handle, struct bpf_program *filter,
 
 	handlep = handle->priv;
 
+	/*
+	 * Packets on a per-interface "any" capture have different
+	 * link-layer headers; a filter compiled for the handle looks
+	 * at nothing but the length and raw link[] bytes, which works
+	 * for all of them.
+	 */
+
+#ifdef HAVE_RECV_BATCH
+	/*
+	 * Packets from the last recvmmsg() that we haven't processed
+	 * yet were accepted by the old filter; discard them, just as
+	 * we discard the ones queued on the socket below.
+	 */
+	handlep->rx_next = handlep->rx_count;
+#endif
+
 	/* Make our private copy of the filter */
 
 	if (install_bpf_program(handle, filter) < 0)
@@ -2999,7 +4396,8 @@ activate_new(pcap_t *handle)
 	const char		*device = handle->opt.source;
 	int			is_any_device = (strcmp(device, "any") == 0);
 	int			sock_fd = -1, arptype;
-#ifdef HAVE_PACKET_AUXDATA
+#if defined(HAVE_PACKET_AUXDATA) || defined(PACKET_QDISC_BYPASS) || \
+    defined(PACKET_FANOUT)
 	int			val;
 #endif
 	int			err = 0;
@@ -3008,10 +4406,13 @@ activate_new(pcap_t *handle)
 	/*
 	 * Open a socket with protocol family packet. If the
 	 * "any" device was specified, we open a SOCK_DGRAM
-	 * socket for the cooked interface, otherwise we first
-	 * try a SOCK_RAW socket for the raw interface.
+	 * socket for the cooked interface, unless we're in
+	 * per-interface mode, in which case we want each
+	 * packet with its own link-layer header; otherwise we
+	 * first try a SOCK_RAW socket for the raw interface.
 	 */
-	sock_fd = is_any_device ?
+	handlep->any_native = is_any_device && handle->opt.per_interface;
+	sock_fd = is_any_device && !handlep->any_native ?
 		socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL)) :
 		socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 
@@ -3043,6 +4444,13 @@ activate_new(pcap_t *handle)
 	/* It seems the kernel supports the new interface. */
 	handlep->sock_packet = 0;
 
+	/*
+	 * In per-interface mode, the headers handed to the callback
+	 * are struct pcap_pkthdr_if.
+	 */
+	if (handle->opt.per_interface)
+		handle->per_interface = 1;
+
 	/*
 	 * Get the interface index of the loopback device.
 	 * If the attempt fails, don't fail, just set the
@@ -3211,11 +4619,23 @@ activate_new(pcap_t *handle)
 			return PCAP_ERROR_RFMON_NOTSUP;
 		}
 
-		/*
-		 * It uses cooked mode.
-		 */
-		handlep->cooked = 1;
-		handle->linktype = DLT_LINUX_SLL;
+		if (handlep->any_native) {
+			/*
+			 * Each packet has the link-layer header of
+			 * the interface it was seen on; the type of
+			 * that header is handed over with it.
+			 */
+			handlep->cooked = 0;
+			handle->linktype = DLT_PCAPNG;
+			handlep->last_hatype = -1;
+			handlep->last_dlt = -1;
+		} else {
+			/*
+			 * It uses cooked mode.
+			 */
+			handlep->cooked = 1;
+			handle->linktype = DLT_LINUX_SLL;
+		}
 
 		/*
 		 * We're not bound to a device.
@@ -3249,32 +4669,103 @@ activate_new(pcap_t *handle)
 	 * disable it in programs such as tcpdump).
 	 */
 
-	if (!is_any_device && handle->opt.promisc) {
-		memset(&mr, 0, sizeof(mr));
-		mr.mr_ifindex = handlep->ifindex;
-		mr.mr_type    = PACKET_MR_PROMISC;
-		if (setsockopt(sock_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
-		    &mr, sizeof(mr)) == -1) {
+	if (!is_any_device && handle->opt.promisc) {
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = handlep->ifindex;
+		mr.mr_type    = PACKET_MR_PROMISC;
+		if (setsockopt(sock_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+		    &mr, sizeof(mr)) == -1) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				"setsockopt: %s", pcap_strerror(errno));
+			close(sock_fd);
+			return PCAP_ERROR;
+		}
+	}
+
+	/* Enable auxillary data if supported and reserve room for
+	 * reconstructing VLAN headers. */
+#ifdef HAVE_PACKET_AUXDATA
+	val = 1;
+	if (setsockopt(sock_fd, SOL_PACKET, PACKET_AUXDATA, &val,
+		       sizeof(val)) == -1) {
+		if (errno != ENOPROTOOPT) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				 "setsockopt: %s", pcap_strerror(errno));
+			close(sock_fd);
+			return PCAP_ERROR;
+		}
+	} else if (handle->opt.vlan_metadata) {
+		/*
+		 * In VLAN metadata mode, tags the kernel has stripped
+		 * are handed over in a struct pcap_pkthdr_vlan rather
+		 * than put back into the packet, and "vlan" in a filter
+		 * tests them with the kernel's special VLAN offsets.
+		 * Without the auxiliary data we don't get the tags, so
+		 * the mode is left off.
+		 */
+		handle->vlan_metadata = 1;
+#ifdef SKF_AD_VLAN_TAG_PRESENT
+		handle->bpf_codegen_flags |= BPF_SPECIAL_VLAN_HANDLING;
+#endif
+	}
+	handle->offset += VLAN_TAG_LEN;
+#endif /* HAVE_PACKET_AUXDATA */
+
+	/*
+	 * If asked to, have packets we send go straight to the
+	 * driver rather than through the device's queueing
+	 * discipline; kernels that don't support that send them
+	 * the usual way.
+	 */
+#ifdef PACKET_QDISC_BYPASS
+	if (handle->opt.qdisc_bypass) {
+		val = 1;
+		if (setsockopt(sock_fd, SOL_PACKET, PACKET_QDISC_BYPASS, &val,
+			       sizeof(val)) == -1 && errno != ENOPROTOOPT) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				 "setsockopt: %s", pcap_strerror(errno));
+			close(sock_fd);
+			return PCAP_ERROR;
+		}
+	}
+#endif /* PACKET_QDISC_BYPASS */
+
+	/*
+	 * Join the fanout group, if asked to, so that the group's
+	 * sockets split the packets between them.
+	 */
+	if (handle->opt.fanout_group >= 0) {
+#ifdef PACKET_FANOUT
+		switch (handle->opt.fanout_mode) {
+
+		case PCAP_FANOUT_LB:
+			val = PACKET_FANOUT_LB;
+			break;
+
+		case PCAP_FANOUT_CPU:
+			val = PACKET_FANOUT_CPU;
+			break;
+
+		default:
+			val = PACKET_FANOUT_HASH;
+			break;
+		}
+		val = (val << 16) | handle->opt.fanout_group;
+		if (setsockopt(sock_fd, SOL_PACKET, PACKET_FANOUT, &val,
+			       sizeof(val)) == -1) {
 			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-				"setsockopt: %s", pcap_strerror(errno));
+				 "setsockopt (PACKET_FANOUT): %s",
+				 pcap_strerror(errno));
 			close(sock_fd);
 			return PCAP_ERROR;
 		}
-	}
-
-	/* Enable auxillary data if supported and reserve room for
-	 * reconstructing VLAN headers. */
-#ifdef HAVE_PACKET_AUXDATA
-	val = 1;
-	if (setsockopt(sock_fd, SOL_PACKET, PACKET_AUXDATA, &val,
-		       sizeof(val)) == -1 && errno != ENOPROTOOPT) {
+#else
 		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
-			 "setsockopt: %s", pcap_strerror(errno));
+			 "Fanout groups aren't supported by this version of libpcap");
 		close(sock_fd);
 		return PCAP_ERROR;
+#endif
 	}
-	handle->offset += VLAN_TAG_LEN;
-#endif /* HAVE_PACKET_AUXDATA */
 
 	/*
 	 * This is a 2.2[.x] or later kernel (we know that
@@ -3397,6 +4888,50 @@ activate_mmap(pcap_t *handle, int *status)
 		return -1;
 	}
 
+#ifdef HAVE_TPACKET3
+	if (handlep->tp_version == TPACKET_V3) {
+		handlep->block_refs = calloc(handle->cc,
+		    sizeof(*handlep->block_refs));
+		if (handlep->block_refs == NULL) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				 "can't allocate block reference counts: %s",
+				 pcap_strerror(errno));
+			destroy_ring(handle);
+			free(handlep->oneshot_buffer);
+			*status = PCAP_ERROR;
+			return -1;
+		}
+		handlep->held_block = -1;
+	}
+#endif
+
+	if (handle->opt.latency_hist) {
+		handle->lat_hist = calloc(1, sizeof(*handle->lat_hist));
+		if (handle->lat_hist == NULL) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				 "can't allocate latency histogram: %s",
+				 pcap_strerror(errno));
+			destroy_ring(handle);
+			free(handlep->oneshot_buffer);
+#ifdef HAVE_TPACKET3
+			free((void *)handlep->block_refs);
+			handlep->block_refs = NULL;
+#endif
+			*status = PCAP_ERROR;
+			return -1;
+		}
+	}
+#ifdef SO_BUSY_POLL
+	/*
+	 * If we're going to spin waiting for packets, have the kernel
+	 * busy-poll the device for them, too; that may need more
+	 * privilege than we have, in which case we just spin.
+	 */
+	if (handle->opt.busy_poll > 0)
+		(void)setsockopt(handle->fd, SOL_SOCKET, SO_BUSY_POLL,
+		    &handle->opt.busy_poll, sizeof(handle->opt.busy_poll));
+#endif
+
 	/*
 	 * Success.  *status has been set either to 0 if there are no
 	 * warnings or to a PCAP_WARNING_ value if there is a warning.
@@ -3419,6 +4954,10 @@ activate_mmap(pcap_t *handle, int *status)
 #ifdef HAVE_TPACKET3
 	case TPACKET_V3:
 		handle->read_op = pcap_read_linux_mmap_v3;
+		handle->retain_op = pcap_retain_linux_mmap;
+		handle->release_op = pcap_release_linux_mmap;
+		handle->block_header_op = pcap_block_header_linux_mmap;
+		handle->write_blocks_op = pcap_write_blocks_linux_mmap;
 		break;
 #endif
 	}
@@ -3523,8 +5062,12 @@ prepare_tpacket_socket(pcap_t *handle)
 	 * The buffering cannot be disabled in that mode, so
 	 * if the user has requested immediate mode, we don't
 	 * use TPACKET_V3.
+	 *
+	 * We also only know how to build TPACKET_V1 and TPACKET_V2
+	 * transmit ring frames, so don't use it if a transmit ring
+	 * was requested.
 	 */
-	if (handle->opt.immediate)
+	if (handle->opt.immediate || handle->opt.tx_ring)
 		ret = 1; /* pretend TPACKET_V3 couldn't be set */
 	else
 		ret = init_tpacket(handle, TPACKET_V3, "TPACKET_V3");
@@ -3580,12 +5123,23 @@ create_ring(pcap_t *handle, int *status)
 	socklen_t len;
 	unsigned int sk_type, tp_reserve, maclen, tp_hdrlen, netoff, macoff;
 	unsigned int frame_size;
+	size_t rxlen, txlen;
+	int want_tx;
 
 	/*
 	 * Start out assuming no warnings or errors.
 	 */
 	*status = 0;
 
+	/*
+	 * prepare_tpacket_socket() doesn't pick TPACKET_V3 if a
+	 * transmit ring was requested.
+	 */
+	want_tx = 0;
+#ifdef HAVE_PACKET_TX_RING
+	want_tx = handle->opt.tx_ring;
+#endif /* HAVE_PACKET_TX_RING */
+
 	switch (handlep->tp_version) {
 
 	case TPACKET_V1:
@@ -3882,8 +5436,23 @@ retry:
 		return -1;
 	}
 
-	/* memory map the rx ring */
-	handlep->mmapbuflen = req.tp_block_nr * req.tp_block_size;
+	rxlen = req.tp_block_nr * req.tp_block_size;
+	txlen = 0;
+#ifdef HAVE_PACKET_TX_RING
+	/*
+	 * Ask for a transmit ring with the same geometry as the
+	 * receive ring; the kernel maps it right after the receive
+	 * ring.  If we can't get one, we send without it.
+	 */
+	if (want_tx && setsockopt(handle->fd, SOL_PACKET, PACKET_TX_RING,
+	    (void *) &req, sizeof(req)) == 0) {
+		txlen = rxlen;
+		handlep->tx_frame_nr = req.tp_frame_nr;
+	}
+#endif
+
+	/* memory map the rx ring, and the tx ring if we have one */
+	handlep->mmapbuflen = rxlen + txlen;
 	handlep->mmapbuf = mmap(0, handlep->mmapbuflen,
 	    PROT_READ|PROT_WRITE, MAP_SHARED, handle->fd, 0);
 	if (handlep->mmapbuf == MAP_FAILED) {
@@ -3895,6 +5464,13 @@ retry:
 		*status = PCAP_ERROR;
 		return -1;
 	}
+	if (txlen != 0) {
+		handlep->txring = handlep->mmapbuf + rxlen;
+		handlep->tx_frame_size = req.tp_frame_size;
+		handlep->tx_frames_per_block = frames_per_block;
+		handlep->tx_block_size = req.tp_block_size;
+		handlep->tx_head = 0;
+	}
 
 	/* allocate a ring for each frame header pointer*/
 	handle->cc = req.tp_frame_nr;
@@ -3942,6 +5518,15 @@ destroy_ring(pcap_t *handle)
 		munmap(handlep->mmapbuf, handlep->mmapbuflen);
 		handlep->mmapbuf = NULL;
 	}
+#ifdef HAVE_PACKET_TX_RING
+	/* only tear down a transmit ring if we created one */
+	if (handlep->tx_frame_nr != 0) {
+		setsockopt(handle->fd, SOL_PACKET, PACKET_TX_RING,
+					(void *) &req, sizeof(req));
+		handlep->tx_frame_nr = 0;
+	}
+	handlep->txring = NULL;
+#endif
 }
 
 /*
@@ -3969,7 +5554,12 @@ pcap_oneshot_mmap(u_char *user, const struct pcap_pkthdr *h,
 	pcap_t *handle = sp->pd;
 	struct pcap_linux *handlep = handle->priv;
 
-	*sp->hdr = *h;
+	if (sp->xhdr != NULL && handle->per_interface)
+		*sp->xhdr = *(const struct pcap_pkthdr_if *)h;
+	else if (sp->xhdr != NULL && handle->vlan_metadata)
+		sp->xhdr->vhdr = *(const struct pcap_pkthdr_vlan *)h;
+	else
+		*sp->hdr = *h;
 	memcpy(handlep->oneshot_buffer, bytes, h->caplen);
 	*sp->pkt = handlep->oneshot_buffer;
 }
@@ -3984,6 +5574,12 @@ pcap_cleanup_linux_mmap( pcap_t *handle )
 		free(handlep->oneshot_buffer);
 		handlep->oneshot_buffer = NULL;
 	}
+#ifdef HAVE_TPACKET3
+	if (handlep->block_refs != NULL) {
+		free((void *)handlep->block_refs);
+		handlep->block_refs = NULL;
+	}
+#endif
 	pcap_cleanup_linux(handle);
 }
 
@@ -4022,6 +5618,24 @@ pcap_setnonblock_mmap(pcap_t *p, int nonblock, char *errbuf)
 	return 0;
 }
 
+#ifdef HAVE_TPACKET3
+/*
+ * Is the TPACKET_V3 block at the current ring position one that we're
+ * done with, but that the application still has packets retained in?
+ * If so, it's still marked as belonging to us, but there's nothing new
+ * in it.
+ */
+static inline int
+pcap_block_pinned(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	return (handlep->block_refs != NULL &&
+	    handlep->block_refs[handle->offset] != 0 &&
+	    handlep->held_block != handle->offset);
+}
+#endif
+
 static inline union thdr *
 pcap_get_ring_frame(pcap_t *handle, int status)
 {
@@ -4047,6 +5661,8 @@ pcap_get_ring_frame(pcap_t *handle, int status)
 		if (status != (h.h3->hdr.bh1.block_status ? TP_STATUS_USER :
 						TP_STATUS_KERNEL))
 			return NULL;
+		if (status == TP_STATUS_USER && pcap_block_pinned(handle))
+			return NULL;
 		break;
 #endif
 	}
@@ -4057,6 +5673,81 @@ pcap_get_ring_frame(pcap_t *handle, int status)
 #define POLLRDHUP 0
 #endif
 
+/*
+ * Tell the CPU we're spinning; this also keeps the compiler from
+ * hoisting the ring status check out of the loop.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define cpu_relax()	__asm__ __volatile__("pause" ::: "memory")
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define cpu_relax()	__asm__ __volatile__("yield" ::: "memory")
+#elif defined(__GNUC__)
+#define cpu_relax()	__asm__ __volatile__("" ::: "memory")
+#else
+#define cpu_relax()	sched_yield()
+#endif
+
+/*
+ * Spin on the status of the next ring frame for up to the busy-poll
+ * budget, or the read timeout if that's shorter, rather than going
+ * to sleep in poll() and paying for the wakeup.  Returns 1 if a frame
+ * turned up, 0 if not, and PCAP_ERROR_BREAK if pcap_breakloop() was
+ * called.
+ */
+static int
+pcap_busy_poll_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	u_int64_t budget, deadline;
+	unsigned int i;
+
+	budget = (u_int64_t)handle->opt.busy_poll * 1000;
+	if (handlep->timeout > 0 &&
+	    budget > (u_int64_t)handlep->timeout * 1000000)
+		budget = (u_int64_t)handlep->timeout * 1000000;
+	deadline = linux_clock_ns(CLOCK_MONOTONIC) + budget;
+	for (i = 1; ; i++) {
+		if (pcap_get_ring_frame(handle, TP_STATUS_USER))
+			return 1;
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+		/* reading the clock costs more than a ring check */
+		if ((i & 63) == 0 &&
+		    linux_clock_ns(CLOCK_MONOTONIC) >= deadline)
+			return 0;
+		if (handle->opt.busy_poll_flags & PCAP_BUSY_POLL_YIELD)
+			sched_yield();
+		else
+			cpu_relax();
+	}
+}
+
+/*
+ * Count, in the latency histogram, how long ago the packet was time
+ * stamped.
+ */
+static void
+pcap_record_latency(pcap_t *handle, unsigned int sec, unsigned int frac)
+{
+	struct pcap_latency_hist *lh = handle->lat_hist;
+	u_int64_t now, then, us;
+	int i;
+
+	now = linux_clock_ns(CLOCK_REALTIME);
+	then = (u_int64_t)sec * 1000000000 +
+	    (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ?
+	    frac : (u_int64_t)frac * 1000);
+	us = now > then ? (now - then) / 1000 : 0;
+	for (i = 0; us >> i != 0 && i < PCAP_LATENCY_BUCKETS - 1; i++)
+		;
+	lh->lh_bucket[i]++;
+	lh->lh_count++;
+	if (us > lh->lh_max)
+		lh->lh_max = us > UINT_MAX ? UINT_MAX : us;
+}
+
 /* wait for frames availability.*/
 static int pcap_wait_for_frames_mmap(pcap_t *handle)
 {
@@ -4067,6 +5758,15 @@ static int pcap_wait_for_frames_mmap(pcap_t *handle)
 		struct pollfd pollinfo;
 		int ret;
 
+		/*
+		 * In busy-poll mode, spin for a while before sleeping.
+		 */
+		if (handle->opt.busy_poll > 0 && handlep->timeout >= 0) {
+			ret = pcap_busy_poll_mmap(handle);
+			if (ret != 0)
+				return (ret == 1 ? 0 : ret);
+		}
+
 		pollinfo.fd = handle->fd;
 		pollinfo.events = POLLIN;
 
@@ -4098,6 +5798,18 @@ static int pcap_wait_for_frames_mmap(pcap_t *handle)
 			timeout = handlep->timeout;	/* block for that amount of time */
 		else
 			timeout = 0;	/* non-blocking mode - poll to pick up errors */
+#ifdef HAVE_TPACKET3
+		/*
+		 * If the application is still holding on to the next
+		 * block, the kernel can't put anything into it, but the
+		 * socket may well poll as readable anyway; rather than
+		 * spinning, give the application a moment to let go.
+		 */
+		if (timeout != 0 && pcap_block_pinned(handle)) {
+			(void)poll(NULL, 0, 1);
+			return 0;
+		}
+#endif
 		do {
 			ret = poll(&pollinfo, 1, timeout);
 			if (ret < 0 && errno != EINTR) {
@@ -4179,12 +5891,15 @@ static int pcap_handle_packet_mmap(
 		unsigned int tp_sec,
 		unsigned int tp_usec,
 		int tp_vlan_tci_valid,
-		__u16 tp_vlan_tci)
+		__u16 tp_vlan_tci,
+		__u16 tp_vlan_tpid)
 {
 	struct pcap_linux *handlep = handle->priv;
 	unsigned char *bp;
 	struct sockaddr_ll *sll;
-	struct pcap_pkthdr pcaphdr;
+	struct pcap_pkthdr_if pcaphdr;
+	int vlan_offset = handlep->vlan_offset;
+	struct bpf_aux_data aux_data;
 
 	/* perform sanity check on internal offset. */
 	if (tp_mac + tp_snaplen > handle->bufsize) {
@@ -4205,20 +5920,29 @@ static int pcap_handle_packet_mmap(
 	 * the filter when the ring became empty, but it can possibly
 	 * happen a lot later... */
 	bp = frame + tp_mac;
+	aux_data.vlan_tag_present = tp_vlan_tci_valid;
+	aux_data.vlan_tag = tp_vlan_tci;
 	if (handlep->filter_in_userland && handle->fcode.bf_insns &&
-			(bpf_filter(handle->fcode.bf_insns, bp,
-				tp_len, tp_snaplen) == 0))
+			(bpf_filter_with_aux_data(handle->fcode.bf_insns, bp,
+				tp_len, tp_snaplen, &aux_data) == 0))
 		return 0;
 
 	sll = (void *)frame + TPACKET_ALIGN(handlep->tp_hdrlen);
 	if (!linux_check_direction(handle, sll))
 		return 0;
+	if (handle->per_interface &&
+	    !linux_packet_interface(handle, sll, &pcaphdr, &vlan_offset))
+		return 0;
+
+	if (handle->lat_hist != NULL)
+		pcap_record_latency(handle, tp_sec, tp_usec);
 
 	/* get required packet info from ring header */
-	pcaphdr.ts.tv_sec = tp_sec;
-	pcaphdr.ts.tv_usec = tp_usec;
-	pcaphdr.caplen = tp_snaplen;
-	pcaphdr.len = tp_len;
+	pcaphdr.vhdr.hdr.ts.tv_sec = tp_sec;
+	pcaphdr.vhdr.hdr.ts.tv_usec = tp_usec;
+	pcaphdr.vhdr.hdr.caplen = tp_snaplen;
+	pcaphdr.vhdr.hdr.len = tp_len;
+	pcaphdr.vhdr.vlan_flags = 0;
 
 	/* if required build in place the sll header*/
 	if (handlep->cooked) {
@@ -4260,26 +5984,34 @@ static int pcap_handle_packet_mmap(
 		hdrp->sll_protocol = sll->sll_protocol;
 
 		/* update packet len */
-		pcaphdr.caplen += SLL_HDR_LEN;
-		pcaphdr.len += SLL_HDR_LEN;
+		pcaphdr.vhdr.hdr.caplen += SLL_HDR_LEN;
+		pcaphdr.vhdr.hdr.len += SLL_HDR_LEN;
 	}
 
 #if defined(HAVE_TPACKET2) || defined(HAVE_TPACKET3)
-	if (tp_vlan_tci_valid &&
-		handlep->vlan_offset != -1 &&
-		tp_snaplen >= (unsigned int) handlep->vlan_offset)
+	if (tp_vlan_tci_valid && handle->vlan_metadata) {
+		/*
+		 * Leave the frame as it is in the ring, and hand the
+		 * tag over in the header.
+		 */
+		pcaphdr.vhdr.vlan_flags = PCAP_VLAN_VALID;
+		pcaphdr.vhdr.vlan_tci = tp_vlan_tci;
+		pcaphdr.vhdr.vlan_tpid = tp_vlan_tpid;
+	} else if (tp_vlan_tci_valid &&
+		vlan_offset != -1 &&
+		tp_snaplen >= (unsigned int) vlan_offset)
 	{
 		struct vlan_tag *tag;
 
 		bp -= VLAN_TAG_LEN;
-		memmove(bp, bp + VLAN_TAG_LEN, handlep->vlan_offset);
+		memmove(bp, bp + VLAN_TAG_LEN, vlan_offset);
 
-		tag = (struct vlan_tag *)(bp + handlep->vlan_offset);
-		tag->vlan_tpid = htons(ETH_P_8021Q);
+		tag = (struct vlan_tag *)(bp + vlan_offset);
+		tag->vlan_tpid = htons(tp_vlan_tpid);
 		tag->vlan_tci = htons(tp_vlan_tci);
 
-		pcaphdr.caplen += VLAN_TAG_LEN;
-		pcaphdr.len += VLAN_TAG_LEN;
+		pcaphdr.vhdr.hdr.caplen += VLAN_TAG_LEN;
+		pcaphdr.vhdr.hdr.len += VLAN_TAG_LEN;
 	}
 #endif
 
@@ -4292,11 +6024,16 @@ static int pcap_handle_packet_mmap(
 	 * Trim the snapshot length to be no longer than the
 	 * specified snapshot length.
 	 */
-	if (pcaphdr.caplen > handle->snapshot)
-		pcaphdr.caplen = handle->snapshot;
+	if (pcaphdr.vhdr.hdr.caplen > handle->snapshot)
+		pcaphdr.vhdr.hdr.caplen = handle->snapshot;
+
+	/* run the filter for the packet's interface, if there is one */
+	if (handle->if_filter_count != 0 &&
+	    !pcap_filter_if(handle, &pcaphdr, bp))
+		return 0;
 
 	/* pass the packet to the user */
-	callback(user, &pcaphdr, bp);
+	callback(user, &pcaphdr.vhdr.hdr, bp);
 
 	return 1;
 }
@@ -4335,6 +6072,7 @@ pcap_read_linux_mmap_v1(pcap_t *handle, int max_packets, pcap_handler callback,
 				h.h1->tp_sec,
 				h.h1->tp_usec,
 				0,
+				0,
 				0);
 		if (ret == 1) {
 			pkts++;
@@ -4413,7 +6151,8 @@ pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
 #else
 				h.h2->tp_vlan_tci != 0,
 #endif
-				h.h2->tp_vlan_tci);
+				h.h2->tp_vlan_tci,
+				VLAN_TPID(h.h2, h.h2));
 		if (ret == 1) {
 			pkts++;
 			handlep->packets_read++;
@@ -4454,6 +6193,126 @@ pcap_read_linux_mmap_v2(pcap_t *handle, int max_packets, pcap_handler callback,
 #endif /* HAVE_TPACKET2 */
 
 #ifdef HAVE_TPACKET3
+/*
+ * Packet retention.
+ *
+ * Each TPACKET_V3 block has a count of references to it: one from the
+ * reader while it's going through the block's packets, and one for
+ * each pcap_retain() of a packet in the block that hasn't yet been
+ * matched by a pcap_release().  Whoever drops the last reference hands
+ * the block back to the kernel, so a block with retained packets stays
+ * out of the kernel's hands, and its packets stay where they are,
+ * until the last of them is released, which can be done from any
+ * thread.  The reader doesn't wait for that; it goes on to the next
+ * block.  (The kernel fills blocks in order, so, if it catches up
+ * with a block that's still pinned, it has to drop packets until the
+ * block is released.)
+ */
+
+/*
+ * Add delta to a block's count of references, unless it has none,
+ * in which case it may already have been handed back to the kernel.
+ * The check and the change are one compare-and-swap, so a block
+ * can't be handed back between them.  Returns the new count, or -1
+ * if the block had no references.
+ */
+static int
+pcap_adjust_block_refs(pcap_t *handle, int block, int delta)
+{
+	struct pcap_linux *handlep = handle->priv;
+	volatile int *refs = &handlep->block_refs[block];
+	int old, seen;
+
+	for (old = *refs; old != 0; old = seen) {
+		seen = __sync_val_compare_and_swap(refs, old, old + delta);
+		if (seen == old)
+			return old + delta;
+	}
+	return -1;
+}
+
+/*
+ * Drop a reference to a block, handing it back to the kernel if that
+ * was the last one.  Returns the number of references left, or -1 if
+ * it had none to drop.
+ */
+static int
+pcap_unref_block(pcap_t *handle, int block)
+{
+	union thdr h;
+	int left;
+
+	/* this is a full barrier, so we're done with the block after it */
+	left = pcap_adjust_block_refs(handle, block, -1);
+	if (left == 0) {
+		h.raw = ((union thdr **)handle->buffer)[block];
+		h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	}
+	return left;
+}
+
+/*
+ * Find the block a packet handed to the callback is in.
+ */
+static int
+pcap_packet_block(pcap_t *handle, const u_char *pkt)
+{
+	struct pcap_linux *handlep = handle->priv;
+	u_char *ring = handlep->mmapbuf;
+
+	if (pkt < ring || pkt >= ring + (size_t)handle->cc * handle->bufsize) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "That packet isn't in the capture ring");
+		return -1;
+	}
+	return (pkt - ring) / handle->bufsize;
+}
+
+static int
+pcap_retain_linux_mmap(pcap_t *handle, const u_char *pkt)
+{
+	int block;
+
+	block = pcap_packet_block(handle, pkt);
+	if (block == -1)
+		return PCAP_ERROR;
+
+	/*
+	 * Something has to be holding on to the block already - the
+	 * reader, if we're in the callback for the packet, or an
+	 * earlier pcap_retain() - or it might have been reused.
+	 */
+	if (pcap_adjust_block_refs(handle, block, 1) == -1) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "That packet has already been handed back to the kernel");
+		return PCAP_ERROR;
+	}
+	return 0;
+}
+
+static int
+pcap_release_linux_mmap(pcap_t *handle, const u_char *pkt)
+{
+	int block;
+
+	block = pcap_packet_block(handle, pkt);
+	if (block == -1)
+		return PCAP_ERROR;
+	switch (pcap_unref_block(handle, block)) {
+
+	case -1:
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "That packet isn't retained");
+		return PCAP_ERROR;
+
+	case 0:
+		/* the reader had finished with it, so it was pinned */
+		__sync_sub_and_fetch(&handle->pinned_blocks, 1);
+		break;
+	}
+	return 0;
+}
+
 static int
 pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 		u_char *user)
@@ -4484,6 +6343,17 @@ pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 
 			handlep->current_packet = h.raw + h.h3->hdr.bh1.offset_to_first_pkt;
 			handlep->packets_left = h.h3->hdr.bh1.num_pkts;
+
+			/*
+			 * Hold on to the block while we go through it,
+			 * unless we already are, having been stopped
+			 * part way through it.
+			 */
+			if (handlep->held_block != handle->offset) {
+				__sync_add_and_fetch(
+				    &handlep->block_refs[handle->offset], 1);
+				handlep->held_block = handle->offset;
+			}
 		}
 		int packets_to_read = handlep->packets_left;
 
@@ -4508,7 +6378,8 @@ pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 #else
 					tp3_hdr->hv1.tp_vlan_tci != 0,
 #endif
-					tp3_hdr->hv1.tp_vlan_tci);
+					tp3_hdr->hv1.tp_vlan_tci,
+					VLAN_TPID(tp3_hdr, &tp3_hdr->hv1));
 			if (ret == 1) {
 				pkts++;
 				handlep->packets_read++;
@@ -4522,13 +6393,18 @@ pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 
 		if (handlep->packets_left <= 0) {
 			/*
-			 * Hand this block back to the kernel, and, if
-			 * we're counting blocks that need to be
-			 * filtered in userland after having been
-			 * filtered by the kernel, count the one we've
-			 * just processed.
+			 * Let go of this block, which hands it back to
+			 * the kernel unless the application has retained
+			 * packets in it, in which case whoever releases
+			 * the last of them does so; either way, we go on
+			 * to the next block.  And, if we're counting
+			 * blocks that need to be filtered in userland
+			 * after having been filtered by the kernel,
+			 * count the one we've just processed.
 			 */
-			h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			if (pcap_unref_block(handle, handle->offset) != 0)
+				__sync_add_and_fetch(&handle->pinned_blocks, 1);
+			handlep->held_block = -1;
 			if (handlep->blocks_to_filter_in_userland > 0) {
 				handlep->blocks_to_filter_in_userland--;
 				if (handlep->blocks_to_filter_in_userland == 0) {
@@ -4555,6 +6431,177 @@ pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 	}
 	return pkts;
 }
+
+/*
+ * Recording whole blocks; see sf-blocks.h.
+ *
+ * A block goes from the ring to the file as it is, so nothing can be
+ * done to the packets in it on the way; the fix-ups that
+ * pcap_handle_packet_mmap() would have done are described in the file
+ * header, and done by the reader.  The one thing that can't be done
+ * that way is filtering in userland, so we don't record from a handle
+ * whose filter couldn't be put in the kernel.  (Blocks that were in
+ * the ring when a new filter was put in the kernel are recorded as
+ * they are.)
+ */
+static int
+pcap_userland_filter_mmap(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (handlep->filter_in_userland &&
+	    handlep->blocks_to_filter_in_userland == 0) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Whole blocks can't be recorded with a filter that couldn't be put in the kernel");
+		return -1;
+	}
+	if (handle->if_filter_count != 0) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Whole blocks can't be recorded with per-interface filters");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+pcap_block_header_linux_mmap(pcap_t *handle,
+    struct pcap_block_file_header *bfh)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (handlep->any_native) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "per-interface captures on the \"any\" device can't be recorded as blocks");
+		return PCAP_ERROR;
+	}
+	if (pcap_userland_filter_mmap(handle) == -1)
+		return PCAP_ERROR;
+	bfh->linktype = handle->linktype;
+	bfh->snaplen = handle->snapshot;
+	bfh->block_size = handle->bufsize;
+	bfh->flags = handlep->cooked ? BLOCKFILE_COOKED : 0;
+	bfh->sll_offset = TPACKET_ALIGN(handlep->tp_hdrlen);
+	bfh->vlan_offset = handlep->vlan_offset;
+	bfh->lo_ifindex = handlep->lo_ifindex;
+	bfh->direction = handle->direction;
+	return 0;
+}
+
+#define MAX_BLOCKS_PER_WRITE	64
+
+static int
+pcap_write_blocks_linux_mmap(pcap_t *handle, int fd, int maxblocks)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct iovec iov[MAX_BLOCKS_PER_WRITE];
+	union thdr blocks[MAX_BLOCKS_PER_WRITE];
+	union thdr h;
+	int nblocks, i, pkts, ret, flags;
+	u_int len;
+	ssize_t n;
+
+	if (handlep->current_packet != NULL) {
+		/*
+		 * We're part way through a block, and can't write out
+		 * what's been handed to the application already.
+		 */
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Whole blocks can't be recorded while packets are being read");
+		return PCAP_ERROR;
+	}
+	if (pcap_userland_filter_mmap(handle) == -1)
+		return PCAP_ERROR;
+
+	ret = pcap_wait_for_frames_mmap(handle);
+	if (ret)
+		return ret;
+
+	/*
+	 * Gather up the blocks that are ready, each padded with zeroes
+	 * to a multiple of BLOCKFILE_ALIGN bytes so that it can be
+	 * written with direct I/O straight from the ring, which is
+	 * page-aligned, as are the blocks in it.
+	 */
+	if (maxblocks <= 0 || maxblocks > MAX_BLOCKS_PER_WRITE)
+		maxblocks = MAX_BLOCKS_PER_WRITE;
+	if (maxblocks > (int)handle->cc)
+		maxblocks = handle->cc;
+	for (nblocks = 0; nblocks < maxblocks; nblocks++) {
+		h.raw = RING_GET_FRAME_AT(handle,
+		    (handle->offset + nblocks) % handle->cc);
+		if (h.h3->hdr.bh1.block_status == TP_STATUS_KERNEL ||
+		    handlep->block_refs[(handle->offset + nblocks) % handle->cc] != 0)
+			break;
+		len = h.h3->hdr.bh1.blk_len;
+		len = (len + BLOCKFILE_ALIGN - 1) & ~(BLOCKFILE_ALIGN - 1);
+		if (len > handle->bufsize)
+			len = handle->bufsize;
+		memset(h.raw + h.h3->hdr.bh1.blk_len, 0,
+		    len - h.h3->hdr.bh1.blk_len);
+		iov[nblocks].iov_base = h.raw;
+		iov[nblocks].iov_len = len;
+		blocks[nblocks] = h;
+	}
+	if (nblocks == 0)
+		return 0;
+
+	for (i = 0; i < nblocks; ) {
+		n = writev(fd, &iov[i], nblocks - i);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EINVAL &&
+			    (flags = fcntl(fd, F_GETFL)) != -1 &&
+			    (flags & O_DIRECT) &&
+			    fcntl(fd, F_SETFL, flags & ~O_DIRECT) != -1) {
+				/*
+				 * The file system doesn't do direct I/O
+				 * after all; go through the page cache.
+				 */
+				continue;
+			}
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't write to block file: %s",
+			    pcap_strerror(errno));
+			return PCAP_ERROR;
+		}
+		/* skip what was written */
+		while (i < nblocks && (size_t)n >= iov[i].iov_len) {
+			n -= iov[i].iov_len;
+			i++;
+		}
+		if (i < nblocks) {
+			iov[i].iov_base = (u_char *)iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+		}
+	}
+
+	/*
+	 * Hand the blocks back to the kernel, and count them and their
+	 * packets as pcap_read_linux_mmap_v3() would have.
+	 */
+	pkts = 0;
+	for (i = 0; i < nblocks; i++) {
+		h = blocks[i];
+		pkts += h.h3->hdr.bh1.num_pkts;
+		h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		if (handlep->blocks_to_filter_in_userland > 0) {
+			handlep->blocks_to_filter_in_userland--;
+			if (handlep->blocks_to_filter_in_userland == 0)
+				handlep->filter_in_userland = 0;
+		}
+		if (++handle->offset >= handle->cc)
+			handle->offset = 0;
+	}
+	handlep->packets_read += pkts;
+
+	/* check for break loop condition*/
+	if (handle->break_loop) {
+		handle->break_loop = 0;
+		return PCAP_ERROR_BREAK;
+	}
+	return pkts;
+}
 #endif /* HAVE_TPACKET3 */
 
 static int 
@@ -5559,6 +7606,12 @@ activate_old(pcap_t *handle)
 	struct utsname	utsname;
 	int		mtu;
 
+	/*
+	 * We can't tell what interface a SOCK_PACKET packet came from
+	 * in any useful way, so there's no per-interface mode.
+	 */
+	handle->per_interface = 0;
+
 	/* Open the socket */
 
 	handle->fd = socket(PF_INET, SOCK_PACKET, htons(ETH_P_ALL));
@@ -0,0 +1,762 @@
+/*
+ * pcap-shm.c - publish the packets from one capture into shared
+ * memory, and capture them from there, as the "shm:<name>" device, in
+ * any number of other processes.
+ *
+ * The shared memory is a header followed by a ring of packet records.
+ * There's one writer, the publisher, which never waits for readers:
+ * it just keeps writing, and a reader that falls more than the size
+ * of the ring behind loses the packets that were overwritten.  Each
+ * reader has its own cursor, and counts what it lost from the gaps in
+ * the packet numbers of the records it does get.
+ *
+ * Positions in the ring are 32-bit byte counts that wrap around; the
+ * ring is at most 1GB, so the difference between two positions that
+ * matter is always less than 2^31.  Before writing a record, the
+ * publisher advances "tail" past the records it's about to overwrite,
+ * and "reserve" past the new one; after writing it, it advances
+ * "head".  A reader copies a record out of the ring and then checks
+ * that "reserve" hasn't come within a ring's length of it, in which
+ * case the copy might be torn, and it skips ahead to "tail" instead.
+ *
+ * Readers that have caught up wait on a futex on Linux, which the
+ * publisher only wakes if somebody's waiting; elsewhere, and if they
+ * can only map the shared memory read-only, so can't say they're
+ * waiting, they poll.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "pcap-int.h"
+#include "pcap-shm.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#ifdef PCAP_SUPPORT_SHM
+
+#define SHM_MAGIC	0x70636170	/* "pcap" */
+#define SHM_VERSION	2
+
+#define SHM_HDR_SIZE	4096		/* header; the ring starts after it */
+#define SHM_MIN_SIZE	(1U << 16)
+#define SHM_MAX_SIZE	(1U << 30)
+#define SHM_DEFAULT_SIZE (1U << 24)
+
+#define SHM_REC_WRAP	0xFFFFFFFFU	/* rest of the ring is unused */
+#define SHM_ALIGN(x)	(((x) + 7) & ~7U)
+
+/*
+ * Wait at most this long at a time, so that pcap_breakloop() from
+ * another thread is noticed.
+ */
+#define SHM_WAIT_MSEC	100
+
+struct pcap_shm_header {
+	u_int32_t	magic;
+	u_int32_t	version;
+	u_int32_t	linktype;	/* DLT_ */
+	u_int32_t	snaplen;
+	u_int32_t	ring_size;	/* power of 2 */
+	u_int32_t	flags;		/* SHM_ flags for the headers */
+	volatile u_int32_t closed;	/* publisher has gone away */
+	volatile u_int32_t waiters;	/* readers waiting on futex */
+	volatile u_int32_t futex;	/* bumped each time head moves */
+	/*
+	 * Written only by the publisher, and read by everybody; keep
+	 * them away from the fields above.
+	 */
+	volatile u_int32_t head __attribute__((aligned(64)));
+	volatile u_int32_t reserve;
+	volatile u_int32_t tail;	/* oldest record not overwritten */
+	volatile u_int64_t packets;	/* packet number of the next record */
+};
+
+/*
+ * Flags saying whether the publisher's headers are more than a
+ * struct pcap_pkthdr; the records carry the rest, and readers hand
+ * on the same kind of header.
+ */
+#define SHM_VLAN	0x00000001	/* VLAN tags are metadata */
+#define SHM_PER_IF	0x00000002	/* struct pcap_pkthdr_if */
+
+struct pcap_shm_record {
+	u_int32_t	rec_len;	/* whole record, padded; or SHM_REC_WRAP */
+	u_int32_t	caplen;
+	u_int32_t	len;
+	u_int32_t	vlan_flags;
+	u_int64_t	seq;		/* packet number */
+	u_int64_t	ts_nsec;	/* time stamp, in nanoseconds */
+	u_int16_t	vlan_tci;
+	u_int16_t	vlan_tpid;
+	int32_t		if_index;
+	int32_t		if_dlt;
+	int32_t		if_direction;
+};
+
+struct pcap_shm_publisher {
+	struct pcap_shm_header *hdr;
+	u_char		*ring;
+	size_t		maplen;
+	u_int32_t	mask;
+	u_int32_t	pos;
+	u_int32_t	tail;
+	u_int64_t	seq;
+	u_int		snaplen;
+	int		nsec;		/* source time stamps are in ns */
+	u_int32_t	flags;		/* SHM_ flags for the headers */
+	char		*name;
+};
+
+/*
+ * Private data for capturing from shared memory.
+ */
+struct pcap_shm {
+	struct pcap_shm_header *hdr;
+	u_char		*ring;
+	size_t		maplen;
+	u_int32_t	mask;
+	u_int32_t	cursor;
+	u_int64_t	next_seq;	/* expected packet number of the next record */
+	int		nonblock;
+	int		readonly;	/* can't register as a waiter */
+	u_int		packets_read;
+	u_int		drops;
+};
+
+static void
+shm_sleep(int msec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = msec / 1000;
+	ts.tv_nsec = (msec % 1000) * 1000000;
+	(void)nanosleep(&ts, NULL);
+}
+
+#ifdef __linux__
+#define SHM_CAN_WAIT	1
+
+static void
+shm_futex_wait(volatile u_int32_t *addr, u_int32_t val, int msec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = msec / 1000;
+	ts.tv_nsec = (msec % 1000) * 1000000;
+	(void)syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void
+shm_futex_wake(volatile u_int32_t *addr)
+{
+	(void)syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#else
+#define SHM_CAN_WAIT	0
+
+#define shm_futex_wait(addr, val, msec)	shm_sleep(msec)
+#define shm_futex_wake(addr)
+#endif
+
+/*
+ * Shared memory object names must start with a "/".
+ */
+static char *
+shm_object_name(const char *name, char *errbuf)
+{
+	char *objname;
+
+	objname = malloc(strlen(name) + 2);
+	if (objname == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	if (name[0] == '/')
+		strcpy(objname, name);
+	else {
+		objname[0] = '/';
+		strcpy(objname + 1, name);
+	}
+	return (objname);
+}
+
+pcap_shm_publisher_t *
+pcap_shm_publisher_open(pcap_t *p, const char *name, u_int size)
+{
+	struct pcap_shm_publisher *pub;
+	struct pcap_shm_header *hdr;
+	u_int ring_size, min_size;
+	size_t maplen;
+	void *map;
+	int fd;
+
+	if (!p->activated) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not-yet-activated pcap_t passed to pcap_shm_publisher_open",
+		    name);
+		return (NULL);
+	}
+
+	/*
+	 * Round the size up to a power of 2, big enough for a few
+	 * packets of the maximum size.
+	 */
+	if (size == 0)
+		size = SHM_DEFAULT_SIZE;
+	min_size = 4 * SHM_ALIGN(sizeof(struct pcap_shm_record) + p->snapshot);
+	if (size < min_size)
+		size = min_size;
+	if (size > SHM_MAX_SIZE) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: ring size %u is bigger than the maximum of %u",
+		    name, size, SHM_MAX_SIZE);
+		return (NULL);
+	}
+	for (ring_size = SHM_MIN_SIZE; ring_size < size; ring_size <<= 1)
+		;
+	maplen = SHM_HDR_SIZE + ring_size;
+
+	pub = calloc(1, sizeof(*pub));
+	if (pub == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	pub->name = shm_object_name(name, p->errbuf);
+	if (pub->name == NULL) {
+		free(pub);
+		return (NULL);
+	}
+
+	/*
+	 * Readers still attached to an earlier capture with this name
+	 * keep it until they're done; new ones get this one.
+	 */
+	(void)shm_unlink(pub->name);
+	fd = shm_open(pub->name, O_RDWR|O_CREAT|O_EXCL, 0644);
+	if (fd == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "shm_open %s: %s",
+		    pub->name, pcap_strerror(errno));
+		goto fail;
+	}
+	if (ftruncate(fd, maplen) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "ftruncate %s: %s",
+		    pub->name, pcap_strerror(errno));
+		close(fd);
+		goto unlink;
+	}
+	map = mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "mmap %s: %s",
+		    pub->name, pcap_strerror(errno));
+		goto unlink;
+	}
+
+	hdr = map;
+	hdr->version = SHM_VERSION;
+	hdr->linktype = p->linktype;
+	hdr->snaplen = p->snapshot;
+	hdr->ring_size = ring_size;
+	if (p->vlan_metadata)
+		pub->flags |= SHM_VLAN;
+	if (p->per_interface)
+		pub->flags |= SHM_PER_IF;
+	hdr->flags = pub->flags;
+	__sync_synchronize();
+	hdr->magic = SHM_MAGIC;
+
+	pub->hdr = hdr;
+	pub->ring = (u_char *)map + SHM_HDR_SIZE;
+	pub->maplen = maplen;
+	pub->mask = ring_size - 1;
+	pub->snaplen = p->snapshot;
+	pub->nsec = (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO);
+	return (pub);
+
+unlink:
+	(void)shm_unlink(pub->name);
+fail:
+	free(pub->name);
+	free(pub);
+	return (NULL);
+}
+
+void
+pcap_shm_publish(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct pcap_shm_publisher *pub = (struct pcap_shm_publisher *)user;
+	struct pcap_shm_header *hdr = pub->hdr;
+	struct pcap_shm_record *rec;
+	const struct pcap_pkthdr_vlan *vh;
+	const struct pcap_pkthdr_if *ih;
+	u_int32_t caplen, rec_len, off, end;
+
+	caplen = h->caplen;
+	if (caplen > pub->snaplen)
+		caplen = pub->snaplen;
+	rec_len = SHM_ALIGN(sizeof(*rec) + caplen);
+
+	off = pub->pos & pub->mask;
+	end = pub->pos + rec_len;
+	if (off + rec_len > pub->mask + 1) {
+		/*
+		 * It won't fit before the end of the ring; mark the
+		 * rest unused and start again at the beginning.
+		 */
+		end = (pub->pos | pub->mask) + 1 + rec_len;
+	}
+	while (end - pub->tail > pub->mask + 1) {
+		rec = (struct pcap_shm_record *)(pub->ring +
+		    (pub->tail & pub->mask));
+		if (rec->rec_len == SHM_REC_WRAP)
+			pub->tail = (pub->tail | pub->mask) + 1;
+		else
+			pub->tail += rec->rec_len;
+	}
+	hdr->tail = pub->tail;
+	hdr->reserve = end;
+	__sync_synchronize();
+
+	if (end - rec_len != pub->pos) {
+		((struct pcap_shm_record *)(pub->ring + off))->rec_len =
+		    SHM_REC_WRAP;
+		off = 0;
+	}
+	rec = (struct pcap_shm_record *)(pub->ring + off);
+	rec->rec_len = rec_len;
+	rec->caplen = caplen;
+	rec->len = h->len;
+	rec->seq = pub->seq++;
+	rec->ts_nsec = (u_int64_t)h->ts.tv_sec * 1000000000 +
+	    (u_int64_t)h->ts.tv_usec * (pub->nsec ? 1 : 1000);
+	if (pub->flags != 0) {
+		vh = (const struct pcap_pkthdr_vlan *)h;
+		rec->vlan_flags = vh->vlan_flags;
+		rec->vlan_tci = vh->vlan_tci;
+		rec->vlan_tpid = vh->vlan_tpid;
+	} else {
+		rec->vlan_flags = 0;
+		rec->vlan_tci = rec->vlan_tpid = 0;
+	}
+	if (pub->flags & SHM_PER_IF) {
+		ih = (const struct pcap_pkthdr_if *)h;
+		rec->if_index = ih->if_index;
+		rec->if_dlt = ih->if_dlt;
+		rec->if_direction = ih->if_direction;
+	} else {
+		rec->if_index = 0;
+		rec->if_dlt = hdr->linktype;
+		rec->if_direction = PCAP_D_INOUT;
+	}
+	memcpy(rec + 1, sp, caplen);
+
+	__sync_synchronize();
+	hdr->head = pub->pos = end;
+	hdr->packets = pub->seq;
+	__sync_add_and_fetch(&hdr->futex, 1);
+	if (hdr->waiters != 0)
+		shm_futex_wake(&hdr->futex);
+}
+
+void
+pcap_shm_publisher_close(pcap_shm_publisher_t *pub)
+{
+	pub->hdr->closed = 1;
+	__sync_add_and_fetch(&pub->hdr->futex, 1);
+	shm_futex_wake(&pub->hdr->futex);
+	(void)shm_unlink(pub->name);
+	munmap(pub->hdr, pub->maplen);
+	free(pub->name);
+	free(pub);
+}
+
+/*
+ * Hand up to "max_packets" packets that have been published, waiting
+ * for the first one for at most the timeout, unless in non-blocking
+ * mode.
+ */
+static int
+shm_read(pcap_t *handle, int max_packets, pcap_handler callback, u_char *user)
+{
+	struct pcap_shm *handlep = handle->priv;
+	struct pcap_shm_header *hdr = handlep->hdr;
+	struct pcap_shm_record rec;
+	struct pcap_pkthdr_if pkth;
+	struct bpf_aux_data aux;
+	u_int32_t head, off, val;
+	int count = 0, waited = 0, msec, torn;
+
+	for (;;) {
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return (PCAP_ERROR_BREAK);
+		}
+		head = hdr->head;
+		__sync_synchronize();
+		if (handlep->cursor == head) {
+			if (count != 0)
+				return (count);
+			if (hdr->closed) {
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				    "The publisher has closed the capture");
+				return (PCAP_ERROR);
+			}
+			if (handlep->nonblock)
+				return (0);
+			if (handle->opt.timeout > 0 &&
+			    waited >= handle->opt.timeout)
+				return (0);
+
+			/*
+			 * Say we're waiting before looking again, so
+			 * that a packet published after we look wakes
+			 * us up.
+			 */
+			msec = (SHM_CAN_WAIT && !handlep->readonly) ?
+			    SHM_WAIT_MSEC : 1;
+			if (handle->opt.timeout > 0 &&
+			    handle->opt.timeout - waited < msec)
+				msec = handle->opt.timeout - waited;
+			if (msec == 1)
+				shm_sleep(msec);
+			else {
+				__sync_add_and_fetch(&hdr->waiters, 1);
+				val = hdr->futex;
+				__sync_synchronize();
+				if (hdr->head == handlep->cursor && !hdr->closed)
+					shm_futex_wait(&hdr->futex, val, msec);
+				__sync_sub_and_fetch(&hdr->waiters, 1);
+			}
+			waited += msec;
+			continue;
+		}
+		if ((int32_t)(head - handlep->cursor) < 0 ||
+		    head - handlep->cursor > handlep->mask + 1) {
+			/*
+			 * We've been lapped; pick up from the oldest
+			 * packet that's left, and count what we missed
+			 * when we get there.
+			 */
+			handlep->cursor = hdr->tail;
+			continue;
+		}
+
+		off = handlep->cursor & handlep->mask;
+		memcpy(&rec, handlep->ring + off, sizeof(rec.rec_len));
+		if (rec.rec_len == SHM_REC_WRAP) {
+			handlep->cursor = (handlep->cursor | handlep->mask) + 1;
+			continue;
+		}
+		/*
+		 * A record header that doesn't fit before the end of the
+		 * ring, or a record that doesn't make sense, is torn; the
+		 * check below will say so.
+		 */
+		torn = 1;
+		if (off + sizeof(rec) <= handlep->mask + 1) {
+			memcpy(&rec, handlep->ring + off, sizeof(rec));
+			if (rec.rec_len >= sizeof(rec) &&
+			    rec.rec_len <= handlep->mask + 1 - off &&
+			    rec.caplen <= rec.rec_len - sizeof(rec) &&
+			    rec.caplen <= (u_int32_t)handle->bufsize) {
+				memcpy(handle->buffer,
+				    handlep->ring + off + sizeof(rec),
+				    rec.caplen);
+				torn = 0;
+			}
+		}
+		__sync_synchronize();
+		if (hdr->reserve - handlep->cursor > handlep->mask + 1) {
+			/*
+			 * It was overwritten while we copied it.
+			 */
+			handlep->cursor = hdr->tail;
+			continue;
+		}
+		if (torn) {
+			/*
+			 * It wasn't overwritten, so it was never a
+			 * record; the ring's been scribbled on.
+			 */
+			if (count != 0)
+				return (count);
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "Bad record at offset %u in the shared memory ring",
+			    off);
+			return (PCAP_ERROR);
+		}
+		handlep->cursor += rec.rec_len;
+
+		if (rec.seq > handlep->next_seq)
+			handlep->drops += (u_int)(rec.seq - handlep->next_seq);
+		handlep->next_seq = rec.seq + 1;
+
+		pkth.vhdr.hdr.caplen = rec.caplen;
+		if (pkth.vhdr.hdr.caplen > (bpf_u_int32)handle->snapshot)
+			pkth.vhdr.hdr.caplen = handle->snapshot;
+		pkth.vhdr.hdr.len = rec.len;
+		pkth.vhdr.hdr.ts.tv_sec = rec.ts_nsec / 1000000000;
+		if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO)
+			pkth.vhdr.hdr.ts.tv_usec = rec.ts_nsec % 1000000000;
+		else
+			pkth.vhdr.hdr.ts.tv_usec =
+			    (rec.ts_nsec % 1000000000) / 1000;
+		pkth.vhdr.vlan_flags = rec.vlan_flags;
+		pkth.vhdr.vlan_tci = rec.vlan_tci;
+		pkth.vhdr.vlan_tpid = rec.vlan_tpid;
+		pkth.if_index = rec.if_index;
+		pkth.if_dlt = rec.if_dlt;
+		pkth.if_direction = rec.if_direction;
+		if (handle->fcode.bf_insns != NULL) {
+			aux.vlan_tag_present =
+			    (rec.vlan_flags & PCAP_VLAN_VALID) != 0;
+			aux.vlan_tag = rec.vlan_tci;
+			if (!bpf_filter_with_aux_data(handle->fcode.bf_insns,
+			    handle->buffer, pkth.vhdr.hdr.len,
+			    pkth.vhdr.hdr.caplen, &aux))
+				continue;
+		}
+		if (handle->if_filter_count != 0 &&
+		    !pcap_filter_if(handle, &pkth, handle->buffer))
+			continue;
+		handlep->packets_read++;
+		callback(user, &pkth.vhdr.hdr, handle->buffer);
+		count++;
+		if (!PACKET_COUNT_IS_UNLIMITED(max_packets) &&
+		    count >= max_packets)
+			return (count);
+	}
+}
+
+static int
+shm_inject(pcap_t *handle, const void *buf _U_, size_t size _U_)
+{
+	snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+	    "Packets can't be sent on a shared memory capture");
+	return (-1);
+}
+
+static int
+shm_stats(pcap_t *handle, struct pcap_stat *stats)
+{
+	struct pcap_shm *handlep = handle->priv;
+
+	stats->ps_recv = handlep->packets_read;
+	stats->ps_drop = handlep->drops;
+	stats->ps_ifdrop = 0;
+	return (0);
+}
+
+static int
+shm_getnonblock(pcap_t *handle, char *errbuf _U_)
+{
+	struct pcap_shm *handlep = handle->priv;
+
+	return (handlep->nonblock);
+}
+
+static int
+shm_setnonblock(pcap_t *handle, int nonblock, char *errbuf _U_)
+{
+	struct pcap_shm *handlep = handle->priv;
+
+	handlep->nonblock = nonblock;
+	return (0);
+}
+
+static void
+shm_cleanup(pcap_t *handle)
+{
+	struct pcap_shm *handlep = handle->priv;
+
+	if (handlep->hdr != NULL) {
+		munmap(handlep->hdr, handlep->maplen);
+		handlep->hdr = NULL;
+	}
+	pcap_cleanup_live_common(handle);
+}
+
+static int
+shm_activate(pcap_t *handle)
+{
+	struct pcap_shm *handlep = handle->priv;
+	struct pcap_shm_header *hdr;
+	struct stat st;
+	char *objname;
+	void *map;
+
+	if (handle->opt.rfmon) {
+		/*
+		 * Monitor mode doesn't apply to shared memory.
+		 */
+		return (PCAP_ERROR_RFMON_NOTSUP);
+	}
+
+	objname = shm_object_name(handle->opt.source + 4, handle->errbuf);
+	if (objname == NULL)
+		return (PCAP_ERROR);
+	handle->fd = shm_open(objname, O_RDWR, 0);
+	if (handle->fd == -1 && errno == EACCES) {
+		handle->fd = shm_open(objname, O_RDONLY, 0);
+		handlep->readonly = 1;
+	}
+	free(objname);
+	if (handle->fd == -1) {
+		if (errno == ENOENT) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: nothing is being published with that name",
+			    handle->opt.source);
+			return (PCAP_ERROR_NO_SUCH_DEVICE);
+		}
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "%s: %s",
+		    handle->opt.source, pcap_strerror(errno));
+		return (errno == EACCES ? PCAP_ERROR_PERM_DENIED : PCAP_ERROR);
+	}
+	if (fstat(handle->fd, &st) == -1 ||
+	    st.st_size < (off_t)(SHM_HDR_SIZE + SHM_MIN_SIZE)) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not ready, or not a published capture",
+		    handle->opt.source);
+		goto fail;
+	}
+	map = mmap(NULL, st.st_size,
+	    handlep->readonly ? PROT_READ : PROT_READ|PROT_WRITE, MAP_SHARED,
+	    handle->fd, 0);
+	if (map == MAP_FAILED) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "mmap %s: %s",
+		    handle->opt.source, pcap_strerror(errno));
+		goto fail;
+	}
+	hdr = map;
+	handlep->hdr = hdr;
+	handlep->maplen = st.st_size;
+	__sync_synchronize();
+	if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION ||
+	    hdr->ring_size > (size_t)st.st_size - SHM_HDR_SIZE ||
+	    (hdr->ring_size & (hdr->ring_size - 1)) != 0) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not ready, or not a published capture",
+		    handle->opt.source);
+		goto fail;
+	}
+	handlep->ring = (u_char *)map + SHM_HDR_SIZE;
+	handlep->mask = hdr->ring_size - 1;
+	/*
+	 * Start with what comes next.  The packet count is read after
+	 * the head, so it's never behind the first record we'll see.
+	 */
+	handlep->cursor = hdr->head;
+	__sync_synchronize();
+	handlep->next_seq = hdr->packets;
+
+	handle->linktype = hdr->linktype;
+	handle->vlan_metadata = (hdr->flags & SHM_VLAN) != 0;
+	handle->per_interface = (hdr->flags & SHM_PER_IF) != 0;
+	if (handle->snapshot <= 0 || handle->snapshot > (int)hdr->snaplen)
+		handle->snapshot = hdr->snaplen;
+	handle->bufsize = hdr->snaplen;
+	handle->buffer = malloc(handle->bufsize);
+	if (handle->buffer == NULL) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		goto fail;
+	}
+	handle->offset = 0;
+	handle->read_op = shm_read;
+	handle->inject_op = shm_inject;
+	handle->setfilter_op = install_bpf_program;
+	handle->setdirection_op = NULL;
+	handle->set_datalink_op = NULL;	/* can't change data link type */
+	handle->getnonblock_op = shm_getnonblock;
+	handle->setnonblock_op = shm_setnonblock;
+	handle->stats_op = shm_stats;
+	handle->cleanup_op = shm_cleanup;
+
+	/*
+	 * There's nothing to select() or poll() on.
+	 */
+	handle->selectable_fd = -1;
+	return (0);
+
+fail:
+	shm_cleanup(handle);
+	return (PCAP_ERROR);
+}
+
+pcap_t *
+shm_create(const char *device, char *ebuf, int *is_ours)
+{
+	pcap_t *p;
+
+	if (strncmp(device, "shm:", 4) != 0 || device[4] == '\0') {
+		*is_ours = 0;
+		return (NULL);
+	}
+
+	*is_ours = 1;
+	p = pcap_create_common(device, ebuf, sizeof (struct pcap_shm));
+	if (p == NULL)
+		return (NULL);
+
+	p->activate_op = shm_activate;
+	return (p);
+}
+
+int
+shm_findalldevs(pcap_if_t **alldevsp _U_, char *errbuf _U_)
+{
+	/*
+	 * Published captures can't be listed portably; they have to
+	 * be asked for by name.
+	 */
+	return (0);
+}
+
+#else /* PCAP_SUPPORT_SHM */
+
+pcap_shm_publisher_t *
+pcap_shm_publisher_open(pcap_t *p, const char *name, u_int size _U_)
+{
+	snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "%s: publishing to shared memory isn't supported on this platform",
+	    name);
+	return (NULL);
+}
+
+void
+pcap_shm_publish(u_char *user _U_, const struct pcap_pkthdr *h _U_,
+    const u_char *sp _U_)
+{
+}
+
+void
+pcap_shm_publisher_close(pcap_shm_publisher_t *pub _U_)
+{
+}
+
+#endif /* PCAP_SUPPORT_SHM */
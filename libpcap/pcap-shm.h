@@ -0,0 +1,5 @@
+/*
+ * Prototypes for capturing from packets published in shared memory.
+ */
+int shm_findalldevs(pcap_if_t **devlistp, char *errbuf);
+pcap_t *shm_create(const char *device, char *ebuf, int *is_ours);
@@ -41,11 +41,91 @@
 #include "pcap-util.h"
 
 
+/*
+ * Interfaces and processes are looked up for every packet, so they're
+ * kept in hash tables, by name and id for interfaces, and by pid and
+ * name for processes, as well as in arrays in the order they were
+ * added, which, for processes, and for interfaces added with an id of
+ * -1, is also the order of their ids.
+ */
+#define PCAP_INFO_HASH_MIN	64
+
+static u_int
+pcap_info_hash_str(const char *str, u_int hash)
+{
+	const u_char *cp = (const u_char *)str;
+
+	while (*cp != 0)
+		hash = (hash ^ *cp++) * 16777619;
+	return (hash);
+}
+
+static u_int
+pcap_info_hash_int(uint32_t val)
+{
+	val ^= val >> 16;
+	val *= 0x7feb352d;
+	val ^= val >> 15;
+	return (val);
+}
+
+#define IF_NAME_HASH(name)	pcap_info_hash_str((name), 2166136261U)
+#define IF_ID_HASH(id)		pcap_info_hash_int((uint32_t)(id))
+#define PROC_HASH(pid, name)	pcap_info_hash_str((name), pcap_info_hash_int(pid))
+
+/*
+ * Make sure the hash tables have room for another entry, growing them,
+ * and rehashing what's in them, if they don't
+ */
+static int
+pcap_grow_if_info_hash(pcap_t * pcap)
+{
+	struct pcap_if_info **by_name, **by_id, *if_info;
+	u_int size, bucket;
+	int i;
+	
+	if ((u_int)pcap->if_info_count < pcap->if_info_hash_size)
+		return (0);
+	size = pcap->if_info_hash_size == 0 ? PCAP_INFO_HASH_MIN :
+	    pcap->if_info_hash_size * 2;
+	by_name = calloc(size, sizeof(struct pcap_if_info *));
+	by_id = calloc(size, sizeof(struct pcap_if_info *));
+	if (by_name == NULL || by_id == NULL) {
+		free(by_name);
+		free(by_id);
+		return (-1);
+	}
+	for (i = 0; i < pcap->if_info_count; i++) {
+		if_info = pcap->if_infos[i];
+		if (if_info == NULL)
+			continue;
+		bucket = IF_NAME_HASH(if_info->if_name) & (size - 1);
+		if_info->if_name_next = by_name[bucket];
+		by_name[bucket] = if_info;
+		bucket = IF_ID_HASH(if_info->if_id) & (size - 1);
+		if_info->if_id_next = by_id[bucket];
+		by_id[bucket] = if_info;
+	}
+	free(pcap->if_info_by_name);
+	free(pcap->if_info_by_id);
+	pcap->if_info_by_name = by_name;
+	pcap->if_info_by_id = by_id;
+	pcap->if_info_hash_size = size;
+	return (0);
+}
+
 void
 pcap_clear_if_infos(pcap_t * pcap)
 {
 	int i;
 	
+	free(pcap->if_info_by_name);
+	pcap->if_info_by_name = NULL;
+	free(pcap->if_info_by_id);
+	pcap->if_info_by_id = NULL;
+	pcap->if_info_hash_size = 0;
+	pcap->if_info_dumped = 0;
+	
 	if (pcap->if_infos != NULL) {
 		for (i = 0; i < pcap->if_info_count; i++)
 			pcap_free_if_info(pcap, pcap->if_infos[i]);
@@ -61,11 +141,15 @@ pcap_clear_if_infos(pcap_t * pcap)
 struct pcap_if_info *
 pcap_find_if_info_by_name(pcap_t * pcap, const char *name)
 {
-	int i;
+	struct pcap_if_info *if_info;
 	
-	for (i = 0; i < pcap->if_info_count; i++) {
-		if (strcmp(name, pcap->if_infos[i]->if_name) == 0)
-			return (pcap->if_infos[i]);
+	if (pcap->if_info_hash_size == 0)
+		return (NULL);
+	if_info = pcap->if_info_by_name[IF_NAME_HASH(name) &
+	    (pcap->if_info_hash_size - 1)];
+	for (; if_info != NULL; if_info = if_info->if_name_next) {
+		if (strcmp(name, if_info->if_name) == 0)
+			return (if_info);
 	}
 	return (NULL);
 }
@@ -73,11 +157,23 @@ pcap_find_if_info_by_name(pcap_t * pcap, const char *name)
 struct pcap_if_info *
 pcap_find_if_info_by_id(pcap_t * pcap, int if_id)
 {
-	int i;
+	struct pcap_if_info *if_info;
 	
-	for (i = 0; i < pcap->if_info_count; i++) {
-		if (if_id == pcap->if_infos[i]->if_id)
-			return (pcap->if_infos[i]);
+	/*
+	 * Ids we assigned are the index in the array
+	 */
+	if (if_id >= 0 && if_id < pcap->if_info_count &&
+	    pcap->if_infos[if_id] != NULL &&
+	    pcap->if_infos[if_id]->if_id == if_id)
+		return (pcap->if_infos[if_id]);
+	
+	if (pcap->if_info_hash_size == 0)
+		return (NULL);
+	if_info = pcap->if_info_by_id[IF_ID_HASH(if_id) &
+	    (pcap->if_info_hash_size - 1)];
+	for (; if_info != NULL; if_info = if_info->if_id_next) {
+		if (if_id == if_info->if_id)
+			return (if_info);
 	}
 	return (NULL);
 }
@@ -86,12 +182,41 @@ void
 pcap_free_if_info(pcap_t * pcap, struct pcap_if_info *if_info)
 {
 	if (if_info != NULL) {
+		struct pcap_if_info **pp;
 		int i;
 		
-		for (i = 0; i < pcap->if_info_count; i++) {
-			if (pcap->if_infos[i] == if_info) {
-				pcap->if_infos[i] = NULL;
-				break;
+		if (if_info->if_id >= 0 && if_info->if_id < pcap->if_info_count &&
+		    pcap->if_infos[if_info->if_id] == if_info)
+			pcap->if_infos[if_info->if_id] = NULL;
+		else {
+			for (i = 0; i < pcap->if_info_count; i++) {
+				if (pcap->if_infos[i] == if_info) {
+					pcap->if_infos[i] = NULL;
+					break;
+				}
+			}
+		}
+		
+		/*
+		 * Unlink it from the hash chains, unless we're
+		 * throwing them away
+		 */
+		if (pcap->if_info_hash_size != 0) {
+			pp = &pcap->if_info_by_name[IF_NAME_HASH(if_info->if_name) &
+			    (pcap->if_info_hash_size - 1)];
+			for (; *pp != NULL; pp = &(*pp)->if_name_next) {
+				if (*pp == if_info) {
+					*pp = if_info->if_name_next;
+					break;
+				}
+			}
+			pp = &pcap->if_info_by_id[IF_ID_HASH(if_info->if_id) &
+			    (pcap->if_info_hash_size - 1)];
+			for (; *pp != NULL; pp = &(*pp)->if_id_next) {
+				if (*pp == if_info) {
+					*pp = if_info->if_id_next;
+					break;
+				}
 			}
 		}
 		
@@ -107,6 +232,7 @@ pcap_add_if_info(pcap_t * pcap, const char *name,
 	struct pcap_if_info *if_info = NULL;
 	size_t ifname_len = strlen(name);
 	struct pcap_if_info **newarray;
+	u_int bucket;
 
 	pcap->cleanup_extra_op = pcap_ng_init_section_info;
 
@@ -147,7 +273,7 @@ pcap_add_if_info(pcap_t * pcap, const char *name,
 	}
 	
 	/*
-	 * Resize pointer array
+	 * Resize pointer array and hash tables
 	 */
 	newarray = realloc(pcap->if_infos,
 			   (pcap->if_info_count + 1) * sizeof(struct pcap_if_info *));
@@ -158,17 +284,64 @@ pcap_add_if_info(pcap_t * pcap, const char *name,
 		return (NULL);
 	}
 	pcap->if_infos = newarray;
+	if (pcap_grow_if_info_hash(pcap) == -1) {
+		snprintf(pcap->errbuf, PCAP_ERRBUF_SIZE,
+				 "%s: calloc() failed", __func__);
+		pcap_free_if_info(pcap, if_info);
+		return (NULL);
+	}
 	pcap->if_infos[pcap->if_info_count] = if_info;
 	pcap->if_info_count += 1;
 	
+	bucket = IF_NAME_HASH(if_info->if_name) & (pcap->if_info_hash_size - 1);
+	if_info->if_name_next = pcap->if_info_by_name[bucket];
+	pcap->if_info_by_name[bucket] = if_info;
+	bucket = IF_ID_HASH(if_info->if_id) & (pcap->if_info_hash_size - 1);
+	if_info->if_id_next = pcap->if_info_by_id[bucket];
+	pcap->if_info_by_id[bucket] = if_info;
+	
 	return (if_info);
 }
 
+static int
+pcap_grow_proc_info_hash(pcap_t * pcap)
+{
+	struct pcap_proc_info **by_pid, *proc_info;
+	u_int size, bucket;
+	int i;
+	
+	if ((u_int)pcap->proc_info_count < pcap->proc_info_hash_size)
+		return (0);
+	size = pcap->proc_info_hash_size == 0 ? PCAP_INFO_HASH_MIN :
+	    pcap->proc_info_hash_size * 2;
+	by_pid = calloc(size, sizeof(struct pcap_proc_info *));
+	if (by_pid == NULL)
+		return (-1);
+	for (i = 0; i < pcap->proc_info_count; i++) {
+		proc_info = pcap->proc_infos[i];
+		if (proc_info == NULL)
+			continue;
+		bucket = PROC_HASH(proc_info->proc_pid, proc_info->proc_name) &
+		    (size - 1);
+		proc_info->proc_hash_next = by_pid[bucket];
+		by_pid[bucket] = proc_info;
+	}
+	free(pcap->proc_info_by_pid);
+	pcap->proc_info_by_pid = by_pid;
+	pcap->proc_info_hash_size = size;
+	return (0);
+}
+
 void
 pcap_clear_proc_infos(pcap_t * pcap)
 {
 	int i;
 	
+	free(pcap->proc_info_by_pid);
+	pcap->proc_info_by_pid = NULL;
+	pcap->proc_info_hash_size = 0;
+	pcap->proc_info_dumped = 0;
+	
 	if (pcap->proc_infos != NULL) {
 		for (i = 0; i < pcap->proc_info_count; i++)
 			pcap_free_proc_info(pcap, pcap->proc_infos[i]);
@@ -184,11 +357,13 @@ pcap_clear_proc_infos(pcap_t * pcap)
 struct pcap_proc_info *
 pcap_find_proc_info(pcap_t * pcap, uint32_t pid, const char *name)
 {
-	int i;
+	struct pcap_proc_info *proc_info;
 	
-	for (i = 0; i < pcap->proc_info_count; i++) {
-		struct pcap_proc_info *proc_info = pcap->proc_infos[i];
-		
+	if (pcap->proc_info_hash_size == 0)
+		return (NULL);
+	proc_info = pcap->proc_info_by_pid[PROC_HASH(pid, name) &
+	    (pcap->proc_info_hash_size - 1)];
+	for (; proc_info != NULL; proc_info = proc_info->proc_hash_next) {
 		if (pid == proc_info->proc_pid &&
 			strcmp(name, proc_info->proc_name) == 0)
 			return (proc_info);
@@ -199,15 +374,9 @@ pcap_find_proc_info(pcap_t * pcap, uint32_t pid, const char *name)
 struct pcap_proc_info *
 pcap_find_proc_info_by_index(pcap_t * pcap, uint32_t index)
 {
-	int i;
-	
-	for (i = 0; i < pcap->proc_info_count; i++) {
-		struct pcap_proc_info *proc_info = pcap->proc_infos[i];
-		
-		if (index == proc_info->proc_index)
-			return (proc_info);
-	}
-	return (NULL);
+	if (index >= (uint32_t)pcap->proc_info_count)
+		return (NULL);
+	return (pcap->proc_infos[index]);
 }
 
 void
@@ -215,12 +384,20 @@ pcap_free_proc_info(pcap_t * pcap, struct pcap_proc_info *proc_info)
 {
 	
 	if (proc_info != NULL) {
-		int i;
+		struct pcap_proc_info **pp;
+		
+		if (proc_info->proc_index < (uint32_t)pcap->proc_info_count &&
+		    pcap->proc_infos[proc_info->proc_index] == proc_info)
+			pcap->proc_infos[proc_info->proc_index] = NULL;
 		
-		for (i = 0; i < pcap->proc_info_count; i++) {
-			if (pcap->proc_infos[i] == proc_info) {
-				pcap->proc_infos[i] = NULL;
-				break;
+		if (pcap->proc_info_hash_size != 0) {
+			pp = &pcap->proc_info_by_pid[PROC_HASH(proc_info->proc_pid,
+			    proc_info->proc_name) & (pcap->proc_info_hash_size - 1)];
+			for (; *pp != NULL; pp = &(*pp)->proc_hash_next) {
+				if (*pp == proc_info) {
+					*pp = proc_info->proc_hash_next;
+					break;
+				}
 			}
 		}
 		free(proc_info);
@@ -233,6 +410,7 @@ pcap_add_proc_info(pcap_t * pcap, uint32_t pid, const char *name)
 	struct pcap_proc_info *proc_info = NULL;
 	size_t name_len = strlen(name);
 	struct pcap_proc_info **newarray;
+	u_int bucket;
 	
 	pcap->cleanup_extra_op = pcap_ng_init_section_info;
 	
@@ -253,7 +431,7 @@ pcap_add_proc_info(pcap_t * pcap, uint32_t pid, const char *name)
 	proc_info->proc_index = pcap->proc_info_count;
 	
 	/*
-	 * Resize pointer array
+	 * Resize pointer array and hash table
 	 */
 	newarray = realloc(pcap->proc_infos,
 			   (pcap->proc_info_count + 1) * sizeof(struct pcap_proc_info *));
@@ -264,9 +442,20 @@ pcap_add_proc_info(pcap_t * pcap, uint32_t pid, const char *name)
 		return (NULL);
 	}
 	pcap->proc_infos = newarray;
+	if (pcap_grow_proc_info_hash(pcap) == -1) {
+		snprintf(pcap->errbuf, PCAP_ERRBUF_SIZE,
+			 "%s: calloc() failed", __func__);
+		pcap_free_proc_info(pcap, proc_info);
+		return (NULL);
+	}
 	pcap->proc_infos[pcap->proc_info_count] = proc_info;
 	pcap->proc_info_count += 1;
 	
+	bucket = PROC_HASH(pid, proc_info->proc_name) &
+	    (pcap->proc_info_hash_size - 1);
+	proc_info->proc_hash_next = pcap->proc_info_by_pid[bucket];
+	pcap->proc_info_by_pid[bucket] = proc_info;
+	
 	return (proc_info);
 }
 
@@ -40,6 +40,8 @@ struct pcap_if_info {
 	u_short if_snaplen;
 	struct bpf_program if_filter_program;
 	int if_block_added;
+	struct pcap_if_info *if_name_next;	/* hash chain */
+	struct pcap_if_info *if_id_next;	/* hash chain */
 };
 extern struct pcap_if_info * pcap_find_if_info_by_name(pcap_t *, const char *);
 extern struct pcap_if_info * pcap_find_if_info_by_id(pcap_t *, int);
@@ -54,6 +56,7 @@ struct pcap_proc_info {
 	uint32_t proc_pid;
 	char *proc_name;
 	int proc_block_added;
+	struct pcap_proc_info *proc_hash_next;	/* hash chain */
 };
 extern struct pcap_proc_info * pcap_find_proc_info(pcap_t *, uint32_t , const char *);
 extern struct pcap_proc_info * pcap_find_proc_info_by_index(pcap_t *, uint32_t);
@@ -52,6 +52,7 @@ static const char rcsid[] _U_ =
 #include <sys/bitypes.h>
 #endif
 #include <sys/types.h>
+#include <net/if.h>
 #endif /* WIN32 */
 
 #include <stdio.h>
@@ -109,6 +110,10 @@ static const char rcsid[] _U_ =
 #include "pcap-dbus.h"
 #endif
 
+#ifdef PCAP_SUPPORT_SHM
+#include "pcap-shm.h"
+#endif
+
 int 
 pcap_not_initialized(pcap_t *pcap _U_)
 {
@@ -203,7 +208,12 @@ pcap_oneshot(u_char *user, const struct pcap_pkthdr *h, const u_char *pkt)
 {
 	struct oneshot_userdata *sp = (struct oneshot_userdata *)user;
 
-	*sp->hdr = *h;
+	if (sp->xhdr != NULL && sp->pd->per_interface)
+		*sp->xhdr = *(const struct pcap_pkthdr_if *)h;
+	else if (sp->xhdr != NULL && sp->pd->vlan_metadata)
+		sp->xhdr->vhdr = *(const struct pcap_pkthdr_vlan *)h;
+	else
+		*sp->hdr = *h;
 	*sp->pkt = pkt;
 }
 
@@ -214,6 +224,7 @@ pcap_next(pcap_t *p, struct pcap_pkthdr *h)
 	const u_char *pkt;
 
 	s.hdr = h;
+	s.xhdr = NULL;
 	s.pkt = &pkt;
 	s.pd = p;
 	if (pcap_dispatch(p, 1, p->oneshot_callback, (u_char *)&s) <= 0)
@@ -227,12 +238,13 @@ pcap_next_ex(pcap_t *p, struct pcap_pkthdr **pkt_header,
 {
 	struct oneshot_userdata s;
 
-	s.hdr = &p->pcap_header;
+	s.hdr = &p->pcap_header.vhdr.hdr;
+	s.xhdr = &p->pcap_header;
 	s.pkt = pkt_data;
 	s.pd = p;
 
 	/* Saves a pointer to the packet headers */
-	*pkt_header= &p->pcap_header;
+	*pkt_header= &p->pcap_header.vhdr.hdr;
 
 	if (p->rfile != NULL) {
 		int status;
@@ -256,9 +268,11 @@ pcap_next_ex(pcap_t *p, struct pcap_pkthdr **pkt_header,
 		 * the timeout expired", so we map it to -2 so you can
 		 * distinguish between an EOF from a savefile and a
 		 * "no packets arrived before the timeout expired, try
-		 * again" from a live capture.
+		 * again" from a live capture.  If we're following the
+		 * file, 0 means nothing more has been written yet, just
+		 * as with a live capture.
 		 */
-		if (status == 0)
+		if (status == 0 && !sf_following(p))
 			return (-2);
 		else
 			return (status);
@@ -343,6 +357,9 @@ struct capture_source_type {
 #endif
 #ifdef PCAP_SUPPORT_DBUS
 	{ dbus_findalldevs, dbus_create },
+#endif
+#ifdef PCAP_SUPPORT_SHM
+	{ shm_findalldevs, shm_create },
 #endif
 	{ NULL, NULL }
 };
@@ -456,12 +473,18 @@ initialize_ops(pcap_t *p)
 	 */
 	p->read_op = (read_op_t)pcap_not_initialized;
 	p->inject_op = (inject_op_t)pcap_not_initialized;
+	p->transmit_op = NULL;	/* pcap_sendqueue_transmit() uses inject_op */
 	p->setfilter_op = (setfilter_op_t)pcap_not_initialized;
 	p->setdirection_op = (setdirection_op_t)pcap_not_initialized;
 	p->set_datalink_op = (set_datalink_op_t)pcap_not_initialized;
 	p->getnonblock_op = (getnonblock_op_t)pcap_not_initialized;
 	p->setnonblock_op = (setnonblock_op_t)pcap_not_initialized;
 	p->stats_op = (stats_op_t)pcap_not_initialized;
+	p->stats64_op = NULL;	/* pcap_stats64() uses stats_op */
+	p->retain_op = NULL;	/* pcap_retain() says it can't */
+	p->release_op = NULL;
+	p->block_header_op = NULL;	/* pcap_block_writer_open() says it can't */
+	p->write_blocks_op = NULL;
 #ifdef WIN32
 	p->setbuff_op = (setbuff_op_t)pcap_not_initialized;
 	p->setmode_op = (setmode_op_t)pcap_not_initialized;
@@ -512,6 +535,8 @@ pcap_alloc_pcap_t(char *ebuf, size_t size)
 	p->fd = -1;	/* not opened yet */
 	p->selectable_fd = -1;
 #endif 
+	p->numa_node = -1;	/* not known */
+	p->cpu = -1;		/* not pinned */
 
 	if (size == 0) {
 		/* No private data was requested. */
@@ -563,6 +588,19 @@ pcap_create_common(const char *source, char *ebuf, size_t size)
 	p->opt.immediate = 0;
 	p->opt.tstamp_type = -1;	/* default to not setting time stamp type */
 	p->opt.tstamp_precision = PCAP_TSTAMP_PRECISION_MICRO;
+	p->opt.tx_ring = 0;
+	p->opt.qdisc_bypass = 0;
+	p->opt.busy_poll = 0;
+	p->opt.busy_poll_flags = 0;
+	p->opt.latency_hist = 0;
+	p->opt.numa_node = PCAP_NUMA_NODE_NONE;
+	p->opt.cpu = PCAP_CPU_NONE;
+	p->opt.fanout_group = -1;
+	p->opt.fanout_mode = PCAP_FANOUT_HASH;
+	p->opt.stats_refresh = 1000;	/* counters up to a second old */
+	p->opt.recv_batch = 0;		/* use a ring if there is one */
+	p->opt.vlan_metadata = 0;
+	p->opt.per_interface = 0;
 	return (p);
 }
 
@@ -669,6 +707,178 @@ pcap_set_buffer_size(pcap_t *p, int buffer_size)
 	return (0);
 }
 
+int
+pcap_set_tx_ring(pcap_t *p, int tx_ring)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.tx_ring = tx_ring;
+	return (0);
+}
+
+int
+pcap_set_qdisc_bypass(pcap_t *p, int qdisc_bypass)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.qdisc_bypass = qdisc_bypass;
+	return (0);
+}
+
+int
+pcap_set_busy_poll(pcap_t *p, int usec, int flags)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.busy_poll = usec;
+	p->opt.busy_poll_flags = flags;
+	return (0);
+}
+
+int
+pcap_set_latency_histogram(pcap_t *p, int latency_hist)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.latency_hist = latency_hist;
+	return (0);
+}
+
+int
+pcap_set_numa_node(pcap_t *p, int node)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (node < PCAP_NUMA_NODE_NONE) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%d is not a valid NUMA node", node);
+		return (PCAP_ERROR);
+	}
+	p->opt.numa_node = node;
+	return (0);
+}
+
+int
+pcap_set_cpu_affinity(pcap_t *p, int cpu)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (cpu < PCAP_CPU_NONE) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%d is not a valid CPU", cpu);
+		return (PCAP_ERROR);
+	}
+	p->opt.cpu = cpu;
+	return (0);
+}
+
+int
+pcap_set_fanout(pcap_t *p, int group, int mode)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (group > 0xffff ||
+	    (mode != PCAP_FANOUT_HASH && mode != PCAP_FANOUT_LB &&
+	     mode != PCAP_FANOUT_CPU)) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "invalid fanout group %d or mode %d", group, mode);
+		return (PCAP_ERROR);
+	}
+	p->opt.fanout_group = group;
+	p->opt.fanout_mode = mode;
+	return (0);
+}
+
+int
+pcap_set_stats_refresh(pcap_t *p, int msec)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.stats_refresh = msec < 0 ? 0 : msec;
+	return (0);
+}
+
+int
+pcap_set_recv_batch(pcap_t *p, int n)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (n < 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%d is not a valid batch size", n);
+		return (PCAP_ERROR);
+	}
+	p->opt.recv_batch = n;
+	return (0);
+}
+
+int
+pcap_set_vlan_metadata(pcap_t *p, int vlan_metadata)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (vlan_metadata && !p->vlan_metadata_ok) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "VLAN metadata isn't supported on this device");
+		return (PCAP_ERROR);
+	}
+	p->opt.vlan_metadata = vlan_metadata;
+	return (0);
+}
+
+int
+pcap_set_per_interface(pcap_t *p, int per_interface)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.per_interface = per_interface;
+	return (0);
+}
+
+int
+pcap_get_numa_node(pcap_t *p)
+{
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	return (p->numa_node);
+}
+
+int
+pcap_get_cpu(pcap_t *p)
+{
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	return (p->cpu);
+}
+
+int
+pcap_get_vlan_metadata(pcap_t *p)
+{
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	return (p->vlan_metadata);
+}
+
+int
+pcap_get_per_interface(pcap_t *p)
+{
+	if (!p->activated)
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	return (p->per_interface);
+}
+
+int
+pcap_latency_histogram(pcap_t *p, struct pcap_latency_hist *lh)
+{
+	if (p->lat_hist == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "No latency histogram was requested, or this device doesn't support one");
+		return (PCAP_ERROR);
+	}
+	*lh = *p->lat_hist;
+	return (0);
+}
+
 int
 pcap_set_tstamp_precision(pcap_t *p, int tstamp_precision)
 {
@@ -849,13 +1059,19 @@ pcap_loop(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 	for (;;) {
 		if (p->rfile != NULL) {
 			/*
-			 * 0 means EOF, so don't loop if we get 0.
+			 * 0 means EOF, so don't loop if we get 0,
+			 * unless we're following the file and it
+			 * might yet grow; in non-blocking mode, that
+			 * would just spin, so return the 0.
 			 */
+			do {
 #ifdef __APPLE__
-			n = p->read_op(p, cnt, callback, user);
+				n = p->read_op(p, cnt, callback, user);
 #else
-			n = pcap_offline_read(p, cnt, callback, user);
+				n = pcap_offline_read(p, cnt, callback, user);
 #endif /* __APPLE__ */
+			} while (n == 0 && sf_following(p) &&
+			    p->getnonblock_op(p, p->errbuf) == 0);
 		} else {
 			/*
 			 * XXX keep reading until we get something
@@ -1586,6 +1802,171 @@ pcap_setfilter(pcap_t *p, struct bpf_program *fp)
 	return (p->setfilter_op(p, fp));
 }
 
+/*
+ * Per-interface filters, for handles in per-interface mode.
+ *
+ * They're kept in a table sorted by interface index, as the indices
+ * can be far too big to index a table with; there are seldom more than
+ * a few filters, and packets mostly come from the same interface as
+ * the one before, so the entry last found is tried first.  Interfaces
+ * with no entry get the default filter, for index 0, as no interface
+ * has index 0; with no default filter, they get everything.
+ */
+
+/*
+ * Find where the filter for an interface is, or would go.
+ */
+static int
+pcap_if_filter_search(pcap_t *p, int ifindex)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = p->if_filter_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (p->if_filters[mid].ifindex < ifindex)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+static const struct bpf_program *
+pcap_if_filter_lookup(pcap_t *p, int ifindex)
+{
+	int i;
+
+	i = p->if_filter_last;
+	if (i < p->if_filter_count && p->if_filters[i].ifindex == ifindex)
+		return (&p->if_filters[i].prog);
+	i = pcap_if_filter_search(p, ifindex);
+	if (i < p->if_filter_count && p->if_filters[i].ifindex == ifindex) {
+		p->if_filter_last = i;
+		return (&p->if_filters[i].prog);
+	}
+	return (NULL);
+}
+
+int
+pcap_setfilter_if(pcap_t *p, int ifindex, struct bpf_program *fp)
+{
+	struct pcap_if_filter *filters;
+	struct bpf_insn *insns = NULL;
+	size_t prog_size;
+	int newmax, i;
+
+	if (!p->per_interface) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "per-interface filters need a handle in per-interface mode");
+		return (-1);
+	}
+	if (ifindex < 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%d isn't a valid interface index", ifindex);
+		return (-1);
+	}
+	if (fp != NULL) {
+		if (!bpf_validate(fp->bf_insns, fp->bf_len)) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "BPF program is not valid");
+			return (-1);
+		}
+		prog_size = sizeof(*fp->bf_insns) * fp->bf_len;
+		insns = (struct bpf_insn *)malloc(prog_size);
+		if (insns == NULL) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		memcpy(insns, fp->bf_insns, prog_size);
+	}
+
+	i = pcap_if_filter_search(p, ifindex);
+	if (i < p->if_filter_count && p->if_filters[i].ifindex == ifindex) {
+		pcap_freecode(&p->if_filters[i].prog);
+		if (fp == NULL) {
+			p->if_filter_count--;
+			memmove(&p->if_filters[i], &p->if_filters[i + 1],
+			    (p->if_filter_count - i) * sizeof(*p->if_filters));
+		}
+	} else {
+		if (fp == NULL)
+			return (0);	/* nothing to remove */
+		if (p->if_filter_count == p->if_filters_max) {
+			newmax = p->if_filters_max == 0 ? 8 :
+			    p->if_filters_max * 2;
+			filters = realloc(p->if_filters,
+			    newmax * sizeof(*filters));
+			if (filters == NULL) {
+				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+				    "malloc: %s", pcap_strerror(errno));
+				free(insns);
+				return (-1);
+			}
+			p->if_filters = filters;
+			p->if_filters_max = newmax;
+		}
+		memmove(&p->if_filters[i + 1], &p->if_filters[i],
+		    (p->if_filter_count - i) * sizeof(*p->if_filters));
+		p->if_filters[i].ifindex = ifindex;
+		p->if_filter_count++;
+	}
+	if (fp != NULL) {
+		p->if_filters[i].prog.bf_len = fp->bf_len;
+		p->if_filters[i].prog.bf_insns = insns;
+	}
+	p->if_filter_last = 0;
+	return (0);
+}
+
+int
+pcap_setfilter_ifname(pcap_t *p, const char *ifname, struct bpf_program *fp)
+{
+#ifndef WIN32
+	u_int ifindex;
+
+	ifindex = if_nametoindex(ifname);
+	if (ifindex == 0) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s", ifname,
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	return (pcap_setfilter_if(p, ifindex, fp));
+#else
+	snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "Per-interface filters are not implemented on this platform");
+	return (-1);
+#endif
+}
+
+/*
+ * Run a packet, as it would be handed to the callback, through the
+ * filter for its interface.  Returns non-zero if it passes.  A VLAN
+ * tag that was handed over as metadata is supplied to the filter as
+ * auxiliary data, as it is to the handle's own filter.
+ */
+int
+pcap_filter_if(pcap_t *p, const struct pcap_pkthdr_if *h, const u_char *pkt)
+{
+	const struct bpf_program *fp = NULL;
+	struct bpf_aux_data aux;
+
+	if (h->if_index > 0)
+		fp = pcap_if_filter_lookup(p, h->if_index);
+	if (fp == NULL) {
+		if (p->if_filter_count == 0 ||
+		    p->if_filters[0].ifindex != PCAP_IF_FILTER_DEFAULT)
+			return (1);
+		fp = &p->if_filters[0].prog;
+	}
+	aux.vlan_tag_present = (h->vhdr.vlan_flags & PCAP_VLAN_VALID) != 0;
+	aux.vlan_tag = h->vhdr.vlan_tci;
+	return (bpf_filter_with_aux_data(fp->bf_insns, pkt, h->vhdr.hdr.len,
+	    h->vhdr.hdr.caplen, &aux));
+}
+
 /*
  * Set direction flag, which controls whether we accept only incoming
  * packets, only outgoing packets, or both.
@@ -1609,6 +1990,52 @@ pcap_stats(pcap_t *p, struct pcap_stat *ps)
 	return (p->stats_op(p, ps));
 }
 
+int
+pcap_stats64(pcap_t *p, struct pcap_stat64 *ps)
+{
+	struct pcap_stat s;
+
+	if (p->stats64_op != NULL)
+		return (p->stats64_op(p, ps));
+	if (p->stats_op(p, &s) != 0)
+		return (-1);
+	ps->ps_recv = s.ps_recv;
+	ps->ps_drop = s.ps_drop;
+	ps->ps_ifdrop = s.ps_ifdrop;
+	return (0);
+}
+
+int
+pcap_retain(pcap_t *p, const u_char *pkt)
+{
+	if (p->retain_op == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Packets can't be retained on this device, or in this capture mode");
+		return (PCAP_ERROR);
+	}
+	return (p->retain_op(p, pkt));
+}
+
+int
+pcap_release(pcap_t *p, const u_char *pkt)
+{
+	if (p->release_op == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Packets can't be retained on this device, or in this capture mode");
+		return (PCAP_ERROR);
+	}
+	return (p->release_op(p, pkt));
+}
+
+int
+pcap_pinned_blocks(pcap_t *p)
+{
+	int n = p->pinned_blocks;
+
+	/* a release can briefly get ahead of the reader's count */
+	return (n < 0 ? 0 : n);
+}
+
 static int
 pcap_stats_dead(pcap_t *p, struct pcap_stat *ps _U_)
 {
@@ -1778,6 +2205,10 @@ pcap_cleanup_live_common(pcap_t *p)
 		p->tstamp_precision_list = NULL;
 		p->tstamp_precision_count = 0;
 	}
+	if (p->lat_hist != NULL) {
+		free(p->lat_hist);
+		p->lat_hist = NULL;
+	}
 	pcap_freecode(&p->fcode);
 #if !defined(WIN32) && !defined(MSDOS)
 	if (p->fd >= 0) {
@@ -1857,9 +2288,88 @@ pcap_inject(pcap_t *p, const void *buf, size_t size)
 	return (p->inject_op(p, buf, size));
 }
 
+pcap_send_queue *
+pcap_sendqueue_alloc(u_int memsize)
+{
+	pcap_send_queue *q;
+
+	q = malloc(sizeof(*q));
+	if (q == NULL)
+		return (NULL);
+	q->buffer = malloc(memsize);
+	if (q->buffer == NULL) {
+		free(q);
+		return (NULL);
+	}
+	q->maxlen = memsize;
+	q->len = 0;
+	q->sent = 0;
+	q->failed = 0;
+	return (q);
+}
+
+void
+pcap_sendqueue_destroy(pcap_send_queue *q)
+{
+	free(q->buffer);
+	free(q);
+}
+
+/*
+ * Append a packet to a send queue; returns -1 if it doesn't fit.
+ */
+int
+pcap_sendqueue_queue(pcap_send_queue *q, const struct pcap_pkthdr *h,
+    const u_char *data)
+{
+	if (q->maxlen - q->len < sizeof(*h) ||
+	    q->maxlen - q->len - sizeof(*h) < h->caplen)
+		return (-1);
+	memcpy(q->buffer + q->len, h, sizeof(*h));
+	memcpy(q->buffer + q->len + sizeof(*h), data, h->caplen);
+	q->len += sizeof(*h) + h->caplen;
+	return (0);
+}
+
+/*
+ * Send everything in a send queue.  Modules that can hand the kernel
+ * a batch of packets at once supply a transmit_op; for the rest, we
+ * inject the packets one at a time.  A packet that can't be sent is
+ * counted in q->failed, with the reason left in the error buffer, and
+ * doesn't stop the rest of the queue from going out.
+ */
+int
+pcap_sendqueue_transmit(pcap_t *p, pcap_send_queue *q)
+{
+	struct pcap_pkthdr h;
+	u_int off;
+
+	q->sent = 0;
+	q->failed = 0;
+	if (p->transmit_op != NULL)
+		return (p->transmit_op(p, q));
+
+	for (off = 0; q->len - off >= sizeof(h); off += sizeof(h) + h.caplen) {
+		memcpy(&h, q->buffer + off, sizeof(h));
+		if (q->len - off - sizeof(h) < h.caplen)
+			break;
+		if (p->inject_op(p, q->buffer + off + sizeof(h),
+		    h.caplen) < 0)
+			q->failed++;
+		else
+			q->sent++;
+	}
+	if (q->sent == 0 && q->failed != 0)
+		return (-1);
+	return (q->sent);
+}
+
 void
 pcap_close(pcap_t *p)
 {
+	struct pcap_ng_if_dumper *ngd;
+	int i;
+
 #ifdef __APPLE__
 	if (p->cleanup_interface_op != NULL)
 		p->cleanup_interface_op(p->opt.source);
@@ -1874,6 +2384,17 @@ pcap_close(pcap_t *p)
 #endif /* __APPLE__ */
 
 	p->cleanup_op(p);
+	while (p->ng_dumpers != NULL) {
+		ngd = p->ng_dumpers;
+		p->ng_dumpers = ngd->next;
+		free(ngd->t.ids);
+		free(ngd);
+	}
+	if (p->if_filters != NULL) {
+		for (i = 0; i < p->if_filter_count; i++)
+			pcap_freecode(&p->if_filters[i].prog);
+		free(p->if_filters);
+	}
 	free(p);
 }
 
@@ -581,7 +581,7 @@ struct bpf_program {
 
 #ifdef __APPLE__
 #define DLT_PKTAP       DLT_USER2
-#define DLT_PCAPNG      DLT_USER3
+#define DLT_PCAPNG      DLT_USER3	/* see below */
 #endif
 /*
  * For future use with 802.11 captures - defined by AbsoluteValue
@@ -1249,6 +1249,20 @@ struct bpf_program {
 #define	DLT_NETBSD_RAWAF_AF(x)	((x) & 0x0000ffff)
 #define	DLT_IS_NETBSD_RAWAF(x)	(DLT_CLASS(x) == DLT_CLASS_NETBSD_RAWAF)
 
+/*
+ * Not a link-layer type as such: what pcap_datalink() returns for a
+ * handle whose packets each have a link-layer type of their own, such
+ * as one reading a pcapng file with the block-based API, or one in
+ * per-interface mode on the "any" device.  On Apple platforms it has
+ * always been DLT_USER3, and binaries built with that value must keep
+ * working; elsewhere it never appears in a savefile, so it's kept out
+ * of the range of values that can, and out of the DLT_USERn values
+ * applications use for their own types.
+ */
+#ifndef DLT_PCAPNG
+#define DLT_PCAPNG		0x7fffffff
+#endif
+
 
 /*
  * The instruction encodings.
@@ -56,6 +56,7 @@ struct pcap_etherent {
 #endif
 struct	pcap_etherent *pcap_next_etherent(FILE *);
 u_char *pcap_ether_hostton(const char*);
+int	pcap_ether_lookup(const char *, u_char *);
 u_char *pcap_ether_aton(const char *);
 
 bpf_u_int32 **pcap_nametoaddr(const char *);
@@ -283,10 +283,12 @@ struct pcapng_process_information_fields {
 #define PCAPNG_PIB_PATH			3	/* UTF-8 string with path of process */
 
 /*
- * To open for reading a file in pcap-ng file format
+ * To open for reading a file, or (see pcap_open_offline_buffer()) a
+ * buffer, in pcap-ng file format
  */
 pcap_t *pcap_ng_fopen_offline(FILE *, char *);
 pcap_t *pcap_ng_open_offline(const char *, char *);
+pcap_t *pcap_ng_open_offline_buffer(const void *, size_t, char *);
 
 /* 
  * Open for writing a capture file -- a "savefile" in pcap-ng file format
@@ -346,6 +348,12 @@ bpf_u_int32 pcap_ng_dump_block(pcap_dumper_t *, pcapng_block_t);
  */
 bpf_u_int32 pcap_ng_externalize_block(void *, size_t , pcapng_block_t );
 
+/*
+ * Write a internalized pcap-ng block through a sink opened with
+ * PCAP_SINK_PCAPNG (see pcap_sink_open())
+ */
+bpf_u_int32 pcap_sink_dump_block(pcap_sink_t *, pcapng_block_t);
+
 /*
  * To allocate or initialize a raw block read from pcap-ng file
  */
@@ -190,6 +190,45 @@ struct pcap_pkthdr {
 #endif
 };
 
+/*
+ * With pcap_set_vlan_metadata(), on platforms that support it, the
+ * header handed to the callback, and returned by pcap_next_ex(), is
+ * one of these.  If the packet arrived with a VLAN tag that was
+ * stripped before we saw it, vlan_flags has PCAP_VLAN_VALID set and
+ * the tag is in vlan_tci and vlan_tpid, rather than being put back
+ * into the packet data.  pcap_set_vlan_metadata() fails on platforms
+ * that don't support it; after activation, pcap_get_vlan_metadata()
+ * says whether the kernel could give us the tags, and so whether the
+ * headers are these.
+ */
+struct pcap_pkthdr_vlan {
+	struct pcap_pkthdr hdr;
+	bpf_u_int32 vlan_flags;	/* PCAP_VLAN_ flags */
+	u_short vlan_tci;	/* priority, DEI and VLAN ID */
+	u_short vlan_tpid;	/* tag protocol ID, e.g. 0x8100 */
+};
+
+#define PCAP_VLAN_VALID		0x00000001	/* the packet had a tag */
+
+/*
+ * With pcap_set_per_interface(), on platforms that support it, the
+ * header handed to the callback, and returned by pcap_next_ex(), is
+ * one of these, saying which interface the packet was seen on, in
+ * which direction, and the link-layer type of that interface.  On the
+ * "any" device the packets are then not put into the cooked
+ * DLT_LINUX_SLL form; each has the link-layer header of its own
+ * interface, as given by if_dlt, and pcap_datalink() returns
+ * DLT_PCAPNG.  If if_dlt is DLT_EN10MB, stripped VLAN tags are put
+ * back into the packet as usual, unless pcap_set_vlan_metadata() was
+ * also called.
+ */
+struct pcap_pkthdr_if {
+	struct pcap_pkthdr_vlan vhdr;
+	int if_index;		/* index of the interface, or 0 if unknown */
+	int if_dlt;		/* DLT_ type of the packet data */
+	pcap_direction_t if_direction;	/* PCAP_D_IN or PCAP_D_OUT */
+};
+
 /*
  * As returned by the pcap_stats()
  */
@@ -202,6 +241,65 @@ struct pcap_stat {
 #endif /* WIN32 */
 };
 
+/*
+ * As returned by pcap_stats64(): the same counts as in a pcap_stat,
+ * accumulated, on platforms that can, in 64 bits, so that they don't
+ * wrap.
+ */
+struct pcap_stat64 {
+	u_int64_t ps_recv;	/* number of packets received */
+	u_int64_t ps_drop;	/* number of packets dropped */
+	u_int64_t ps_ifdrop;	/* drops by interface */
+};
+
+/*
+ * As returned by pcap_latency_histogram(): how long packets took to
+ * get from being time stamped to being handed to the callback.
+ * lh_bucket[0] counts packets that took under a microsecond, and
+ * lh_bucket[i] those that took from 2^(i-1) up to 2^i microseconds.
+ */
+#define PCAP_LATENCY_BUCKETS	32
+
+struct pcap_latency_hist {
+	u_int lh_count;		/* number of packets measured */
+	u_int lh_max;		/* worst latency seen, in microseconds */
+	u_int lh_bucket[PCAP_LATENCY_BUCKETS];
+};
+
+/*
+ * Flags for pcap_set_busy_poll().
+ */
+#define PCAP_BUSY_POLL_YIELD	0x00000001	/* sched_yield() while spinning */
+
+/*
+ * Special values for pcap_set_numa_node(); other values are node
+ * numbers.
+ */
+#define PCAP_NUMA_NODE_NONE	-2	/* leave it to the OS */
+#define PCAP_NUMA_NODE_DEVICE	-1	/* the device's own node */
+
+/*
+ * Special values for pcap_set_cpu_affinity(); other values are CPU
+ * numbers.  The buffer is allocated near the requested CPUs, and each
+ * thread that reads from the handle is pinned to them when it first
+ * does so; the thread that activates the handle keeps its affinity
+ * unless it reads as well.  With PCAP_CPU_NODE, those are the CPUs of
+ * the node the buffer was put on or, if the handle is in a fanout
+ * group, one of them, with the members of the group open at once
+ * spread across them.  pcap_get_cpu() returns the CPU, if there was
+ * just one.
+ */
+#define PCAP_CPU_NONE		-2	/* don't change the affinity */
+#define PCAP_CPU_NODE		-1	/* the CPUs of the buffer's node */
+
+/*
+ * Modes for pcap_set_fanout(): how packets are split between the
+ * handles in a group.
+ */
+#define PCAP_FANOUT_HASH	0	/* by flow */
+#define PCAP_FANOUT_LB		1	/* round-robin */
+#define PCAP_FANOUT_CPU		2	/* by the CPU that received them */
+
 #ifdef MSDOS
 /*
  * As returned by the pcap_stats_ex()
@@ -259,6 +357,24 @@ struct pcap_addr {
 	struct sockaddr *dstaddr;	/* P2P destination address for that address */
 };
 
+/*
+ * Interface change notification, as returned by pcap_if_watch_next().
+ * The interfaces are the ones pcap_findalldevs() reports, so an
+ * interface being brought up or down is reported as it being added
+ * or removed.
+ */
+typedef struct pcap_if_watch pcap_if_watch_t;
+
+struct pcap_if_event {
+	int	ev_type;		/* PCAP_IF_EVENT_ */
+	const char *ev_name;		/* valid until the next event */
+	bpf_u_int32 ev_flags;		/* PCAP_IF_ interface flags */
+};
+
+#define PCAP_IF_EVENT_ADDED	1	/* interface appeared */
+#define PCAP_IF_EVENT_REMOVED	2	/* interface went away */
+#define PCAP_IF_EVENT_CHANGED	3	/* interface's addresses changed */
+
 typedef void (*pcap_handler)(u_char *, const struct pcap_pkthdr *,
 			     const u_char *);
 
@@ -310,6 +426,33 @@ int	pcap_set_immediate_mode(pcap_t *, int);
 int	pcap_set_buffer_size(pcap_t *, int);
 int	pcap_set_tstamp_precision(pcap_t *, int);
 int	pcap_get_tstamp_precision(pcap_t *);
+int	pcap_set_tx_ring(pcap_t *, int);
+int	pcap_set_qdisc_bypass(pcap_t *, int);
+int	pcap_set_busy_poll(pcap_t *, int, int);
+int	pcap_set_latency_histogram(pcap_t *, int);
+int	pcap_set_numa_node(pcap_t *, int);
+int	pcap_set_cpu_affinity(pcap_t *, int);
+int	pcap_set_fanout(pcap_t *, int, int);
+/*
+ * How old, in milliseconds, the interface drop count that pcap_stats()
+ * reports in ps_ifdrop may be; 0 means fetch it on every call, and the
+ * default is 1000.  On Linux, which reports it for promiscuous handles,
+ * the counts for all interfaces are fetched together and shared by all
+ * handles.
+ */
+int	pcap_set_stats_refresh(pcap_t *, int);
+/*
+ * With a count of 1 or more, read packets from the socket, up to that
+ * many per system call, rather than from a memory-mapped ring; with 0,
+ * the default, use a ring if there is one.
+ */
+int	pcap_set_recv_batch(pcap_t *, int);
+int	pcap_set_vlan_metadata(pcap_t *, int);
+int	pcap_set_per_interface(pcap_t *, int);
+int	pcap_get_numa_node(pcap_t *);
+int	pcap_get_cpu(pcap_t *);
+int	pcap_get_vlan_metadata(pcap_t *);
+int	pcap_get_per_interface(pcap_t *);
 int	pcap_activate(pcap_t *);
 #ifdef __APPLE__
 int pcap_apple_set_exthdr(pcap_t *p, int);
@@ -402,6 +545,51 @@ pcap_t	*pcap_fopen_offline_with_tstamp_precision(FILE *, u_int, char *);
 pcap_t	*pcap_fopen_offline(FILE *, char *);
 #endif /*WIN32*/
 
+/*
+ * Read a savefile from buffers the caller owns.  The first buffer must
+ * hold all of the file's header (for a pcap-ng file, up to and including
+ * the first Interface Description Block); more can be appended, in
+ * order, as they arrive, and appending a null buffer says that no more
+ * are coming.  Until then, running out part way through a record is
+ * treated as the end of the file, and reading can carry on once more
+ * has been appended.  Packets are handed out as pointers into the
+ * buffers wherever possible, so the buffers must stay valid until
+ * pcap_close(), unless a release handler is set, right after opening,
+ * with pcap_offline_buffer_set_release().  It's then called once for
+ * each buffer, starting with the first one, in order, as soon as all
+ * of it has been read and nothing handed out, or read ahead to be
+ * handed out later, points into it any more, and for the rest when
+ * the pcap_t is closed; after that, the buffer isn't looked at again.
+ * A packet handed to a callback stops pointing into its buffer when
+ * the callback returns, and one returned by pcap_next_ex() at the
+ * next read from the pcap_t, so buffers are only released by reads.
+ */
+typedef void (*pcap_release_handler)(u_char *, const void *, size_t);
+
+pcap_t	*pcap_open_offline_buffer_with_tstamp_precision(const void *, size_t,
+	    u_int, char *);
+pcap_t	*pcap_open_offline_buffer(const void *, size_t, char *);
+int	pcap_offline_buffer_append(pcap_t *, const void *, size_t);
+int	pcap_offline_buffer_set_release(pcap_t *, pcap_release_handler,
+	    u_char *);
+
+/*
+ * Follow a savefile that's still being written, as "tail -f" does.
+ * Reaching the end of what's been written, even part way through a
+ * record, means waiting up to the timeout, in milliseconds (0 means
+ * no limit), for more; pcap_dispatch() returns 0, and pcap_next_ex()
+ * returns 0, if nothing more arrives in that time, and pcap_loop()
+ * carries on waiting.  In non-blocking mode, we don't wait at all,
+ * and pcap_loop() returns 0 too.  Once the file's been renamed or
+ * removed, as a rotating writer does, and everything in it has been
+ * read, it's the end of the file, and the caller can open the next
+ * one.  Renaming is only noticed where there's inotify, i.e. on Linux;
+ * elsewhere, a rotating writer has to remove the old file for readers
+ * to move on.  Followed files put in a pcap_group_t are put in
+ * non-blocking mode, as live handles are.
+ */
+int	pcap_offline_follow(pcap_t *, int, int);
+
 void	pcap_close(pcap_t *);
 int	pcap_loop(pcap_t *, int, pcap_handler, u_char *);
 int	pcap_dispatch(pcap_t *, int, pcap_handler, u_char *);
@@ -410,12 +598,332 @@ const u_char*
 int 	pcap_next_ex(pcap_t *, struct pcap_pkthdr **, const u_char **);
 void	pcap_breakloop(pcap_t *);
 int	pcap_stats(pcap_t *, struct pcap_stat *);
+int	pcap_stats64(pcap_t *, struct pcap_stat64 *);
+int	pcap_latency_histogram(pcap_t *, struct pcap_latency_hist *);
+
+/*
+ * Packet retention, for handing packets to other threads without
+ * copying them.  pcap_retain(), called in the callback with the packet
+ * data pointer it was handed, keeps the packet where it is in the
+ * capture buffer, and valid, after the callback returns, until a
+ * matching pcap_release(), which may be called from any thread.  The
+ * part of the buffer the packet is in can't be reused until then, so
+ * retained packets should be released promptly; pcap_pinned_blocks()
+ * reports how much of the buffer is being held that way.  Supported,
+ * currently, only with TPACKET_V3 rings on Linux.
+ */
+int	pcap_retain(pcap_t *, const u_char *);
+int	pcap_release(pcap_t *, const u_char *);
+int	pcap_pinned_blocks(pcap_t *);
+
 int	pcap_setfilter(pcap_t *, struct bpf_program *);
+
+/*
+ * Filters for the packets from each interface on a handle in
+ * per-interface mode, applied to packets as they'd be handed to the
+ * callback, after any pcap_setfilter() filter.  Each should be
+ * compiled for the link-layer type of its interface, e.g. with
+ * pcap_compile_nopcap().  Interfaces without a filter of their own
+ * get the one for PCAP_IF_FILTER_DEFAULT, if any.  A null program
+ * removes the filter.
+ */
+#define PCAP_IF_FILTER_DEFAULT	0
+
+int	pcap_setfilter_if(pcap_t *, int, struct bpf_program *);
+int	pcap_setfilter_ifname(pcap_t *, const char *, struct bpf_program *);
 int 	pcap_setdirection(pcap_t *, pcap_direction_t);
 int	pcap_getnonblock(pcap_t *, char *);
 int	pcap_setnonblock(pcap_t *, int, char *);
 int	pcap_inject(pcap_t *, const void *, size_t);
 int	pcap_sendpacket(pcap_t *, const u_char *, int);
+
+/*
+ * Send queues.  Packets are appended to the queue's buffer, each as a
+ * struct pcap_pkthdr followed by "caplen" bytes of data, and are then
+ * handed to the device in one go by pcap_sendqueue_transmit(), which
+ * returns the number of packets sent, or -1 if none could be sent, and
+ * leaves the per-packet results of the transmit in "sent" and "failed".
+ */
+struct pcap_send_queue {
+	u_int	maxlen;		/* size of buffer */
+	u_int	len;		/* number of bytes of buffer in use */
+	char	*buffer;	/* queued packets */
+	u_int	sent;		/* packets sent by the last transmit */
+	u_int	failed;		/* packets the last transmit couldn't send */
+};
+typedef struct pcap_send_queue pcap_send_queue;
+
+pcap_send_queue *pcap_sendqueue_alloc(u_int);
+void	pcap_sendqueue_destroy(pcap_send_queue *);
+int	pcap_sendqueue_queue(pcap_send_queue *, const struct pcap_pkthdr *,
+	    const u_char *);
+int	pcap_sendqueue_transmit(pcap_t *, pcap_send_queue *);
+
+/*
+ * Replay the packets read from one pcap_t on another, paced to the
+ * capture's own time stamps (sped up or slowed down by "multiplier"),
+ * to "rate" packets or bits per second, or as fast as possible.
+ */
+#define PCAP_REPLAY_ORIGINAL	0	/* capture timing, divided by multiplier */
+#define PCAP_REPLAY_PPS		1	/* "rate" packets per second */
+#define PCAP_REPLAY_BPS		2	/* "rate" bits per second */
+#define PCAP_REPLAY_TOPSPEED	3	/* no pacing */
+
+struct pcap_replay_opts {
+	int	mode;		/* PCAP_REPLAY_ value */
+	double	multiplier;	/* PCAP_REPLAY_ORIGINAL speed-up; 0 means 1 */
+	double	rate;		/* PCAP_REPLAY_PPS or PCAP_REPLAY_BPS rate */
+	int	cnt;		/* packets to send; 0 or -1 means all */
+	u_int	batch;		/* most packets per transmit; 0 for default */
+	u_int	readahead;	/* bytes of packets to read ahead; 0 for default */
+};
+
+struct pcap_replay_stat {
+	u_int	rs_sent;	/* packets sent */
+	u_int	rs_failed;	/* packets the device wouldn't take */
+	u_int	rs_batches;	/* number of transmits */
+	double	rs_elapsed;	/* seconds from first packet to last */
+	double	rs_target_pps;	/* rates the schedule called for */
+	double	rs_target_bps;
+	double	rs_pps;		/* rates achieved */
+	double	rs_bps;
+	double	rs_jitter_avg;	/* microseconds packets went out late, mean */
+	double	rs_jitter_max;	/* and worst */
+};
+
+int	pcap_replay(pcap_t *, pcap_t *, const struct pcap_replay_opts *,
+	    struct pcap_replay_stat *);
+
+/*
+ * Spread the packets captured on a pcap_t, after filtering, over a
+ * set of worker threads, by a hash of the packet's flow that's the
+ * same in both directions, so that all of a flow's packets go to the
+ * same worker, in order.  Each worker has a queue of up to "qlen"
+ * packets; packets that arrive for it when its queue is full are
+ * dropped, and counted.  Workers are handed the same kind of header
+ * as the pcap_t's own callback would be.
+ */
+typedef struct pcap_dispatcher pcap_dispatcher_t;
+typedef void (*pcap_worker_handler)(u_char *, int, const struct pcap_pkthdr *,
+			     const u_char *);
+
+struct pcap_worker_stat {
+	u_int	ws_queued;	/* packets queued for the worker */
+	u_int	ws_dropped;	/* packets dropped because its queue was full */
+	u_int	ws_handled;	/* packets it has handled */
+	u_int	ws_depth;	/* packets in its queue now */
+	u_int	ws_max_depth;	/* most packets ever in its queue */
+};
+
+pcap_dispatcher_t *pcap_dispatcher_create(pcap_t *, int, int,
+	    pcap_worker_handler, u_char *, char *);
+int	pcap_dispatcher_loop(pcap_dispatcher_t *, int);
+int	pcap_dispatcher_dispatch(pcap_dispatcher_t *, int);
+int	pcap_dispatcher_stats(pcap_dispatcher_t *, int, struct pcap_worker_stat *);
+void	pcap_dispatcher_destroy(pcap_dispatcher_t *);
+u_int	pcap_flow_hash(pcap_dispatcher_t *, const struct pcap_pkthdr *,
+	    const u_char *);
+
+/*
+ * Wait on a group of pcap_t's, live or savefiles, at once, and hand
+ * the packets from those that are ready to their callbacks, at most
+ * "budget" packets per handle per round, starting each round with a
+ * different handle, so that a busy handle can't starve the others.
+ * Live handles are put in non-blocking mode while in the group.  A
+ * savefile opened with pcap_open_offline_buffer() stays in the group
+ * until the end has been appended, and one being followed, with
+ * pcap_offline_follow() before it's added, until it's been renamed or
+ * removed; pcap_group_loop() returns when it has read all there is so
+ * far, if there's nothing else to read from.
+ */
+typedef struct pcap_group pcap_group_t;
+
+#define PCAP_GROUP_BUDGET	64	/* default packets per handle per round */
+
+pcap_group_t *pcap_group_create(char *);
+int	pcap_group_add(pcap_group_t *, pcap_t *, pcap_handler, u_char *);
+int	pcap_group_remove(pcap_group_t *, pcap_t *);
+int	pcap_group_set_budget(pcap_group_t *, int);
+int	pcap_group_dispatch(pcap_group_t *, int);
+int	pcap_group_loop(pcap_group_t *, int);
+void	pcap_group_breakloop(pcap_group_t *);
+char	*pcap_group_geterr(pcap_group_t *);
+void	pcap_group_destroy(pcap_group_t *);
+
+/*
+ * Publish the packets from one capture in shared memory, for any
+ * number of other processes to capture from the "shm:<name>" device.
+ * pcap_shm_publish() is a pcap_handler, to be passed to pcap_loop()
+ * or pcap_dispatch() with the publisher as the user argument.  The
+ * publisher never waits; a reader that falls "size" bytes behind
+ * loses packets, and counts them in its ps_drop.  Readers hand on the
+ * same kind of header as the published capture, as
+ * pcap_get_vlan_metadata() and pcap_get_per_interface() on them say.
+ */
+typedef struct pcap_shm_publisher pcap_shm_publisher_t;
+
+pcap_shm_publisher_t *pcap_shm_publisher_open(pcap_t *, const char *, u_int);
+void	pcap_shm_publish(u_char *, const struct pcap_pkthdr *, const u_char *);
+void	pcap_shm_publisher_close(pcap_shm_publisher_t *);
+
+/*
+ * Keep the last "bytes" bytes, and, if "seconds" isn't 0, no more than
+ * the last "seconds" seconds, of a capture in memory.
+ * pcap_flightrec_record() is a pcap_handler, to be passed to
+ * pcap_loop() or pcap_dispatch() with the recorder as the user
+ * argument.  pcap_flightrec_dump() writes what's held to a file,
+ * returning the number of packets written, and leaves it held.
+ * pcap_flightrec_trigger() may be called from a signal handler; what's
+ * held when the next packet is recorded is dumped to a file named by
+ * passing the pattern given to pcap_flightrec_set_trigger() to
+ * strftime().  The writing isn't done while recording, but by
+ * pcap_flightrec_poll(), which writes at most "max_packets" packets
+ * (all of them, if it's 0 or less) and returns 1 if there are more to
+ * write, or another dump's been triggered, 0 if the dump is done, or
+ * there's none, and -1 on an error; call it between calls to
+ * pcap_dispatch(), in the same thread.  Packets that capture throws
+ * away before they're written are counted in fs_lost.
+ * pcap_flightrec_service() finishes a triggered dump in one go,
+ * returning the number of packets written.  Handles whose
+ * packets have link-layer types of their own (see pcap_datalink())
+ * can only be dumped to pcapng files.
+ */
+typedef struct pcap_flightrec pcap_flightrec_t;
+
+#define PCAP_FLIGHTREC_PCAPNG	0x00000001	/* write pcapng, not pcap */
+
+struct pcap_flightrec_stat {
+	u_int	fs_packets;	/* packets held */
+	u_int	fs_bytes;	/* space they take up */
+	u_int	fs_too_big;	/* packets too big to hold */
+	struct timeval fs_first; /* time stamp of the oldest one held */
+	u_int	fs_lost;	/* packets thrown away before being dumped */
+};
+
+pcap_flightrec_t *pcap_flightrec_create(pcap_t *, u_int, u_int, char *);
+void	pcap_flightrec_record(u_char *, const struct pcap_pkthdr *,
+	    const u_char *);
+int	pcap_flightrec_dump(pcap_flightrec_t *, const char *, int);
+int	pcap_flightrec_set_trigger(pcap_flightrec_t *, const char *, int);
+void	pcap_flightrec_trigger(pcap_flightrec_t *);
+int	pcap_flightrec_poll(pcap_flightrec_t *, int);
+int	pcap_flightrec_service(pcap_flightrec_t *);
+void	pcap_flightrec_stats(pcap_flightrec_t *, struct pcap_flightrec_stat *);
+char	*pcap_flightrec_geterr(pcap_flightrec_t *);
+void	pcap_flightrec_destroy(pcap_flightrec_t *);
+
+/*
+ * Write a savefile through a callback, rather than to a FILE.  Records
+ * are put, whole, into a buffer - "buf", or, if that's null, one the
+ * sink allocates - of "size" bytes, or 1MB if that's 0, and the buffer
+ * is handed to the callback once the next record won't fit, or on
+ * pcap_sink_flush() or pcap_sink_close().  The callback returns 0, or
+ * -1, with errno set, on an error; it may call pcap_sink_set_buffer()
+ * to have the sink carry on in another buffer, and keep the one it was
+ * handed.  pcap_sink_dump() is a pcap_handler, to be passed to
+ * pcap_loop() or pcap_dispatch() with the sink as the user argument.
+ */
+typedef struct pcap_sink pcap_sink_t;
+typedef int (*pcap_sink_write_t)(pcap_sink_t *, void *, u_char *, size_t);
+
+#define PCAP_SINK_PCAPNG	0x00000001	/* write pcapng, not pcap */
+
+pcap_sink_t *pcap_sink_open(pcap_t *, pcap_sink_write_t, void *, u_char *,
+	    size_t, int);
+void	pcap_sink_dump(u_char *, const struct pcap_pkthdr *, const u_char *);
+void	pcap_sink_set_buffer(pcap_sink_t *, u_char *, size_t);
+int	pcap_sink_flush(pcap_sink_t *);
+char	*pcap_sink_geterr(pcap_sink_t *);
+int	pcap_sink_close(pcap_sink_t *);
+
+/*
+ * Write a columnar file of packet metadata - time stamps, lengths,
+ * interfaces, where the network-layer and transport-layer headers
+ * are, and, for IPv4 and IPv6, the addresses, protocol, ports and TCP
+ * flags - so that scans that only need those needn't read the packets.
+ * pcap_meta_write() is a pcap_handler, to be passed to pcap_loop() or
+ * pcap_dispatch() with the writer as the user argument;
+ * pcap_meta_export() writes the metadata for "cnt" packets, or, if
+ * that's 0 or less, all of them, and returns how many it wrote.
+ *
+ * pcap_meta_next_group() reads the next group of rows of such a file,
+ * with a pointer to the start of each column; the columns stay valid
+ * until the next call.  pcap_meta_get() puts one row of a group together,
+ * and pcap_meta_next() goes through the file a row at a time.  Both
+ * return 1, 0 at the end of the file, or -1 on an error.
+ */
+typedef struct pcap_meta_writer pcap_meta_writer_t;
+typedef struct pcap_meta pcap_meta_t;
+
+#define PCAP_META_NONE	0xffff	/* no such header, in off_l3 and off_l4 */
+
+struct pcap_meta_group {
+	u_int		rows;
+	u_int		v6_rows;	/* IPv6 address pairs in v6 */
+	const u_int64_t	*ts;		/* time stamp, in ns since 1970 */
+	const bpf_u_int32 *caplen;
+	const bpf_u_int32 *len;
+	const bpf_u_int32 *ifid;	/* interface ID, index, or 0 */
+	const bpf_u_int32 *src;		/* IPv4 address, in host byte */
+	const bpf_u_int32 *dst;		/* order, or IPv6 pair in v6 */
+	const u_short	*off_l3;	/* network-layer header offset */
+	const u_short	*off_l4;	/* transport-layer header offset */
+	const u_short	*ethertype;
+	const u_short	*sport;
+	const u_short	*dport;
+	const u_char	*version;	/* IP version, or 0 if not IP */
+	const u_char	*proto;
+	const u_char	*tcpflags;
+	const u_char	*v6;		/* 16-byte source and destination */
+};
+
+struct pcap_meta_rec {
+	u_int64_t	ts;
+	bpf_u_int32	caplen;
+	bpf_u_int32	len;
+	bpf_u_int32	ifid;
+	u_short		off_l3;
+	u_short		off_l4;
+	u_short		ethertype;
+	u_short		sport;
+	u_short		dport;
+	u_char		version;
+	u_char		proto;
+	u_char		tcpflags;
+	u_char		src[16];	/* IPv4 addresses in the first 4 */
+	u_char		dst[16];
+};
+
+pcap_meta_writer_t *pcap_meta_writer_open(pcap_t *, const char *);
+void	pcap_meta_write(u_char *, const struct pcap_pkthdr *, const u_char *);
+int	pcap_meta_writer_flush(pcap_meta_writer_t *);
+char	*pcap_meta_writer_geterr(pcap_meta_writer_t *);
+int	pcap_meta_writer_close(pcap_meta_writer_t *);
+int	pcap_meta_export(pcap_t *, const char *, int);
+
+pcap_meta_t *pcap_meta_open(const char *, char *);
+int	pcap_meta_datalink(pcap_meta_t *);
+int	pcap_meta_snapshot(pcap_meta_t *);
+int	pcap_meta_next_group(pcap_meta_t *, struct pcap_meta_group *);
+void	pcap_meta_get(const struct pcap_meta_group *, u_int,
+	    struct pcap_meta_rec *);
+int	pcap_meta_next(pcap_meta_t *, struct pcap_meta_rec *);
+char	*pcap_meta_geterr(pcap_meta_t *);
+void	pcap_meta_close(pcap_meta_t *);
+
+/*
+ * Record whole blocks of a capture buffer to a file, as the capture
+ * mechanism filled them in, without looking at the packets in them;
+ * the file can be read with pcap_open_offline().  Only supported for
+ * memory-mapped TPACKET_V3 captures on Linux.
+ */
+typedef struct pcap_block_writer pcap_block_writer_t;
+
+pcap_block_writer_t *pcap_block_writer_open(pcap_t *, const char *);
+int	pcap_block_writer_write(pcap_block_writer_t *, int);
+int	pcap_block_writer_loop(pcap_block_writer_t *, int);
+int	pcap_block_writer_close(pcap_block_writer_t *);
+
 const char *pcap_statustostr(int);
 const char *pcap_strerror(int);
 char	*pcap_geterr(pcap_t *);
@@ -452,9 +960,27 @@ int	pcap_dump_flush(pcap_dumper_t *);
 void	pcap_dump_close(pcap_dumper_t *);
 void	pcap_dump(u_char *, const struct pcap_pkthdr *, const u_char *);
 
+/*
+ * Write the packets from a pcap_t in per-interface mode to a pcapng
+ * file, with an Interface Description Block for each interface, and
+ * link-layer type, as it's first seen, and the direction of each
+ * packet in its Enhanced Packet Block.  Any number of files can be
+ * written at once; each is closed with pcap_ng_dump_if_close(), which
+ * frees what was kept about it, before the pcap_t is closed.
+ */
+pcap_dumper_t *pcap_ng_dump_if_open(pcap_t *, const char *);
+int	pcap_ng_dump_if(pcap_t *, pcap_dumper_t *, const struct pcap_pkthdr *,
+	    const u_char *);
+void	pcap_ng_dump_if_close(pcap_t *, pcap_dumper_t *);
+
 int	pcap_findalldevs(pcap_if_t **, char *);
 void	pcap_freealldevs(pcap_if_t *);
 
+pcap_if_watch_t *pcap_if_watch_open(char *);
+int	pcap_if_watch_get_selectable_fd(pcap_if_watch_t *);
+int	pcap_if_watch_next(pcap_if_watch_t *, struct pcap_if_event *, char *);
+void	pcap_if_watch_close(pcap_if_watch_t *);
+
 const char *pcap_lib_version(void);
 
 /*
@@ -471,6 +997,57 @@ int	bpf_validate(const struct bpf_insn *f, int len);
 char	*bpf_image(const struct bpf_insn *, int);
 void	bpf_dump(const struct bpf_program *, int);
 
+/*
+ * Packet metadata that isn't in the packet data; a program compiled
+ * for a handle in VLAN metadata mode loads it from the special
+ * offsets Linux's socket filter uses, and bpf_filter_with_aux_data()
+ * supplies it from here.  With a null pointer, it's bpf_filter().
+ */
+struct bpf_aux_data {
+	u_short vlan_tag_present;
+	u_short vlan_tag;
+};
+
+u_int	bpf_filter_with_aux_data(const struct bpf_insn *, const u_char *,
+	    u_int, u_int, const struct bpf_aux_data *);
+
+/*
+ * Run one filter program over an array of packets, storing what
+ * bpf_filter() would have returned for each; returns the number of
+ * packets accepted.  On CPUs with AVX2, packets are run through the
+ * program eight at a time, in the lanes of vector registers, for as
+ * long as they take the same path through it; that's quicker than
+ * bpf_filter() when most packets do.
+ */
+u_int	bpf_filter_batch(const struct bpf_insn *, const u_char **,
+	    const u_int *, const u_int *, u_int *, u_int);
+
+/*
+ * Filter execution profiling.  bpf_filter_profile() runs a filter
+ * program the same way bpf_filter() does, but also counts how many
+ * times each instruction was executed and how many CPU clock ticks
+ * were spent in it; bpf_dump_profile() prints the program annotated
+ * with those counts.
+ */
+struct bpf_profile {
+	u_int		bp_len;		/* number of instructions profiled */
+	u_int64_t	*bp_hits;	/* per-instruction execution counts */
+	u_int64_t	*bp_cycles;	/* per-instruction clock ticks */
+	u_int64_t	*bp_taken;	/* times a jump went to its jt target */
+	u_int64_t	bp_runs;	/* times the program was run */
+	u_int64_t	bp_accepted;	/* runs that returned non-zero */
+};
+
+int	bpf_profile_init(struct bpf_profile *, const struct bpf_program *);
+void	bpf_profile_reset(struct bpf_profile *);
+void	bpf_profile_free(struct bpf_profile *);
+u_int	bpf_filter_profile(const struct bpf_insn *, const u_char *, u_int,
+	    u_int, struct bpf_profile *);
+char	*bpf_image_profile(const struct bpf_insn *, int,
+	    const struct bpf_profile *);
+void	bpf_dump_profile(const struct bpf_program *,
+	    const struct bpf_profile *);
+
 #if defined(WIN32)
 
 /*
@@ -870,12 +870,30 @@ pcap_ng_externalize_block(void *buffer, size_t buflen, pcapng_block_t block)
 	}
 
 	block_trailer.total_length = block->pcapng_block_len;
-	bcopy(&block_trailer, ptr + bytes_written, bytes_written);
+	bcopy(&block_trailer, ptr + bytes_written, sizeof(struct pcapng_block_trailer));
 	bytes_written += sizeof(struct pcapng_block_trailer);		
 		
 	return (bytes_written);
 }
 
+/*
+ * The block is externalized straight into the sink's buffer.
+ */
+bpf_u_int32
+pcap_sink_dump_block(pcap_sink_t *s, pcapng_block_t block)
+{
+	u_char *ptr;
+	bpf_u_int32 bytes_written;
+
+	ptr = pcap_sink_reserve(s, block->pcapng_block_len);
+	if (ptr == NULL)
+		return (0);
+	bytes_written = pcap_ng_externalize_block(ptr,
+	    block->pcapng_block_len, block);
+	pcap_sink_commit(s, bytes_written);
+	return (bytes_written);
+}
+
 bpf_u_int32
 pcap_ng_dump_block(pcap_dumper_t *p, pcapng_block_t block)
 {
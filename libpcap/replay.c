@@ -0,0 +1,420 @@
+/*
+ * replay.c - send the packets read from one pcap_t out another one,
+ * paced to the capture's own timing, to a fixed packet or bit rate,
+ * or as fast as the device will take them.
+ *
+ * Packets are read ahead into a send queue, with each record's time
+ * stamp replaced by the time, relative to the start of the replay,
+ * at which it's due to go out.  We sleep through long gaps, spin
+ * through short ones, where a timer sleep would overshoot, and hand
+ * everything that's due when we wake up to the device in one
+ * transmit.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_SYS_BITYPES_H
+#include <sys/bitypes.h>
+#endif
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pcap-int.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#define NSEC_PER_SEC	1000000000ULL
+
+/*
+ * Gaps longer than this are slept through, less REPLAY_SPIN_NS, which
+ * is spun through; shorter ones are spun through entirely, as timer
+ * sleeps generally overshoot by tens of microseconds.
+ */
+#define REPLAY_SLEEP_NS	200000
+#define REPLAY_SPIN_NS	100000
+
+/*
+ * What we're reading from; what pcap_next_ex() returning 0 or -2 means
+ * depends on it.
+ */
+#define REPLAY_LIVE	0	/* 0: timeout; -2: pcap_breakloop() */
+#define REPLAY_FILE	1	/* -2: end of file, or pcap_breakloop() */
+#define REPLAY_FOLLOW	2	/* 0: nothing more written yet */
+#define REPLAY_BUFFER	3	/* -2: nothing more appended yet, or the end */
+
+#define REPLAY_BATCH		64		/* default packets per transmit */
+#define REPLAY_READAHEAD	(1024*1024)	/* default read-ahead bytes */
+
+struct replay {
+	pcap_t		*in;
+	pcap_t		*out;
+	const struct pcap_replay_opts *opts;
+	pcap_send_queue	*q;
+	u_int		head;		/* offset of the next record to send */
+	int		kind;		/* REPLAY_ input kind */
+	int		nanos;		/* input time stamps are in nanoseconds */
+	int		eof;		/* nothing more to read */
+	int		broken;		/* pcap_breakloop() called on input */
+	int		scheduled;	/* packets read and scheduled so far */
+	u_int64_t	first_ts;	/* input time stamp of the first packet */
+	u_int64_t	last_due;
+	u_int64_t	bits;		/* bits scheduled so far */
+	struct pcap_pkthdr *held_hdr;	/* packet read that didn't fit */
+	const u_char	*held_data;
+};
+
+static u_int64_t
+replay_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((u_int64_t)tv.tv_sec * NSEC_PER_SEC + tv.tv_usec * 1000);
+#endif
+}
+
+/*
+ * Work out when, relative to the start of the replay, a packet is due.
+ */
+static u_int64_t
+replay_due(struct replay *r, const struct pcap_pkthdr *h)
+{
+	const struct pcap_replay_opts *opts = r->opts;
+	u_int64_t ts, due;
+	double mult;
+
+	switch (opts->mode) {
+
+	case PCAP_REPLAY_ORIGINAL:
+		ts = (u_int64_t)h->ts.tv_sec * NSEC_PER_SEC +
+		    (r->nanos ? h->ts.tv_usec : h->ts.tv_usec * 1000);
+		if (r->scheduled == 0)
+			r->first_ts = ts;
+		mult = opts->multiplier > 0 ? opts->multiplier : 1.0;
+		due = ts > r->first_ts ? (ts - r->first_ts) / mult : 0;
+		break;
+
+	case PCAP_REPLAY_PPS:
+		due = r->scheduled * (NSEC_PER_SEC / opts->rate);
+		break;
+
+	case PCAP_REPLAY_BPS:
+		due = r->bits * (NSEC_PER_SEC / opts->rate);
+		break;
+
+	default:
+		due = 0;
+		break;
+	}
+
+	/*
+	 * Captures with time stamps that go backwards get those
+	 * packets sent right after the ones before them.
+	 */
+	if (due < r->last_due)
+		due = r->last_due;
+	r->last_due = due;
+	r->bits += h->caplen * 8;
+	r->scheduled++;
+	return (due);
+}
+
+/*
+ * pcap_next_ex() returned -2; is that because there's nothing more to
+ * read, rather than because pcap_breakloop() was called or, for a
+ * buffer, because nothing more has been appended yet?
+ */
+static int
+replay_at_end(struct replay *r)
+{
+	pcap_t *in = r->in;
+
+	switch (r->kind) {
+
+	case REPLAY_FILE:
+		return (feof(in->rfile));
+
+	case REPLAY_FOLLOW:
+		/* once the file's gone away, we stop following it */
+		return (!sf_following(in));
+
+	case REPLAY_BUFFER:
+		return (in->sf_mem->done && in->sf_mem->avail == 0);
+	}
+	return (0);
+}
+
+/*
+ * Move the unsent records to the front of the send queue, and read
+ * ahead until it's full.  Returns -1 on error, 0 otherwise.
+ */
+static int
+replay_fill(struct replay *r)
+{
+	pcap_send_queue *q = r->q;
+	struct pcap_pkthdr h;
+	u_int64_t due;
+	int status;
+
+	if (r->head != 0) {
+		memmove(q->buffer, q->buffer + r->head, q->len - r->head);
+		q->len -= r->head;
+		r->head = 0;
+	}
+
+	while (!r->eof) {
+		if (r->held_hdr == NULL) {
+			if (r->opts->cnt > 0 && r->scheduled >= r->opts->cnt) {
+				r->eof = 1;
+				break;
+			}
+			/*
+			 * Notice pcap_breakloop() before reading, as a
+			 * savefile read that returns -2 for it looks
+			 * just like one that hit the end.
+			 */
+			if (r->in->break_loop) {
+				r->broken = 1;
+				break;
+			}
+			status = pcap_next_ex(r->in, &r->held_hdr,
+			    &r->held_data);
+			if (status == 0) {
+				/*
+				 * Read timeout, or nothing more has been
+				 * written to a file we're following.
+				 */
+				r->held_hdr = NULL;
+				break;
+			}
+			if (status == -2) {
+				r->held_hdr = NULL;
+				if (replay_at_end(r))
+					r->eof = 1;
+				else if (r->kind != REPLAY_BUFFER)
+					r->broken = 1;
+				break;
+			}
+			if (status == -1) {
+				r->held_hdr = NULL;
+				memcpy(r->out->errbuf, r->in->errbuf,
+				    PCAP_ERRBUF_SIZE);
+				return (-1);
+			}
+		}
+		if (q->maxlen - q->len < sizeof(h) + r->held_hdr->caplen) {
+			if (q->len != 0)
+				break;
+			snprintf(r->out->errbuf, PCAP_ERRBUF_SIZE,
+			    "%u-byte packet doesn't fit in the %u-byte read-ahead buffer",
+			    r->held_hdr->caplen, q->maxlen);
+			return (-1);
+		}
+
+		h = *r->held_hdr;
+		due = replay_due(r, &h);
+		h.ts.tv_sec = due / NSEC_PER_SEC;
+		h.ts.tv_usec = due % NSEC_PER_SEC;
+		(void)pcap_sendqueue_queue(q, &h, r->held_data);
+		r->held_hdr = NULL;
+	}
+	return (0);
+}
+
+static void
+replay_sleep(u_int64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / NSEC_PER_SEC;
+	ts.tv_nsec = ns % NSEC_PER_SEC;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Replay the packets read from "in" on "out".  Returns 0 once the
+ * input is exhausted or "cnt" packets have been sent, -1 on an error,
+ * with the message in out's error buffer, or -2 if pcap_breakloop()
+ * was called on either handle.  A packet the device won't take is
+ * counted in rs_failed and doesn't stop the replay.
+ */
+int
+pcap_replay(pcap_t *in, pcap_t *out, const struct pcap_replay_opts *opts,
+    struct pcap_replay_stat *rs)
+{
+	struct replay r;
+	struct pcap_send_queue batch;
+	struct pcap_pkthdr h;
+	u_int64_t start, now, due, late, late_sum;
+	u_int64_t first_due, last_due, first_tx, last_tx, bits, last_bits;
+	u_int off, n, maxbatch;
+	double span;
+	int status = 0;
+
+	memset(rs, 0, sizeof(*rs));
+	if ((opts->mode == PCAP_REPLAY_PPS || opts->mode == PCAP_REPLAY_BPS) &&
+	    opts->rate <= 0) {
+		snprintf(out->errbuf, PCAP_ERRBUF_SIZE,
+		    "replay rate must be positive");
+		return (-1);
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.in = in;
+	r.out = out;
+	r.opts = opts;
+	if (in->rfile == NULL)
+		r.kind = REPLAY_LIVE;
+	else if (in->sf_mem != NULL)
+		r.kind = REPLAY_BUFFER;
+	else if (in->sf_follow != NULL)
+		r.kind = REPLAY_FOLLOW;
+	else
+		r.kind = REPLAY_FILE;
+	r.nanos = (pcap_get_tstamp_precision(in) == PCAP_TSTAMP_PRECISION_NANO);
+	r.q = pcap_sendqueue_alloc(opts->readahead != 0 ?
+	    opts->readahead : REPLAY_READAHEAD);
+	if (r.q == NULL) {
+		snprintf(out->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	maxbatch = opts->batch != 0 ? opts->batch : REPLAY_BATCH;
+
+	if (replay_fill(&r) == -1) {
+		pcap_sendqueue_destroy(r.q);
+		return (-1);
+	}
+	start = replay_clock();
+	late_sum = 0;
+	bits = last_bits = 0;
+	first_due = last_due = first_tx = last_tx = 0;
+
+	for (;;) {
+		if (r.broken || in->break_loop || out->break_loop) {
+			in->break_loop = out->break_loop = 0;
+			status = -2;
+			break;
+		}
+		if (r.head == r.q->len) {
+			if (r.eof)
+				break;
+			if (replay_fill(&r) == -1) {
+				status = -1;
+				break;
+			}
+			/*
+			 * Reads from a buffer don't wait for more to
+			 * be appended, so we have to.
+			 */
+			if (r.q->len == 0 && r.kind == REPLAY_BUFFER &&
+			    !r.eof && !r.broken)
+				replay_sleep(REPLAY_SLEEP_NS);
+			continue;
+		}
+
+		/*
+		 * Wait until the next packet is due, reading ahead
+		 * while we have the time.
+		 */
+		memcpy(&h, r.q->buffer + r.head, sizeof(h));
+		due = (u_int64_t)h.ts.tv_sec * NSEC_PER_SEC + h.ts.tv_usec;
+		now = replay_clock() - start;
+		if (due > now + REPLAY_SLEEP_NS) {
+			if (!r.eof && replay_fill(&r) == -1) {
+				status = -1;
+				break;
+			}
+			now = replay_clock() - start;
+			if (due > now + REPLAY_SLEEP_NS)
+				replay_sleep(due - now - REPLAY_SPIN_NS);
+			continue;
+		}
+		while (now < due)
+			now = replay_clock() - start;
+
+		/*
+		 * Send everything that's due.
+		 */
+		n = 0;
+		for (off = r.head; n < maxbatch && off < r.q->len;
+		    off += sizeof(h) + h.caplen) {
+			memcpy(&h, r.q->buffer + off, sizeof(h));
+			due = (u_int64_t)h.ts.tv_sec * NSEC_PER_SEC +
+			    h.ts.tv_usec;
+			if (due > now)
+				break;
+			if (rs->rs_sent + rs->rs_failed + n == 0) {
+				first_due = due;
+				first_tx = now;
+			}
+			late = now - due;
+			late_sum += late;
+			if (late / 1000.0 > rs->rs_jitter_max)
+				rs->rs_jitter_max = late / 1000.0;
+			last_due = due;
+			last_bits = h.caplen * 8;
+			bits += last_bits;
+			n++;
+		}
+		batch.buffer = r.q->buffer + r.head;
+		batch.len = batch.maxlen = off - r.head;
+		if (pcap_sendqueue_transmit(out, &batch) == -1 &&
+		    batch.failed == 0) {
+			status = -1;
+			break;
+		}
+		rs->rs_sent += batch.sent;
+		rs->rs_failed += batch.failed;
+		rs->rs_batches++;
+		r.head = off;
+		last_tx = now;
+	}
+
+	/*
+	 * Rates are measured from the first packet to the last, so
+	 * the last packet's bits don't count; done this way, a fixed
+	 * rate replay that kept up reports exactly its target rate.
+	 */
+	n = rs->rs_sent + rs->rs_failed;
+	if (n != 0)
+		rs->rs_jitter_avg = late_sum / 1000.0 / n;
+	if (n > 1) {
+		bits -= last_bits;
+		if (last_due > first_due) {
+			span = (last_due - first_due) / 1e9;
+			rs->rs_target_pps = (n - 1) / span;
+			rs->rs_target_bps = bits / span;
+		}
+		if (last_tx > first_tx) {
+			rs->rs_elapsed = (last_tx - first_tx) / 1e9;
+			rs->rs_pps = (n - 1) / rs->rs_elapsed;
+			rs->rs_bps = bits / rs->rs_elapsed;
+		}
+	}
+
+	pcap_sendqueue_destroy(r.q);
+	return (status);
+}
@@ -56,6 +56,16 @@ static const char rcsid[] _U_ =
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef WIN32
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #include "pcap-int.h"
 #include "pcap/usb.h"
@@ -66,6 +76,7 @@ static const char rcsid[] _U_ =
 
 #include "sf-pcap.h"
 #include "sf-pcap-ng.h"
+#include "sf-blocks.h"
 
 static pcap_t *
 pcap_fopen_offline_internal(FILE *fp, u_int precision,
@@ -85,19 +96,42 @@ pcap_fopen_offline_internal(FILE *fp, u_int precision,
   #endif
 #endif
 
+/*
+ * State for following a savefile as it's written.
+ */
+struct sf_follow {
+	int	timeout;	/* ms to wait for more, or 0 for no limit */
+	int	nonblock;	/* don't wait at all */
+	int	fd;		/* inotify descriptor, or -1 to poll */
+	off_t	size;		/* size of the file when we last looked */
+	int	gone;		/* it's been renamed or removed */
+	int	done;		/* ...and we've read all of it */
+};
+
 static int
 sf_getnonblock(pcap_t *p, char *errbuf)
 {
 	/*
 	 * This is a savefile, not a live capture file, so never say
-	 * it's in non-blocking mode.
+	 * it's in non-blocking mode, unless we're following it.
 	 */
+	if (p->sf_follow != NULL)
+		return (p->sf_follow->nonblock);
 	return (0);
 }
 
 static int
 sf_setnonblock(pcap_t *p, int nonblock, char *errbuf)
 {
+	/*
+	 * If we're following it, non-blocking just means not waiting
+	 * for more to be written.
+	 */
+	if (p->sf_follow != NULL) {
+		p->sf_follow->nonblock = nonblock;
+		return (0);
+	}
+
 	/*
 	 * This is a savefile, not a live capture file, so reject
 	 * requests to put it in non-blocking mode.  (If it's a
@@ -165,13 +199,173 @@ sf_setdirection(pcap_t *p, pcap_direction_t d)
 	return (-1);
 }
 
+/*
+ * If PCAP_SF_BATCH is set in the environment, then, when we're reading
+ * a savefile through a filter until the end of the file, we read records
+ * ahead SF_BATCH at a time and run the filter over all of them at once
+ * with bpf_filter_batch(), which, on CPUs with AVX2, runs several packets
+ * through the program together.  Records in a buffer handed to
+ * pcap_open_offline_buffer() are filtered where they are; otherwise,
+ * as the next_packet_op reuses its buffer for every record, each record
+ * in the batch gets a buffer of its own, by swapping p->buffer with the
+ * batch's buffer for the record if it was read into p->buffer, and by
+ * copying it if not.  Records left over after pcap_breakloop() are
+ * handed out by the reads that follow.
+ *
+ * Filtering is only a small part of the cost of reading a record, and
+ * less than reading ahead adds, so that's not the default.
+ */
+#define SF_BATCH	16
+
+struct sf_batch {
+	u_int	count;			/* number of records read ahead */
+	u_int	next;			/* next record to hand out */
+	int	status;			/* status of the read that ended the batch */
+	int	filtered;		/* results[] are for the current filter */
+	u_int	mem_first;		/* first sf_mem buffer they may be in */
+	struct pcap_pkthdr hdr[SF_BATCH];
+	u_char	*buf[SF_BATCH];
+	u_int	bufsize[SF_BATCH];
+	const u_char *pkt[SF_BATCH];
+	u_int	wirelen[SF_BATCH];
+	u_int	caplen[SF_BATCH];
+	u_int	results[SF_BATCH];
+};
+
+static int
+sf_batch_pending(pcap_t *p)
+{
+	struct sf_batch *b = p->sf_batch;
+
+	return (b->next < b->count || b->status != 0);
+}
+
+/*
+ * Return the next record from the batch that passes the filter, reading
+ * ahead another batch if we've run out; returns what next_packet_op
+ * would.  A read error or end of file that ends a batch is reported
+ * once the records before it have been handed out.
+ */
+static int
+sf_batch_next(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	struct sf_batch *b = p->sf_batch;
+	struct bpf_insn *fcode;
+	int status;
+	u_char *d, *tmp;
+	u_int i, size;
+
+	for (;;) {
+		while (b->next < b->count) {
+			i = b->next++;
+			fcode = p->fcode.bf_insns;
+			if (b->filtered ? b->results[i] != 0 :
+			    (fcode == NULL || bpf_filter(fcode, b->pkt[i],
+			    b->wirelen[i], b->caplen[i]))) {
+				*hdr = b->hdr[i];
+				*data = (u_char *)b->pkt[i];
+				return (0);
+			}
+		}
+		if (b->status != 0) {
+			status = b->status;
+			b->status = 0;
+			return (status);
+		}
+
+		b->count = b->next = 0;
+		if (p->sf_mem != NULL)
+			b->mem_first = p->sf_mem->base + p->sf_mem->cur;
+		while (b->count < SF_BATCH) {
+			i = b->count;
+			status = p->next_packet_op(p, &b->hdr[i], &d);
+			if (status != 0) {
+				b->status = status;
+				break;
+			}
+			if (d != p->buffer && p->sf_mem != NULL) {
+				/*
+				 * It's in the caller's buffer, and stays
+				 * there.
+				 */
+				b->pkt[i] = d;
+			} else {
+				size = b->hdr[i].caplen;
+				if (d == p->buffer)
+					size = p->bufsize;
+				if (size > b->bufsize[i]) {
+					tmp = realloc(b->buf[i], size);
+					if (tmp == NULL) {
+						snprintf(p->errbuf,
+						    PCAP_ERRBUF_SIZE,
+						    "malloc: %s",
+						    pcap_strerror(errno));
+						b->status = -1;
+						break;
+					}
+					b->buf[i] = tmp;
+					b->bufsize[i] = size;
+				}
+				if (d == p->buffer) {
+					p->buffer = b->buf[i];
+					b->buf[i] = d;
+					b->bufsize[i] = p->bufsize;
+				} else
+					memcpy(b->buf[i], d, b->hdr[i].caplen);
+				b->pkt[i] = b->buf[i];
+			}
+			b->wirelen[i] = b->hdr[i].len;
+			b->caplen[i] = b->hdr[i].caplen;
+			b->count++;
+		}
+		if ((fcode = p->fcode.bf_insns) != NULL) {
+			bpf_filter_batch(fcode, b->pkt, b->wirelen, b->caplen,
+			    b->results, b->count);
+			b->filtered = 1;
+		} else
+			b->filtered = 0;
+	}
+}
+
+static int
+sf_setfilter(pcap_t *p, struct bpf_program *fp)
+{
+	/*
+	 * Records already read ahead were filtered with the old program.
+	 */
+	if (p->sf_batch != NULL)
+		p->sf_batch->filtered = 0;
+	return (install_bpf_program(p, fp));
+}
+
 void
 sf_cleanup(pcap_t *p)
 {
+	u_int i;
+
 	if (p->rfile != stdin)
 		(void)fclose(p->rfile);
+	if (p->sf_mem != NULL) {
+		if (p->sf_mem->release != NULL)
+			sf_mem_release(p, 1);
+		free(p->sf_mem->bufs);
+		free(p->sf_mem);
+		p->sf_mem = NULL;
+	}
+	if (p->sf_follow != NULL) {
+		if (p->sf_follow->fd != -1)
+			close(p->sf_follow->fd);
+		free(p->sf_follow);
+		p->sf_follow = NULL;
+	}
 	if (p->buffer != NULL)
 		free(p->buffer);
+	if (p->sf_batch != NULL) {
+		for (i = 0; i < SF_BATCH; i++)
+			free(p->sf_batch->buf[i]);
+		free(p->sf_batch);
+		p->sf_batch = NULL;
+	}
 	pcap_freecode(&p->fcode);
 }
 
@@ -254,7 +448,8 @@ pcap_t* pcap_hopen_offline(intptr_t osfd, char *errbuf)
 
 static pcap_t *(*check_headers[])(bpf_u_int32, FILE *, u_int, char *, int *, int) = {
 	pcap_check_header,
-	pcap_ng_check_header
+	pcap_ng_check_header,
+	pcap_blocks_check_header
 };
 
 #define	N_FILE_TYPES	(sizeof check_headers / sizeof check_headers[0])
@@ -320,6 +515,60 @@ pcap_ng_fopen_offline(FILE *fp, char *errbuf)
 
 #endif /* __APPLE__ */
 
+/*
+ * Set up a pcap_t whose savefile header has been read, for reading
+ * the rest of the file.
+ */
+static void
+sf_setup_handle(pcap_t *p, FILE *fp, int isng)
+{
+	p->rfile = fp;
+
+	/* Padding only needed for live capture fcode */
+	p->fddipad = 0;
+
+#if !defined(WIN32) && !defined(MSDOS)
+	/*
+	 * You can do "select()" and "poll()" on plain files on most
+	 * platforms, and should be able to do so on pipes.
+	 *
+	 * You can't do "select()" on anything other than sockets in
+	 * Windows, so, on Win32 systems, we don't have "selectable_fd".
+	 */
+	p->selectable_fd = fileno(fp);
+#endif
+
+	/*
+	 * Batching is only an optimization, so if we can't allocate
+	 * the batch, we just do without it.
+	 */
+	if (getenv("PCAP_SF_BATCH") != NULL)
+		p->sf_batch = calloc(1, sizeof(struct sf_batch));
+
+	p->read_op = isng ? pcap_ng_offline_read : pcap_offline_read;
+	p->inject_op = sf_inject;
+	p->setfilter_op = sf_setfilter;
+	p->setdirection_op = sf_setdirection;
+	p->set_datalink_op = NULL;	/* we don't support munging link-layer headers */
+	p->getnonblock_op = sf_getnonblock;
+	p->setnonblock_op = sf_setnonblock;
+	p->stats_op = sf_stats;
+#ifdef WIN32
+	p->setbuff_op = sf_setbuff;
+	p->setmode_op = sf_setmode;
+	p->setmintocopy_op = sf_setmintocopy;
+#endif
+
+	/*
+	 * For offline captures, the standard one-shot callback can
+	 * be used for pcap_next()/pcap_next_ex().
+	 */
+	p->oneshot_callback = pcap_oneshot;
+
+	p->cleanup_op = sf_cleanup;
+	p->activated = 1;
+}
+
 static pcap_t *
 pcap_fopen_offline_internal(FILE *fp, u_int precision,
     char *errbuf, int isng)
@@ -395,44 +644,7 @@ pcap_fopen_offline_internal(FILE *fp, u_int precision,
 	goto bad;
 
 found:
-	p->rfile = fp;
-
-	/* Padding only needed for live capture fcode */
-	p->fddipad = 0;
-
-#if !defined(WIN32) && !defined(MSDOS)
-	/*
-	 * You can do "select()" and "poll()" on plain files on most
-	 * platforms, and should be able to do so on pipes.
-	 *
-	 * You can't do "select()" on anything other than sockets in
-	 * Windows, so, on Win32 systems, we don't have "selectable_fd".
-	 */
-	p->selectable_fd = fileno(fp);
-#endif
-
-	p->read_op = isng ? pcap_ng_offline_read : pcap_offline_read;
-	p->inject_op = sf_inject;
-	p->setfilter_op = install_bpf_program;
-	p->setdirection_op = sf_setdirection;
-	p->set_datalink_op = NULL;	/* we don't support munging link-layer headers */
-	p->getnonblock_op = sf_getnonblock;
-	p->setnonblock_op = sf_setnonblock;
-	p->stats_op = sf_stats;
-#ifdef WIN32
-	p->setbuff_op = sf_setbuff;
-	p->setmode_op = sf_setmode;
-	p->setmintocopy_op = sf_setmintocopy;
-#endif
-
-	/*
-	 * For offline captures, the standard one-shot callback can
-	 * be used for pcap_next()/pcap_next_ex().
-	 */
-	p->oneshot_callback = pcap_oneshot;
-
-	p->cleanup_op = sf_cleanup;
-	p->activated = 1;
+	sf_setup_handle(p, fp, isng);
 
 	return (p);
  bad:
@@ -452,6 +664,539 @@ pcap_fopen_offline(FILE *fp, char *errbuf)
 	    PCAP_TSTAMP_PRECISION_MICRO, errbuf));
 }
 
+/*
+ * Savefiles in memory.
+ *
+ * The file's header is checked, by the same routines that check the
+ * header of a file, through a stdio stream on the first buffer, so that
+ * has to hold all of it; the stream's kept as "rfile", which is how
+ * the rest of libpcap knows a pcap_t is reading a savefile.  After
+ * that, records are read straight out of the buffers.
+ */
+#define SF_MEM_MINBUFS	16
+
+static pcap_t *
+sf_open_buffer(const void *buf, size_t len, u_int precision, char *errbuf,
+    int isng)
+{
+#ifdef HAVE_FMEMOPEN
+	pcap_t *p;
+	struct sf_mem *m;
+	FILE *fp;
+	bpf_u_int32 magic;
+	off_t offset;
+	int err;
+
+	if (len < sizeof(magic)) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "truncated dump file; tried to read %lu file header bytes, only got %lu",
+		    (unsigned long)sizeof(magic), (unsigned long)len);
+		return (NULL);
+	}
+	m = calloc(1, sizeof(*m));
+	if (m == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	m->bufs = malloc(SF_MEM_MINBUFS * sizeof(*m->bufs));
+	if (m->bufs == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		free(m);
+		return (NULL);
+	}
+	m->size = SF_MEM_MINBUFS;
+
+	fp = fmemopen((void *)buf, len, "r");
+	if (fp == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "fmemopen: %s",
+		    pcap_strerror(errno));
+		free(m->bufs);
+		free(m);
+		return (NULL);
+	}
+	(void)fread(&magic, 1, sizeof(magic), fp);
+
+	/*
+	 * Only pcap and pcap-ng files can be read from memory.
+	 */
+	err = 0;
+	p = NULL;
+	if (!isng)
+		p = pcap_check_header(magic, fp, precision, errbuf, &err, isng);
+	if (p == NULL && !err)
+		p = pcap_ng_check_header(magic, fp, precision, errbuf, &err,
+		    isng);
+	if (p == NULL) {
+		if (!err)
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "unknown file format");
+		fclose(fp);
+		free(m->bufs);
+		free(m);
+		return (NULL);
+	}
+
+	offset = ftello(fp);
+	m->bufs[0].data = buf;
+	m->bufs[0].len = len;
+	m->count = 1;
+	m->off = offset;
+	m->avail = len - offset;
+	p->sf_mem = m;
+	sf_setup_handle(p, fp, isng);
+	return (p);
+#else
+	snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "Reading savefiles from memory is not supported on this platform");
+	return (NULL);
+#endif
+}
+
+pcap_t *
+pcap_open_offline_buffer_with_tstamp_precision(const void *buf, size_t len,
+    u_int precision, char *errbuf)
+{
+	return (sf_open_buffer(buf, len, precision, errbuf, 0));
+}
+
+pcap_t *
+pcap_open_offline_buffer(const void *buf, size_t len, char *errbuf)
+{
+	return (sf_open_buffer(buf, len, PCAP_TSTAMP_PRECISION_MICRO, errbuf,
+	    0));
+}
+
+#ifdef __APPLE__
+pcap_t *
+pcap_ng_open_offline_buffer(const void *buf, size_t len, char *errbuf)
+{
+	return (sf_open_buffer(buf, len, PCAP_TSTAMP_PRECISION_MICRO, errbuf,
+	    1));
+}
+#endif /* __APPLE__ */
+
+int
+pcap_offline_buffer_append(pcap_t *p, const void *buf, size_t len)
+{
+	struct sf_mem *m = p->sf_mem;
+	struct sf_mem_buf *newbufs;
+	u_int drop;
+
+	if (m == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "The savefile wasn't opened with pcap_open_offline_buffer()");
+		return (-1);
+	}
+	if (m->done) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "The end of the savefile has already been appended");
+		return (-1);
+	}
+	if (buf == NULL) {
+		m->done = 1;
+		return (0);
+	}
+	if (len == 0)
+		return (0);
+
+	/*
+	 * Forget the buffers we've finished with and handed back, and
+	 * make room for this one if we need to.  Without a release
+	 * handler, finishing with them is enough.
+	 */
+	if (m->release == NULL && m->released < m->base + m->cur)
+		m->released = m->base + m->cur;
+	drop = m->released - m->base;
+	if (drop > m->cur)
+		drop = m->cur;
+	if (drop != 0) {
+		memmove(m->bufs, m->bufs + drop,
+		    (m->count - drop) * sizeof(*m->bufs));
+		m->count -= drop;
+		m->cur -= drop;
+		m->base += drop;
+	}
+	if (m->count == m->size) {
+		newbufs = realloc(m->bufs, 2 * m->size * sizeof(*m->bufs));
+		if (newbufs == NULL) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		m->bufs = newbufs;
+		m->size *= 2;
+	}
+	m->bufs[m->count].data = buf;
+	m->bufs[m->count].len = len;
+	m->count++;
+	m->avail += len;
+	return (0);
+}
+
+int
+pcap_offline_buffer_set_release(pcap_t *p, pcap_release_handler release,
+    u_char *user)
+{
+	struct sf_mem *m = p->sf_mem;
+
+	if (m == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "The savefile wasn't opened with pcap_open_offline_buffer()");
+		return (-1);
+	}
+	m->release = release;
+	m->release_user = user;
+	return (0);
+}
+
+/*
+ * Hand back, in order, the buffers that nothing points into any more:
+ * those before the one being read, and that one too if it's all been
+ * read, but not any that records read ahead by sf_batch_next(), and
+ * not yet handed out, may be in.  This is done at the start of each
+ * read, by which time the caller is done with the packets handed out
+ * before.  If "all" is set, the pcap_t is being closed, and the rest
+ * are handed back as well.
+ */
+void
+sf_mem_release(pcap_t *p, int all)
+{
+	struct sf_mem *m = p->sf_mem;
+	struct sf_batch *b = p->sf_batch;
+	struct sf_mem_buf *mb;
+	u_int keep;
+
+	if (all)
+		keep = m->base + m->count;
+	else {
+		keep = m->base + m->cur;
+		if (m->off == m->bufs[m->cur].len)
+			keep++;
+		if (b != NULL && b->next < b->count && b->mem_first < keep)
+			keep = b->mem_first;
+	}
+	while (m->released < keep) {
+		mb = &m->bufs[m->released - m->base];
+		(*m->release)(m->release_user, mb->data, mb->len);
+		m->released++;
+	}
+}
+
+int
+sf_mem_have(pcap_t *p, size_t len)
+{
+	struct sf_mem *m = p->sf_mem;
+
+	if (m->avail >= len)
+		return (1);
+	if (m->avail == 0 || !m->done)
+		return (0);
+	snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "truncated dump file; tried to read %lu bytes, only got %lu",
+	    (unsigned long)len, (unsigned long)m->avail);
+	return (-1);
+}
+
+/*
+ * Copy, or, if "copybuf" is null, skip over, the next "len" bytes,
+ * and, if "consume" is set, consume them.
+ */
+static void
+sf_mem_copy(struct sf_mem *m, u_char *copybuf, size_t len, int consume)
+{
+	u_int cur = m->cur;
+	size_t off = m->off, total = len, n;
+
+	while (len != 0) {
+		if (off == m->bufs[cur].len) {
+			cur++;
+			off = 0;
+			continue;
+		}
+		n = m->bufs[cur].len - off;
+		if (n > len)
+			n = len;
+		if (copybuf != NULL) {
+			memcpy(copybuf, m->bufs[cur].data + off, n);
+			copybuf += n;
+		}
+		off += n;
+		len -= n;
+	}
+	if (consume) {
+		m->cur = cur;
+		m->off = off;
+		m->avail -= total;
+	}
+}
+
+void
+sf_mem_peek(pcap_t *p, void *buf, size_t len)
+{
+	sf_mem_copy(p->sf_mem, buf, len, 0);
+}
+
+u_char *
+sf_mem_get(pcap_t *p, size_t len, u_char *copybuf, u_int align)
+{
+	struct sf_mem *m = p->sf_mem;
+	const u_char *data;
+
+	while (m->off == m->bufs[m->cur].len && m->cur + 1 < m->count) {
+		m->cur++;
+		m->off = 0;
+	}
+	data = m->bufs[m->cur].data + m->off;
+	if (align != 0 && m->bufs[m->cur].len - m->off >= len &&
+	    (uintptr_t)data % align == 0) {
+		m->off += len;
+		m->avail -= len;
+		return ((u_char *)data);
+	}
+	sf_mem_copy(m, copybuf, len, 1);
+	return (copybuf);
+}
+
+/*
+ * Following a savefile as it's written.
+ *
+ * Running into the end of the file, part way through a record or not,
+ * just means that no more has been written yet; the readers go back to
+ * the start of the record, and we wait for the file to grow - with
+ * inotify, where we have it, and otherwise by looking every so often -
+ * and try again.  Once the file has been renamed or removed, as it is
+ * when the writer moves on to the next file, and we've read all there
+ * is, it's the end of the file.  Without inotify, all we have is the
+ * file's descriptor, so we can see that it's been removed, but not
+ * that it's been renamed.
+ */
+#define SF_FOLLOW_POLL	50	/* ms between looks, without inotify */
+
+int
+pcap_offline_follow(pcap_t *p, int follow, int to_ms)
+{
+	struct sf_follow *f;
+	struct stat st;
+#ifdef HAVE_SYS_INOTIFY_H
+	char path[64];
+#endif
+
+	if (p->rfile == NULL || p->sf_mem != NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Only savefiles read from files can be followed");
+		return (-1);
+	}
+	if (!follow) {
+		if (p->sf_follow != NULL) {
+			if (p->sf_follow->fd != -1)
+				close(p->sf_follow->fd);
+			free(p->sf_follow);
+			p->sf_follow = NULL;
+		}
+		return (0);
+	}
+	if (p->sf_follow != NULL) {
+		p->sf_follow->timeout = to_ms;
+		return (0);
+	}
+	if (fstat(fileno(p->rfile), &st) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "fstat: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	if (!S_ISREG(st.st_mode)) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Only regular files can be followed");
+		return (-1);
+	}
+	f = calloc(1, sizeof(*f));
+	if (f == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	f->timeout = to_ms;
+	f->size = st.st_size;
+	f->fd = -1;
+#ifdef HAVE_SYS_INOTIFY_H
+	/*
+	 * We don't have the file's name, and it might have been
+	 * renamed already, so watch it through our descriptor for it.
+	 * If we can't, we poll.
+	 */
+	f->fd = inotify_init();
+	if (f->fd != -1) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%d",
+		    fileno(p->rfile));
+		if (inotify_add_watch(f->fd, path, IN_MODIFY|IN_ATTRIB|
+		    IN_MOVE_SELF|IN_DELETE_SELF) == -1) {
+			close(f->fd);
+			f->fd = -1;
+		}
+	}
+#endif
+	p->sf_follow = f;
+	return (0);
+}
+
+int
+sf_follow_rewind(pcap_t *p, off_t offset)
+{
+	if (fseeko(p->rfile, offset, SEEK_SET) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "error seeking in dump file: %s", pcap_strerror(errno));
+		return (-1);
+	}
+	return (1);
+}
+
+int
+sf_following(pcap_t *p)
+{
+	return (p->sf_follow != NULL && !p->sf_follow->done);
+}
+
+/*
+ * Milliseconds since some fixed point, from a clock that isn't set
+ * back, where we have one.
+ */
+static u_int64_t
+sf_follow_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((u_int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000);
+#endif
+}
+
+/*
+ * Wait for the file to grow; returns 1 if it has, 0 if it hasn't, in
+ * the time we're allowed to wait, or if it never will, and -1 on an
+ * error.
+ */
+static int
+sf_follow_wait(pcap_t *p)
+{
+	struct sf_follow *f = p->sf_follow;
+	struct stat st;
+	u_int64_t start;
+	int waited = 0, wait;
+#ifdef HAVE_SYS_INOTIFY_H
+	struct pollfd pfd;
+	char events[4096];
+	struct inotify_event *ev;
+	ssize_t n, i;
+#endif
+
+	/*
+	 * stdio remembers that it's seen the end of the file.
+	 */
+	clearerr(p->rfile);
+	start = sf_follow_clock();
+	for (;;) {
+		if (fstat(fileno(p->rfile), &st) == -1) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "fstat: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		if (st.st_size != f->size) {
+			f->size = st.st_size;
+			return (1);
+		}
+		if (st.st_nlink == 0)
+			f->gone = 1;
+		if (f->gone) {
+			f->done = 1;
+			return (0);
+		}
+		if (p->break_loop)
+			return (0);
+		if (f->nonblock)
+			wait = 0;
+		else if (f->timeout != 0) {
+			waited = sf_follow_clock() - start;
+			if (waited >= f->timeout)
+				return (0);
+			wait = f->timeout - waited;
+		} else
+			wait = -1;
+#ifdef HAVE_SYS_INOTIFY_H
+		if (f->fd != -1) {
+			/*
+			 * Wait for the file to be written to, renamed,
+			 * or removed; in non-blocking mode, just pick
+			 * up any news of that, so that we still see
+			 * it being renamed.
+			 */
+			pfd.fd = f->fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, wait) == -1) {
+				if (errno == EINTR)
+					return (0);
+				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+				    "poll: %s", pcap_strerror(errno));
+				return (-1);
+			}
+			if (pfd.revents == 0)
+				return (0);	/* timed out */
+			n = read(f->fd, events, sizeof(events));
+			for (i = 0; i < n; i += sizeof(*ev) + ev->len) {
+				ev = (struct inotify_event *)(events + i);
+				if (ev->mask & (IN_MOVE_SELF|IN_DELETE_SELF|
+				    IN_IGNORED))
+					f->gone = 1;
+			}
+			continue;
+		}
+#endif
+		if (wait == 0)
+			return (0);
+		if (wait == -1 || wait > SF_FOLLOW_POLL)
+			wait = SF_FOLLOW_POLL;
+		usleep(wait * 1000);
+	}
+}
+
+/*
+ * Called by the readers on reaching the end of the file, or of what's
+ * been written of it so far, having handed out "n" packets this time.
+ * Returns 1 if there's more to read, and otherwise 0, with what the
+ * reader should return in "*retp".  We only wait for more if we
+ * haven't handed out anything yet.
+ */
+static int
+sf_follow_eof(pcap_t *p, int n, int *retp)
+{
+	if (!sf_following(p)) {
+		*retp = 0;
+		return (0);
+	}
+	if (n > 0) {
+		*retp = n;
+		return (0);
+	}
+	switch (sf_follow_wait(p)) {
+
+	case 1:
+		return (1);
+
+	case 0:
+		*retp = 0;
+		return (0);
+	}
+	*retp = -1;
+	return (0);
+}
+
 /*
  * Read packets from a capture file, and call the callback for each
  * packet.
@@ -485,10 +1230,44 @@ pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 				return (n);
 		}
 
+		/*
+		 * We're done with the last packet we handed out, so
+		 * the caller can have back any buffers it was in.
+		 */
+		if (p->sf_mem != NULL && p->sf_mem->release != NULL)
+			sf_mem_release(p, 0);
+
+		/*
+		 * If we're batching, and we're reading through a filter
+		 * until the end of a file that isn't being followed, or
+		 * have records left over from doing so, filter the
+		 * records in batches; otherwise read and filter them one
+		 * at a time, so that we don't read ahead of what the
+		 * caller asked for.
+		 */
+		if (p->sf_batch != NULL &&
+		    ((cnt <= 0 && p->fcode.bf_insns != NULL &&
+		    p->sf_follow == NULL) || sf_batch_pending(p))) {
+			status = sf_batch_next(p, &h, &data);
+			if (status) {
+				if (status == 1 && sf_follow_eof(p, n, &status)) {
+					status = 0;
+					continue;
+				}
+				return (status);
+			}
+			(*callback)(user, &h, data);
+			if (++n >= cnt && cnt > 0)
+				break;
+			continue;
+		}
+
 		status = p->next_packet_op(p, &h, &data);
 		if (status) {
-			if (status == 1)
-				return (0);
+			if (status == 1 && sf_follow_eof(p, n, &status)) {
+				status = 0;
+				continue;
+			}
 			return (status);
 		}
 
@@ -535,15 +1314,25 @@ pcap_ng_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 			} else
 				return (n);
 		}
+
+		/*
+		 * We're done with the last packet we handed out, so
+		 * the caller can have back any buffers it was in.
+		 */
+		if (p->sf_mem != NULL && p->sf_mem->release != NULL)
+			sf_mem_release(p, 0);
 		
         /*
          * The begining of the block is always returned into p->buffer 
+         * (or p->sf_mem->block, for a savefile in memory)
          * even when data is NULL (because it's not a data block)
          */
 		status = p->next_packet_op(p, &h, &data);
 		if (status) {
-			if (status == 1)
-				return (0);
+			if (status == 1 && sf_follow_eof(p, n, &status)) {
+				status = 0;
+				continue;
+			}
 			return (status);
 		}
 		
@@ -554,7 +1343,8 @@ pcap_ng_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 		if ((fcode = p->fcode.bf_insns) == NULL ||
 			data == NULL || 
 		    bpf_filter(fcode, data, h.len, h.caplen)) {
-			(*callback)(user, &h, p->buffer);
+			(*callback)(user, &h, p->sf_mem != NULL ?
+			    p->sf_mem->block : p->buffer);
 			if (++n >= cnt && cnt > 0)
 				break;
 		}
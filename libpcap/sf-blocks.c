@@ -0,0 +1,604 @@
+/*
+ * sf-blocks.c - block-file-format-specific code
+ *
+ * A block file holds whole blocks of a capture buffer, written by
+ * pcap_block_writer_write() straight from the buffer, with no per-packet
+ * work.  Reading one back with pcap_open_offline() does the per-packet
+ * work - walking the blocks, and fixing up the packets the way a live
+ * capture would have - instead; see sf-blocks.h for the format.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef WIN32
+#include <pcap-stdinc.h>
+#else /* WIN32 */
+#if HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_SYS_BITYPES_H
+#include <sys/bitypes.h>
+#endif
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* WIN32 */
+
+#include <errno.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "pcap/sll.h"
+
+#include "pcap-common.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "sf-blocks.h"
+
+/*
+ * Offsets of the fields we use in the TPACKET_V3 block descriptor,
+ * tpacket3_hdr and sockaddr_ll; we don't use the structures from the
+ * Linux headers, so that block files can be read anywhere.
+ */
+#define BD_NUM_PKTS		12
+#define BD_OFFSET_TO_FIRST_PKT	16
+#define BD_BLK_LEN		20
+#define BD_LEN			24	/* as much as we need to look at */
+
+#define TP3_NEXT_OFFSET		0
+#define TP3_SEC			4
+#define TP3_NSEC		8
+#define TP3_SNAPLEN		12
+#define TP3_LEN			16
+#define TP3_STATUS		20
+#define TP3_MAC			24
+#define TP3_VLAN_TCI		32
+#define TP3_VLAN_TPID		36
+#define TP3_LEN_MIN		40
+
+#define SLL_PROTOCOL		2
+#define SLL_IFINDEX		4
+#define SLL_HATYPE		8
+#define SLL_PKTTYPE		10
+#define SLL_HALEN		11
+#define SLL_ADDR		12
+#define SLL_LEN			20
+
+#define TP3_STATUS_VLAN_VALID		0x10
+#define TP3_STATUS_VLAN_TPID_VALID	0x40
+
+#define PACKET_TYPE_OUTGOING	4
+#define VLAN_TAG_LEN		4
+#define VLAN_TPID_8021Q		0x8100
+
+struct pcap_blocks_sf {
+	u_int	block_size;
+	u_int	flags;
+	u_int	sll_offset;
+	int	vlan_offset;
+	int	lo_ifindex;
+	u_int	direction;
+	int	nanos;		/* caller wants nanosecond time stamps */
+	u_char	*block;		/* block we're handing packets out of */
+	u_int	blk_len;
+	u_int	next;		/* offset, in it, of the next packet */
+	u_int	left;		/* packets left in it */
+	u_char	*pkt;		/* where we build fixed-up packets */
+};
+
+static int pcap_blocks_next_packet(pcap_t *p, struct pcap_pkthdr *hdr,
+    u_char **datap);
+
+static bpf_u_int32
+get32(pcap_t *p, const u_char *cp)
+{
+	bpf_u_int32 v;
+
+	memcpy(&v, cp, sizeof(v));
+	return (p->swapped ? SWAPLONG(v) : v);
+}
+
+static u_int
+get16(pcap_t *p, const u_char *cp)
+{
+	u_short v;
+
+	memcpy(&v, cp, sizeof(v));
+	return (p->swapped ? SWAPSHORT(v) : v);
+}
+
+/*
+ * Round a block's length up to what was written for it.
+ */
+static u_int
+block_record_len(u_int blk_len, u_int block_size)
+{
+	u_int len;
+
+	len = (blk_len + BLOCKFILE_ALIGN - 1) & ~(BLOCKFILE_ALIGN - 1);
+	return (len > block_size ? block_size : len);
+}
+
+/*
+ * Check whether this is a block file and, if it is, read the rest of
+ * its header and set up a pcap_t to read it.
+ */
+pcap_t *
+pcap_blocks_check_header(bpf_u_int32 magic, FILE *fp, u_int precision,
+    char *errbuf, int *err, int isng _U_)
+{
+	struct pcap_block_file_header hdr;
+	struct pcap_blocks_sf *ps;
+	size_t amt_read;
+	u_int skip;
+	char junk[256];
+	pcap_t *p;
+	int swapped = 0;
+
+	/*
+	 * Assume no read errors.
+	 */
+	*err = 0;
+
+	if (magic != BLOCKFILE_MAGIC) {
+		if (SWAPLONG(magic) != BLOCKFILE_MAGIC)
+			return (NULL);	/* nope */
+		swapped = 1;
+	}
+
+	hdr.magic = BLOCKFILE_MAGIC;
+	amt_read = fread(((char *)&hdr) + sizeof hdr.magic, 1,
+	    sizeof(hdr) - sizeof(hdr.magic), fp);
+	if (amt_read != sizeof(hdr) - sizeof(hdr.magic)) {
+		if (ferror(fp)) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "error reading dump file: %s",
+			    pcap_strerror(errno));
+		} else {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated dump file; tried to read %lu file header bytes, only got %lu",
+			    (unsigned long)sizeof(hdr),
+			    (unsigned long)amt_read);
+		}
+		*err = 1;
+		return (NULL);
+	}
+	if (swapped) {
+		hdr.version_major = SWAPSHORT(hdr.version_major);
+		hdr.version_minor = SWAPSHORT(hdr.version_minor);
+		hdr.linktype = SWAPLONG(hdr.linktype);
+		hdr.snaplen = SWAPLONG(hdr.snaplen);
+		hdr.header_len = SWAPLONG(hdr.header_len);
+		hdr.block_size = SWAPLONG(hdr.block_size);
+		hdr.flags = SWAPLONG(hdr.flags);
+		hdr.sll_offset = SWAPLONG(hdr.sll_offset);
+		hdr.vlan_offset = SWAPLONG(hdr.vlan_offset);
+		hdr.lo_ifindex = SWAPLONG(hdr.lo_ifindex);
+		hdr.direction = SWAPLONG(hdr.direction);
+	}
+
+	if (hdr.version_major != BLOCKFILE_VERSION_MAJOR) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "unsupported block file version %u.%u",
+		    hdr.version_major, hdr.version_minor);
+		*err = 1;
+		return (NULL);
+	}
+	if (hdr.header_len < sizeof(hdr) || hdr.block_size < BD_LEN ||
+	    hdr.block_size > 1024*1024*1024 || hdr.snaplen > 1024*1024 ||
+	    hdr.sll_offset < TP3_LEN_MIN) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "bad block file header");
+		*err = 1;
+		return (NULL);
+	}
+
+	/*
+	 * Skip the padding, reading it rather than seeking, so that
+	 * we can read from a pipe.
+	 */
+	for (skip = hdr.header_len - sizeof(hdr); skip != 0;
+	    skip -= amt_read) {
+		amt_read = fread(junk, 1,
+		    skip > sizeof(junk) ? sizeof(junk) : skip, fp);
+		if (amt_read == 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated block file header");
+			*err = 1;
+			return (NULL);
+		}
+	}
+
+	p = pcap_open_offline_common(errbuf, sizeof (struct pcap_blocks_sf));
+	if (p == NULL) {
+		/* Allocation failed. */
+		*err = 1;
+		return (NULL);
+	}
+	p->swapped = swapped;
+	p->version_major = hdr.version_major;
+	p->version_minor = hdr.version_minor;
+	p->tzoff = 0;
+	p->snapshot = hdr.snaplen;
+	p->linktype = linktype_to_dlt(hdr.linktype);
+	p->linktype_ext = 0;
+	p->opt.tstamp_precision = precision;
+	p->next_packet_op = pcap_blocks_next_packet;
+
+	ps = p->priv;
+	ps->block_size = hdr.block_size;
+	ps->flags = hdr.flags;
+	ps->sll_offset = hdr.sll_offset;
+	ps->vlan_offset = hdr.vlan_offset;
+	ps->lo_ifindex = hdr.lo_ifindex;
+	ps->direction = hdr.direction;
+	ps->nanos = (precision == PCAP_TSTAMP_PRECISION_NANO);
+
+	/*
+	 * The buffer holds a block, and, after it, room to build a
+	 * packet with a cooked header and a VLAN tag added.
+	 */
+	p->bufsize = hdr.block_size + SLL_HDR_LEN + VLAN_TAG_LEN + hdr.snaplen;
+	p->buffer = malloc(p->bufsize);
+	if (p->buffer == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+		free(p);
+		*err = 1;
+		return (NULL);
+	}
+	ps->block = p->buffer;
+	ps->pkt = (u_char *)p->buffer + hdr.block_size;
+	return (p);
+}
+
+/*
+ * Read the next block into the buffer.  Returns 0 on success, 1 at
+ * the end of the file, and -1 on error.
+ */
+static int
+pcap_blocks_next_block(pcap_t *p)
+{
+	struct pcap_blocks_sf *ps = p->priv;
+	FILE *fp = p->rfile;
+	size_t amt_read;
+	u_int len, first;
+
+	amt_read = fread(ps->block, 1, BD_LEN, fp);
+	if (amt_read != BD_LEN) {
+		if (ferror(fp)) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "error reading dump file: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		if (amt_read != 0) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated dump file; tried to read %u block header bytes, only got %lu",
+			    BD_LEN, (unsigned long)amt_read);
+			return (-1);
+		}
+		return (1);
+	}
+	ps->blk_len = get32(p, ps->block + BD_BLK_LEN);
+	first = get32(p, ps->block + BD_OFFSET_TO_FIRST_PKT);
+	ps->left = get32(p, ps->block + BD_NUM_PKTS);
+	if (ps->blk_len < BD_LEN || ps->blk_len > ps->block_size ||
+	    (ps->left != 0 && (first < BD_LEN || first >= ps->blk_len))) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "bad block in block file: length %u, first packet at %u",
+		    ps->blk_len, first);
+		return (-1);
+	}
+	len = block_record_len(ps->blk_len, ps->block_size);
+	amt_read = fread(ps->block + BD_LEN, 1, len - BD_LEN, fp);
+	if (amt_read != len - BD_LEN) {
+		if (ferror(fp)) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "error reading dump file: %s",
+			    pcap_strerror(errno));
+		} else {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated dump file; tried to read %u block bytes, only got %lu",
+			    len, (unsigned long)amt_read + BD_LEN);
+		}
+		return (-1);
+	}
+	ps->next = first;
+	return (0);
+}
+
+/*
+ * Hand out the next packet, doing to it what pcap_handle_packet_mmap()
+ * in pcap-linux.c would have.
+ */
+static int
+pcap_blocks_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	struct pcap_blocks_sf *ps = p->priv;
+	u_char *tp, *sll, *bp;
+	u_int mac, caplen, len, status, tci, tpid, pkttype, off, n, ncopy;
+	int ret;
+
+	for (;;) {
+		while (ps->left == 0) {
+			ret = pcap_blocks_next_block(p);
+			if (ret != 0)
+				return (ret);
+		}
+		off = ps->next;
+		tp = ps->block + off;
+		if (off + ps->sll_offset + SLL_LEN > ps->blk_len) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "packet header past the end of the block");
+			return (-1);
+		}
+		mac = get16(p, tp + TP3_MAC);
+		caplen = get32(p, tp + TP3_SNAPLEN);
+		len = get32(p, tp + TP3_LEN);
+		if (off + mac + caplen > ps->blk_len) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "packet data past the end of the block");
+			return (-1);
+		}
+		ps->next += get32(p, tp + TP3_NEXT_OFFSET);
+		ps->left--;
+
+		/*
+		 * Drop what the live capture would have.
+		 */
+		sll = tp + ps->sll_offset;
+		pkttype = sll[SLL_PKTTYPE];
+		if (pkttype == PACKET_TYPE_OUTGOING) {
+			if ((int)get32(p, sll + SLL_IFINDEX) == ps->lo_ifindex ||
+			    ps->direction == PCAP_D_IN)
+				continue;
+		} else if (ps->direction == PCAP_D_OUT)
+			continue;
+		break;
+	}
+
+	hdr->ts.tv_sec = get32(p, tp + TP3_SEC);
+	hdr->ts.tv_usec = get32(p, tp + TP3_NSEC);
+	if (!ps->nanos)
+		hdr->ts.tv_usec /= 1000;
+	hdr->caplen = caplen;
+	hdr->len = len;
+
+	status = get32(p, tp + TP3_STATUS);
+	tci = get32(p, tp + TP3_VLAN_TCI);
+	if (!(ps->flags & BLOCKFILE_COOKED) &&
+	    (ps->vlan_offset == -1 || (tci == 0 &&
+	     !(status & TP3_STATUS_VLAN_VALID)))) {
+		/*
+		 * Nothing to fix up; hand it out from the block.
+		 */
+		if (hdr->caplen > (bpf_u_int32)p->snapshot)
+			hdr->caplen = p->snapshot;
+		*data = tp + mac;
+		return (0);
+	}
+
+	/*
+	 * Build the packet, with any cooked header and VLAN tag it
+	 * should have, after the block.
+	 */
+	bp = ps->pkt;
+	n = 0;
+	if (ps->flags & BLOCKFILE_COOKED) {
+		struct sll_header *hdrp = (struct sll_header *)bp;
+
+		/* the LINUX_SLL_ types have the PACKET_ types' values */
+		hdrp->sll_pkttype = htons(pkttype);
+		hdrp->sll_hatype = htons(get16(p, sll + SLL_HATYPE));
+		hdrp->sll_halen = htons(sll[SLL_HALEN]);
+		memcpy(hdrp->sll_addr, sll + SLL_ADDR, SLL_ADDRLEN);
+		/* already in network byte order */
+		memcpy(&hdrp->sll_protocol, sll + SLL_PROTOCOL, 2);
+		n = SLL_HDR_LEN;
+		hdr->len += SLL_HDR_LEN;
+	}
+	ncopy = caplen;
+	if (ncopy > (u_int)p->snapshot)
+		ncopy = p->snapshot;
+	memcpy(bp + n, tp + mac, ncopy);
+	n += ncopy;
+
+	if (ps->vlan_offset != -1 && (tci != 0 ||
+	    (status & TP3_STATUS_VLAN_VALID)) &&
+	    caplen >= (u_int)ps->vlan_offset &&
+	    n >= (u_int)ps->vlan_offset) {
+		tpid = get16(p, tp + TP3_VLAN_TPID);
+		if (tpid == 0 && !(status & TP3_STATUS_VLAN_TPID_VALID))
+			tpid = VLAN_TPID_8021Q;
+		memmove(bp + ps->vlan_offset + VLAN_TAG_LEN,
+		    bp + ps->vlan_offset, n - ps->vlan_offset);
+		bp[ps->vlan_offset] = tpid >> 8;
+		bp[ps->vlan_offset + 1] = tpid;
+		bp[ps->vlan_offset + 2] = tci >> 8;
+		bp[ps->vlan_offset + 3] = tci;
+		n += VLAN_TAG_LEN;
+		hdr->len += VLAN_TAG_LEN;
+	}
+	if (n > (u_int)p->snapshot)
+		n = p->snapshot;
+	hdr->caplen = n;
+	*data = bp;
+	return (0);
+}
+
+#ifndef WIN32
+
+struct pcap_block_writer {
+	pcap_t	*p;
+	int	fd;
+};
+
+/*
+ * Write out something that we've laid out for direct I/O; if the
+ * file system won't do direct I/O, go through the page cache instead.
+ */
+static int
+blocks_write(pcap_t *p, int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+#ifdef O_DIRECT
+	int flags;
+#endif
+
+	while (len != 0) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+#ifdef O_DIRECT
+			if (errno == EINVAL &&
+			    (flags = fcntl(fd, F_GETFL)) != -1 &&
+			    (flags & O_DIRECT) &&
+			    fcntl(fd, F_SETFL, flags & ~O_DIRECT) != -1)
+				continue;
+#endif
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't write to block file: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+	return (0);
+}
+
+pcap_block_writer_t *
+pcap_block_writer_open(pcap_t *p, const char *fname)
+{
+	struct pcap_block_writer *w;
+	struct pcap_block_file_header *hdr;
+	char *hdrbuf;
+	int fd, flags;
+
+	if (!p->activated) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_block_writer_open");
+		return (NULL);
+	}
+	if (p->block_header_op == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Whole blocks can't be recorded from this device, or in this capture mode");
+		return (NULL);
+	}
+
+	/*
+	 * The header's aligned, and padded, for direct I/O.
+	 */
+	hdrbuf = malloc(2 * BLOCKFILE_ALIGN);
+	if (hdrbuf == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	hdr = (struct pcap_block_file_header *)(hdrbuf + BLOCKFILE_ALIGN -
+	    ((unsigned long)hdrbuf & (BLOCKFILE_ALIGN - 1)));
+	memset(hdr, 0, BLOCKFILE_ALIGN);
+	if ((*p->block_header_op)(p, hdr) == -1) {
+		free(hdrbuf);
+		return (NULL);
+	}
+	hdr->magic = BLOCKFILE_MAGIC;
+	hdr->version_major = BLOCKFILE_VERSION_MAJOR;
+	hdr->version_minor = BLOCKFILE_VERSION_MINOR;
+	hdr->linktype = dlt_to_linktype(hdr->linktype);
+	hdr->header_len = BLOCKFILE_ALIGN;
+
+	if (fname[0] == '-' && fname[1] == '\0')
+		fd = dup(1);
+	else {
+		flags = O_WRONLY|O_CREAT|O_TRUNC;
+#ifdef O_DIRECT
+		fd = open(fname, flags|O_DIRECT, 0644);
+		if (fd == -1 && errno == EINVAL)
+#endif
+			fd = open(fname, flags, 0644);
+	}
+	if (fd == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s", fname,
+		    pcap_strerror(errno));
+		free(hdrbuf);
+		return (NULL);
+	}
+	if (blocks_write(p, fd, hdr, BLOCKFILE_ALIGN) == -1) {
+		close(fd);
+		free(hdrbuf);
+		return (NULL);
+	}
+	free(hdrbuf);
+
+	w = malloc(sizeof(*w));
+	if (w == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		close(fd);
+		return (NULL);
+	}
+	w->p = p;
+	w->fd = fd;
+	return (w);
+}
+
+/*
+ * Write out up to "maxblocks" blocks, or all the ones that are ready
+ * if it's not positive, waiting for one if need be, the way
+ * pcap_dispatch() waits for packets; returns the number of packets
+ * in the blocks written.
+ */
+int
+pcap_block_writer_write(pcap_block_writer_t *w, int maxblocks)
+{
+	return ((*w->p->write_blocks_op)(w->p, w->fd, maxblocks));
+}
+
+/*
+ * Write out blocks until blocks with at least "cnt" packets have been
+ * written, if it's positive, or pcap_breakloop() is called.
+ */
+int
+pcap_block_writer_loop(pcap_block_writer_t *w, int cnt)
+{
+	int n;
+
+	for (;;) {
+		n = pcap_block_writer_write(w, -1);
+		if (n < 0)
+			return (n);
+		if (cnt > 0) {
+			cnt -= n;
+			if (cnt <= 0)
+				return (0);
+		}
+	}
+}
+
+int
+pcap_block_writer_close(pcap_block_writer_t *w)
+{
+	int ret = 0;
+
+	if (close(w->fd) == -1) {
+		snprintf(w->p->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't close block file: %s", pcap_strerror(errno));
+		ret = -1;
+	}
+	free(w);
+	return (ret);
+}
+
+#endif /* WIN32 */
@@ -0,0 +1,51 @@
+/*
+ * sf-blocks.h - block-file-format-specific routines
+ *
+ * Used to write whole blocks of a capture buffer, as the capture
+ * mechanism filled them in, to a file, and to read them back.
+ */
+
+#ifndef sf_blocks_h
+#define	sf_blocks_h
+
+/*
+ * A block file starts with this header, padded out to "header_len"
+ * bytes, which is a multiple of BLOCKFILE_ALIGN, so that the blocks
+ * after it can be written with direct I/O.  All fields are in the byte
+ * order of the machine that wrote the file.
+ *
+ * Each block is the TPACKET_V3 block descriptor followed by the
+ * block's packets, each a tpacket3_hdr, a sockaddr_ll and the packet
+ * data, exactly as the kernel laid them out, padded with zeroes to a
+ * multiple of BLOCKFILE_ALIGN bytes.  The fix-ups that libpcap does to
+ * packets in the ring before handing them to the application -
+ * constructing cooked-mode headers, re-inserting VLAN tags, and
+ * dropping packets that are going in the wrong direction - are done
+ * by the reader instead, from the information in the header.
+ */
+#define BLOCKFILE_MAGIC		0xa1b2b10c
+#define BLOCKFILE_VERSION_MAJOR	1
+#define BLOCKFILE_VERSION_MINOR	0
+#define BLOCKFILE_ALIGN		4096
+
+struct pcap_block_file_header {
+	bpf_u_int32	magic;
+	u_short		version_major;
+	u_short		version_minor;
+	bpf_u_int32	linktype;	/* LINKTYPE_ of the packets handed out */
+	bpf_u_int32	snaplen;
+	bpf_u_int32	header_len;	/* offset of the first block */
+	bpf_u_int32	block_size;	/* size of the largest block */
+	bpf_u_int32	flags;		/* BLOCKFILE_ flags */
+	bpf_u_int32	sll_offset;	/* of the sockaddr_ll in a packet */
+	bpf_int32	vlan_offset;	/* where to re-insert VLAN tags, or -1 */
+	bpf_int32	lo_ifindex;	/* loopback's ifindex, or -1 */
+	bpf_u_int32	direction;	/* pcap_direction_t wanted */
+};
+
+#define BLOCKFILE_COOKED	0x00000001	/* construct a cooked header */
+
+extern pcap_t *pcap_blocks_check_header(bpf_u_int32 magic, FILE *fp,
+    u_int precision, char *errbuf, int *err, int isng);
+
+#endif
@@ -0,0 +1,662 @@
+/*
+ * sf-meta.c - write, and read back, a columnar file of packet metadata
+ * alongside a capture.
+ *
+ * For each packet, the file has the time stamp, lengths and interface,
+ * and, for IPv4 and IPv6, where the network-layer and transport-layer
+ * headers are, and the addresses, protocol, ports and TCP flags; not
+ * the packet data.  Scans that only need those can read this file,
+ * rather than the capture, and only the columns they need.
+ *
+ * The file starts with a pcap_meta_file_header, and then has groups of
+ * up to "group_rows" packets; each group is a pcap_meta_group_header
+ * followed by its columns, one after the other, each padded to a
+ * multiple of 8 bytes, in the order they're in struct pcap_meta_group.
+ * Everything's in the byte order of the machine that wrote the file,
+ * which the magic number shows.  IPv4 addresses are in the "src" and
+ * "dst" columns, in host byte order; for IPv6 packets, those columns
+ * hold an index into the group's table of IPv6 address pairs, which
+ * comes after the other columns.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_SYS_BITYPES_H
+#include <sys/bitypes.h>
+#endif
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "pcap-common.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "sf-pcap-ng.h"
+
+#define PCAP_META_MAGIC		0x504d4431	/* "PMD1" */
+#define PCAP_META_VERSION_MAJOR	1
+#define PCAP_META_VERSION_MINOR	0
+
+#define META_GROUP_ROWS		65536	/* rows per group we write */
+#define META_MAX_GROUP_ROWS	(16*1024*1024)	/* most we'll read */
+
+#define META_GET32(p)	((bpf_u_int32)(p)[0] << 24 | (bpf_u_int32)(p)[1] << 16 | \
+			 (bpf_u_int32)(p)[2] << 8 | (bpf_u_int32)(p)[3])
+#define META_PAD(n)	(((n) + 7) & ~(size_t)7)
+
+struct pcap_meta_file_header {
+	bpf_u_int32	magic;
+	u_short		version_major;
+	u_short		version_minor;
+	bpf_u_int32	linktype;	/* DLT_ value */
+	bpf_u_int32	snaplen;
+	bpf_u_int32	group_rows;	/* most rows in a group */
+	bpf_u_int32	reserved;
+};
+
+struct pcap_meta_group_header {
+	bpf_u_int32	rows;
+	bpf_u_int32	v6_rows;	/* IPv6 address pairs */
+	u_int64_t	length;		/* bytes of columns that follow */
+};
+
+/*
+ * The columns, their sizes, and where they are in a pcap_meta_group.
+ */
+#define META_COL(m, w)	{ offsetof(struct pcap_meta_group, m), w }
+
+static const struct meta_column {
+	size_t	offset;
+	size_t	width;
+} meta_columns[] = {
+	META_COL(ts, 8),
+	META_COL(caplen, 4),
+	META_COL(len, 4),
+	META_COL(ifid, 4),
+	META_COL(src, 4),
+	META_COL(dst, 4),
+	META_COL(off_l3, 2),
+	META_COL(off_l4, 2),
+	META_COL(ethertype, 2),
+	META_COL(sport, 2),
+	META_COL(dport, 2),
+	META_COL(version, 1),
+	META_COL(proto, 1),
+	META_COL(tcpflags, 1),
+};
+#define META_NCOLUMNS	(sizeof(meta_columns) / sizeof(meta_columns[0]))
+
+/*
+ * Get, or set, the pointer to column "i" of a group; the pointers are
+ * of different types, so they're copied rather than cast.
+ */
+static void *
+meta_column(const struct pcap_meta_group *g, u_int i)
+{
+	void *col;
+
+	memcpy(&col, (const char *)g + meta_columns[i].offset, sizeof(col));
+	return (col);
+}
+
+static void
+meta_set_column(struct pcap_meta_group *g, u_int i, void *col)
+{
+	memcpy((char *)g + meta_columns[i].offset, &col, sizeof(col));
+}
+
+/*
+ * Bytes of columns in a group.
+ */
+static u_int64_t
+meta_group_length(u_int rows, u_int v6_rows)
+{
+	u_int64_t length = 0;
+	u_int i;
+
+	for (i = 0; i < META_NCOLUMNS; i++)
+		length += META_PAD((u_int64_t)rows * meta_columns[i].width);
+	return (length + (u_int64_t)v6_rows * 32);
+}
+
+struct pcap_meta_writer {
+	pcap_t		*p;
+	FILE		*f;
+	int		nanos;		/* time stamps are in nanoseconds */
+	int		off_nl;		/* network-layer header, or -1 */
+	int		off_ethertype;	/* Ethernet type field, or -1 */
+	struct pcap_meta_group g;	/* the group being filled */
+	u_char		*v6;		/* its IPv6 address pairs */
+	int		failed;		/* we've had an error, and given up */
+	char		errbuf[PCAP_ERRBUF_SIZE];
+};
+
+/*
+ * Allocate, or free, the columns of a group of "rows" rows, and an
+ * IPv6 address table of the same number of rows.
+ */
+static int
+meta_alloc_columns(struct pcap_meta_group *g, u_int rows)
+{
+	u_int i;
+
+	for (i = 0; i < META_NCOLUMNS; i++) {
+		meta_set_column(g, i, malloc(META_PAD(rows *
+		    meta_columns[i].width)));
+		if (meta_column(g, i) == NULL)
+			return (-1);
+	}
+	return (0);
+}
+
+static void
+meta_free_columns(struct pcap_meta_group *g)
+{
+	u_int i;
+
+	for (i = 0; i < META_NCOLUMNS; i++) {
+		free(meta_column(g, i));
+		meta_set_column(g, i, NULL);
+	}
+}
+
+static int
+meta_flush(pcap_meta_writer_t *w)
+{
+	struct pcap_meta_group *g = &w->g;
+	struct pcap_meta_group_header gh;
+	size_t n;
+	u_int i;
+
+	if (g->rows == 0)
+		return (0);
+	gh.rows = g->rows;
+	gh.v6_rows = g->v6_rows;
+	gh.length = meta_group_length(g->rows, g->v6_rows);
+	if (fwrite(&gh, sizeof(gh), 1, w->f) != 1)
+		goto fail;
+	for (i = 0; i < META_NCOLUMNS; i++) {
+		n = g->rows * meta_columns[i].width;
+		/*
+		 * Zero the padding, rather than writing out whatever
+		 * was there.
+		 */
+		memset((u_char *)meta_column(g, i) + n, 0, META_PAD(n) - n);
+		if (fwrite(meta_column(g, i), 1, META_PAD(n), w->f) !=
+		    META_PAD(n))
+			goto fail;
+	}
+	if (g->v6_rows != 0 &&
+	    fwrite(w->v6, 32, g->v6_rows, w->f) != g->v6_rows)
+		goto fail;
+	g->rows = 0;
+	g->v6_rows = 0;
+	return (0);
+
+fail:
+	snprintf(w->errbuf, PCAP_ERRBUF_SIZE,
+	    "error writing metadata file: %s", pcap_strerror(errno));
+	w->failed = 1;
+	return (-1);
+}
+
+pcap_meta_writer_t *
+pcap_meta_writer_open(pcap_t *p, const char *fname)
+{
+	pcap_meta_writer_t *w;
+	struct pcap_meta_file_header hdr;
+
+	if (!p->activated) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_meta_writer_open");
+		return (NULL);
+	}
+	w = calloc(1, sizeof(*w));
+	if (w == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	w->p = p;
+	w->nanos = (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO);
+	w->off_nl = pcap_nl_offset(p, &w->off_ethertype);
+	if (meta_alloc_columns(&w->g, META_GROUP_ROWS) == -1 ||
+	    (w->v6 = malloc(META_GROUP_ROWS * 32)) == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		meta_free_columns(&w->g);
+		free(w);
+		return (NULL);
+	}
+
+	w->f = fopen(fname, "wb");
+	if (w->f == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s",
+		    fname, pcap_strerror(errno));
+		goto fail;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PCAP_META_MAGIC;
+	hdr.version_major = PCAP_META_VERSION_MAJOR;
+	hdr.version_minor = PCAP_META_VERSION_MINOR;
+	hdr.linktype = p->linktype;
+	hdr.snaplen = p->snapshot;
+	hdr.group_rows = META_GROUP_ROWS;
+	if (fwrite(&hdr, sizeof(hdr), 1, w->f) != 1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s",
+		    fname, pcap_strerror(errno));
+		fclose(w->f);
+		goto fail;
+	}
+	return (w);
+
+fail:
+	meta_free_columns(&w->g);
+	free(w->v6);
+	free(w);
+	return (NULL);
+}
+
+void
+pcap_meta_write(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	pcap_meta_writer_t *w = (pcap_meta_writer_t *)user;
+	struct pcap_meta_group *g = &w->g;
+	struct pcap_flow_key k;
+	u_int r;
+	int ifid;
+
+	if (w->failed)
+		return;
+	r = g->rows;
+
+	((u_int64_t *)g->ts)[r] = (u_int64_t)h->ts.tv_sec * 1000000000 +
+	    (u_int64_t)h->ts.tv_usec * (w->nanos ? 1 : 1000);
+	((bpf_u_int32 *)g->caplen)[r] = h->caplen;
+	((bpf_u_int32 *)g->len)[r] = h->len;
+	if (w->p->per_interface)
+		ifid = ((const struct pcap_pkthdr_if *)h)->if_index;
+	else if ((ifid = pcap_ng_sf_interface(w->p)) == -1)
+		ifid = 0;
+	((bpf_u_int32 *)g->ifid)[r] = ifid;
+
+	pcap_flow_parse(sp, h->caplen, w->off_nl, w->off_ethertype, &k);
+	((u_short *)g->off_l3)[r] = k.off_l3 == -1 ? PCAP_META_NONE : k.off_l3;
+	((u_short *)g->off_l4)[r] = k.off_l4 == -1 ? PCAP_META_NONE : k.off_l4;
+	((u_short *)g->ethertype)[r] = k.ethertype;
+	((u_short *)g->sport)[r] = k.sport;
+	((u_short *)g->dport)[r] = k.dport;
+	((u_char *)g->version)[r] = k.version;
+	((u_char *)g->proto)[r] = k.version != 0 ? k.proto : 0;
+	((u_char *)g->tcpflags)[r] = k.version != 0 && k.proto == 6 &&
+	    k.off_l4 != -1 && (u_int)k.off_l4 + 14 <= h->caplen ?
+	    sp[k.off_l4 + 13] : 0;
+	switch (k.version) {
+
+	case 4:
+		((bpf_u_int32 *)g->src)[r] = META_GET32(k.src);
+		((bpf_u_int32 *)g->dst)[r] = META_GET32(k.dst);
+		break;
+
+	case 6:
+		memcpy(w->v6 + g->v6_rows * 32, k.src, 16);
+		memcpy(w->v6 + g->v6_rows * 32 + 16, k.dst, 16);
+		((bpf_u_int32 *)g->src)[r] = g->v6_rows;
+		((bpf_u_int32 *)g->dst)[r] = g->v6_rows;
+		g->v6_rows++;
+		break;
+
+	default:
+		((bpf_u_int32 *)g->src)[r] = 0;
+		((bpf_u_int32 *)g->dst)[r] = 0;
+		break;
+	}
+
+	if (++g->rows == META_GROUP_ROWS)
+		(void)meta_flush(w);
+}
+
+int
+pcap_meta_writer_flush(pcap_meta_writer_t *w)
+{
+	if (w->failed || meta_flush(w) == -1)
+		return (-1);
+	if (fflush(w->f) == EOF) {
+		snprintf(w->errbuf, PCAP_ERRBUF_SIZE,
+		    "error writing metadata file: %s", pcap_strerror(errno));
+		w->failed = 1;
+		return (-1);
+	}
+	return (0);
+}
+
+char *
+pcap_meta_writer_geterr(pcap_meta_writer_t *w)
+{
+	return (w->errbuf);
+}
+
+int
+pcap_meta_writer_close(pcap_meta_writer_t *w)
+{
+	int status;
+
+	status = pcap_meta_writer_flush(w);
+	if (fclose(w->f) == EOF)
+		status = -1;
+	meta_free_columns(&w->g);
+	free(w->v6);
+	free(w);
+	return (status);
+}
+
+/*
+ * Write the metadata for the rest of a savefile, or for "cnt" packets
+ * of a capture, that pass its filter; returns the number of packets.
+ * Packets are read one at a time, so that, for a pcap-ng file, we know
+ * which interface each came in on.
+ */
+int
+pcap_meta_export(pcap_t *p, const char *fname, int cnt)
+{
+	pcap_meta_writer_t *w;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	int n = 0, status;
+
+	w = pcap_meta_writer_open(p, fname);
+	if (w == NULL)
+		return (-1);
+	while (PACKET_COUNT_IS_UNLIMITED(cnt) || n < cnt) {
+		status = pcap_next_ex(p, &h, &data);
+		if (status == -1) {
+			(void)pcap_meta_writer_close(w);
+			return (-1);
+		}
+		if (status == -2)
+			break;		/* end of file, or pcap_breakloop() */
+		if (status == 1) {
+			pcap_meta_write((u_char *)w, h, data);
+			n++;
+		}
+	}
+	if (pcap_meta_writer_flush(w) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s", fname,
+		    pcap_meta_writer_geterr(w));
+		(void)pcap_meta_writer_close(w);
+		return (-1);
+	}
+	if (pcap_meta_writer_close(w) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s", fname,
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	return (n);
+}
+
+/*
+ * Reading.
+ */
+struct pcap_meta {
+	FILE		*f;
+	struct pcap_meta_file_header hdr;
+	int		swapped;
+	u_char		*buf;		/* the group's columns */
+	size_t		bufsize;
+	struct pcap_meta_group g;	/* the group for pcap_meta_next() */
+	u_int		row;		/* the next row of it */
+	char		errbuf[PCAP_ERRBUF_SIZE];
+};
+
+pcap_meta_t *
+pcap_meta_open(const char *fname, char *errbuf)
+{
+	pcap_meta_t *m;
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	m->f = fopen(fname, "rb");
+	if (m->f == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", fname,
+		    pcap_strerror(errno));
+		free(m);
+		return (NULL);
+	}
+	if (fread(&m->hdr, sizeof(m->hdr), 1, m->f) != 1) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: truncated metadata file header", fname);
+		goto fail;
+	}
+	if (m->hdr.magic != PCAP_META_MAGIC) {
+		if (m->hdr.magic != SWAPLONG(PCAP_META_MAGIC)) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: not a packet metadata file", fname);
+			goto fail;
+		}
+		m->swapped = 1;
+		m->hdr.version_major = SWAPSHORT(m->hdr.version_major);
+		m->hdr.version_minor = SWAPSHORT(m->hdr.version_minor);
+		m->hdr.linktype = SWAPLONG(m->hdr.linktype);
+		m->hdr.snaplen = SWAPLONG(m->hdr.snaplen);
+		m->hdr.group_rows = SWAPLONG(m->hdr.group_rows);
+	}
+	if (m->hdr.version_major != PCAP_META_VERSION_MAJOR) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: packet metadata file version %u.%u isn't supported",
+		    fname, m->hdr.version_major, m->hdr.version_minor);
+		goto fail;
+	}
+	return (m);
+
+fail:
+	fclose(m->f);
+	free(m);
+	return (NULL);
+}
+
+int
+pcap_meta_datalink(pcap_meta_t *m)
+{
+	return (m->hdr.linktype);
+}
+
+int
+pcap_meta_snapshot(pcap_meta_t *m)
+{
+	return (m->hdr.snaplen);
+}
+
+static void
+meta_swap_group(struct pcap_meta_group *g)
+{
+	u_int i, r;
+	u_int64_t *p64;
+	bpf_u_int32 *p32;
+	u_short *p16;
+
+	for (i = 0; i < META_NCOLUMNS; i++) {
+		switch (meta_columns[i].width) {
+
+		case 8:
+			p64 = meta_column(g, i);
+			for (r = 0; r < g->rows; r++)
+				p64[r] = SWAPLONGLONG(p64[r]);
+			break;
+
+		case 4:
+			p32 = meta_column(g, i);
+			for (r = 0; r < g->rows; r++)
+				p32[r] = SWAPLONG(p32[r]);
+			break;
+
+		case 2:
+			p16 = meta_column(g, i);
+			for (r = 0; r < g->rows; r++)
+				p16[r] = SWAPSHORT(p16[r]);
+			break;
+		}
+	}
+}
+
+int
+pcap_meta_next_group(pcap_meta_t *m, struct pcap_meta_group *g)
+{
+	struct pcap_meta_group_header gh;
+	size_t amt_read;
+	u_char *cp;
+	u_int i;
+
+	amt_read = fread(&gh, 1, sizeof(gh), m->f);
+	if (amt_read != sizeof(gh)) {
+		if (ferror(m->f)) {
+			snprintf(m->errbuf, PCAP_ERRBUF_SIZE,
+			    "error reading metadata file: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		if (amt_read != 0) {
+			snprintf(m->errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated metadata file; tried to read %lu group header bytes, only got %lu",
+			    (unsigned long)sizeof(gh),
+			    (unsigned long)amt_read);
+			return (-1);
+		}
+		return (0);	/* EOF */
+	}
+	if (m->swapped) {
+		gh.rows = SWAPLONG(gh.rows);
+		gh.v6_rows = SWAPLONG(gh.v6_rows);
+		gh.length = SWAPLONGLONG(gh.length);
+	}
+	if (gh.rows > META_MAX_GROUP_ROWS || gh.v6_rows > gh.rows ||
+	    gh.length != meta_group_length(gh.rows, gh.v6_rows)) {
+		snprintf(m->errbuf, PCAP_ERRBUF_SIZE,
+		    "bogus metadata group of %u rows, %u IPv6",
+		    gh.rows, gh.v6_rows);
+		return (-1);
+	}
+	if (m->bufsize < gh.length) {
+		free(m->buf);
+		m->buf = malloc(gh.length);
+		if (m->buf == NULL) {
+			m->bufsize = 0;
+			snprintf(m->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			return (-1);
+		}
+		m->bufsize = gh.length;
+	}
+	amt_read = fread(m->buf, 1, gh.length, m->f);
+	if (amt_read != gh.length) {
+		if (ferror(m->f)) {
+			snprintf(m->errbuf, PCAP_ERRBUF_SIZE,
+			    "error reading metadata file: %s",
+			    pcap_strerror(errno));
+		} else {
+			snprintf(m->errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated metadata file; tried to read %lu group bytes, only got %lu",
+			    (unsigned long)gh.length,
+			    (unsigned long)amt_read);
+		}
+		return (-1);
+	}
+
+	g->rows = gh.rows;
+	g->v6_rows = gh.v6_rows;
+	for (i = 0, cp = m->buf; i < META_NCOLUMNS; i++) {
+		meta_set_column(g, i, cp);
+		cp += META_PAD(gh.rows * meta_columns[i].width);
+	}
+	g->v6 = cp;
+	if (m->swapped)
+		meta_swap_group(g);
+	return (1);
+}
+
+void
+pcap_meta_get(const struct pcap_meta_group *g, u_int r,
+    struct pcap_meta_rec *rec)
+{
+	bpf_u_int32 a;
+
+	rec->ts = g->ts[r];
+	rec->caplen = g->caplen[r];
+	rec->len = g->len[r];
+	rec->ifid = g->ifid[r];
+	rec->off_l3 = g->off_l3[r];
+	rec->off_l4 = g->off_l4[r];
+	rec->ethertype = g->ethertype[r];
+	rec->sport = g->sport[r];
+	rec->dport = g->dport[r];
+	rec->version = g->version[r];
+	rec->proto = g->proto[r];
+	rec->tcpflags = g->tcpflags[r];
+	memset(rec->src, 0, sizeof(rec->src));
+	memset(rec->dst, 0, sizeof(rec->dst));
+	switch (rec->version) {
+
+	case 4:
+		a = g->src[r];
+		rec->src[0] = a >> 24; rec->src[1] = a >> 16;
+		rec->src[2] = a >> 8; rec->src[3] = a;
+		a = g->dst[r];
+		rec->dst[0] = a >> 24; rec->dst[1] = a >> 16;
+		rec->dst[2] = a >> 8; rec->dst[3] = a;
+		break;
+
+	case 6:
+		if (g->src[r] < g->v6_rows) {
+			memcpy(rec->src, g->v6 + g->src[r] * 32, 16);
+			memcpy(rec->dst, g->v6 + g->src[r] * 32 + 16, 16);
+		}
+		break;
+	}
+}
+
+int
+pcap_meta_next(pcap_meta_t *m, struct pcap_meta_rec *rec)
+{
+	int status;
+
+	while (m->row >= m->g.rows) {
+		status = pcap_meta_next_group(m, &m->g);
+		if (status <= 0)
+			return (status);
+		m->row = 0;
+	}
+	pcap_meta_get(&m->g, m->row++, rec);
+	return (1);
+}
+
+char *
+pcap_meta_geterr(pcap_meta_t *m)
+{
+	return (m->errbuf);
+}
+
+void
+pcap_meta_close(pcap_meta_t *m)
+{
+	fclose(m->f);
+	free(m->buf);
+	free(m);
+}
@@ -64,6 +64,7 @@ static const char rcsid[] _U_ =
 #include <sys/bitypes.h>
 #endif
 #include <sys/types.h>
+#include <net/if.h>
 #endif /* WIN32 */
 
 #include <errno.h>
@@ -191,6 +192,14 @@ struct enhanced_packet_block {
 	/* followed by packet data, options, and trailer */
 };
 
+/*
+ * Options in the EPB.
+ */
+#define EPB_FLAGS	2	/* link-layer flags */
+
+#define EPB_FLAGS_INBOUND	0x00000001
+#define EPB_FLAGS_OUTBOUND	0x00000002
+
 /*
  * Simple Packet Block.
  */
@@ -248,6 +257,7 @@ struct pcap_ng_sf {
 	bpf_u_int32 ifcount;		/* number of interfaces seen in this capture */
 	bpf_u_int32 ifaces_size;	/* size of arrary below */
 	struct pcap_ng_if *ifaces;	/* array of interface information */
+	bpf_u_int32 last_if;		/* interface of the last packet read */
 };
 
 static void pcap_ng_cleanup(pcap_t *p);
@@ -288,10 +298,33 @@ read_block(FILE *fp, pcap_t *p, struct block_cursor *cursor, char *errbuf)
 {
 	int status;
 	struct block_header bhdr;
+	u_char *block;
+	off_t offset = 0;
+
+	/*
+	 * If we're following a file that's still being written, and
+	 * run out part way through a block, we go back to its start
+	 * to read it again once there's more.
+	 */
+	if (p->sf_follow != NULL)
+		offset = ftello(fp);
 
-	status = read_bytes(fp, &bhdr, sizeof(bhdr), 0, errbuf);
-	if (status <= 0)
-		return (status);	/* error or EOF */
+	if (p->sf_mem != NULL) {
+		/*
+		 * In memory, the block header's only consumed along
+		 * with the rest of the block, once that's all there.
+		 */
+		status = sf_mem_have(p, sizeof(bhdr));
+		if (status <= 0)
+			return (status);	/* error, EOF, or not yet */
+		sf_mem_peek(p, &bhdr, sizeof(bhdr));
+	} else {
+		status = read_bytes(fp, &bhdr, sizeof(bhdr), 0, errbuf);
+		if (status == -1 && sf_following(p) && !ferror(fp))
+			return (sf_follow_rewind(p, offset) == -1 ? -1 : 0);
+		if (status <= 0)
+			return (status);	/* error or EOF */
+	}
 
 	if (p->swapped) {
 		bhdr.block_type = SWAPLONG(bhdr.block_type);
@@ -346,19 +379,40 @@ read_block(FILE *fp, pcap_t *p, struct block_cursor *cursor, char *errbuf)
 		}
 	}
 
-	/*
-	 * Copy the stuff we've read to the buffer, and read the rest
-	 * of the block.
-	 */
-	memcpy(p->buffer, &bhdr, sizeof(bhdr));
-	if (read_bytes(fp, p->buffer + sizeof(bhdr),
-	    bhdr.total_length - sizeof(bhdr), 1, errbuf) == -1)
-		return (-1);
+	if (p->sf_mem != NULL) {
+		/*
+		 * Use the block where it is, unless it has to be
+		 * byte-swapped, isn't aligned, or is split between
+		 * buffers.
+		 */
+		status = sf_mem_have(p, bhdr.total_length);
+		if (status <= 0)
+			return (status);
+		block = sf_mem_get(p, bhdr.total_length, p->buffer,
+		    p->swapped ? 0 : 4);
+		if (block == p->buffer)
+			memcpy(p->buffer, &bhdr, sizeof(bhdr));
+		p->sf_mem->block = block;
+	} else {
+		/*
+		 * Copy the stuff we've read to the buffer, and read
+		 * the rest of the block.
+		 */
+		memcpy(p->buffer, &bhdr, sizeof(bhdr));
+		if (read_bytes(fp, p->buffer + sizeof(bhdr),
+		    bhdr.total_length - sizeof(bhdr), 1, errbuf) == -1) {
+			if (sf_following(p) && !ferror(fp))
+				return (sf_follow_rewind(p, offset) == -1 ?
+				    -1 : 0);
+			return (-1);
+		}
+		block = p->buffer;
+	}
 
 	/*
 	 * Initialize the cursor.
 	 */
-	cursor->data = p->buffer + sizeof(bhdr);
+	cursor->data = block + sizeof(bhdr);
 	cursor->data_remaining = bhdr.total_length - sizeof(bhdr) -
 	    sizeof(struct block_trailer);
 	cursor->block_type = bhdr.block_type;
@@ -985,6 +1039,21 @@ fail:
 	return (NULL);
 }
 
+/*
+ * The interface ID of the last packet read from a pcap-ng savefile,
+ * or -1 if it isn't one.
+ */
+int
+pcap_ng_sf_interface(pcap_t *p)
+{
+	struct pcap_ng_sf *ps = p->priv;
+
+	if (p->rfile == NULL || (p->next_packet_op != pcap_ng_next_packet &&
+	    p->next_packet_op != pcap_ng_next_block))
+		return (-1);
+	return (ps->last_if);
+}
+
 static void
 pcap_ng_cleanup(pcap_t *p)
 {
@@ -1281,6 +1350,7 @@ found:
 		    interface_id);
 		return (-1);
 	}
+	ps->last_if = interface_id;
 
 	/*
 	 * Convert the time stamp to a struct timeval.
@@ -1611,3 +1681,431 @@ pcap_ng_dump_close(pcap_dumper_t *p)
 
 #endif /* __APPLE__ */
 
+/*
+ * Writing the packets from a handle in per-interface mode.
+ *
+ * Each interface gets an IDB, and a pcapng interface ID, the first
+ * time a packet from it is written; after that, the ID is found by
+ * looking the interface index up in a table sorted by index, as the
+ * indices can be far too big to index a table with.  A handle that
+ * isn't in per-interface mode has one interface, of the handle's own
+ * link-layer type.
+ *
+ * The blocks go either to a stdio stream or, for a sink (see
+ * sf-sink.c), straight into the sink's buffer, which the caller has
+ * made sure has room for them.
+ */
+struct pcap_ng_if_id {
+	int		ifindex;	/* interface index */
+	int		dlt;		/* DLT_ type the IDB was written for, or -1 */
+	bpf_u_int32	id;		/* pcapng interface ID */
+};
+
+struct pcap_ng_out {
+	FILE		*f;		/* stream, or null for memory */
+	u_char		*buf;		/* memory */
+	size_t		len;		/* bytes put in it so far */
+};
+
+#define IDB_OPTS_MAX	(2 * sizeof(struct option_header) + IF_NAMESIZE + 3 + \
+			 sizeof(struct option_header) + 4 + sizeof(struct option_header))
+#define EPB_OPTS_LEN	(2 * sizeof(struct option_header) + 4)
+
+static int
+pcap_ng_write_block(struct pcap_ng_out *out, bpf_u_int32 block_type,
+    const void *fields, size_t fields_len, const void *data, size_t data_len,
+    const void *opts, size_t opts_len)
+{
+	static const u_char zeroes[4];
+	struct block_header bh;
+	struct block_trailer bt;
+	FILE *f = out->f;
+	u_char *cp;
+	size_t pad;
+
+	pad = (4 - (data_len % 4)) % 4;
+	bh.block_type = block_type;
+	bh.total_length = sizeof(bh) + fields_len + data_len + pad +
+	    opts_len + sizeof(bt);
+	bt.total_length = bh.total_length;
+	if (f == NULL) {
+		cp = out->buf + out->len;
+		memcpy(cp, &bh, sizeof(bh));
+		cp += sizeof(bh);
+		memcpy(cp, fields, fields_len);
+		cp += fields_len;
+		if (data_len != 0) {
+			memcpy(cp, data, data_len);
+			cp += data_len;
+			memset(cp, 0, pad);
+			cp += pad;
+		}
+		if (opts_len != 0) {
+			memcpy(cp, opts, opts_len);
+			cp += opts_len;
+		}
+		memcpy(cp, &bt, sizeof(bt));
+		out->len += bh.total_length;
+		return (0);
+	}
+	if (fwrite(&bh, sizeof(bh), 1, f) != 1 ||
+	    fwrite(fields, fields_len, 1, f) != 1)
+		return (-1);
+	if (data_len != 0 && (fwrite(data, data_len, 1, f) != 1 ||
+	    (pad != 0 && fwrite(zeroes, pad, 1, f) != 1)))
+		return (-1);
+	if (opts_len != 0 && fwrite(opts, opts_len, 1, f) != 1)
+		return (-1);
+	if (fwrite(&bt, sizeof(bt), 1, f) != 1)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Write an IDB for the interface with the given index and type.
+ */
+static int
+pcap_ng_dump_if_idb(pcap_t *p, struct pcap_ng_out *out, int ifindex, int dlt)
+{
+	struct interface_description_block idb;
+	struct option_header *oh;
+	u_char opts[IDB_OPTS_MAX];
+	size_t optlen = 0, namelen;
+	int linktype;
+#ifndef WIN32
+	char ifname[IF_NAMESIZE];
+#endif
+
+	linktype = dlt_to_linktype(dlt);
+	if (linktype == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "link-layer type %d isn't supported in savefiles", dlt);
+		return (-1);
+	}
+	idb.linktype = linktype;
+	idb.reserved = 0;
+	idb.snaplen = p->snapshot;
+
+	memset(opts, 0, sizeof(opts));
+#ifndef WIN32
+	if (ifindex > 0 && if_indextoname(ifindex, ifname) != NULL) {
+		namelen = strlen(ifname);
+		oh = (struct option_header *)opts;
+		oh->option_code = IF_NAME;
+		oh->option_length = namelen;
+		memcpy(opts + sizeof(*oh), ifname, namelen);
+		optlen += sizeof(*oh) + ((namelen + 3) & ~3);
+	}
+#endif
+	if (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
+		oh = (struct option_header *)(opts + optlen);
+		oh->option_code = IF_TSRESOL;
+		oh->option_length = 1;
+		opts[optlen + sizeof(*oh)] = 9;
+		optlen += sizeof(*oh) + 4;
+	}
+	if (optlen != 0) {
+		/* the end-of-options option is already zeroed */
+		optlen += sizeof(*oh);
+	}
+
+	if (pcap_ng_write_block(out, BT_IDB, &idb, sizeof(idb), NULL, 0,
+	    opts, optlen) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "Can't write IDB: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+pcap_ng_dump_if_shb(struct pcap_ng_if_table *t, struct pcap_ng_out *out)
+{
+	struct section_header_block shb;
+
+	/*
+	 * A new section has no interfaces yet.
+	 */
+	free(t->ids);
+	t->ids = NULL;
+	t->size = t->max = t->last = 0;
+	t->count = 0;
+
+	shb.byte_order_magic = BYTE_ORDER_MAGIC;
+	shb.major_version = PCAP_NG_VERSION_MAJOR;
+	shb.minor_version = 0;
+	shb.section_length = -1;	/* not known */
+	return (pcap_ng_write_block(out, BT_SHB, &shb, sizeof(shb), NULL, 0,
+	    NULL, 0));
+}
+
+/*
+ * Find an interface's entry in the table, adding one, with a "dlt" of
+ * -1, if it's not there.  Packets mostly come from the same interface
+ * as the one before, so that one's tried first.  Returns null if we
+ * run out of memory.
+ */
+static struct pcap_ng_if_id *
+pcap_ng_if_lookup(struct pcap_ng_if_table *t, int ifindex)
+{
+	struct pcap_ng_if_id *ids;
+	int lo, hi, mid, newmax;
+
+	if (t->last < t->size && t->ids[t->last].ifindex == ifindex)
+		return (&t->ids[t->last]);
+
+	lo = 0;
+	hi = t->size;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->ids[mid].ifindex < ifindex)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == t->size || t->ids[lo].ifindex != ifindex) {
+		if (t->size == t->max) {
+			newmax = t->max == 0 ? 16 : t->max * 2;
+			ids = realloc(t->ids, newmax * sizeof(*ids));
+			if (ids == NULL)
+				return (NULL);
+			t->ids = ids;
+			t->max = newmax;
+		}
+		memmove(&t->ids[lo + 1], &t->ids[lo],
+		    (t->size - lo) * sizeof(*t->ids));
+		t->ids[lo].ifindex = ifindex;
+		t->ids[lo].dlt = -1;
+		t->size++;
+	}
+	t->last = lo;
+	return (&t->ids[lo]);
+}
+
+/*
+ * Write the blocks for a packet: an IDB, if it's the first packet from
+ * its interface, and an EPB.
+ */
+static int
+pcap_ng_dump_if_blocks(pcap_t *p, struct pcap_ng_if_table *t,
+    struct pcap_ng_out *out, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct enhanced_packet_block epb;
+	struct pcap_ng_if_id *ifid;
+	struct option_header *oh;
+	u_char opts[EPB_OPTS_LEN];
+	size_t optlen = 0;
+	u_int64_t ts;
+	int ifindex, dlt;
+	bpf_u_int32 flags;
+
+	if (p->per_interface) {
+		const struct pcap_pkthdr_if *ih =
+		    (const struct pcap_pkthdr_if *)h;
+
+		ifindex = ih->if_index;
+		dlt = ih->if_dlt;
+		flags = ih->if_direction == PCAP_D_OUT ?
+		    EPB_FLAGS_OUTBOUND : EPB_FLAGS_INBOUND;
+	} else {
+		ifindex = 0;
+		dlt = p->linktype;
+		flags = 0;
+	}
+	if (ifindex < 0)
+		ifindex = 0;
+
+	ifid = pcap_ng_if_lookup(t, ifindex);
+	if (ifid == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	if (ifid->dlt != dlt) {
+		/*
+		 * First packet from this interface, or it's changed
+		 * type since the last one; describe it.
+		 */
+		if (pcap_ng_dump_if_idb(p, out, ifindex, dlt) == -1)
+			return (-1);
+		ifid->dlt = dlt;
+		ifid->id = t->count++;
+	}
+
+	if (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO)
+		ts = (u_int64_t)h->ts.tv_sec * 1000000000 + h->ts.tv_usec;
+	else
+		ts = (u_int64_t)h->ts.tv_sec * 1000000 + h->ts.tv_usec;
+	epb.interface_id = ifid->id;
+	epb.timestamp_high = (bpf_u_int32)(ts >> 32);
+	epb.timestamp_low = (bpf_u_int32)ts;
+	epb.caplen = h->caplen;
+	epb.len = h->len;
+
+	if (flags != 0) {
+		memset(opts, 0, sizeof(opts));
+		oh = (struct option_header *)opts;
+		oh->option_code = EPB_FLAGS;
+		oh->option_length = sizeof(flags);
+		memcpy(opts + sizeof(*oh), &flags, sizeof(flags));
+		optlen = sizeof(opts);
+	}
+
+	if (pcap_ng_write_block(out, BT_EPB, &epb, sizeof(epb), sp, h->caplen,
+	    opts, optlen) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "Can't write EPB: %s",
+		    pcap_strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Each file being written has its own table of interfaces, found
+ * from the stream, as that's what the pcap_dumper_t is.
+ */
+static struct pcap_ng_if_dumper **
+pcap_ng_dump_if_find(pcap_t *p, FILE *f)
+{
+	struct pcap_ng_if_dumper **ngdp;
+
+	for (ngdp = &p->ng_dumpers; *ngdp != NULL; ngdp = &(*ngdp)->next) {
+		if ((*ngdp)->f == f)
+			break;
+	}
+	return (ngdp);
+}
+
+static void
+pcap_ng_dump_if_forget(pcap_t *p, FILE *f)
+{
+	struct pcap_ng_if_dumper **ngdp, *ngd;
+
+	ngdp = pcap_ng_dump_if_find(p, f);
+	ngd = *ngdp;
+	if (ngd != NULL) {
+		*ngdp = ngd->next;
+		free(ngd->t.ids);
+		free(ngd);
+	}
+}
+
+pcap_dumper_t *
+pcap_ng_dump_if_open(pcap_t *p, const char *fname)
+{
+	struct pcap_ng_if_dumper *ngd;
+	struct pcap_ng_out out;
+	FILE *f;
+
+	if (!p->activated) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not-yet-activated pcap_t passed to pcap_ng_dump_if_open",
+		    fname);
+		return (NULL);
+	}
+	if (fname[0] == '-' && fname[1] == '\0') {
+		f = stdout;
+		fname = "standard output";
+	} else {
+		f = fopen(fname, "wb");
+		if (f == NULL) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: %s",
+			    fname, pcap_strerror(errno));
+			return (NULL);
+		}
+	}
+
+	ngd = calloc(1, sizeof(*ngd));
+	if (ngd == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		if (f != stdout)
+			fclose(f);
+		return (NULL);
+	}
+	out.f = f;
+	if (pcap_ng_dump_if_shb(&ngd->t, &out) == -1) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "Can't write to %s: %s",
+		    fname, pcap_strerror(errno));
+		free(ngd);
+		if (f != stdout)
+			fclose(f);
+		return (NULL);
+	}
+
+	/*
+	 * A stream closed with pcap_dump_close(), rather than
+	 * pcap_ng_dump_if_close(), may have left its table behind.
+	 */
+	pcap_ng_dump_if_forget(p, f);
+	ngd->f = f;
+	ngd->next = p->ng_dumpers;
+	p->ng_dumpers = ngd;
+	return ((pcap_dumper_t *)f);
+}
+
+int
+pcap_ng_dump_if(pcap_t *p, pcap_dumper_t *d, const struct pcap_pkthdr *h,
+    const u_char *sp)
+{
+	struct pcap_ng_if_dumper *ngd;
+	struct pcap_ng_out out;
+
+	ngd = *pcap_ng_dump_if_find(p, (FILE *)d);
+	if (ngd == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "That file wasn't opened with pcap_ng_dump_if_open()");
+		return (-1);
+	}
+	out.f = ngd->f;
+	return (pcap_ng_dump_if_blocks(p, &ngd->t, &out, h, sp));
+}
+
+void
+pcap_ng_dump_if_close(pcap_t *p, pcap_dumper_t *d)
+{
+	pcap_ng_dump_if_forget(p, (FILE *)d);
+	pcap_dump_close(d);
+}
+
+/*
+ * The same, for a sink: the blocks are put at "buf", which must have
+ * room for pcap_ng_sink_maxlen() bytes, and the number of bytes put
+ * there is returned, or -1 on an error.
+ */
+size_t
+pcap_ng_sink_maxlen(bpf_u_int32 caplen)
+{
+	return (sizeof(struct block_header) +
+	    sizeof(struct interface_description_block) + IDB_OPTS_MAX +
+	    sizeof(struct block_trailer) +
+	    sizeof(struct block_header) +
+	    sizeof(struct enhanced_packet_block) + caplen + 3 + EPB_OPTS_LEN +
+	    sizeof(struct block_trailer));
+}
+
+int
+pcap_ng_sink_shb(struct pcap_ng_if_table *t, u_char *buf)
+{
+	struct pcap_ng_out out;
+
+	out.f = NULL;
+	out.buf = buf;
+	out.len = 0;
+	(void)pcap_ng_dump_if_shb(t, &out);
+	return (out.len);
+}
+
+int
+pcap_ng_sink_blocks(pcap_t *p, struct pcap_ng_if_table *t, u_char *buf,
+    const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct pcap_ng_out out;
+
+	out.f = NULL;
+	out.buf = buf;
+	out.len = 0;
+	if (pcap_ng_dump_if_blocks(p, t, &out, h, sp) == -1)
+		return (-1);
+	return (out.len);
+}
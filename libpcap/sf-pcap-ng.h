@@ -28,6 +28,18 @@
 
 extern pcap_t *pcap_ng_check_header(bpf_u_int32 magic, FILE *fp,
     u_int precision, char *errbuf, int *err, int isng);
+extern int pcap_ng_sf_interface(pcap_t *p);
+
+/*
+ * Putting the blocks of a pcap-ng file being written to a sink in the
+ * sink's buffer.
+ */
+struct pcap_ng_if_table;
+
+extern size_t pcap_ng_sink_maxlen(bpf_u_int32 caplen);
+extern int pcap_ng_sink_shb(struct pcap_ng_if_table *t, u_char *buf);
+extern int pcap_ng_sink_blocks(pcap_t *p, struct pcap_ng_if_table *t,
+    u_char *buf, const struct pcap_pkthdr *h, const u_char *sp);
 
 #ifdef __APPLE__
 struct block_cursor;
@@ -400,7 +400,17 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	struct pcap_sf_patched_pkthdr sf_hdr;
 	FILE *fp = p->rfile;
 	size_t amt_read;
-	bpf_u_int32 t;
+	bpf_u_int32 t, caplen;
+	int status;
+	off_t offset = 0;
+
+	/*
+	 * If we're following a file that's still being written, and
+	 * run out part way through a record, we go back to its start
+	 * to read it again once there's more.
+	 */
+	if (p->sf_follow != NULL)
+		offset = ftello(fp);
 
 	/*
 	 * Read the packet header; the structure we use as a buffer
@@ -408,15 +418,25 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	 * libpcap, but if the file has the magic number for an
 	 * unpatched libpcap we only read as many bytes as the regular
 	 * header has.
+	 *
+	 * In memory, the header's only consumed along with the data,
+	 * once that's all there.
 	 */
-	amt_read = fread(&sf_hdr, 1, ps->hdrsize, fp);
-	if (amt_read != ps->hdrsize) {
+	if (p->sf_mem != NULL) {
+		status = sf_mem_have(p, ps->hdrsize);
+		if (status <= 0)
+			return (status == 0 ? 1 : -1);
+		sf_mem_peek(p, &sf_hdr, ps->hdrsize);
+	} else if ((amt_read = fread(&sf_hdr, 1, ps->hdrsize, fp)) !=
+	    ps->hdrsize) {
 		if (ferror(fp)) {
 			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
 			    "error reading dump file: %s",
 			    pcap_strerror(errno));
 			return (-1);
 		} else {
+			if (amt_read != 0 && sf_following(p))
+				return (sf_follow_rewind(p, offset));
 			if (amt_read != 0) {
 				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
 				    "truncated dump file; tried to read %lu header bytes, only got %lu",
@@ -493,7 +513,30 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 		break;
 	}
 
-	if (hdr->caplen > p->bufsize) {
+	if (p->sf_mem != NULL) {
+		if (hdr->caplen > p->bufsize && hdr->caplen > 65535) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "bogus savefile header");
+			return (-1);
+		}
+		status = sf_mem_have(p, ps->hdrsize + hdr->caplen);
+		if (status <= 0)
+			return (status == 0 ? 1 : -1);
+		(void)sf_mem_get(p, ps->hdrsize, NULL, 1);
+
+		/*
+		 * Hand out the data where it is, unless it has to be
+		 * byte-swapped or is split between buffers; as with a
+		 * file, we keep no more than p->bufsize bytes of it.
+		 */
+		caplen = hdr->caplen;
+		if (hdr->caplen > p->bufsize)
+			hdr->caplen = p->bufsize;
+		*data = sf_mem_get(p, hdr->caplen, p->buffer,
+		    p->swapped ? 0 : 1);
+		if (caplen > hdr->caplen)
+			(void)sf_mem_get(p, caplen - hdr->caplen, NULL, 1);
+	} else if (hdr->caplen > p->bufsize) {
 		/*
 		 * This can happen due to Solaris 2.3 systems tripping
 		 * over the BUFMOD problem and not setting the snapshot
@@ -527,6 +570,8 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
 				    "error reading dump file: %s",
 				    pcap_strerror(errno));
+			} else if (sf_following(p)) {
+				return (sf_follow_rewind(p, offset));
 			} else {
 				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
 				    "truncated dump file; tried to read %u captured bytes, only got %lu",
@@ -544,6 +589,7 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 		 */
 		hdr->caplen = p->bufsize;
 		memcpy(p->buffer, (char *)tp, p->bufsize);
+		*data = p->buffer;
 	} else {
 		/* read the packet itself */
 		amt_read = fread(p->buffer, 1, hdr->caplen, fp);
@@ -552,6 +598,8 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
 				    "error reading dump file: %s",
 				    pcap_strerror(errno));
+			} else if (sf_following(p)) {
+				return (sf_follow_rewind(p, offset));
 			} else {
 				snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
 				    "truncated dump file; tried to read %u captured bytes, only got %lu",
@@ -559,8 +607,8 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 			}
 			return (-1);
 		}
+		*data = p->buffer;
 	}
-	*data = p->buffer;
 
 	if (p->swapped) {
 		/*
@@ -583,20 +631,26 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	return (0);
 }
 
+void
+sf_fill_header(pcap_t *p, struct pcap_file_header *hdr, int linktype,
+    int thiszone, int snaplen)
+{
+	hdr->magic = p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ? NSEC_TCPDUMP_MAGIC : TCPDUMP_MAGIC;
+	hdr->version_major = PCAP_VERSION_MAJOR;
+	hdr->version_minor = PCAP_VERSION_MINOR;
+
+	hdr->thiszone = thiszone;
+	hdr->snaplen = snaplen;
+	hdr->sigfigs = 0;
+	hdr->linktype = linktype;
+}
+
 static int
 sf_write_header(pcap_t *p, FILE *fp, int linktype, int thiszone, int snaplen)
 {
 	struct pcap_file_header hdr;
 
-	hdr.magic = p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ? NSEC_TCPDUMP_MAGIC : TCPDUMP_MAGIC;
-	hdr.version_major = PCAP_VERSION_MAJOR;
-	hdr.version_minor = PCAP_VERSION_MINOR;
-
-	hdr.thiszone = thiszone;
-	hdr.snaplen = snaplen;
-	hdr.sigfigs = 0;
-	hdr.linktype = linktype;
-
+	sf_fill_header(p, &hdr, linktype, thiszone, snaplen);
 	if (fwrite((char *)&hdr, sizeof(hdr), 1, fp) != 1)
 		return (-1);
 
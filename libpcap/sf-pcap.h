@@ -33,5 +33,7 @@
 
 extern pcap_t *pcap_check_header(bpf_u_int32 magic, FILE *fp,
     u_int precision, char *errbuf, int *err, int isng);
+extern void sf_fill_header(pcap_t *p, struct pcap_file_header *hdr,
+    int linktype, int thiszone, int snaplen);
 
 #endif
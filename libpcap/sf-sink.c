@@ -0,0 +1,241 @@
+/*
+ * sf-sink.c - write a savefile through a callback rather than to a
+ * stdio stream.
+ *
+ * Records are put, fully formed, into one buffer, and the buffer is
+ * handed to the callback when the next record won't fit in it, or when
+ * the sink's flushed or closed; the callback can hand the sink another
+ * buffer to carry on with, so that a caller with a pool of buffers can
+ * send each one off without copying it.  Nothing goes through stdio.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_SYS_BITYPES_H
+#include <sys/bitypes.h>
+#endif
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "pcap-common.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "sf-pcap.h"
+#include "sf-pcap-ng.h"
+
+#define SINK_DEFAULT_SIZE	(1024*1024)
+
+struct pcap_sink {
+	pcap_t		*p;
+	pcap_sink_write_t write;
+	void		*arg;
+	int		flags;
+	u_char		*buf;		/* buffer being filled */
+	size_t		size;		/* its size */
+	size_t		len;		/* bytes in it */
+	u_char		*ours;		/* buffer we allocated, if any */
+	int		failed;		/* we've had an error, and given up */
+	struct pcap_ng_if_table ng_ifs;	/* interfaces described so far */
+	char		errbuf[PCAP_ERRBUF_SIZE];
+};
+
+/*
+ * The most a record for a packet of "caplen" bytes can take up.
+ */
+static size_t
+sink_maxlen(pcap_sink_t *s, bpf_u_int32 caplen)
+{
+	if (s->flags & PCAP_SINK_PCAPNG)
+		return (pcap_ng_sink_maxlen(caplen));
+	return (sizeof(struct pcap_sf_pkthdr) + caplen);
+}
+
+pcap_sink_t *
+pcap_sink_open(pcap_t *p, pcap_sink_write_t write, void *arg, u_char *buf,
+    size_t size, int flags)
+{
+	struct pcap_sink *s;
+	struct pcap_file_header hdr;
+	size_t minsize;
+	int linktype;
+
+	if (!p->activated) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_sink_open");
+		return (NULL);
+	}
+	s = calloc(1, sizeof(*s));
+	if (s == NULL) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+		    pcap_strerror(errno));
+		return (NULL);
+	}
+	s->p = p;
+	s->write = write;
+	s->arg = arg;
+	s->flags = flags;
+	minsize = sink_maxlen(s, p->snapshot);
+	if (size == 0)
+		size = SINK_DEFAULT_SIZE;
+	if (size < minsize) {
+		snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "sink buffer of %lu bytes can't hold a packet of the snapshot length; it must be at least %lu bytes",
+		    (unsigned long)size, (unsigned long)minsize);
+		free(s);
+		return (NULL);
+	}
+	if (buf == NULL) {
+		buf = s->ours = malloc(size);
+		if (buf == NULL) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "malloc: %s",
+			    pcap_strerror(errno));
+			free(s);
+			return (NULL);
+		}
+	}
+	s->buf = buf;
+	s->size = size;
+
+	/*
+	 * Start with the file header.
+	 */
+	if (flags & PCAP_SINK_PCAPNG)
+		s->len = pcap_ng_sink_shb(&s->ng_ifs, s->buf);
+	else {
+		linktype = dlt_to_linktype(p->linktype);
+		if (linktype == -1) {
+			snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "link-layer type %d isn't supported in savefiles",
+			    p->linktype);
+			free(s->ours);
+			free(s);
+			return (NULL);
+		}
+		linktype |= p->linktype_ext;
+		sf_fill_header(p, &hdr, linktype, p->tzoff, p->snapshot);
+		memcpy(s->buf, &hdr, sizeof(hdr));
+		s->len = sizeof(hdr);
+	}
+	return (s);
+}
+
+void
+pcap_sink_set_buffer(pcap_sink_t *s, u_char *buf, size_t size)
+{
+	s->buf = buf;
+	s->size = size;
+}
+
+int
+pcap_sink_flush(pcap_sink_t *s)
+{
+	size_t len;
+
+	if (s->failed)
+		return (-1);
+	if (s->len == 0)
+		return (0);
+	len = s->len;
+	s->len = 0;
+	if ((*s->write)(s, s->arg, s->buf, len) == -1) {
+		snprintf(s->errbuf, PCAP_ERRBUF_SIZE,
+		    "sink write callback failed: %s", pcap_strerror(errno));
+		s->failed = 1;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Get room for "len" bytes at the end of the buffer, handing the buffer
+ * to the callback first if we have to; returns null if the sink has
+ * failed.
+ */
+u_char *
+pcap_sink_reserve(pcap_sink_t *s, size_t len)
+{
+	if (s->failed)
+		return (NULL);
+	if (len > s->size - s->len) {
+		if (pcap_sink_flush(s) == -1)
+			return (NULL);
+		if (len > s->size) {
+			snprintf(s->errbuf, PCAP_ERRBUF_SIZE,
+			    "record of %lu bytes won't fit in the sink buffer",
+			    (unsigned long)len);
+			s->failed = 1;
+			return (NULL);
+		}
+	}
+	return (s->buf + s->len);
+}
+
+void
+pcap_sink_commit(pcap_sink_t *s, size_t len)
+{
+	s->len += len;
+}
+
+void
+pcap_sink_dump(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	pcap_sink_t *s = (pcap_sink_t *)user;
+	struct pcap_sf_pkthdr sf_hdr;
+	u_char *cp;
+	int len;
+
+	cp = pcap_sink_reserve(s, sink_maxlen(s, h->caplen));
+	if (cp == NULL)
+		return;
+	if (s->flags & PCAP_SINK_PCAPNG) {
+		len = pcap_ng_sink_blocks(s->p, &s->ng_ifs, cp, h, sp);
+		if (len == -1) {
+			snprintf(s->errbuf, PCAP_ERRBUF_SIZE, "%s",
+			    pcap_geterr(s->p));
+			s->failed = 1;
+			return;
+		}
+	} else {
+		sf_hdr.ts.tv_sec = h->ts.tv_sec;
+		sf_hdr.ts.tv_usec = h->ts.tv_usec;
+		sf_hdr.caplen = h->caplen;
+		sf_hdr.len = h->len;
+		memcpy(cp, &sf_hdr, sizeof(sf_hdr));
+		memcpy(cp + sizeof(sf_hdr), sp, h->caplen);
+		len = sizeof(sf_hdr) + h->caplen;
+	}
+	pcap_sink_commit(s, len);
+}
+
+char *
+pcap_sink_geterr(pcap_sink_t *s)
+{
+	return (s->errbuf);
+}
+
+int
+pcap_sink_close(pcap_sink_t *s)
+{
+	int status;
+
+	status = pcap_sink_flush(s);
+	free(s->ng_ifs.ids);
+	free(s->ours);
+	free(s);
+	return (status);
+}
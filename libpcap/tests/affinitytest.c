@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#define _GNU_SOURCE		/* for sched_getaffinity() and CPU_ macros */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/*
+ * Activate handles pinned to CPUs and NUMA nodes, and check that the
+ * activating thread gets its own CPU affinity back afterwards, whether
+ * or not the activation works, that pcap_get_cpu() reports the CPU a
+ * handle was pinned to, that reading from the handle pins the reader
+ * there, and that a fanout group's CPUs are handed out afresh once
+ * all its members are closed.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+
+static char *program_name;
+static char *device;
+static cpu_set_t original;
+static int failures;
+
+/* Forwards */
+static pcap_t *activate(const char *, int, int, int, int);
+static void check_affinity(const char *);
+static void discard(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	pcap_t *pd, *members[2];
+	char ebuf[PCAP_ERRBUF_SIZE];
+	cpu_set_t now;
+	int cpu, i, first;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "i:")) != -1) {
+		switch (op) {
+
+		case 'i':
+			device = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL)
+		usage();
+
+	if (sched_getaffinity(0, sizeof(original), &original) == -1)
+		error("sched_getaffinity failed");
+
+	/*
+	 * Pin to the last CPU we may run on; with more than one, that
+	 * changes our affinity, if only while activating.
+	 */
+	for (cpu = CPU_SETSIZE - 1; !CPU_ISSET(cpu, &original); cpu--)
+		;
+	pd = activate("one CPU", cpu, PCAP_NUMA_NODE_NONE, -1, 1);
+	if (pcap_get_cpu(pd) != cpu) {
+		printf("one CPU: pcap_get_cpu() returned %d, not %d\n",
+		    pcap_get_cpu(pd), cpu);
+		failures++;
+	}
+
+	/*
+	 * Reading from it pins us to that CPU.
+	 */
+	if (pcap_setnonblock(pd, 1, ebuf) == -1)
+		error("%s", ebuf);
+	if (pcap_dispatch(pd, 1, discard, NULL) < 0)
+		error("one CPU: %s", pcap_geterr(pd));
+	if (sched_getaffinity(0, sizeof(now), &now) == -1)
+		error("sched_getaffinity failed");
+	if (CPU_COUNT(&now) != 1 || !CPU_ISSET(cpu, &now)) {
+		printf("one CPU: reader left on %d CPUs\n", CPU_COUNT(&now));
+		failures++;
+	}
+	if (sched_setaffinity(0, sizeof(original), &original) == -1)
+		error("sched_setaffinity failed");
+	pcap_close(pd);
+
+	/*
+	 * The CPUs of node 0, which every NUMA system has, and, for
+	 * members of a fanout group, one each of them.
+	 */
+	pd = activate("node 0", PCAP_CPU_NODE, 0, -1, 1);
+	pcap_close(pd);
+	for (i = 0; i < 2; i++)
+		members[i] = activate("fanout member", PCAP_CPU_NODE, 0,
+		    4242, 1);
+	printf("fanout members on CPUs %d and %d\n", pcap_get_cpu(members[0]),
+	    pcap_get_cpu(members[1]));
+	first = pcap_get_cpu(members[0]);
+	for (i = 0; i < 2; i++) {
+		if (pcap_get_cpu(members[i]) < 0) {
+			printf("fanout member %d wasn't pinned to a CPU\n", i);
+			failures++;
+		}
+		pcap_close(members[i]);
+	}
+
+	/*
+	 * With the group's members all closed, a new member starts
+	 * over on the first CPU.
+	 */
+	pd = activate("new fanout member", PCAP_CPU_NODE, 0, 4242, 1);
+	if (pcap_get_cpu(pd) != first) {
+		printf("new fanout member on CPU %d, not %d\n",
+		    pcap_get_cpu(pd), first);
+		failures++;
+	}
+	pcap_close(pd);
+
+	/*
+	 * A node that can't exist; that's only found to be wrong after
+	 * we've been pinned to the CPU.
+	 */
+	(void)activate("bad node", cpu, 1000000, -1, 0);
+
+	if (failures != 0)
+		error("%d failures", failures);
+	printf("affinity restored every time\n");
+	exit(0);
+}
+
+/*
+ * Create and activate a handle with the given placement, check that
+ * it worked or failed as expected, and check our affinity afterwards.
+ */
+static pcap_t *
+activate(const char *what, int cpu, int node, int group, int should_work)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+	int status;
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_cpu_affinity(pd, cpu) != 0 ||
+	    pcap_set_numa_node(pd, node) != 0 ||
+	    (group >= 0 && pcap_set_fanout(pd, group, PCAP_FANOUT_HASH) != 0))
+		error("%s: %s", what, pcap_geterr(pd));
+	status = pcap_activate(pd);
+	if (should_work && status < 0)
+		error("%s: %s", what, pcap_geterr(pd));
+	if (!should_work && status >= 0)
+		error("%s: activation worked", what);
+	check_affinity(what);
+	if (status < 0) {
+		pcap_close(pd);
+		return (NULL);
+	}
+	return (pd);
+}
+
+static void
+check_affinity(const char *what)
+{
+	cpu_set_t now;
+
+	if (sched_getaffinity(0, sizeof(now), &now) == -1)
+		error("sched_getaffinity failed");
+	if (!CPU_EQUAL(&now, &original)) {
+		printf("%s: affinity left at %d CPUs, was %d\n", what,
+		    CPU_COUNT(&now), CPU_COUNT(&original));
+		failures++;
+	}
+}
+
+static void
+discard(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr, "Usage: %s -i interface\n", program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+#else /* __linux__ */
+int
+main(int argc, char **argv)
+{
+	printf("CPU affinity isn't set on this platform\n");
+	exit(0);
+}
+#endif /* __linux__ */
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static char *copy_argv(char **);
+static double now(void);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static const u_char **pkts;
+static u_int *wirelens, *buflens;
+static u_int npkts, maxpkts;
+
+static void
+add_packet(const u_char *data, u_int caplen, u_int len)
+{
+	u_char *copy;
+
+	if (npkts == maxpkts) {
+		maxpkts = maxpkts == 0 ? 1024 : 2 * maxpkts;
+		pkts = realloc(pkts, maxpkts * sizeof(*pkts));
+		wirelens = realloc(wirelens, maxpkts * sizeof(*wirelens));
+		buflens = realloc(buflens, maxpkts * sizeof(*buflens));
+		if (pkts == NULL || wirelens == NULL || buflens == NULL)
+			error("out of memory");
+	}
+	copy = malloc(caplen != 0 ? caplen : 1);
+	if (copy == NULL)
+		error("out of memory");
+	memcpy(copy, data, caplen);
+	pkts[npkts] = copy;
+	buflens[npkts] = caplen;
+	wirelens[npkts] = len;
+	npkts++;
+}
+
+/*
+ * Run a filter over the packets of a savefile, or over random packets,
+ * with bpf_filter_batch(), and check that it gets the same answers as
+ * bpf_filter() does; with -t, time both.  The random packets are short,
+ * so that loads near and off the ends of packets get exercised.
+ */
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *file, *cmdbuf;
+	pcap_t *pd;
+	struct bpf_program fcode;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	u_char buf[128];
+	u_int *expected, *got;
+	u_int i, j, nrandom, maxlen, rounds, accepted, nexpected;
+	int timing, status;
+	double t, best_one, best_batch;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	file = NULL;
+	nrandom = 0;
+	maxlen = 80;
+	rounds = 20;
+	timing = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "l:n:R:r:t")) != -1) {
+		switch (op) {
+
+		case 'l':
+			maxlen = atoi(optarg);
+			if (maxlen > sizeof(buf))
+				maxlen = sizeof(buf);
+			break;
+
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+
+		case 'R':
+			nrandom = atoi(optarg);
+			break;
+
+		case 'r':
+			file = optarg;
+			break;
+
+		case 't':
+			timing = 1;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if ((file == NULL) == (nrandom == 0) || optind >= argc)
+		usage();
+	cmdbuf = copy_argv(&argv[optind]);
+
+	if (file != NULL) {
+		pd = pcap_open_offline(file, ebuf);
+		if (pd == NULL)
+			error("%s", ebuf);
+		while ((status = pcap_next_ex(pd, &h, &data)) == 1)
+			add_packet(data, h->caplen, h->len);
+		if (status == -1)
+			error("%s", pcap_geterr(pd));
+	} else {
+		pd = pcap_open_dead(DLT_EN10MB, 65535);
+		if (pd == NULL)
+			error("can't open a dead handle");
+		srandom(1);
+		for (i = 0; i < nrandom; i++) {
+			/*
+			 * Mostly IPv4, so that filters get some way in.
+			 */
+			for (j = 0; j < sizeof(buf); j++)
+				buf[j] = random() & (random() & 1 ? 0xff : 0x1f);
+			if (random() % 4 != 0) {
+				buf[12] = 0x08;
+				buf[13] = 0x00;
+				buf[14] = 0x45;
+			}
+			j = random() % (maxlen + 1);
+			add_packet(buf, j, j + random() % 100);
+		}
+	}
+	if (pcap_compile(pd, &fcode, cmdbuf, 1, 0) < 0)
+		error("%s", pcap_geterr(pd));
+
+	expected = malloc(npkts * sizeof(*expected));
+	got = malloc(npkts * sizeof(*got));
+	if (expected == NULL || got == NULL)
+		error("out of memory");
+	nexpected = 0;
+	for (i = 0; i < npkts; i++) {
+		expected[i] = bpf_filter(fcode.bf_insns, pkts[i], wirelens[i],
+		    buflens[i]);
+		if (expected[i] != 0)
+			nexpected++;
+	}
+	accepted = bpf_filter_batch(fcode.bf_insns, pkts, wirelens, buflens,
+	    got, npkts);
+	for (i = 0; i < npkts; i++) {
+		if (got[i] != expected[i])
+			error("packet %u: bpf_filter_batch() returned %u, bpf_filter() %u",
+			    i, got[i], expected[i]);
+	}
+	if (accepted != nexpected)
+		error("bpf_filter_batch() accepted %u packets, bpf_filter() %u",
+		    accepted, nexpected);
+	printf("%u of %u packets accepted\n", accepted, npkts);
+
+	if (timing) {
+		/*
+		 * Best of "rounds" runs over all the packets.
+		 */
+		best_one = best_batch = 0;
+		for (j = 0; j < rounds; j++) {
+			t = now();
+			for (i = 0; i < npkts; i++)
+				expected[i] = bpf_filter(fcode.bf_insns,
+				    pkts[i], wirelens[i], buflens[i]);
+			t = now() - t;
+			if (j == 0 || t < best_one)
+				best_one = t;
+			t = now();
+			(void)bpf_filter_batch(fcode.bf_insns, pkts, wirelens,
+			    buflens, got, npkts);
+			t = now() - t;
+			if (j == 0 || t < best_batch)
+				best_batch = t;
+		}
+		printf("one at a time: %.1f ns per packet; batched: %.1f ns per packet\n",
+		    best_one * 1e9 / npkts, best_batch * 1e9 / npkts);
+	}
+	pcap_freecode(&fcode);
+	pcap_close(pd);
+	exit(0);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/*
+ * Copy arg vector into a new buffer, concatenating arguments with spaces.
+ */
+static char *
+copy_argv(register char **argv)
+{
+	register char **p;
+	register u_int len = 0;
+	char *buf;
+	char *src, *dst;
+
+	p = argv;
+	if (*p == 0)
+		return 0;
+
+	while (*p)
+		len += strlen(*p++) + 1;
+
+	buf = (char *)malloc(len);
+	if (buf == NULL)
+		error("copy_argv: malloc");
+
+	p = argv;
+	dst = buf;
+	while ((src = *p++) != NULL) {
+		while ((*dst++ = *src++) != '\0')
+			;
+		dst[-1] = ' ';
+	}
+	dst[-1] = '\0';
+
+	return buf;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -t ] [ -n rounds ] { -r file | -R count [ -l maxlen ] } expression\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static u_int packets;
+static u_int vlan_tagged;
+static int verbose;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device, *rfile, *wfile;
+	pcap_t *pd;
+	pcap_block_writer_t *w;
+	pcap_dumper_t *dumper;
+	struct bpf_program fcode;
+	int count, status;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	rfile = NULL;
+	wfile = NULL;
+	count = -1;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:i:r:vw:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'r':
+			rfile = optarg;
+			break;
+
+		case 'v':
+			verbose++;
+			break;
+
+		case 'w':
+			wfile = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if ((device == NULL) == (rfile == NULL))
+		usage();
+
+	if (device != NULL) {
+		/*
+		 * Record whole blocks from the device to the file.
+		 */
+		if (wfile == NULL)
+			usage();
+		pd = pcap_create(device, ebuf);
+		if (pd == NULL)
+			error("%s", ebuf);
+		if (pcap_set_snaplen(pd, 65535) != 0 ||
+		    pcap_set_timeout(pd, 100) != 0)
+			error("%s", pcap_geterr(pd));
+		status = pcap_activate(pd);
+		if (status < 0)
+			error("%s: %s", device, pcap_geterr(pd));
+		if (optind < argc) {
+			if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+				error("%s", pcap_geterr(pd));
+			if (pcap_setfilter(pd, &fcode) < 0)
+				error("%s", pcap_geterr(pd));
+			pcap_freecode(&fcode);
+		}
+		w = pcap_block_writer_open(pd, wfile);
+		if (w == NULL)
+			error("%s", pcap_geterr(pd));
+		status = pcap_block_writer_loop(w, count);
+		if (status < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_block_writer_close(w) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_close(pd);
+		exit(0);
+	}
+
+	/*
+	 * Read a block file back, and, if asked to, convert it to
+	 * a pcap file.
+	 */
+	pd = pcap_open_offline(rfile, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+	if (wfile != NULL) {
+		dumper = pcap_dump_open(pd, wfile);
+		if (dumper == NULL)
+			error("%s", pcap_geterr(pd));
+		status = pcap_loop(pd, count, pcap_dump, (u_char *)dumper);
+		pcap_dump_close(dumper);
+	} else
+		status = pcap_loop(pd, count, countme, NULL);
+	if (status == -1)
+		error("%s", pcap_geterr(pd));
+	if (wfile == NULL)
+		printf("%u packets, %u with VLAN tags\n", packets,
+		    vlan_tagged);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	packets++;
+	if (h->caplen >= 16 && sp[12] == 0x81 && sp[13] == 0x00)
+		vlan_tagged++;
+	if (verbose)
+		printf("%ld.%06ld caplen %u len %u\n", (long)h->ts.tv_sec,
+		    (long)h->ts.tv_usec, h->caplen, h->len);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -c count ] -i interface -w blockfile [ expression ]\n",
+	    program_name);
+	(void)fprintf(stderr,
+	    "       %s [ -v ] [ -c count ] -r blockfile [ -w pcapfile ] [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void sumup(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void release(u_char *, const void *, size_t);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+struct sums {
+	u_int	packets;
+	u_int	bytes;
+	u_int	sum;
+};
+
+static void drain(pcap_t *, struct sums *);
+
+static pcap_t *pd;
+static u_char **chunks;
+static u_int nchunks;
+static u_int released;		/* chunks handed back so far */
+static int break_every;		/* pcap_breakloop() after this many packets */
+
+/*
+ * Read a savefile with pcap_open_offline(), and again, handed over in
+ * "chunk"-byte buffers, with pcap_open_offline_buffer(), and check that
+ * the same packets come out.  Buffers handed back by libpcap are
+ * scribbled on, so that the packets differ if they're looked at again,
+ * and must come back in order, each of them once.  With -k, the reads
+ * are broken off every "count" packets, leaving records read ahead
+ * with PCAP_SF_BATCH set in the environment to be handed out later.
+ */
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *fname;
+	FILE *fp;
+	struct stat st;
+	u_char *file;
+	struct bpf_program fcode;
+	struct sums fsums, bsums;
+	size_t chunk, off, n;
+	u_int i;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	chunk = 65536;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "b:k:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			chunk = atoi(optarg);
+			break;
+
+		case 'k':
+			break_every = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind >= argc || chunk == 0)
+		usage();
+	fname = argv[optind++];
+
+	/*
+	 * Read it from the file.
+	 */
+	memset(&fsums, 0, sizeof(fsums));
+	pd = pcap_open_offline(fname, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+	drain(pd, &fsums);
+	pcap_close(pd);
+
+	/*
+	 * Read it into memory, a chunk to a buffer.
+	 */
+	fp = fopen(fname, "r");
+	if (fp == NULL || fstat(fileno(fp), &st) == -1)
+		error("%s: can't open", fname);
+	file = malloc(st.st_size);
+	if (file == NULL || fread(file, 1, st.st_size, fp) != (size_t)st.st_size)
+		error("%s: can't read", fname);
+	fclose(fp);
+	nchunks = (st.st_size + chunk - 1) / chunk;
+	chunks = malloc(nchunks * sizeof(*chunks));
+	if (chunks == NULL)
+		error("out of memory");
+	for (i = 0, off = 0; i < nchunks; i++, off += n) {
+		n = st.st_size - off < chunk ? st.st_size - off : chunk;
+		chunks[i] = malloc(n);
+		if (chunks[i] == NULL)
+			error("out of memory");
+		memcpy(chunks[i], file + off, n);
+	}
+
+	/*
+	 * Hand it over a buffer at a time, reading what we can after
+	 * each one.
+	 */
+	memset(&bsums, 0, sizeof(bsums));
+	pd = pcap_open_offline_buffer(chunks[0],
+	    st.st_size < chunk ? st.st_size : chunk, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_offline_buffer_set_release(pd, release, NULL) == -1)
+		error("%s", pcap_geterr(pd));
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+	for (i = 1, off = chunk; i <= nchunks; i++, off += chunk) {
+		drain(pd, &bsums);
+		if (i < nchunks) {
+			n = st.st_size - off < chunk ? st.st_size - off : chunk;
+			if (pcap_offline_buffer_append(pd, chunks[i], n) == -1)
+				error("%s", pcap_geterr(pd));
+		} else {
+			if (pcap_offline_buffer_append(pd, NULL, 0) == -1)
+				error("%s", pcap_geterr(pd));
+			drain(pd, &bsums);
+		}
+	}
+	pcap_close(pd);
+	if (released != nchunks)
+		error("%u of %u buffers handed back", released, nchunks);
+
+	printf("file: %u packets, %u bytes, sum %08x\n", fsums.packets,
+	    fsums.bytes, fsums.sum);
+	printf("buffers of %lu: %u packets, %u bytes, sum %08x\n",
+	    (unsigned long)chunk, bsums.packets, bsums.bytes, bsums.sum);
+	if (memcmp(&fsums, &bsums, sizeof(fsums)) != 0)
+		error("the packets differ");
+	exit(0);
+}
+
+/*
+ * Read all that can be read from what's been handed over so far.
+ */
+static void
+drain(pcap_t *p, struct sums *s)
+{
+	int status;
+
+	while ((status = pcap_dispatch(p, -1, sumup, (u_char *)s)) != 0) {
+		if (status == -1)
+			error("%s", pcap_geterr(p));
+	}
+}
+
+static void
+sumup(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct sums *s = (struct sums *)user;
+	u_int i;
+
+	s->packets++;
+	s->bytes += h->caplen;
+	s->sum = s->sum * 31 + h->ts.tv_sec + h->ts.tv_usec + h->len;
+	for (i = 0; i < h->caplen; i++)
+		s->sum = s->sum * 31 + sp[i];
+	if (break_every != 0 && s->packets % break_every == 0)
+		pcap_breakloop(pd);
+}
+
+static void
+release(u_char *user, const void *buf, size_t len)
+{
+	if (released >= nchunks || buf != chunks[released])
+		error("buffer %u handed back out of order", released);
+	memset(chunks[released], 0xa5, len);
+	released++;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -b chunk ] [ -k count ] file [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
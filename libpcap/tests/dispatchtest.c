@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void countme(u_char *, int, const struct pcap_pkthdr *, const u_char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static pcap_dispatcher_t *dispatcher;
+static int nworkers = 4;
+static int linktype;
+static int slow;
+static volatile u_int misplaced;	/* packets given to the wrong worker */
+static volatile u_int asymmetric;	/* packets reversing to another hash */
+static int per_interface;
+static volatile u_int unlabelled;	/* packets without their interface */
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp, *cmdbuf;
+	char *device, *infile;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+	struct bpf_program fcode;
+	struct pcap_worker_stat ws;
+	int i, qlen, count, status;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	infile = NULL;
+	qlen = 0;
+	count = -1;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:Ii:q:r:sw:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'I':
+			per_interface = 1;
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'q':
+			qlen = atoi(optarg);
+			break;
+
+		case 'r':
+			infile = optarg;
+			break;
+
+		case 's':
+			slow = 1;
+			break;
+
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if ((device == NULL) == (infile == NULL))
+		usage();
+
+	if (infile != NULL)
+		pd = pcap_open_offline(infile, ebuf);
+	else if (per_interface) {
+		pd = pcap_create(device, ebuf);
+		if (pd == NULL)
+			error("%s", ebuf);
+		if (pcap_set_snaplen(pd, 65535) != 0 ||
+		    pcap_set_timeout(pd, 100) != 0 ||
+		    pcap_set_per_interface(pd, 1) != 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_activate(pd) < 0)
+			error("%s: %s", device, pcap_geterr(pd));
+		per_interface = pcap_get_per_interface(pd);
+	} else
+		pd = pcap_open_live(device, 65535, 0, 100, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	linktype = pcap_datalink(pd);
+	if (optind < argc) {
+		cmdbuf = argv[optind];
+		if (pcap_compile(pd, &fcode, cmdbuf, 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+	}
+
+	dispatcher = pcap_dispatcher_create(pd, nworkers, qlen, countme,
+	    NULL, ebuf);
+	if (dispatcher == NULL)
+		error("%s", ebuf);
+	status = pcap_dispatcher_loop(dispatcher, count);
+	if (status == -1)
+		error("%s", pcap_geterr(pd));
+
+	/*
+	 * Let the workers finish before reporting what they did.
+	 */
+	for (i = 0; i < nworkers; i++) {
+		for (;;) {
+			pcap_dispatcher_stats(dispatcher, i, &ws);
+			if (ws.ws_depth == 0)
+				break;
+			usleep(1000);
+		}
+		printf("worker %d: %u queued, %u dropped, %u handled, max depth %u\n",
+		    i, ws.ws_queued, ws.ws_dropped, ws.ws_handled,
+		    ws.ws_max_depth);
+	}
+	printf("%u misplaced, %u asymmetric\n", misplaced, asymmetric);
+	if (per_interface)
+		printf("%u without their interface\n", unlabelled);
+	pcap_dispatcher_destroy(dispatcher);
+	pcap_close(pd);
+	exit(misplaced == 0 && asymmetric == 0 && unlabelled == 0 ? 0 : 1);
+}
+
+/*
+ * Check that the packet went to the worker its hash picks and, for
+ * untagged IPv4 over Ethernet, that the packet with its addresses
+ * and ports swapped hashes the same.  With -I, check that the worker
+ * was told which interface the packet came from.
+ */
+static void
+countme(u_char *user, int worker, const struct pcap_pkthdr *h,
+    const u_char *sp)
+{
+	u_char rev[54];
+	struct pcap_pkthdr rh;
+	u_int hash;
+	int hlen;
+
+	hash = pcap_flow_hash(dispatcher, h, sp);
+	if ((int)(((unsigned long long)hash * nworkers) >> 32) != worker)
+		misplaced++;
+
+	if (linktype == DLT_EN10MB && h->caplen >= sizeof(rev) &&
+	    sp[12] == 0x08 && sp[13] == 0x00 && (sp[14] & 0x0f) == 5) {
+		memcpy(rev, sp, sizeof(rev));
+		memcpy(rev + 26, sp + 30, 4);
+		memcpy(rev + 30, sp + 26, 4);
+		hlen = 14 + 20;
+		memcpy(rev + hlen, sp + hlen + 2, 2);
+		memcpy(rev + hlen + 2, sp + hlen, 2);
+		rh = *h;
+		rh.caplen = sizeof(rev);
+		if (pcap_flow_hash(dispatcher, &rh, rev) != hash)
+			asymmetric++;
+	}
+	if (per_interface &&
+	    ((const struct pcap_pkthdr_if *)h)->if_index <= 0)
+		unlabelled++;
+	if (slow)
+		usleep(100);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -s ] [ -I ] [ -w workers ] [ -q qlen ] [ -c count ] -i interface | -r file [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <pcap/namedb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void *lookup_thread(void *);
+static double now(void);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+struct name {
+	char	name[sizeof(((struct pcap_etherent *)0)->name)];
+	u_char	addr[6];
+};
+
+static struct name *names;
+static int nnames;
+static int bad;
+
+/*
+ * Read the ethers file with pcap_next_etherent(), and look each name
+ * in it up with pcap_ether_lookup(), from "threads" threads at once,
+ * checking that each gets the address of the first entry for it; then
+ * time looking up "count" of the names both ways.
+ */
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	FILE *fp;
+	struct pcap_etherent *ep;
+	pthread_t *tids;
+	int threads, count, i, j, found;
+	u_char addr[6];
+	double t0, scan, indexed;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	threads = 4;
+	count = 1000;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:t:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (threads <= 0 || count < 0)
+		usage();
+
+	fp = fopen(PCAP_ETHERS_FILE, "r");
+	if (fp == NULL)
+		error("can't open %s", PCAP_ETHERS_FILE);
+	while ((ep = pcap_next_etherent(fp)) != NULL) {
+		/*
+		 * Keep only the first entry for each name; that's
+		 * the one that's found.
+		 */
+		for (i = 0; i < nnames; i++)
+			if (strcmp(names[i].name, ep->name) == 0)
+				break;
+		if (i < nnames)
+			continue;
+		if ((nnames & (nnames - 1)) == 0) {
+			names = realloc(names,
+			    (nnames ? nnames * 2 : 1) * sizeof(*names));
+			if (names == NULL)
+				error("out of memory");
+		}
+		strcpy(names[nnames].name, ep->name);
+		memcpy(names[nnames].addr, ep->addr, 6);
+		nnames++;
+	}
+	if (nnames == 0)
+		error("no entries in %s", PCAP_ETHERS_FILE);
+
+	tids = malloc(threads * sizeof(*tids));
+	if (tids == NULL)
+		error("out of memory");
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tids[i], NULL, lookup_thread, NULL) != 0)
+			error("can't create a thread");
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+	if (pcap_ether_lookup("no.such.name.in.the.ethers.file", addr))
+		bad++;
+
+	/*
+	 * Going through the file for each name, as pcap_ether_hostton()
+	 * used to, and looking them up in the index.
+	 */
+	t0 = now();
+	for (i = 0; i < count; i++) {
+		rewind(fp);
+		j = (i * 7919) % nnames;
+		while ((ep = pcap_next_etherent(fp)) != NULL)
+			if (strcmp(ep->name, names[j].name) == 0)
+				break;
+	}
+	scan = now() - t0;
+	t0 = now();
+	for (i = 0, found = 0; i < count; i++)
+		found += pcap_ether_lookup(names[(i * 7919) % nnames].name,
+		    addr);
+	indexed = now() - t0;
+	fclose(fp);
+
+	printf("%d names, %d threads, %d wrong\n", nnames, threads, bad);
+	printf("%d lookups: %.3f s scanning, %.3f s indexed, %d found\n",
+	    count, scan, indexed, found);
+	if (bad != 0 || found != count)
+		error("lookups went wrong");
+	exit(0);
+}
+
+static void *
+lookup_thread(void *arg)
+{
+	u_char addr[6];
+	int i;
+
+	for (i = 0; i < nnames; i++) {
+		if (!pcap_ether_lookup(names[i].name, addr) ||
+		    memcmp(addr, names[i].addr, 6) != 0)
+			__sync_fetch_and_add(&bad, 1);
+	}
+	return (arg);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -c count ] [ -t threads ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/*
+ * Copy arg vector into a new buffer, concatenating arguments with spaces.
+ */
+static char *
+copy_argv(register char **argv)
+{
+	register char **p;
+	register u_int len = 0;
+	char *buf;
+	char *src, *dst;
+
+	p = argv;
+	if (*p == 0)
+		return 0;
+
+	while (*p)
+		len += strlen(*p++) + 1;
+
+	buf = (char *)malloc(len);
+	if (buf == NULL)
+		error("copy_argv: malloc");
+
+	p = argv;
+	dst = buf;
+	while ((src = *p++) != NULL) {
+		while ((*dst++ = *src++) != '\0')
+			;
+		dst[-1] = ' ';
+	}
+	dst[-1] = '\0';
+
+	return buf;
+}
+
+/*
+ * Print the path most packets took through the program: starting at
+ * the first instruction, follow whichever branch of each jump was taken
+ * more often, until we reach a return or an instruction nobody reached.
+ */
+static void
+print_hot_path(const struct bpf_program *fcode, const struct bpf_profile *prof)
+{
+	const struct bpf_insn *insn;
+	u_int i, t, f;
+	u_int64_t ticks = 0;
+
+	printf("\nhot path:\n");
+	i = 0;
+	while (i < fcode->bf_len && prof->bp_hits[i] != 0) {
+		insn = &fcode->bf_insns[i];
+		puts(bpf_image_profile(insn, i, prof));
+		ticks += prof->bp_cycles[i] / prof->bp_hits[i];
+		if (BPF_CLASS(insn->code) == BPF_RET)
+			break;
+		if (BPF_CLASS(insn->code) != BPF_JMP) {
+			i++;
+			continue;
+		}
+		if (BPF_OP(insn->code) == BPF_JA) {
+			i += 1 + insn->k;
+			continue;
+		}
+		t = i + 1 + insn->jt;
+		f = i + 1 + insn->jf;
+		if (t >= fcode->bf_len || f >= fcode->bf_len)
+			break;
+		i = 2 * prof->bp_taken[i] >= prof->bp_hits[i] ? t : f;
+	}
+	printf("about %llu ticks per packet along this path\n",
+	    (unsigned long long)ticks);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *cp;
+	int op;
+	int Oflag;
+	long count;
+	char *rfile;
+	bpf_u_int32 netmask = PCAP_NETMASK_UNKNOWN;
+	char *cmdbuf;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+	struct bpf_program fcode;
+	struct bpf_profile prof;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	int status;
+
+	Oflag = 1;
+	count = -1;
+	status = 0;
+	rfile = NULL;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:Or:")) != -1) {
+		switch (op) {
+
+		case 'c': {
+			char *end;
+
+			count = strtol(optarg, &end, 0);
+			if (optarg == end || *end != '\0' || count <= 0)
+				error("invalid packet count %s", optarg);
+			break;
+		}
+
+		case 'O':
+			Oflag = 0;
+			break;
+
+		case 'r':
+			rfile = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+
+	if (rfile == NULL) {
+		usage();
+		/* NOTREACHED */
+	}
+
+	cmdbuf = copy_argv(&argv[optind]);
+
+	pd = pcap_open_offline(rfile, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+
+	if (pcap_compile(pd, &fcode, cmdbuf ? cmdbuf : "", Oflag,
+	    netmask) < 0)
+		error("%s", pcap_geterr(pd));
+	if (bpf_profile_init(&prof, &fcode) < 0)
+		error("can't allocate profile");
+
+	while (count != 0 &&
+	    (status = pcap_next_ex(pd, &h, &data)) == 1) {
+		bpf_filter_profile(fcode.bf_insns, data, h->len, h->caplen,
+		    &prof);
+		if (count > 0)
+			count--;
+	}
+	if (count != 0 && status == -1)
+		error("%s", pcap_geterr(pd));
+
+	bpf_dump_profile(&fcode, &prof);
+	print_hot_path(&fcode, &prof);
+
+	bpf_profile_free(&prof);
+	pcap_freecode(&fcode);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [-O] [ -c count ] -r file [ expression ]\n",
+	    program_name);
+	exit(1);
+}
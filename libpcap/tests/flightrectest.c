@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static pcap_t *pd;
+static pcap_flightrec_t *fr;
+
+static void
+dump_now(int sig)
+{
+	pcap_flightrec_trigger(fr);
+}
+
+static void
+stop_now(int sig)
+{
+	pcap_breakloop(pd);
+}
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device, *pattern;
+	struct bpf_program fcode;
+	struct pcap_flightrec_stat fs;
+	int count, flags, per_interface, status, n;
+	u_int bytes, seconds;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	pattern = NULL;
+	count = -1;
+	bytes = 4*1024*1024;
+	seconds = 0;
+	flags = 0;
+	per_interface = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "b:c:i:nPt:w:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			bytes = atoi(optarg);
+			break;
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'n':
+			flags |= PCAP_FLIGHTREC_PCAPNG;
+			break;
+
+		case 'P':
+			per_interface = 1;
+			break;
+
+		case 't':
+			seconds = atoi(optarg);
+			break;
+
+		case 'w':
+			pattern = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL || pattern == NULL)
+		usage();
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(pd, 65535) != 0 ||
+	    pcap_set_timeout(pd, 100) != 0)
+		error("%s", pcap_geterr(pd));
+	if (per_interface && pcap_set_per_interface(pd, 1) != 0)
+		error("%s", pcap_geterr(pd));
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(pd));
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+
+	fr = pcap_flightrec_create(pd, bytes, seconds, ebuf);
+	if (fr == NULL)
+		error("%s", ebuf);
+	if (pcap_flightrec_set_trigger(fr, pattern, flags) == -1)
+		error("%s", pcap_flightrec_geterr(fr));
+
+	/*
+	 * SIGUSR1 dumps what's held, and carries on; SIGINT, or
+	 * capturing "count" packets, dumps what's held, and stops.
+	 */
+	signal(SIGUSR1, dump_now);
+	signal(SIGINT, stop_now);
+	n = 0;
+	for (;;) {
+		status = pcap_dispatch(pd, count < 0 ? -1 : count - n,
+		    pcap_flightrec_record, (u_char *)fr);
+		if (status == -1)
+			error("%s", pcap_geterr(pd));
+		if (status == -2)
+			break;
+		n += status;
+
+		/*
+		 * Write a bit of any dump that's been triggered, between
+		 * batches of packets.
+		 */
+		if (pcap_flightrec_poll(fr, 100) == -1)
+			error("%s", pcap_flightrec_geterr(fr));
+		if (count >= 0 && n >= count)
+			break;
+	}
+
+	if (pcap_datalink(pd) == DLT_PCAPNG &&
+	    !(flags & PCAP_FLIGHTREC_PCAPNG)) {
+		/*
+		 * Packets with link-layer types of their own can't go
+		 * in a pcap file.
+		 */
+		if (pcap_flightrec_dump(fr, "/dev/null", 0) != -1)
+			error("per-interface packets dumped to a pcap file");
+		printf("%s\n", pcap_flightrec_geterr(fr));
+		pcap_flightrec_destroy(fr);
+		pcap_close(pd);
+		exit(0);
+	}
+	pcap_flightrec_trigger(fr);
+	status = pcap_flightrec_service(fr);
+	if (status == -1)
+		error("%s", pcap_flightrec_geterr(fr));
+	pcap_flightrec_stats(fr, &fs);
+	printf("%d packets written; %u held in %u bytes, %u too big, %u lost\n",
+	    status, fs.fs_packets, fs.fs_bytes, fs.fs_too_big, fs.fs_lost);
+	pcap_flightrec_destroy(fr);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -nP ] [ -b bytes ] [ -t seconds ] [ -c count ] -i interface -w pattern [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
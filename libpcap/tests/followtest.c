@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void sumup(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void writer(FILE *, FILE *, size_t, int, const char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+struct sums {
+	u_int	packets;
+	u_int	bytes;
+	u_int	sum;
+};
+
+/*
+ * Copy a savefile to "file", "chunk" bytes at a time, so that records
+ * are split between writes, and then rename it, as a rotating writer
+ * would; meanwhile, follow "file" with pcap_offline_follow(), and check
+ * that the same packets come out as from reading the savefile itself.
+ * With -g, read it through a pcap_group_t, which should keep coming
+ * back to it until it's been renamed, without waiting for it.
+ */
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *source, *fname;
+	FILE *in, *out;
+	pcap_t *pd;
+	pcap_group_t *group;
+	struct bpf_program fcode;
+	struct sums ssums, fsums;
+	size_t chunk;
+	int delay, timeout, status, timeouts, grouped, exited;
+	pid_t pid;
+	char *buf;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	chunk = 1000;
+	delay = 1;
+	timeout = 100;
+	grouped = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "b:d:gt:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			chunk = atoi(optarg);
+			break;
+
+		case 'd':
+			delay = atoi(optarg);
+			break;
+
+		case 'g':
+			grouped = 1;
+			break;
+
+		case 't':
+			timeout = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind + 1 >= argc || chunk == 0)
+		usage();
+	source = argv[optind++];
+	fname = argv[optind++];
+
+	/*
+	 * Read the savefile itself.
+	 */
+	memset(&ssums, 0, sizeof(ssums));
+	pd = pcap_open_offline(source, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+	if (pcap_loop(pd, -1, sumup, (u_char *)&ssums) == -1)
+		error("%s", pcap_geterr(pd));
+	pcap_close(pd);
+
+	/*
+	 * Start the copy with the first chunk, which has to hold the
+	 * file header, so that we can open it.
+	 */
+	in = fopen(source, "r");
+	if (in == NULL)
+		error("%s: can't open", source);
+	out = fopen(fname, "w");
+	if (out == NULL)
+		error("%s: can't create", fname);
+	buf = malloc(chunk);
+	if (buf == NULL)
+		error("out of memory");
+	if (fwrite(buf, 1, fread(buf, 1, chunk, in), out) == 0 ||
+	    fflush(out) == EOF)
+		error("%s: can't write", fname);
+
+	memset(&fsums, 0, sizeof(fsums));
+	pd = pcap_open_offline(fname, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+	if (pcap_offline_follow(pd, 1, timeout) == -1)
+		error("%s", pcap_geterr(pd));
+
+	pid = fork();
+	if (pid == -1)
+		error("fork failed");
+	if (pid == 0) {
+		writer(in, out, chunk, delay, fname);
+		_exit(0);
+	}
+	fclose(in);
+	fclose(out);
+
+	/*
+	 * Read it as it's written; 0 means we timed out waiting for
+	 * more, and -2 that the file's been renamed
+	 * and read to the end.
+	 */
+	timeouts = 0;
+	if (grouped) {
+		/*
+		 * The group's loop returns once it's read all there
+		 * is so far; keep at it until the writer's done, and
+		 * then once more, to read the rest and see the rename.
+		 */
+		group = pcap_group_create(ebuf);
+		if (group == NULL)
+			error("%s", ebuf);
+		if (pcap_group_add(group, pd, sumup, (u_char *)&fsums) < 0)
+			error("%s", pcap_group_geterr(group));
+		if (pcap_getnonblock(pd, ebuf) != 1)
+			error("followed savefile isn't non-blocking in a group");
+		do {
+			exited = (waitpid(pid, NULL, WNOHANG) == pid);
+			if (pcap_group_loop(group, -1) == -1)
+				error("%s", pcap_group_geterr(group));
+			timeouts++;
+			if (!exited)
+				usleep(delay * 1000);
+		} while (!exited);
+		pcap_group_destroy(group);
+		if (pcap_getnonblock(pd, ebuf) != 0)
+			error("followed savefile left non-blocking");
+		if (pcap_dispatch(pd, -1, sumup, (u_char *)&fsums) != 0)
+			error("followed savefile not at the end");
+		pcap_close(pd);
+	} else {
+		while ((status = pcap_next_ex(pd, &h, &data)) >= 0) {
+			if (status == 0) {
+				timeouts++;
+				continue;
+			}
+			sumup((u_char *)&fsums, h, data);
+		}
+		if (status == -1)
+			error("%s", pcap_geterr(pd));
+		pcap_close(pd);
+		(void)waitpid(pid, NULL, 0);
+	}
+
+	printf("source: %u packets, %u bytes, sum %08x\n", ssums.packets,
+	    ssums.bytes, ssums.sum);
+	printf("followed in chunks of %lu: %u packets, %u bytes, sum %08x, %d timeouts\n",
+	    (unsigned long)chunk, fsums.packets, fsums.bytes, fsums.sum,
+	    timeouts);
+	if (memcmp(&ssums, &fsums, sizeof(ssums)) != 0)
+		error("the packets differ");
+	exit(0);
+}
+
+/*
+ * Copy the rest of the savefile, a chunk every "delay" milliseconds,
+ * and then move the file out of the way.
+ */
+static void
+writer(FILE *in, FILE *out, size_t chunk, int delay, const char *fname)
+{
+	char *buf, *old;
+	size_t n;
+
+	buf = malloc(chunk);
+	old = malloc(strlen(fname) + sizeof(".old"));
+	if (buf == NULL || old == NULL)
+		error("out of memory");
+	while ((n = fread(buf, 1, chunk, in)) != 0) {
+		if (fwrite(buf, 1, n, out) != n || fflush(out) == EOF)
+			error("%s: can't write", fname);
+		if (delay != 0)
+			usleep(delay * 1000);
+	}
+	fclose(out);
+	sprintf(old, "%s.old", fname);
+	if (rename(fname, old) == -1)
+		error("%s: can't rename", fname);
+}
+
+static void
+sumup(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct sums *s = (struct sums *)user;
+	u_int i;
+
+	s->packets++;
+	s->bytes += h->caplen;
+	s->sum = s->sum * 31 + h->ts.tv_sec + h->ts.tv_usec + h->len;
+	for (i = 0; i < h->caplen; i++)
+		s->sum = s->sum * 31 + sp[i];
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -g ] [ -b chunk ] [ -d delay ] [ -t timeout ] savefile file [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
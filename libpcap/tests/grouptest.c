@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#define MAXHANDLES	256
+
+static char *program_name;
+
+struct handle;
+
+/* Forwards */
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static pcap_t *open_halved(struct handle *, char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+struct handle {
+	char	*name;
+	pcap_t	*pd;
+	u_int	packets;
+	u_int	longest_run;	/* most packets in a row from this handle */
+	u_char	*file;		/* -m: the file, read into memory */
+	size_t	half;		/* where the second half starts */
+	size_t	len;
+};
+
+static struct handle handles[MAXHANDLES];
+static struct handle *last;
+static u_int run;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_group_t *group;
+	struct bpf_program fcode;
+	struct pcap_pkthdr h;
+	int i, nhandles, budget, count, status, halved;
+	u_int expected;
+	pcap_t *pd;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	group = pcap_group_create(ebuf);
+	if (group == NULL)
+		error("%s", ebuf);
+	nhandles = 0;
+	budget = 0;
+	count = -1;
+	opterr = 0;
+	halved = 0;
+	while ((op = getopt(argc, argv, "b:c:i:m:r:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			budget = atoi(optarg);
+			break;
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+		case 'm':
+		case 'r':
+			if (nhandles == MAXHANDLES)
+				error("too many handles");
+			handles[nhandles].name = optarg;
+			if (op == 'i')
+				handles[nhandles].pd = pcap_open_live(optarg,
+				    65535, 0, 100, ebuf);
+			else if (op == 'm') {
+				handles[nhandles].pd =
+				    open_halved(&handles[nhandles], ebuf);
+				halved = 1;
+			} else
+				handles[nhandles].pd = pcap_open_offline(optarg,
+				    ebuf);
+			if (handles[nhandles].pd == NULL)
+				error("%s", ebuf);
+			nhandles++;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (nhandles == 0)
+		usage();
+
+	for (i = 0; i < nhandles; i++) {
+		if (optind < argc) {
+			if (pcap_compile(handles[i].pd, &fcode, argv[optind],
+			    1, 0) < 0)
+				error("%s", pcap_geterr(handles[i].pd));
+			if (pcap_setfilter(handles[i].pd, &fcode) < 0)
+				error("%s", pcap_geterr(handles[i].pd));
+			pcap_freecode(&fcode);
+		}
+		if (pcap_group_add(group, handles[i].pd, countme,
+		    (u_char *)&handles[i]) < 0)
+			error("%s: %s", handles[i].name,
+			    pcap_group_geterr(group));
+	}
+	pcap_group_set_budget(group, budget);
+
+	status = pcap_group_loop(group, count);
+	if (status == -1)
+		error("%s", pcap_group_geterr(group));
+
+	if (halved) {
+		/*
+		 * The files read from memory have had only their first
+		 * halves so far; they should still be in the group,
+		 * waiting for the rest.
+		 */
+		for (i = 0; i < nhandles; i++) {
+			if (handles[i].file == NULL)
+				continue;
+			if (pcap_offline_buffer_append(handles[i].pd,
+			    handles[i].file + handles[i].half,
+			    handles[i].len - handles[i].half) == -1 ||
+			    pcap_offline_buffer_append(handles[i].pd,
+			    NULL, 0) == -1)
+				error("%s: %s", handles[i].name,
+				    pcap_geterr(handles[i].pd));
+		}
+		status = pcap_group_loop(group, count);
+		if (status == -1)
+			error("%s", pcap_group_geterr(group));
+		if (count < 0) {
+			for (i = 0; i < nhandles; i++) {
+				if (handles[i].file == NULL)
+					continue;
+				pd = pcap_open_offline(handles[i].name, ebuf);
+				if (pd == NULL)
+					error("%s", ebuf);
+				expected = 0;
+				while (pcap_next(pd, &h) != NULL)
+					expected++;
+				pcap_close(pd);
+				if (handles[i].packets != expected)
+					error("%s: %u packets read from memory, expected %u",
+					    handles[i].name,
+					    handles[i].packets, expected);
+			}
+		}
+	}
+
+	for (i = 0; i < nhandles; i++)
+		printf("%s: %u packets, at most %u in a row\n",
+		    handles[i].name, handles[i].packets,
+		    handles[i].longest_run);
+	pcap_group_destroy(group);
+	for (i = 0; i < nhandles; i++) {
+		pcap_close(handles[i].pd);
+		free(handles[i].file);
+	}
+	exit(status == 0 ? 0 : 1);
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct handle *hp = (struct handle *)user;
+
+	if (hp != last) {
+		last = hp;
+		run = 0;
+	}
+	if (++run > hp->longest_run)
+		hp->longest_run = run;
+	hp->packets++;
+}
+
+/*
+ * Read a savefile into memory, and open it with only its first half
+ * handed over.
+ */
+static pcap_t *
+open_halved(struct handle *hp, char *ebuf)
+{
+	FILE *fp;
+	long len;
+	pcap_t *pd;
+
+	fp = fopen(hp->name, "r");
+	if (fp == NULL || fseek(fp, 0, SEEK_END) == -1 ||
+	    (len = ftell(fp)) == -1)
+		error("%s: %s", hp->name, strerror(errno));
+	rewind(fp);
+	hp->len = len;
+	hp->file = malloc(hp->len);
+	if (hp->file == NULL)
+		error("out of memory");
+	if (fread(hp->file, 1, hp->len, fp) != hp->len)
+		error("%s: short read", hp->name);
+	fclose(fp);
+	hp->half = hp->len / 2;
+	pd = pcap_open_offline_buffer(hp->file, hp->half, ebuf);
+	if (pd == NULL)
+		error("%s: %s", hp->name, ebuf);
+	return (pd);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -b budget ] [ -c count ] { -i interface | -r file | -m file } ... [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
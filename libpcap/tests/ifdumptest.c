@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void setfilter_if(char *);
+static void dumpme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void check_file(const char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+#define MAX_WFILES	4
+
+static pcap_t *pd;
+static pcap_dumper_t *dumpers[MAX_WFILES];
+static int n_wfiles;
+static u_int packets;
+static u_int outbound;
+static int verbose;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device, *wfiles[MAX_WFILES];
+	char *if_filters[16];
+	int n_if_filters, i, count, status;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = "any";
+	count = -1;
+	n_if_filters = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:F:i:vw:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'F':
+			if (n_if_filters == 16)
+				error("too many interface filters");
+			if_filters[n_if_filters++] = optarg;
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'v':
+			verbose++;
+			break;
+
+		case 'w':
+			if (n_wfiles == MAX_WFILES)
+				error("too many files to write");
+			wfiles[n_wfiles++] = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(pd, 65535) != 0 ||
+	    pcap_set_timeout(pd, 100) != 0 ||
+	    pcap_set_per_interface(pd, 1) != 0)
+		error("%s", pcap_geterr(pd));
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(pd));
+	if (pcap_get_per_interface(pd) != 1)
+		error("%s: per-interface mode isn't supported", device);
+	for (i = 0; i < n_if_filters; i++)
+		setfilter_if(if_filters[i]);
+	for (i = 0; i < n_wfiles; i++) {
+		dumpers[i] = pcap_ng_dump_if_open(pd, wfiles[i]);
+		if (dumpers[i] == NULL)
+			error("%s", pcap_geterr(pd));
+	}
+	status = pcap_loop(pd, count, dumpme, NULL);
+	if (status == -1)
+		error("%s", pcap_geterr(pd));
+	for (i = 0; i < n_wfiles; i++)
+		pcap_ng_dump_if_close(pd, dumpers[i]);
+	printf("%u packets, %u outbound\n", packets, outbound);
+	pcap_close(pd);
+
+	/*
+	 * Each file must describe every interface its packets came
+	 * from, whatever was written to the others.
+	 */
+	for (i = 0; i < n_wfiles; i++)
+		check_file(wfiles[i]);
+	exit(0);
+}
+
+static void
+check_file(const char *fname)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *rd;
+	u_int n = 0;
+
+	if (strcmp(fname, "-") == 0)
+		return;
+	rd = pcap_open_offline(fname, ebuf);
+	if (rd == NULL)
+		error("%s", ebuf);
+	if (pcap_loop(rd, -1, countme, (u_char *)&n) == -1)
+		error("%s: %s", fname, pcap_geterr(rd));
+	pcap_close(rd);
+	if (n != packets)
+		error("%s: read back %u packets, not %u", fname, n, packets);
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	(*(u_int *)user)++;
+}
+
+/*
+ * Set the filter for an interface from "ifname=expression", with
+ * "default" as the name for the default filter, and a number taken
+ * as an interface index; only Ethernet interfaces are supported.
+ */
+static void
+setfilter_if(char *arg)
+{
+	struct bpf_program fcode;
+	char *expr;
+	int status;
+
+	expr = strchr(arg, '=');
+	if (expr == NULL)
+		usage();
+	*expr++ = '\0';
+	if (pcap_compile_nopcap(65535, DLT_EN10MB, &fcode, expr, 1,
+	    PCAP_NETMASK_UNKNOWN) < 0)
+		error("can't compile filter for %s: %s", arg, expr);
+	if (strcmp(arg, "default") == 0)
+		status = pcap_setfilter_if(pd, PCAP_IF_FILTER_DEFAULT, &fcode);
+	else if (strspn(arg, "0123456789") == strlen(arg))
+		status = pcap_setfilter_if(pd, atoi(arg), &fcode);
+	else
+		status = pcap_setfilter_ifname(pd, arg, &fcode);
+	if (status < 0)
+		error("%s", pcap_geterr(pd));
+	pcap_freecode(&fcode);
+}
+
+static void
+dumpme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	const struct pcap_pkthdr_if *ih = (const struct pcap_pkthdr_if *)h;
+	int i;
+
+	packets++;
+	if (ih->if_direction == PCAP_D_OUT)
+		outbound++;
+	if (verbose)
+		printf("%ld.%06ld if %d %s %s caplen %u len %u\n",
+		    (long)h->ts.tv_sec, (long)h->ts.tv_usec, ih->if_index,
+		    pcap_datalink_val_to_name(ih->if_dlt),
+		    ih->if_direction == PCAP_D_OUT ? "out" : "in",
+		    h->caplen, h->len);
+	for (i = 0; i < n_wfiles; i++) {
+		if (pcap_ng_dump_if(pd, dumpers[i], h, sp) == -1)
+			error("%s", pcap_geterr(pd));
+	}
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -v ] [ -c count ] [ -i interface ] [ -w pcapngfile ] ...\n",
+	    program_name);
+	(void)fprintf(stderr,
+	    "\t[ -F interface=expression ] ...\n");
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
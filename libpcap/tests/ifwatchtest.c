@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <pcap.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/*
+ * Check that pcap_findalldevs() reports the interfaces that are up
+ * and, given an interface, bring it down and up again, and check that
+ * an interface watch reports it being removed and added, and that
+ * pcap_findalldevs() doesn't go on reporting what it had cached.
+ * Two watches are open at once, to check that they don't get in each
+ * other's way.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#define WAIT_MS		2000	/* how long to wait for an event */
+
+static char *program_name;
+static int failures;
+
+/* Forwards */
+static void check_list(void);
+static int listed(const char *);
+static void set_up(int, const char *, int);
+static void expect(pcap_if_watch_t *, const char *, const char *, int);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device;
+	pcap_if_watch_t *w1, *w2;
+	struct pcap_if_event ev;
+	int fd;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "i:")) != -1) {
+		switch (op) {
+
+		case 'i':
+			device = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+
+	check_list();
+	if (device == NULL)
+		goto done;
+
+	w1 = pcap_if_watch_open(ebuf);
+	if (w1 == NULL) {
+		printf("no interface watches: %s\n", ebuf);
+		goto done;
+	}
+	w2 = pcap_if_watch_open(ebuf);
+	if (w2 == NULL)
+		error("second watch: %s", ebuf);
+	/* nothing that was already there is news */
+	if (pcap_if_watch_next(w1, &ev, ebuf) != 0)
+		error("event before anything changed");
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error("socket: %s", strerror(errno));
+	if (!listed(device))
+		error("%s isn't up", device);
+
+	set_up(fd, device, 0);
+	expect(w1, "first", device, PCAP_IF_EVENT_REMOVED);
+	if (listed(device)) {
+		printf("FAIL: %s still listed after going down\n", device);
+		failures++;
+	}
+	set_up(fd, device, 1);
+	expect(w1, "first", device, PCAP_IF_EVENT_ADDED);
+	expect(w2, "second", device, PCAP_IF_EVENT_REMOVED);
+	expect(w2, "second", device, PCAP_IF_EVENT_ADDED);
+	if (!listed(device)) {
+		printf("FAIL: %s not listed after coming back up\n", device);
+		failures++;
+	}
+	close(fd);
+	pcap_if_watch_close(w1);
+	pcap_if_watch_close(w2);
+
+done:
+	if (failures != 0) {
+		printf("%d failures\n", failures);
+		exit(1);
+	}
+	printf("ok\n");
+	exit(0);
+}
+
+/*
+ * Every interface that's up should be in the list.
+ */
+static void
+check_list(void)
+{
+	struct if_nameindex *ifs, *ifn;
+	struct ifreq ifr;
+	int fd, n = 0;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error("socket: %s", strerror(errno));
+	ifs = if_nameindex();
+	if (ifs == NULL)
+		error("if_nameindex: %s", strerror(errno));
+	for (ifn = ifs; ifn->if_name != NULL; ifn++) {
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, ifn->if_name, sizeof(ifr.ifr_name) - 1);
+		if (ioctl(fd, SIOCGIFFLAGS, &ifr) == -1 ||
+		    !(ifr.ifr_flags & IFF_UP))
+			continue;
+		n++;
+		if (!listed(ifn->if_name)) {
+			printf("FAIL: %s is up but not listed\n",
+			    ifn->if_name);
+			failures++;
+		}
+	}
+	if_freenameindex(ifs);
+	close(fd);
+	printf("%d interfaces up\n", n);
+}
+
+static int
+listed(const char *name)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_if_t *devs, *d;
+	int found = 0;
+
+	if (pcap_findalldevs(&devs, ebuf) == -1)
+		error("pcap_findalldevs: %s", ebuf);
+	for (d = devs; d != NULL; d = d->next)
+		if (strcmp(d->name, name) == 0)
+			found = 1;
+	pcap_freealldevs(devs);
+	return (found);
+}
+
+static void
+set_up(int fd, const char *name, int up)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name) - 1);
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) == -1)
+		error("%s: SIOCGIFFLAGS: %s", name, strerror(errno));
+	if (up)
+		ifr.ifr_flags |= IFF_UP;
+	else
+		ifr.ifr_flags &= ~IFF_UP;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr) == -1)
+		error("%s: SIOCSIFFLAGS: %s", name, strerror(errno));
+}
+
+/*
+ * Wait for an event of the given type for the named interface,
+ * skipping any others.
+ */
+static void
+expect(pcap_if_watch_t *w, const char *which, const char *name, int type)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct pcap_if_event ev;
+	struct pollfd pfd;
+	int ret, waited;
+
+	pfd.fd = pcap_if_watch_get_selectable_fd(w);
+	pfd.events = POLLIN;
+	for (waited = 0; waited < WAIT_MS; ) {
+		ret = pcap_if_watch_next(w, &ev, ebuf);
+		if (ret == -1)
+			error("%s watch: %s", which, ebuf);
+		if (ret == 0) {
+			if (poll(&pfd, 1, 100) == 0)
+				waited += 100;
+			continue;
+		}
+		if (strcmp(ev.ev_name, name) != 0 ||
+		    ev.ev_type == PCAP_IF_EVENT_CHANGED)
+			continue;
+		if (ev.ev_type != type) {
+			printf("FAIL: %s watch: %s event %d, expected %d\n",
+			    which, name, ev.ev_type, type);
+			failures++;
+		}
+		return;
+	}
+	printf("FAIL: %s watch: no event %d for %s\n", which, type, name);
+	failures++;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr, "Usage: %s [ -i interface ]\n", program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2012-2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <stdio.h>
+#include <err.h>
+#include <sysexits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define PRIVATE 1
+
+#include "pcap-int.h"
+#include "pcap-util.h"
+
+/*
+ * Times looking up interface and process info the way the pktap
+ * pcapng code does for every packet, with "-n" of each (10000 by
+ * default); each entry is looked up "-l" times (10 by default).
+ */
+
+int num_entries = 10000;
+int num_lookups = 10;
+
+void
+help(const char *str)
+{
+	printf("# usage: %s options...\n", str);
+	printf(" %-20s # %s\n", "-h", "display this help");
+	printf(" %-20s # %s\n", "-l count", "number of lookups of each entry");
+	printf(" %-20s # %s\n", "-n count", "number of interfaces and processes");
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1000000.0);
+}
+
+static void
+report(const char *what, double start, unsigned long ops)
+{
+	double elapsed = now() - start;
+
+	printf("%-28s %10lu ops %10.1f ns/op\n", what, ops,
+	    ops != 0 ? elapsed * 1000000000.0 / ops : 0.0);
+}
+
+int
+main(int argc, char * const argv[])
+{
+	int ch;
+	pcap_t *pcap;
+	char name[64];
+	double start;
+	int i, j;
+	struct pcap_if_info *if_info;
+	struct pcap_proc_info *proc_info;
+
+	while ((ch = getopt(argc, argv, "hl:n:")) != -1) {
+		switch (ch) {
+			case 'h':
+				help(argv[0]);
+				return (0);
+
+			case 'l':
+				num_lookups = atoi(optarg);
+				break;
+
+			case 'n':
+				num_entries = atoi(optarg);
+				break;
+
+			default:
+				help(argv[0]);
+				return (0);
+		}
+	}
+	if (num_entries <= 0 || num_lookups <= 0)
+		errx(EX_USAGE, "counts must be positive");
+
+	pcap = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pcap == NULL)
+		errx(EX_OSERR, "pcap_open_dead() failed");
+
+	start = now();
+	for (i = 0; i < num_entries; i++) {
+		snprintf(name, sizeof(name), "utun%d", i);
+		if (pcap_add_if_info(pcap, name, -1, DLT_RAW, 65535) == NULL)
+			errx(EX_OSERR, "%s", pcap_geterr(pcap));
+	}
+	report("pcap_add_if_info", start, num_entries);
+
+	start = now();
+	for (j = 0; j < num_lookups; j++) {
+		for (i = 0; i < num_entries; i++) {
+			snprintf(name, sizeof(name), "utun%d", i);
+			if_info = pcap_find_if_info_by_name(pcap, name);
+			if (if_info == NULL || if_info->if_id != i)
+				errx(EX_SOFTWARE, "interface %s not found", name);
+		}
+	}
+	report("pcap_find_if_info_by_name", start,
+	    (unsigned long)num_entries * num_lookups);
+
+	start = now();
+	for (j = 0; j < num_lookups; j++) {
+		for (i = 0; i < num_entries; i++) {
+			if_info = pcap_find_if_info_by_id(pcap, i);
+			if (if_info == NULL || if_info->if_id != i)
+				errx(EX_SOFTWARE, "interface %d not found", i);
+		}
+	}
+	report("pcap_find_if_info_by_id", start,
+	    (unsigned long)num_entries * num_lookups);
+
+	start = now();
+	for (i = 0; i < num_entries; i++) {
+		snprintf(name, sizeof(name), "proc%d", i % 100);
+		if (pcap_add_proc_info(pcap, 1000 + i, name) == NULL)
+			errx(EX_OSERR, "%s", pcap_geterr(pcap));
+	}
+	report("pcap_add_proc_info", start, num_entries);
+
+	start = now();
+	for (j = 0; j < num_lookups; j++) {
+		for (i = 0; i < num_entries; i++) {
+			snprintf(name, sizeof(name), "proc%d", i % 100);
+			proc_info = pcap_find_proc_info(pcap, 1000 + i, name);
+			if (proc_info == NULL || proc_info->proc_index != i)
+				errx(EX_SOFTWARE, "process %d not found", 1000 + i);
+		}
+	}
+	report("pcap_find_proc_info", start,
+	    (unsigned long)num_entries * num_lookups);
+
+	start = now();
+	for (j = 0; j < num_lookups; j++) {
+		for (i = 0; i < num_entries; i++) {
+			proc_info = pcap_find_proc_info_by_index(pcap, i);
+			if (proc_info == NULL || proc_info->proc_index != i)
+				errx(EX_SOFTWARE, "process index %d not found", i);
+		}
+	}
+	report("pcap_find_proc_info_by_index", start,
+	    (unsigned long)num_entries * num_lookups);
+
+	/*
+	 * Misses, as for every packet from a new interface or process
+	 */
+	start = now();
+	for (i = 0; i < num_entries; i++) {
+		snprintf(name, sizeof(name), "bridge%d", i);
+		if (pcap_find_if_info_by_name(pcap, name) != NULL)
+			errx(EX_SOFTWARE, "found interface %s", name);
+		if (pcap_find_proc_info(pcap, i, name) != NULL)
+			errx(EX_SOFTWARE, "found process %s", name);
+	}
+	report("misses", start, (unsigned long)num_entries * 2);
+
+	pcap_close(pcap);
+
+	return (0);
+}
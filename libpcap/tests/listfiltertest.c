@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void check(pcap_t *, const char *);
+static void collect_values(const char *);
+static void make_packet(u_char *, bpf_u_int32, bpf_u_int32, u_int, u_int);
+static void add_value(bpf_u_int32);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+#define PKTLEN	(14 + 20 + 20)
+
+/*
+ * Lists that have gone wrong, or that are at the edges of what the
+ * optimizer's binary search handles: the lowest and highest values,
+ * duplicates, adjacent and overlapping values and nets, nets that
+ * cover everything, and lists just long enough to be searched.
+ */
+static const char *cases[] = {
+	/*
+	 * A net test that, after common subexpressions were eliminated,
+	 * masked the address the last host test had loaded; reordering
+	 * the chain left it masking the wrong address.
+	 */
+	"net 0.0.0.0/11 or net 75.249.234.252/30 or net 75.249.235.2/31 or "
+	"host 75.249.235.3 or host 75.249.235.4 or net 80.106.0.0/16 or "
+	"host 80.106.253.9 or host 26.71.214.121 or host 26.71.214.123 or "
+	"host 26.71.214.126",
+
+	/*
+	 * Repeated tests that got or_pullup() to move a block shared
+	 * with a part of the graph opt_j() had made unreachable, losing
+	 * the test for source port 27465.
+	 */
+	"host 95.133.107.70 or port 27462 or host 95.133.107.70 or "
+	"port 27462 or port 27465",
+
+	"host 0.0.0.0 or host 0.0.0.1 or host 0.0.0.2 or host 0.0.0.3 or "
+	"host 255.255.255.252 or host 255.255.255.253 or "
+	"host 255.255.255.254 or host 255.255.255.255",
+
+	"host 10.0.0.1 or host 10.0.0.1 or host 10.0.0.1 or host 10.0.0.1 or "
+	"host 10.0.0.1 or host 10.0.0.1 or host 10.0.0.1 or host 10.0.0.1",
+
+	"net 10.0.0.0/8 or net 10.1.0.0/16 or net 10.1.2.0/24 or "
+	"host 10.1.2.3 or net 11.0.0.0/8 or net 12.0.0.0/7 or "
+	"net 9.255.255.255/32 or host 14.0.0.0",
+
+	"net 0.0.0.0/1 or net 128.0.0.0/1 or host 1.2.3.4 or host 5.6.7.8 or "
+	"host 9.10.11.12 or host 13.14.15.16 or host 17.18.19.20 or "
+	"host 21.22.23.24",
+
+	"port 0 or port 1 or port 2 or port 3 or port 65532 or port 65533 or "
+	"port 65534 or port 65535",
+
+	"src host 1.1.1.1 or src host 1.1.1.2 or src host 1.1.1.3 or "
+	"src host 1.1.1.4 or src host 1.1.1.5 or src host 1.1.1.6 or "
+	"src host 1.1.1.7",
+
+	"host 1.1.1.1 or port 80 or host 1.1.1.2 or port 81 or "
+	"host 1.1.1.3 or port 82 or host 1.1.1.4 or port 83 or "
+	"host 1.1.1.5 or port 84 or host 1.1.1.6 or port 85 or "
+	"host 1.1.1.7 or port 86 or host 1.1.1.8 or port 87",
+
+	"tcp and (dst port 22 or dst port 23 or dst port 25 or dst port 53 or "
+	"dst port 80 or dst port 110 or dst port 143 or dst port 443 or "
+	"dst port 993)",
+
+	"not (host 192.168.0.1 or host 192.168.0.2 or host 192.168.0.3 or "
+	"host 192.168.0.4 or host 192.168.0.5 or host 192.168.0.6 or "
+	"host 192.168.0.7 or host 192.168.0.8)",
+};
+
+/*
+ * Values to try packets with, for the current list.
+ */
+static bpf_u_int32 *values;
+static int nvalues, maxvalues;
+
+/*
+ * Compile lists of "or"ed host, net and port tests, both with the
+ * optimizer, which turns long lists into binary searches, and without,
+ * and check that both programs give the same answer for packets with
+ * each value in the lists, the values either side of it, and random
+ * ones.
+ */
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	pcap_t *pd;
+	char *expr;
+	size_t len;
+	u_int i, j, n, lists, seed, bits;
+	bpf_u_int32 a, m;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	lists = 50;
+	seed = 1;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "n:s:")) != -1) {
+		switch (op) {
+
+		case 'n':
+			lists = atoi(optarg);
+			break;
+
+		case 's':
+			seed = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	srandom(seed);
+
+	pd = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pd == NULL)
+		error("can't open a dead pcap_t");
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		check(pd, cases[i]);
+
+	/*
+	 * Random lists, of hosts clustered so that some are adjacent,
+	 * nets of random lengths, and ports.
+	 */
+	expr = malloc(64 * 1024);
+	if (expr == NULL)
+		error("out of memory");
+	for (i = 0; i < lists; i++) {
+		n = 8 + random() % 100;
+		len = 0;
+		a = random();
+		for (j = 0; j < n; j++) {
+			if (j != 0)
+				len += sprintf(expr + len, " or ");
+			if (random() % 4 != 0)
+				a += random() % 4;
+			else
+				a = random();
+			switch (random() % 3) {
+
+			case 0:
+				len += sprintf(expr + len, "host %u.%u.%u.%u",
+				    a >> 24, (a >> 16) & 0xff,
+				    (a >> 8) & 0xff, a & 0xff);
+				break;
+
+			case 1:
+				bits = 8 + random() % 25;
+				m = a & (0xffffffffU << (32 - bits));
+				len += sprintf(expr + len,
+				    "net %u.%u.%u.%u/%u", m >> 24,
+				    (m >> 16) & 0xff, (m >> 8) & 0xff,
+				    m & 0xff, bits);
+				break;
+
+			case 2:
+				len += sprintf(expr + len, "port %u",
+				    a & 0xffff);
+				break;
+			}
+		}
+		check(pd, expr);
+	}
+	printf("%u lists checked\n",
+	    lists + (u_int)(sizeof(cases) / sizeof(cases[0])));
+	exit(0);
+}
+
+/*
+ * Collect the numbers in the expression, which are the values being
+ * tested for, or near them.
+ */
+static void
+collect_values(const char *expr)
+{
+	const char *cp = expr;
+	u_int b[4];
+	int n;
+
+	nvalues = 0;
+	add_value(0);
+	add_value(0xffffffff);
+	while (*cp != '\0') {
+		if (sscanf(cp, "%u.%u.%u.%u%n", &b[0], &b[1], &b[2], &b[3],
+		    &n) == 4) {
+			add_value(b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3]);
+			cp += n;
+		} else if (sscanf(cp, "%u%n", &b[0], &n) == 1) {
+			add_value(b[0]);
+			cp += n;
+		} else
+			cp++;
+	}
+}
+
+static void
+add_value(bpf_u_int32 v)
+{
+	int i;
+
+	if (nvalues + 3 > maxvalues) {
+		maxvalues = maxvalues ? maxvalues * 2 : 1024;
+		values = realloc(values, maxvalues * sizeof(*values));
+		if (values == NULL)
+			error("out of memory");
+	}
+	for (i = -1; i <= 1; i++)
+		values[nvalues++] = v + i;
+}
+
+static void
+check(pcap_t *pd, const char *expr)
+{
+	struct bpf_program opt, noopt;
+	struct pcap_pkthdr h;
+	u_char pkt[PKTLEN];
+	bpf_u_int32 src, dst;
+	u_int sport, dport, r1, r2;
+	int i, k;
+
+	if (pcap_compile(pd, &opt, expr, 1, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s: %s", expr, pcap_geterr(pd));
+	if (pcap_compile(pd, &noopt, expr, 0, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s: %s", expr, pcap_geterr(pd));
+	if (!bpf_validate(opt.bf_insns, opt.bf_len))
+		error("%s: optimized program isn't valid", expr);
+
+	collect_values(expr);
+	h.caplen = h.len = PKTLEN;
+	for (i = 0; i < nvalues * 3; i++) {
+		/*
+		 * Each value as the source, the destination, and both
+		 * ports, with the rest random.
+		 */
+		src = random();
+		dst = random();
+		sport = random() & 0xffff;
+		dport = random() & 0xffff;
+		k = i / 3;
+		switch (i % 3) {
+
+		case 0:
+			src = values[k];
+			sport = values[k] & 0xffff;
+			break;
+
+		case 1:
+			dst = values[k];
+			dport = values[k] & 0xffff;
+			break;
+
+		case 2:
+			src = values[k];
+			dst = values[(k * 7) % nvalues];
+			break;
+		}
+		make_packet(pkt, src, dst, sport, dport);
+		r1 = bpf_filter(opt.bf_insns, pkt, h.len, h.caplen);
+		r2 = bpf_filter(noopt.bf_insns, pkt, h.len, h.caplen);
+		if ((r1 != 0) != (r2 != 0))
+			error("%s: src %08x dst %08x sport %u dport %u: optimized %u, unoptimized %u",
+			    expr, src, dst, sport, dport, r1, r2);
+	}
+	pcap_freecode(&opt);
+	pcap_freecode(&noopt);
+}
+
+/*
+ * An Ethernet, IPv4 and TCP header.
+ */
+static void
+make_packet(u_char *pkt, bpf_u_int32 src, bpf_u_int32 dst, u_int sport,
+    u_int dport)
+{
+	memset(pkt, 0, PKTLEN);
+	pkt[12] = 0x08;			/* ETHERTYPE_IP */
+	pkt[14] = 0x45;			/* version 4, 20-byte header */
+	pkt[16] = 0;
+	pkt[17] = 40;			/* total length */
+	pkt[22] = 64;			/* TTL */
+	pkt[23] = 6;			/* TCP */
+	pkt[26] = src >> 24; pkt[27] = src >> 16;
+	pkt[28] = src >> 8; pkt[29] = src;
+	pkt[30] = dst >> 24; pkt[31] = dst >> 16;
+	pkt[32] = dst >> 8; pkt[33] = dst;
+	pkt[34] = sport >> 8; pkt[35] = sport;
+	pkt[36] = dport >> 8; pkt[37] = dport;
+	pkt[46] = 0x50;			/* 20-byte TCP header */
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr, "Usage: %s [ -n lists ] [ -s seed ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static pcap_t *open_file(const char *, const char *, int);
+static void count(u_char *, const struct pcap_pkthdr *, const u_char *);
+static double now(void);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+struct totals {
+	u_int	packets;
+	u_int	tcp, udp;
+	u_int64_t bytes;
+};
+
+/*
+ * Write the metadata file for a savefile, check it against the packets
+ * in the savefile, and time going through the one against the other.
+ */
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *fname, *mname, *expr;
+	pcap_t *pd;
+	pcap_meta_t *m;
+	struct pcap_meta_group g;
+	struct pcap_meta_rec rec;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	struct totals ft, mt;
+	struct stat fst, mst;
+	double t0, ftime, mtime;
+	int n, nanos, status, bad;
+	u_int i;
+	u_int64_t ts;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	fname = mname = NULL;
+	nanos = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "nr:w:")) != -1) {
+		switch (op) {
+
+		case 'n':
+			nanos = 1;
+			break;
+
+		case 'r':
+			fname = optarg;
+			break;
+
+		case 'w':
+			mname = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (fname == NULL || mname == NULL)
+		usage();
+	expr = optind < argc ? argv[optind] : NULL;
+
+	pd = open_file(fname, expr, nanos);
+	n = pcap_meta_export(pd, mname, 0);
+	if (n == -1)
+		error("%s", pcap_geterr(pd));
+	pcap_close(pd);
+
+	/*
+	 * Check each row against its packet.
+	 */
+	pd = open_file(fname, expr, nanos);
+	m = pcap_meta_open(mname, ebuf);
+	if (m == NULL)
+		error("%s", ebuf);
+	if (pcap_meta_datalink(m) != pcap_datalink(pd))
+		error("link-layer type %d, not %d", pcap_meta_datalink(m),
+		    pcap_datalink(pd));
+	bad = 0;
+	while ((status = pcap_next_ex(pd, &h, &data)) == 1) {
+		status = pcap_meta_next(m, &rec);
+		if (status == -1)
+			error("%s", pcap_meta_geterr(m));
+		if (status == 0)
+			error("metadata file ends early");
+		ts = (u_int64_t)h->ts.tv_sec * 1000000000 +
+		    (u_int64_t)h->ts.tv_usec * (nanos ? 1 : 1000);
+		if (rec.ts != ts || rec.caplen != h->caplen ||
+		    rec.len != h->len)
+			bad++;
+		else if (rec.version == 4 && (rec.off_l3 + 20 > h->caplen ||
+		    memcmp(rec.src, data + rec.off_l3 + 12, 4) != 0 ||
+		    memcmp(rec.dst, data + rec.off_l3 + 16, 4) != 0))
+			bad++;
+		else if (rec.version == 6 && (rec.off_l3 + 40 > h->caplen ||
+		    memcmp(rec.src, data + rec.off_l3 + 8, 16) != 0 ||
+		    memcmp(rec.dst, data + rec.off_l3 + 24, 16) != 0))
+			bad++;
+		else if ((rec.proto == 6 || rec.proto == 17) &&
+		    rec.off_l4 != PCAP_META_NONE &&
+		    rec.off_l4 + 4 <= h->caplen &&
+		    (rec.sport != (data[rec.off_l4] << 8 | data[rec.off_l4 + 1]) ||
+		     rec.dport != (data[rec.off_l4 + 2] << 8 | data[rec.off_l4 + 3])))
+			bad++;
+	}
+	if (status == -1)
+		error("%s", pcap_geterr(pd));
+	if (pcap_meta_next(m, &rec) != 0)
+		error("metadata file has more rows than packets");
+	pcap_meta_close(m);
+	pcap_close(pd);
+
+	/*
+	 * Count TCP and UDP packets and bytes, first from the savefile,
+	 * and then from the metadata file's columns.
+	 */
+	memset(&ft, 0, sizeof(ft));
+	t0 = now();
+	pd = open_file(fname, expr, nanos);
+	if (pcap_loop(pd, -1, count, (u_char *)&ft) == -1)
+		error("%s", pcap_geterr(pd));
+	pcap_close(pd);
+	ftime = now() - t0;
+
+	memset(&mt, 0, sizeof(mt));
+	t0 = now();
+	m = pcap_meta_open(mname, ebuf);
+	if (m == NULL)
+		error("%s", ebuf);
+	while ((status = pcap_meta_next_group(m, &g)) == 1) {
+		for (i = 0; i < g.rows; i++) {
+			mt.packets++;
+			mt.bytes += g.len[i];
+			if (g.version[i] != 0 && g.proto[i] == 6)
+				mt.tcp++;
+			else if (g.version[i] != 0 && g.proto[i] == 17)
+				mt.udp++;
+		}
+	}
+	if (status == -1)
+		error("%s", pcap_meta_geterr(m));
+	pcap_meta_close(m);
+	mtime = now() - t0;
+
+	if (stat(fname, &fst) == -1 || stat(mname, &mst) == -1)
+		error("can't stat the files");
+	printf("%d packets, %d rows that don't match\n", n, bad);
+	printf("savefile: %lld bytes, %.3f s: %u packets, %u tcp, %u udp, %llu bytes\n",
+	    (long long)fst.st_size, ftime, ft.packets, ft.tcp, ft.udp,
+	    (unsigned long long)ft.bytes);
+	printf("metadata: %lld bytes, %.3f s: %u packets, %u tcp, %u udp, %llu bytes\n",
+	    (long long)mst.st_size, mtime, mt.packets, mt.tcp, mt.udp,
+	    (unsigned long long)mt.bytes);
+	if (bad != 0 || memcmp(&ft, &mt, sizeof(ft)) != 0)
+		error("the metadata doesn't match the packets");
+	exit(0);
+}
+
+static pcap_t *
+open_file(const char *fname, const char *expr, int nanos)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct bpf_program fcode;
+	pcap_t *pd;
+
+	pd = pcap_open_offline_with_tstamp_precision(fname,
+	    nanos ? PCAP_TSTAMP_PRECISION_NANO : PCAP_TSTAMP_PRECISION_MICRO,
+	    ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (expr != NULL) {
+		if (pcap_compile(pd, &fcode, expr, 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+	return (pd);
+}
+
+/*
+ * Count the packets the hard way, by looking at them.
+ */
+static void
+count(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct totals *t = (struct totals *)user;
+	u_int off = 14, type, proto = 0;
+
+	t->packets++;
+	t->bytes += h->len;
+	if (h->caplen < off)
+		return;
+	type = sp[12] << 8 | sp[13];
+	while ((type == 0x8100 || type == 0x88a8 || type == 0x9100) &&
+	    h->caplen >= off + 4) {
+		type = sp[off + 2] << 8 | sp[off + 3];
+		off += 4;
+	}
+	if (type == 0x0800 && h->caplen >= off + 20)
+		proto = sp[off + 9];
+	else if (type == 0x86dd && h->caplen >= off + 40)
+		proto = sp[off + 6];
+	if (proto == 6)
+		t->tcp++;
+	else if (proto == 17)
+		t->udp++;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -n ] -r file -w metafile [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
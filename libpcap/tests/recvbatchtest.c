@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/*
+ * Capture packets we send ourselves with a handle that reads them in
+ * batches straight from the socket, handing them out a few at a time,
+ * and check that they all arrive, in order, with sane time stamps.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#define ETHERTYPE_TEST	0x88b5
+#define PKTSIZE		60
+
+static char *program_name;
+
+/* Forwards */
+static void checkpacket(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void drain(pcap_t *, int, u_int);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static u_int received;
+static u_int bad;
+static struct timeval last;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device;
+	pcap_t *rx, *tx;
+	struct bpf_program fcode;
+	u_char pkt[PKTSIZE];
+	int batch, burst, count, per, i, status;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	batch = 32;
+	burst = 50;
+	count = 1000;
+	per = 5;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "B:b:c:i:n:")) != -1) {
+		switch (op) {
+
+		case 'B':
+			burst = atoi(optarg);
+			break;
+
+		case 'b':
+			batch = atoi(optarg);
+			break;
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'n':
+			per = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL || burst <= 0 || per <= 0)
+		usage();
+
+	rx = pcap_create(device, ebuf);
+	if (rx == NULL)
+		error("%s", ebuf);
+	if (pcap_set_recv_batch(rx, -1) != PCAP_ERROR)
+		error("a negative batch size was accepted");
+	if (pcap_set_snaplen(rx, 128) != 0 ||
+	    pcap_set_timeout(rx, 100) != 0 ||
+	    pcap_set_recv_batch(rx, batch) != 0)
+		error("%s", pcap_geterr(rx));
+	status = pcap_activate(rx);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(rx));
+	if (pcap_set_recv_batch(rx, batch) != PCAP_ERROR_ACTIVATED)
+		error("the batch size was changed after activation");
+	if (pcap_compile(rx, &fcode, "ether proto 0x88b5", 1, 0) < 0 ||
+	    pcap_setfilter(rx, &fcode) < 0)
+		error("%s", pcap_geterr(rx));
+	pcap_freecode(&fcode);
+	if (pcap_setnonblock(rx, 1, ebuf) == -1)
+		error("%s", ebuf);
+
+	tx = pcap_open_live(device, 128, 0, 100, ebuf);
+	if (tx == NULL)
+		error("%s", ebuf);
+
+	/*
+	 * Send in bursts, each of which is read "per" packets at a
+	 * time before the next is sent; with bursts that aren't a
+	 * multiple of the batch size, batches are left partly handed
+	 * out, and reads come up short.  Draining each burst keeps
+	 * the socket buffer from overflowing.
+	 */
+	memset(pkt, 0, sizeof(pkt));
+	memset(pkt, 0xff, 6);
+	pkt[6] = 0x02;
+	pkt[12] = ETHERTYPE_TEST >> 8;
+	pkt[13] = ETHERTYPE_TEST & 0xff;
+	for (i = 0; i < count; i++) {
+		pkt[14] = i >> 24;
+		pkt[15] = i >> 16;
+		pkt[16] = i >> 8;
+		pkt[17] = i;
+		if (pcap_inject(tx, pkt, sizeof(pkt)) != sizeof(pkt))
+			error("inject: %s", pcap_geterr(tx));
+		if (i % burst == burst - 1 || i == count - 1)
+			drain(rx, per, i + 1);
+	}
+	printf("%u of %d packets received, %u bad\n", received, count, bad);
+	if (received != (u_int)count || bad != 0)
+		error("packets missing, out of order or mangled");
+	pcap_close(tx);
+	pcap_close(rx);
+	exit(0);
+}
+
+/*
+ * Read until "total" packets have arrived, or we've waited a second
+ * for more.
+ */
+static void
+drain(pcap_t *rx, int per, u_int total)
+{
+	int n, idle;
+
+	for (idle = 0; received < total && idle < 10; ) {
+		n = pcap_dispatch(rx, per, checkpacket, NULL);
+		if (n == -1)
+			error("%s", pcap_geterr(rx));
+		if (n > per)
+			error("%d packets read, asked for %d", n, per);
+		if (n == 0) {
+			idle++;
+			usleep(100000);
+		} else
+			idle = 0;
+	}
+}
+
+static void
+checkpacket(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct timeval now;
+	u_int seq;
+
+	gettimeofday(&now, NULL);
+	if (h->caplen != PKTSIZE || h->len != PKTSIZE) {
+		bad++;
+		return;
+	}
+	seq = ((u_int)sp[14] << 24) | ((u_int)sp[15] << 16) |
+	    ((u_int)sp[16] << 8) | sp[17];
+	if (seq != received)
+		bad++;
+	if (h->ts.tv_sec == 0 || timercmp(&h->ts, &last, <) ||
+	    now.tv_sec - h->ts.tv_sec > 5)
+		bad++;
+	last = h->ts;
+	received++;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -B burst ] [ -b batch ] [ -c count ] [ -n per-dispatch ] -i interface\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+#define CHUNKSIZE	4096
+
+/* Forwards */
+static pcap_t *open_buffer(const char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char *infile, *device;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *in, *out;
+	struct pcap_replay_opts opts;
+	struct pcap_replay_stat rs;
+	int txring, inmem, status;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	memset(&opts, 0, sizeof(opts));
+	opts.mode = PCAP_REPLAY_ORIGINAL;
+	infile = NULL;
+	device = NULL;
+	txring = 0;
+	inmem = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "B:b:c:i:mp:r:Ttx:")) != -1) {
+		switch (op) {
+
+		case 'B':
+			opts.batch = atoi(optarg);
+			break;
+
+		case 'b':
+			opts.mode = PCAP_REPLAY_BPS;
+			opts.rate = atof(optarg);
+			break;
+
+		case 'c':
+			opts.cnt = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'm':
+			inmem = 1;
+			break;
+
+		case 'p':
+			opts.mode = PCAP_REPLAY_PPS;
+			opts.rate = atof(optarg);
+			break;
+
+		case 'r':
+			infile = optarg;
+			break;
+
+		case 'T':
+			txring = 1;
+			break;
+
+		case 't':
+			opts.mode = PCAP_REPLAY_TOPSPEED;
+			break;
+
+		case 'x':
+			opts.mode = PCAP_REPLAY_ORIGINAL;
+			opts.multiplier = atof(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (infile == NULL || device == NULL || optind != argc)
+		usage();
+
+	if (inmem)
+		in = open_buffer(infile);
+	else {
+		in = pcap_open_offline_with_tstamp_precision(infile,
+		    PCAP_TSTAMP_PRECISION_NANO, ebuf);
+		if (in == NULL)
+			error("%s", ebuf);
+	}
+	out = pcap_create(device, ebuf);
+	if (out == NULL)
+		error("%s", ebuf);
+	if (txring)
+		pcap_set_tx_ring(out, 1);
+	status = pcap_activate(out);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(out));
+
+	status = pcap_replay(in, out, &opts, &rs);
+	if (status == -1)
+		error("%s", pcap_geterr(out));
+
+	printf("%u packets sent, %u failed, in %u transmits\n",
+	    rs.rs_sent, rs.rs_failed, rs.rs_batches);
+	printf("%.6f seconds\n", rs.rs_elapsed);
+	printf("target %.1f pps %.1f bps, achieved %.1f pps %.1f bps\n",
+	    rs.rs_target_pps, rs.rs_target_bps, rs.rs_pps, rs.rs_bps);
+	printf("lateness: mean %.1f us, max %.1f us\n",
+	    rs.rs_jitter_avg, rs.rs_jitter_max);
+	pcap_close(out);
+	pcap_close(in);
+	exit(status == 0 ? 0 : 1);
+}
+
+/*
+ * Read the file into memory, and hand it to libpcap a chunk at a time.
+ * The chunks aren't freed, as the handle reads from them in place.
+ */
+static pcap_t *
+open_buffer(const char *fname)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct stat st;
+	FILE *fp;
+	u_char *file;
+	size_t off, n;
+	pcap_t *pd;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL || fstat(fileno(fp), &st) == -1)
+		error("%s: can't open", fname);
+	file = malloc(st.st_size);
+	if (file == NULL || fread(file, 1, st.st_size, fp) != (size_t)st.st_size)
+		error("%s: can't read", fname);
+	fclose(fp);
+
+	n = st.st_size < CHUNKSIZE ? st.st_size : CHUNKSIZE;
+	pd = pcap_open_offline_buffer_with_tstamp_precision(file, n,
+	    PCAP_TSTAMP_PRECISION_NANO, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	for (off = n; off < (size_t)st.st_size; off += n) {
+		n = st.st_size - off < CHUNKSIZE ? st.st_size - off : CHUNKSIZE;
+		if (pcap_offline_buffer_append(pd, file + off, n) == -1)
+			error("%s", pcap_geterr(pd));
+	}
+	if (pcap_offline_buffer_append(pd, NULL, 0) == -1)
+		error("%s", pcap_geterr(pd));
+	return (pd);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -mT ] [ -x multiplier | -p pps | -b bps | -t ] [ -c count ] [ -B batch ] -r file -i interface\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
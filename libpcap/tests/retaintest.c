@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/*
+ * Retain a packet past the dispatch that handed it over, and check
+ * that it stays intact while the ring fills up, that the reader stops
+ * at the block it's in rather than skipping it, and that, once the
+ * packet's released, the reader carries on from that block, with the
+ * packets in order.
+ *
+ * Each round of packets is sent in one go, and then left long enough
+ * for the kernel to retire the block it went into, so each round gets
+ * a block, or, if the retirement timer goes off in the middle of it,
+ * two, of its own; after NBLOCKS rounds or so, the kernel comes round
+ * to the block with the retained packet in it.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#define ETHERTYPE_TEST	0x88b5
+#define PKTSIZE		60
+#define NBLOCKS		4
+#define BLOCKSIZE	131072	/* size of a TPACKET_V3 block */
+#define TIMEOUT		10	/* ms; also when the kernel retires a block */
+
+static char *program_name;
+
+struct state {
+	pcap_t	*pd;
+	int	retain;		/* retain the next packet */
+	const u_char *retained;	/* ...which is this one */
+	u_int	seq;		/* its sequence number */
+	u_int	first, last;	/* first and last seen since reset */
+	u_int	got;		/* how many since reset */
+	int	disorder;	/* one of them was out of order */
+	char	errbuf[PCAP_ERRBUF_SIZE];
+};
+
+/* Forwards */
+static void send_round(pcap_t *, u_int, u_int);
+static int drain(struct state *);
+static void reset(struct state *);
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static u_int getseq(const u_char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device;
+	pcap_t *rx, *tx;
+	struct bpf_program fcode;
+	struct state st;
+	u_int per_round, seq, round;
+	int status, failures = 0;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	per_round = 10;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:i:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			per_round = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL || per_round == 0)
+		usage();
+
+	rx = pcap_create(device, ebuf);
+	if (rx == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(rx, 128) != 0 ||
+	    pcap_set_timeout(rx, TIMEOUT) != 0 ||
+	    pcap_set_buffer_size(rx, NBLOCKS * BLOCKSIZE) != 0)
+		error("%s", pcap_geterr(rx));
+	status = pcap_activate(rx);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(rx));
+	if (pcap_compile(rx, &fcode, "ether proto 0x88b5", 1, 0) < 0 ||
+	    pcap_setfilter(rx, &fcode) < 0)
+		error("%s", pcap_geterr(rx));
+	pcap_freecode(&fcode);
+
+	tx = pcap_open_live(device, 128, 0, 0, ebuf);
+	if (tx == NULL)
+		error("%s", ebuf);
+
+	memset(&st, 0, sizeof(st));
+	st.pd = rx;
+	seq = 0;
+
+	/*
+	 * Retain the first packet of the first round; when the
+	 * dispatch is over, the block it's in should be pinned.
+	 */
+	send_round(tx, seq, per_round);
+	seq += per_round;
+	reset(&st);
+	st.retain = 1;
+	if (drain(&st) == -1) {
+		printf("can't retain packets: %s\n", st.errbuf);
+		exit(0);
+	}
+	if (st.retained == NULL)
+		error("nothing received");
+	if (pcap_pinned_blocks(rx) != 1) {
+		printf("FAIL: %d blocks pinned, expected 1\n",
+		    pcap_pinned_blocks(rx));
+		failures++;
+	}
+
+	/*
+	 * Fill the rest of the ring; what goes into it should all be
+	 * read, until the kernel gets to the pinned block.
+	 */
+	for (round = 1; round <= 2 * NBLOCKS; round++) {
+		reset(&st);
+		send_round(tx, seq, per_round);
+		if (drain(&st) == -1)
+			error("%s", st.errbuf);
+		if (st.disorder || (st.got != 0 && st.first != seq)) {
+			printf("FAIL: round %u: packets out of order\n",
+			    round);
+			failures++;
+		}
+		seq += per_round;
+		if (st.got < per_round)
+			break;
+	}
+	if (round > 2 * NBLOCKS)
+		error("the ring never filled up");
+
+	/*
+	 * The next round has nowhere to go, and the reader should
+	 * wait at the pinned block, with the packet still intact.
+	 */
+	reset(&st);
+	send_round(tx, seq, per_round);
+	seq += per_round;
+	if (drain(&st) == -1)
+		error("%s", st.errbuf);
+	if (st.got != 0) {
+		printf("FAIL: %u packets read with the ring full\n", st.got);
+		failures++;
+	}
+	if (pcap_pinned_blocks(rx) != 1) {
+		printf("FAIL: %d blocks pinned with the ring full\n",
+		    pcap_pinned_blocks(rx));
+		failures++;
+	}
+	if (getseq(st.retained) != st.seq) {
+		printf("FAIL: retained packet %u overwritten with %u\n",
+		    st.seq, getseq(st.retained));
+		failures++;
+	}
+
+	/*
+	 * Let go of it; the next round should go into that block, and
+	 * be read, in order.
+	 */
+	if (pcap_release(rx, st.retained) != 0)
+		error("pcap_release: %s", pcap_geterr(rx));
+	st.retained = NULL;
+	if (pcap_pinned_blocks(rx) != 0) {
+		printf("FAIL: %d blocks pinned after release\n",
+		    pcap_pinned_blocks(rx));
+		failures++;
+	}
+	for (round = 0; round < NBLOCKS + 1; round++) {
+		reset(&st);
+		send_round(tx, seq, per_round);
+		if (drain(&st) == -1)
+			error("%s", st.errbuf);
+		if (st.got != per_round || st.disorder || st.first != seq) {
+			printf("FAIL: after release, round %u: %u of %u "
+			    "packets, from %u, expected from %u%s\n", round,
+			    st.got, per_round, st.first, seq,
+			    st.disorder ? ", out of order" : "");
+			failures++;
+		}
+		seq += per_round;
+	}
+
+	pcap_close(tx);
+	pcap_close(rx);
+	if (failures != 0) {
+		printf("%d failures\n", failures);
+		exit(1);
+	}
+	printf("ok\n");
+	exit(0);
+}
+
+/*
+ * Broadcast from a locally-administered address, with the sequence
+ * number in the first four bytes of the payload.
+ */
+static void
+send_round(pcap_t *tx, u_int seq, u_int n)
+{
+	u_char pkt[PKTSIZE];
+	u_int i;
+
+	for (i = 0; i < n; i++) {
+		memset(pkt, 0, sizeof(pkt));
+		memset(pkt, 0xff, 6);
+		pkt[6] = 0x02;
+		pkt[12] = ETHERTYPE_TEST >> 8;
+		pkt[13] = ETHERTYPE_TEST & 0xff;
+		pkt[14] = (seq + i) >> 24;
+		pkt[15] = (seq + i) >> 16;
+		pkt[16] = (seq + i) >> 8;
+		pkt[17] = seq + i;
+		if (pcap_inject(tx, pkt, sizeof(pkt)) != sizeof(pkt))
+			error("inject: %s", pcap_geterr(tx));
+	}
+	/* give the kernel time to retire the block */
+	usleep(TIMEOUT * 5 * 1000);
+}
+
+/*
+ * Read until there's nothing more to read.
+ */
+static int
+drain(struct state *st)
+{
+	int idle, n;
+
+	for (idle = 0; idle < 3; ) {
+		n = pcap_dispatch(st->pd, -1, countme, (u_char *)st);
+		if (n == -1) {
+			strcpy(st->errbuf, pcap_geterr(st->pd));
+			return (-1);
+		}
+		if (n == -2)
+			return (-1);
+		if (n == 0)
+			idle++;
+	}
+	return (0);
+}
+
+static void
+reset(struct state *st)
+{
+	st->got = 0;
+	st->disorder = 0;
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct state *st = (struct state *)user;
+	u_int seq;
+
+	if (h->caplen < 18)
+		return;
+	seq = getseq(sp);
+	if (st->got == 0)
+		st->first = seq;
+	else if (seq != st->last + 1)
+		st->disorder = 1;
+	st->last = seq;
+	st->got++;
+	if (st->retain) {
+		st->retain = 0;
+		if (pcap_retain(st->pd, sp) != 0) {
+			strcpy(st->errbuf, pcap_geterr(st->pd));
+			pcap_breakloop(st->pd);
+			return;
+		}
+		st->retained = sp;
+		st->seq = seq;
+	}
+}
+
+static u_int
+getseq(const u_char *d)
+{
+	return ((u_int)d[14] << 24) | ((u_int)d[15] << 16) |
+	    ((u_int)d[16] << 8) | d[17];
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr, "Usage: %s [ -c count ] -i interface\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
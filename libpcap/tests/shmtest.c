@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+static u_int packets;
+static int verbose;
+static int per_interface;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device, *publish;
+	pcap_t *pd;
+	pcap_shm_publisher_t *pub;
+	struct bpf_program fcode;
+	struct pcap_stat ps;
+	int count, size, status, per_if;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	publish = NULL;
+	count = -1;
+	size = 0;
+	per_if = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:Ii:P:s:v")) != -1) {
+		switch (op) {
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'I':
+			per_if = 1;
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'P':
+			publish = optarg;
+			break;
+
+		case 's':
+			size = atoi(optarg);
+			break;
+
+		case 'v':
+			verbose++;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL)
+		usage();
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(pd, 65535) != 0 ||
+	    pcap_set_timeout(pd, 100) != 0 ||
+	    (per_if && pcap_set_per_interface(pd, 1) != 0))
+		error("%s", pcap_geterr(pd));
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(pd));
+	per_interface = pcap_get_per_interface(pd);
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+
+	if (publish != NULL) {
+		/*
+		 * Publish what we capture, until we've captured "count"
+		 * packets.
+		 */
+		pub = pcap_shm_publisher_open(pd, publish, size);
+		if (pub == NULL)
+			error("%s", pcap_geterr(pd));
+		status = pcap_loop(pd, count, pcap_shm_publish, (u_char *)pub);
+		pcap_shm_publisher_close(pub);
+	} else
+		status = pcap_loop(pd, count, countme, NULL);
+	if (status == -1)
+		error("%s", pcap_geterr(pd));
+	if (pcap_stats(pd, &ps) < 0)
+		error("%s", pcap_geterr(pd));
+	if (publish == NULL)
+		printf("%u packets; %u received, %u dropped\n", packets,
+		    ps.ps_recv, ps.ps_drop);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	const struct pcap_pkthdr_if *ih = (const struct pcap_pkthdr_if *)h;
+
+	packets++;
+	if (verbose && per_interface)
+		printf("%ld.%06ld caplen %u len %u if %d dlt %d %s\n",
+		    (long)h->ts.tv_sec, (long)h->ts.tv_usec, h->caplen, h->len,
+		    ih->if_index, ih->if_dlt,
+		    ih->if_direction == PCAP_D_OUT ? "out" : "in");
+	else if (verbose)
+		printf("%ld.%06ld caplen %u len %u\n", (long)h->ts.tv_sec,
+		    (long)h->ts.tv_usec, h->caplen, h->len);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -I ] [ -c count ] [ -s size ] -i interface -P name [ expression ]\n",
+	    program_name);
+	(void)fprintf(stderr,
+	    "       %s [ -v ] [ -c count ] -i shm:name [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
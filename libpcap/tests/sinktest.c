@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static int writeout(pcap_sink_t *, void *, u_char *, size_t);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+/*
+ * With -p, the sink's given one of a pair of buffers of ours, and
+ * switched to the other one each time it hands one over.
+ */
+static u_char *pool[2];
+static size_t poolsize;
+static u_int writes;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device, *rfile, *wfile;
+	pcap_t *pd;
+	pcap_sink_t *sink;
+	struct bpf_program fcode;
+	int count, flags, fd, status, usepool;
+	size_t size;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	rfile = NULL;
+	wfile = NULL;
+	count = -1;
+	flags = 0;
+	size = 0;
+	usepool = 0;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "b:c:i:npr:w:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			size = atoi(optarg);
+			break;
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'n':
+			flags |= PCAP_SINK_PCAPNG;
+			break;
+
+		case 'p':
+			usepool = 1;
+			break;
+
+		case 'r':
+			rfile = optarg;
+			break;
+
+		case 'w':
+			wfile = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if ((device == NULL) == (rfile == NULL) || wfile == NULL)
+		usage();
+
+	if (rfile != NULL) {
+		pd = pcap_open_offline(rfile, ebuf);
+		if (pd == NULL)
+			error("%s", ebuf);
+	} else {
+		pd = pcap_create(device, ebuf);
+		if (pd == NULL)
+			error("%s", ebuf);
+		if (pcap_set_snaplen(pd, 65535) != 0 ||
+		    pcap_set_timeout(pd, 100) != 0)
+			error("%s", pcap_geterr(pd));
+		status = pcap_activate(pd);
+		if (status < 0)
+			error("%s: %s", device, pcap_geterr(pd));
+	}
+	if (optind < argc) {
+		if (pcap_compile(pd, &fcode, argv[optind], 1, 0) < 0)
+			error("%s", pcap_geterr(pd));
+		if (pcap_setfilter(pd, &fcode) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_freecode(&fcode);
+	}
+
+	fd = open(wfile, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1)
+		error("%s: %s", wfile, strerror(errno));
+	if (usepool) {
+		poolsize = size != 0 ? size : 1024*1024;
+		pool[0] = malloc(poolsize);
+		pool[1] = malloc(poolsize);
+		if (pool[0] == NULL || pool[1] == NULL)
+			error("out of memory");
+	}
+	sink = pcap_sink_open(pd, writeout, &fd, pool[0], size, flags);
+	if (sink == NULL)
+		error("%s", pcap_geterr(pd));
+	status = pcap_loop(pd, count, pcap_sink_dump, (u_char *)sink);
+	if (status == -1)
+		error("%s", pcap_geterr(pd));
+	if (pcap_sink_flush(sink) == -1)
+		error("%s", pcap_sink_geterr(sink));
+	(void)pcap_sink_close(sink);
+	close(fd);
+	printf("%u writes\n", writes);
+	pcap_close(pd);
+	exit(0);
+}
+
+static int
+writeout(pcap_sink_t *sink, void *arg, u_char *buf, size_t len)
+{
+	int fd = *(int *)arg;
+	ssize_t n;
+
+	writes++;
+	while (len != 0) {
+		n = write(fd, buf, len);
+		if (n == -1)
+			return (-1);
+		buf += n;
+		len -= n;
+	}
+	if (pool[0] != NULL)
+		pcap_sink_set_buffer(sink, pool[writes % 2], poolsize);
+	return (0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -np ] [ -b size ] [ -c count ] -i interface | -r file -w file [ expression ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
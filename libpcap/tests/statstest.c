@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/*
+ * Check that pcap_stats() reuses the interface counters for the
+ * pcap_set_stats_refresh() interval, a second by default, by timing
+ * it with the default and with 0, which has it fetch them every time,
+ * and that both give the same answers; then call it from "threads"
+ * threads at once, each with a handle of its own, half of them
+ * refetching the counters every time and half reusing them, as the
+ * threads share them, and check that none of them sees more drops than
+ * a handle that was open all the while.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#define MIN_SPEEDUP	4	/* caching should be at least this much faster */
+
+static char *program_name;
+
+/* Forwards */
+static double time_stats(const char *, int, int, struct pcap_stat *);
+static void *stats_thread(void *);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+struct stats_thread {
+	pthread_t	tid;
+	const char	*device;
+	int		refresh;
+	int		count;
+	struct pcap_stat ps;
+};
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char *device;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct pcap_stat cached, fresh, all;
+	struct stats_thread *st;
+	pcap_t *pd;
+	double cached_us, fresh_us;
+	int count, threads, i;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	count = 2000;
+	threads = 4;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "c:i:t:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL || count <= 0 || threads < 0)
+		usage();
+
+	cached_us = time_stats(device, -1, count, &cached);
+	fresh_us = time_stats(device, 0, count, &fresh);
+	printf("pcap_stats(): %.2f us with the default refresh, %.2f us with none\n",
+	    cached_us, fresh_us);
+	if (cached.ps_ifdrop != fresh.ps_ifdrop)
+		error("%u interface drops with the default refresh, %u with none",
+		    cached.ps_ifdrop, fresh.ps_ifdrop);
+	if (fresh_us < cached_us * MIN_SPEEDUP)
+		error("the interface counters don't seem to be cached");
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_promisc(pd, 1) != 0 ||
+	    pcap_set_stats_refresh(pd, 0) != 0 || pcap_activate(pd) < 0 ||
+	    pcap_stats(pd, &all) < 0)
+		error("%s: %s", device, pcap_geterr(pd));
+	st = calloc(threads, sizeof(*st));
+	if (st == NULL && threads != 0)
+		error("out of memory");
+	for (i = 0; i < threads; i++) {
+		st[i].device = device;
+		st[i].refresh = (i & 1) ? -1 : 0;
+		st[i].count = count;
+		if (pthread_create(&st[i].tid, NULL, stats_thread, &st[i]) != 0)
+			error("can't create a thread");
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(st[i].tid, NULL);
+	if (pcap_stats(pd, &all) < 0)
+		error("%s", pcap_geterr(pd));
+	for (i = 0; i < threads; i++) {
+		if (st[i].ps.ps_ifdrop > all.ps_ifdrop)
+			error("thread %d saw %u interface drops, but there were only %u",
+			    i, st[i].ps.ps_ifdrop, all.ps_ifdrop);
+	}
+	pcap_close(pd);
+	exit(0);
+}
+
+static void *
+stats_thread(void *arg)
+{
+	struct stats_thread *st = arg;
+
+	(void)time_stats(st->device, st->refresh, st->count, &st->ps);
+	return (NULL);
+}
+
+/*
+ * Open a promiscuous handle, for which pcap_stats() reports interface
+ * drops, with the given refresh interval, or the default if that's
+ * negative, and return the average time a pcap_stats() call takes,
+ * in microseconds.
+ */
+static double
+time_stats(const char *device, int refresh, int count, struct pcap_stat *ps)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct timeval start, end;
+	pcap_t *pd;
+	int i, status;
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_promisc(pd, 1) != 0 ||
+	    (refresh >= 0 && pcap_set_stats_refresh(pd, refresh) != 0))
+		error("%s", pcap_geterr(pd));
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(pd));
+	if (pcap_set_stats_refresh(pd, 0) != PCAP_ERROR_ACTIVATED)
+		error("the refresh interval was changed after activation");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++) {
+		if (pcap_stats(pd, ps) < 0)
+			error("%s", pcap_geterr(pd));
+	}
+	gettimeofday(&end, NULL);
+	pcap_close(pd);
+	return (((end.tv_sec - start.tv_sec) * 1e6 +
+	    (end.tv_usec - start.tv_usec)) / count);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -c count ] [ -t threads ] -i interface\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
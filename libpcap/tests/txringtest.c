@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/*
+ * Send packets through a transmit ring, with some of them too big for
+ * the interface, and check that exactly the others go out, in order,
+ * and that the too-big ones are counted as failed.
+ *
+ * The interface's MTU has to be smaller than the oversized packets
+ * (BIGSIZE bytes), so use something like one end of a veth pair,
+ * not the loopback interface.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+#define ETHERTYPE_TEST	0x88b5
+#define SMALLSIZE	60
+#define BIGSIZE		4000
+
+static char *program_name;
+
+/* Forwards */
+static void makepacket(u_char *, u_int, u_int);
+static u_int receive(pcap_t *, u_int *, u_int);
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device;
+	pcap_t *rx, *tx;
+	pcap_send_queue *q;
+	struct pcap_pkthdr h;
+	struct bpf_program fcode;
+	u_char *pkt;
+	u_int *expect;
+	u_int count, every, i, good, bad, got;
+	int bufsize, ret, status;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	count = 200;
+	every = 7;
+	bufsize = 65536;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "B:b:c:i:")) != -1) {
+		switch (op) {
+
+		case 'B':
+			bufsize = atoi(optarg);
+			break;
+
+		case 'b':
+			every = atoi(optarg);
+			break;
+
+		case 'c':
+			count = atoi(optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL || every == 0)
+		usage();
+
+	/*
+	 * Start capturing before we send, so we see everything.
+	 */
+	rx = pcap_create(device, ebuf);
+	if (rx == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(rx, 128) != 0 ||
+	    pcap_set_timeout(rx, 200) != 0)
+		error("%s", pcap_geterr(rx));
+	status = pcap_activate(rx);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(rx));
+	if (pcap_compile(rx, &fcode, "ether proto 0x88b5", 1, 0) < 0 ||
+	    pcap_setfilter(rx, &fcode) < 0)
+		error("%s", pcap_geterr(rx));
+	pcap_freecode(&fcode);
+
+	/*
+	 * A small buffer gives a small transmit ring, so the queue
+	 * wraps around it several times.
+	 */
+	tx = pcap_create(device, ebuf);
+	if (tx == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(tx, BIGSIZE + 64) != 0 ||
+	    pcap_set_buffer_size(tx, bufsize) != 0 ||
+	    pcap_set_tx_ring(tx, 1) != 0)
+		error("%s", pcap_geterr(tx));
+	status = pcap_activate(tx);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(tx));
+
+	/*
+	 * Every "every"th packet is too big to send.
+	 */
+	pkt = calloc(1, BIGSIZE);
+	expect = calloc(count + 1, sizeof(*expect));
+	q = pcap_sendqueue_alloc((count + 1) * (sizeof(h) + BIGSIZE));
+	if (pkt == NULL || expect == NULL || q == NULL)
+		error("out of memory");
+	memset(&h, 0, sizeof(h));
+	good = bad = 0;
+	for (i = 0; i < count; i++) {
+		h.caplen = h.len = (i % every == every - 1) ? BIGSIZE :
+		    SMALLSIZE;
+		makepacket(pkt, h.caplen, i);
+		if (pcap_sendqueue_queue(q, &h, pkt) == -1)
+			error("can't queue packet %u", i);
+		if (h.caplen == BIGSIZE)
+			bad++;
+		else
+			expect[good++] = i;
+	}
+	ret = pcap_sendqueue_transmit(tx, q);
+	printf("transmit returned %d, %u sent, %u failed\n", ret, q->sent,
+	    q->failed);
+	if (ret != (good != 0 ? (int)good : -1) || q->sent != good ||
+	    q->failed != bad)
+		error("expected %u sent, %u failed", good, bad);
+
+	/*
+	 * A single oversized packet is rejected; the ring still works
+	 * after it.
+	 */
+	makepacket(pkt, BIGSIZE, count);
+	if (pcap_inject(tx, pkt, BIGSIZE) != -1)
+		error("oversized packet was injected");
+	makepacket(pkt, SMALLSIZE, count);
+	if (pcap_inject(tx, pkt, SMALLSIZE) != SMALLSIZE)
+		error("inject: %s", pcap_geterr(tx));
+	expect[good++] = count;
+
+	got = receive(rx, expect, good);
+	printf("%u of %u packets received in order\n", got, good);
+	if (got != good)
+		error("packets missing or out of order");
+
+	pcap_sendqueue_destroy(q);
+	free(expect);
+	free(pkt);
+	pcap_close(tx);
+	pcap_close(rx);
+	exit(0);
+}
+
+/*
+ * Broadcast from a locally-administered address, with the sequence
+ * number in the first four bytes of the payload.
+ */
+static void
+makepacket(u_char *pkt, u_int len, u_int seq)
+{
+	memset(pkt, 0, len);
+	memset(pkt, 0xff, 6);
+	pkt[6] = 0x02;
+	pkt[12] = ETHERTYPE_TEST >> 8;
+	pkt[13] = ETHERTYPE_TEST & 0xff;
+	pkt[14] = seq >> 24;
+	pkt[15] = seq >> 16;
+	pkt[16] = seq >> 8;
+	pkt[17] = seq;
+}
+
+/*
+ * Read until a timeout, returning how many of the expected packets
+ * arrived before the first one that's missing or out of order.
+ */
+static u_int
+receive(pcap_t *rx, u_int *expect, u_int n)
+{
+	struct pcap_pkthdr *h;
+	const u_char *d;
+	u_int got, seq;
+	int ret, ok;
+
+	got = 0;
+	ok = 1;
+	while ((ret = pcap_next_ex(rx, &h, &d)) == 1) {
+		if (h->caplen < 18)
+			continue;
+		seq = ((u_int)d[14] << 24) | ((u_int)d[15] << 16) |
+		    ((u_int)d[16] << 8) | d[17];
+		if (ok && got < n && seq == expect[got])
+			got++;
+		else
+			ok = 0;
+	}
+	if (ret == -1)
+		error("%s", pcap_geterr(rx));
+	return (ok ? got : 0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -B bufsize ] [ -b every ] [ -c count ] -i interface\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/*
+ * Compile "vlan" filters for a handle in VLAN metadata mode, and run
+ * them, with bpf_filter_with_aux_data(), on made-up packets whose
+ * outermost tag is in the auxiliary data rather than the packet, as
+ * it is when the kernel has stripped it.
+ */
+
+#ifndef HAVE___ATTRIBUTE__
+#define __attribute__(x)
+#endif
+
+static char *program_name;
+
+/* Forwards */
+static void usage(void) __attribute__((noreturn));
+static void error(const char *, ...)
+    __attribute__((noreturn, format (printf, 1, 2)));
+
+extern int optind;
+extern int opterr;
+extern char *optarg;
+
+/* an IPv4 packet, untagged */
+static const u_char plain[] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x01,	/* destination */
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x02,	/* source */
+	0x08, 0x00,				/* IPv4 */
+	0x45, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00,
+	0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+	0x0a, 0x00, 0x00, 0x02
+};
+
+/* an IPv4 packet with a tag, for VLAN 20, still in it */
+static const u_char tagged[] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x01,	/* destination */
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x02,	/* source */
+	0x81, 0x00, 0x00, 0x14,			/* 802.1Q, VLAN 20 */
+	0x08, 0x00,				/* IPv4 */
+	0x45, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00,
+	0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+	0x0a, 0x00, 0x00, 0x02
+};
+
+static const struct {
+	const char *filter;
+	int	present;	/* a tag was stripped */
+	u_short	tci;		/* ...and this was it */
+	int	in_packet;	/* use the packet with a tag in it */
+	int	match;
+} cases[] = {
+	{ "vlan",			1, 10,		0, 1 },
+	{ "vlan",			0, 0,		0, 0 },
+	{ "vlan",			0, 0,		1, 0 },
+	{ "not vlan",			0, 0,		0, 1 },
+	{ "vlan 10",			1, 10,		0, 1 },
+	{ "vlan 10",			1, 0xe00a,	0, 1 },
+	{ "vlan 10",			1, 20,		0, 0 },
+	{ "vlan 10 and ip",		1, 10,		0, 1 },
+	{ "vlan 10 and ip6",		1, 10,		0, 0 },
+	{ "vlan 10 and vlan 20",	1, 10,		1, 1 },
+	{ "vlan 10 and vlan 30",	1, 10,		1, 0 },
+	{ NULL,				0, 0,		0, 0 }
+};
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	char *device;
+	pcap_t *pd;
+	struct bpf_program fcode;
+	struct bpf_aux_data aux;
+	const u_char *pkt;
+	u_int len;
+	int i, status, match, failures = 0;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	device = NULL;
+	opterr = 0;
+	while ((op = getopt(argc, argv, "i:")) != -1) {
+		switch (op) {
+
+		case 'i':
+			device = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL)
+		usage();
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_vlan_metadata(pd, 1) != 0) {
+		printf("no VLAN metadata: %s\n", pcap_geterr(pd));
+		exit(0);
+	}
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s", device, pcap_geterr(pd));
+	if (pcap_get_vlan_metadata(pd) != 1) {
+		printf("the kernel doesn't give us VLAN tags\n");
+		exit(0);
+	}
+	if (pcap_datalink(pd) != DLT_EN10MB)
+		error("%s isn't an Ethernet device", device);
+
+	for (i = 0; cases[i].filter != NULL; i++) {
+		if (pcap_compile(pd, &fcode, cases[i].filter, 1, 0) < 0)
+			error("%s: %s", cases[i].filter, pcap_geterr(pd));
+		if (cases[i].in_packet) {
+			pkt = tagged;
+			len = sizeof(tagged);
+		} else {
+			pkt = plain;
+			len = sizeof(plain);
+		}
+		aux.vlan_tag_present = cases[i].present;
+		aux.vlan_tag = cases[i].tci;
+		match = bpf_filter_with_aux_data(fcode.bf_insns, pkt, len, len,
+		    &aux) != 0;
+		if (match != cases[i].match) {
+			printf("FAIL: \"%s\", tag %s 0x%04x, %s: %s\n",
+			    cases[i].filter,
+			    cases[i].present ? "present" : "absent",
+			    cases[i].tci,
+			    cases[i].in_packet ? "tagged" : "untagged",
+			    match ? "matched" : "didn't match");
+			failures++;
+		}
+		/*
+		 * Without the auxiliary data, there's nothing to say
+		 * there was a tag.
+		 */
+		if (cases[i].present && !cases[i].in_packet &&
+		    bpf_filter(fcode.bf_insns, pkt, len, len) != 0 &&
+		    strncmp(cases[i].filter, "not", 3) != 0) {
+			printf("FAIL: \"%s\" matched with no auxiliary data\n",
+			    cases[i].filter);
+			failures++;
+		}
+		pcap_freecode(&fcode);
+	}
+	pcap_close(pd);
+	if (failures != 0) {
+		printf("%d failures\n", failures);
+		exit(1);
+	}
+	printf("%d cases ok\n", i);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr, "Usage: %s -i interface\n", program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}